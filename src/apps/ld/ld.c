@@ -0,0 +1,319 @@
+#include <include/elf.h>
+#include <libc/string.h>
+#include <libc/unistd.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LD_MAX_OBJECTS 16
+#define LD_LIBRARY_PATH "/lib/"
+#define LD_MAX_PATH 256
+
+/*
+  NOTE: MQ 2020-10-18
+  Kernel maps the program and ld.so, then enters ld.so with auxv on top of the stack:
+    [auxv] [return address] [program's arguments ...]
+  _start pops auxv, ld_main maps needed libraries (via uselib, text is shared in page cache),
+  resolves every relocation eagerly (GOT/PLT included, no lazy binding) and returns program's entry,
+  _start jumps there with the stack as if the kernel had entered the program directly
+*/
+__asm__(
+	".global _start\n"
+	"_start:\n"
+	"	pop %eax\n"
+	"	push %eax\n"
+	"	call ld_main\n"
+	"	add $4, %esp\n"
+	"	jmp *%eax\n");
+
+struct ld_object
+{
+	const char *name;
+	uint32_t base;
+	struct Elf32_Dyn *dynamic;
+	struct Elf32_Sym *symtab;
+	const char *strtab;
+	uint32_t *hash;
+	struct Elf32_Rel *rel;
+	uint32_t relsz;
+	struct Elf32_Rel *jmprel;
+	uint32_t pltrelsz;
+	uint32_t init;
+	uint32_t *init_array;
+	uint32_t init_arraysz;
+};
+
+// objects[0] is the program, libraries follow in breadth-first order of DT_NEEDED (global lookup scope)
+static struct ld_object objects[LD_MAX_OBJECTS];
+static uint32_t nobjects;
+
+static size_t ld_strlen(const char *s)
+{
+	size_t length = 0;
+	while (s[length])
+		length++;
+	return length;
+}
+
+static int ld_strcmp(const char *s1, const char *s2)
+{
+	for (; *s1 && *s1 == *s2; s1++, s2++)
+		;
+	return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+static void ld_fatal(const char *message, const char *name)
+{
+	const char *parts[] = {"ld.so: ", message, " ", name};
+	char buf[LD_MAX_PATH];
+	size_t length = 0;
+	for (uint32_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+	{
+		size_t part_length = ld_strlen(parts[i]);
+		if (length + part_length >= LD_MAX_PATH)
+			break;
+		memcpy(buf + length, parts[i], part_length);
+		length += part_length;
+	}
+	buf[length] = 0;
+
+	debug_println(DEBUG_ERROR, buf);
+	exit(-1);
+}
+
+static void ld_parse_dynamic(struct ld_object *obj)
+{
+	for (struct Elf32_Dyn *dyn = obj->dynamic; dyn->d_tag != DT_NULL; ++dyn)
+	{
+		uint32_t ptr = obj->base + dyn->d_un.d_ptr;
+
+		switch (dyn->d_tag)
+		{
+		case DT_HASH:
+			obj->hash = (uint32_t *)ptr;
+			break;
+		case DT_STRTAB:
+			obj->strtab = (const char *)ptr;
+			break;
+		case DT_SYMTAB:
+			obj->symtab = (struct Elf32_Sym *)ptr;
+			break;
+		case DT_REL:
+			obj->rel = (struct Elf32_Rel *)ptr;
+			break;
+		case DT_RELSZ:
+			obj->relsz = dyn->d_un.d_val;
+			break;
+		case DT_JMPREL:
+			obj->jmprel = (struct Elf32_Rel *)ptr;
+			break;
+		case DT_PLTRELSZ:
+			obj->pltrelsz = dyn->d_un.d_val;
+			break;
+		case DT_INIT:
+			obj->init = ptr;
+			break;
+		case DT_INIT_ARRAY:
+			obj->init_array = (uint32_t *)ptr;
+			break;
+		case DT_INIT_ARRAYSZ:
+			obj->init_arraysz = dyn->d_un.d_val;
+			break;
+		}
+	}
+}
+
+static struct Elf32_Dyn *ld_find_dynamic(struct Elf32_Phdr *phdr, uint32_t phnum, uint32_t base)
+{
+	for (uint32_t i = 0; i < phnum; ++i)
+		if (phdr[i].p_type == PT_DYNAMIC)
+			return (struct Elf32_Dyn *)(base + phdr[i].p_vaddr);
+
+	return NULL;
+}
+
+static struct ld_object *ld_load_library(const char *name)
+{
+	for (uint32_t i = 1; i < nobjects; ++i)
+		if (ld_strcmp(objects[i].name, name) == 0)
+			return &objects[i];
+
+	if (nobjects == LD_MAX_OBJECTS)
+		ld_fatal("too many libraries, cannot load", name);
+
+	char path[LD_MAX_PATH] = LD_LIBRARY_PATH;
+	size_t prefix_length = ld_strlen(path);
+	size_t name_length = ld_strlen(name);
+	if (prefix_length + name_length >= LD_MAX_PATH)
+		ld_fatal("library path is too long", name);
+	memcpy(path + prefix_length, name, name_length + 1);
+
+	// errors are returned as -errno
+	int32_t base = uselib(path);
+	if ((uint32_t)base >= (uint32_t)-4095)
+		ld_fatal("cannot load library", name);
+
+	// shared object's first segment starts at file offset 0 -> elf and program headers are mapped
+	struct ld_object *obj = &objects[nobjects++];
+	struct Elf32_Ehdr *elf_header = (struct Elf32_Ehdr *)base;
+	obj->name = name;
+	obj->base = base;
+	obj->dynamic = ld_find_dynamic((struct Elf32_Phdr *)(base + elf_header->e_phoff), elf_header->e_phnum, base);
+	if (!obj->dynamic)
+		ld_fatal("not a shared object", name);
+	ld_parse_dynamic(obj);
+
+	return obj;
+}
+
+static uint32_t ld_elf_hash(const char *name)
+{
+	uint32_t h = 0, g;
+	while (*name)
+	{
+		h = (h << 4) + *(unsigned char *)name++;
+		if ((g = h & 0xf0000000))
+			h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+static struct Elf32_Sym *ld_lookup_in(struct ld_object *obj, const char *name, uint32_t hash)
+{
+	if (!obj->hash || !obj->symtab)
+		return NULL;
+
+	uint32_t nbucket = obj->hash[0];
+	uint32_t *bucket = &obj->hash[2];
+	uint32_t *chain = &bucket[nbucket];
+	for (uint32_t i = bucket[hash % nbucket]; i != 0; i = chain[i])
+	{
+		struct Elf32_Sym *sym = &obj->symtab[i];
+		uint32_t bind = ELF32_ST_BIND(sym->st_info);
+
+		if (sym->st_shndx != SHN_UNDEF && (bind == STB_GLOBAL || bind == STB_WEAK) &&
+			ld_strcmp(obj->strtab + sym->st_name, name) == 0)
+			return sym;
+	}
+	return NULL;
+}
+
+// the first definition in global scope wins, `skip` is used by copy relocation (program's copy is not the source)
+static struct Elf32_Sym *ld_lookup(const char *name, struct ld_object *skip, struct ld_object **def)
+{
+	uint32_t hash = ld_elf_hash(name);
+	for (uint32_t i = 0; i < nobjects; ++i)
+	{
+		if (&objects[i] == skip)
+			continue;
+
+		struct Elf32_Sym *sym = ld_lookup_in(&objects[i], name, hash);
+		if (sym)
+		{
+			*def = &objects[i];
+			return sym;
+		}
+	}
+	return NULL;
+}
+
+static void ld_relocate(struct ld_object *obj, struct Elf32_Rel *rel, uint32_t size)
+{
+	for (; size >= sizeof(struct Elf32_Rel); ++rel, size -= sizeof(struct Elf32_Rel))
+	{
+		uint32_t *where = (uint32_t *)(obj->base + rel->r_offset);
+		uint32_t type = ELF32_R_TYPE(rel->r_info);
+		uint32_t isym = ELF32_R_SYM(rel->r_info);
+		struct Elf32_Sym *sym = &obj->symtab[isym];
+		struct Elf32_Sym *def_sym = NULL;
+		uint32_t value = 0;
+
+		if (type == R_386_NONE)
+			continue;
+
+		if (isym && ELF32_ST_BIND(sym->st_info) == STB_LOCAL)
+			value = obj->base + sym->st_value;
+		else if (isym)
+		{
+			struct ld_object *def = NULL;
+			def_sym = ld_lookup(obj->strtab + sym->st_name, type == R_386_COPY ? obj : NULL, &def);
+			if (def_sym)
+				value = def->base + def_sym->st_value;
+			else if (ELF32_ST_BIND(sym->st_info) != STB_WEAK)
+				ld_fatal("undefined symbol", obj->strtab + sym->st_name);
+		}
+
+		switch (type)
+		{
+		case R_386_32:
+			*where += value;
+			break;
+		case R_386_PC32:
+			*where += value - (uint32_t)where;
+			break;
+		case R_386_GLOB_DAT:
+		case R_386_JMP_SLOT:
+			*where = value;
+			break;
+		case R_386_RELATIVE:
+			*where += obj->base;
+			break;
+		case R_386_COPY:
+			if (def_sym)
+				memcpy(where, (void *)value, sym->st_size);
+			break;
+		default:
+			ld_fatal("unsupported relocation in", obj->name);
+		}
+	}
+}
+
+static void ld_init(struct ld_object *obj)
+{
+	if (obj->init)
+		((void (*)())obj->init)();
+
+	for (uint32_t i = 0; i < obj->init_arraysz / sizeof(uint32_t); ++i)
+		((void (*)())obj->init_array[i])();
+}
+
+uint32_t ld_main(struct Elf32_auxv *auxv)
+{
+	struct Elf32_Phdr *phdr = NULL;
+	uint32_t phnum = 0, entry = 0;
+	for (; auxv->a_type != AT_NULL; ++auxv)
+	{
+		if (auxv->a_type == AT_PHDR)
+			phdr = (struct Elf32_Phdr *)auxv->a_val;
+		else if (auxv->a_type == AT_PHNUM)
+			phnum = auxv->a_val;
+		else if (auxv->a_type == AT_ENTRY)
+			entry = auxv->a_val;
+	}
+
+	// program is ET_EXEC, it is mapped at its link address
+	struct ld_object *program = &objects[nobjects++];
+	program->name = "";
+	program->dynamic = ld_find_dynamic(phdr, phnum, 0);
+	if (!program->dynamic)
+		return entry;
+	ld_parse_dynamic(program);
+
+	for (uint32_t i = 0; i < nobjects; ++i)
+		for (struct Elf32_Dyn *dyn = objects[i].dynamic; dyn->d_tag != DT_NULL; ++dyn)
+			if (dyn->d_tag == DT_NEEDED)
+				ld_load_library(objects[i].strtab + dyn->d_un.d_val);
+
+	// dependencies first, copy relocations in program read already relocated library data
+	for (uint32_t i = nobjects; i-- > 0;)
+	{
+		ld_relocate(&objects[i], objects[i].rel, objects[i].relsz);
+		ld_relocate(&objects[i], objects[i].jmprel, objects[i].pltrelsz);
+	}
+
+	for (uint32_t i = nobjects; i-- > 1;)
+		ld_init(&objects[i]);
+
+	return entry;
+}
@@ -43,7 +43,7 @@ void init_terminal_tab_dev(struct terminal_tab *tab)
 	tab->fd_ptm = fdm;
 	tab->fd_pts = fds;
 
-	int pid = fork();
+	int pid = vfork();
 
 	if (!pid)
 	{
@@ -383,7 +383,7 @@ void handle_mouse_event(struct mouse_event *mevent)
 			if (icon)
 			{
 				if (icon->active)
-					posix_spawn(icon->exec_path);
+					posix_spawn(NULL, icon->exec_path, NULL, NULL, NULL, NULL);
 				else
 					icon->active = true;
 			}
@@ -10,6 +10,15 @@
 
 int main(struct framebuffer fb)
 {
+	// compositor gets 8ms of every 16ms frame, even when apps saturate the cpu
+	sched_setattr(0, &(struct sched_attr){
+						 .sched_policy = SCHED_DEADLINE,
+						 .sched_runtime = 8000000,
+						 .sched_deadline = 16000000,
+						 .sched_period = 16000000,
+					 },
+				  0);
+
 	int32_t ws_fd = mq_open(WINDOW_SERVER_QUEUE, O_RDONLY, &(struct mq_attr){
 															   .mq_msgsize = sizeof(struct msgui),
 															   .mq_maxmsg = 32,
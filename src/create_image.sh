@@ -14,6 +14,10 @@ mkdir "/Volumes/${VOLUME_NAME}/usr/share"
 cp -R assets/fonts "/Volumes/${VOLUME_NAME}/usr/share"
 cp -R assets/images "/Volumes/${VOLUME_NAME}/usr/share"
 
+cd libc && make clean && make
+cd ..
+cd apps/ld && make clean && make
+cd ../..
 cd apps/window_server && make clean && make
 cd ../..
 cd apps/terminal && make clean && make
@@ -23,6 +27,10 @@ cd ../..
 cd apps/calculator && make clean && make
 cd ../..
 
+mkdir "/Volumes/${VOLUME_NAME}/lib"
+cp libc/libc.so "/Volumes/${VOLUME_NAME}/lib"
+cp apps/ld/ld.so "/Volumes/${VOLUME_NAME}/lib"
+
 mkdir "/Volumes/${VOLUME_NAME}/bin"
 cp apps/window_server/window_server "/Volumes/${VOLUME_NAME}/bin"
 cp apps/terminal/terminal "/Volumes/${VOLUME_NAME}/bin"
@@ -47,4 +47,16 @@ static inline void atomic_dec(atomic_t *v)
 		: "m"(v->counter));
 }
 
+// returns true if the counter has dropped to 0
+static inline int atomic_dec_and_test(atomic_t *v)
+{
+	unsigned char c;
+	__asm__ __volatile__(
+		"decl %0; sete %1"
+		: "=m"(v->counter), "=qm"(c)
+		: "m"(v->counter)
+		: "memory");
+	return c != 0;
+}
+
 #endif
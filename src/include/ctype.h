@@ -23,6 +23,7 @@ typedef unsigned long sigset_t;
 typedef int idtype_t;
 typedef int id_t;
 typedef unsigned int time_t;
+typedef int clockid_t;
 
 #define isspace(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
 #define isupper(c) ((c) >= 'A' && (c) <= 'Z')
@@ -70,4 +71,13 @@ struct timespec
 	long tv_nsec;
 };
 
+struct timeval
+{
+	long tv_sec;
+	long tv_usec;
+};
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
 #endif
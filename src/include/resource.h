@@ -0,0 +1,30 @@
+#ifndef INCLUDE_RESOURCE_H
+#define INCLUDE_RESOURCE_H
+
+#include <include/ctype.h>
+
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN (-1)
+
+// only cpu times and context switches are filled, the rest is kept for compatibility and is zero
+struct rusage
+{
+	struct timeval ru_utime;
+	struct timeval ru_stime;
+	long ru_maxrss;
+	long ru_ixrss;
+	long ru_idrss;
+	long ru_isrss;
+	long ru_minflt;
+	long ru_majflt;
+	long ru_nswap;
+	long ru_inblock;
+	long ru_oublock;
+	long ru_msgsnd;
+	long ru_msgrcv;
+	long ru_nsignals;
+	long ru_nvcsw;
+	long ru_nivcsw;
+};
+
+#endif
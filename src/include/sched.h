@@ -0,0 +1,22 @@
+#ifndef INCLUDE_SCHED_H
+#define INCLUDE_SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_NORMAL 0
+#define SCHED_DEADLINE 6
+
+// runtime, deadline and period are in nanoseconds, runtime <= deadline <= period
+struct sched_attr
+{
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+#endif
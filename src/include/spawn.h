@@ -0,0 +1,32 @@
+#ifndef INCLUDE_SPAWN_H
+#define INCLUDE_SPAWN_H
+
+#include <stdint.h>
+
+#define SPAWN_FILE_ACTIONS_MAX 8
+
+enum spawn_action_type
+{
+	SPAWN_DO_CLOSE,
+	SPAWN_DO_DUP2,
+	SPAWN_DO_OPEN,
+};
+
+struct spawn_action
+{
+	enum spawn_action_type type;
+	int32_t fd;
+	int32_t newfd;	// dup2: target fd
+	const char *path;  // open
+	int32_t oflag;
+	int32_t mode;
+};
+
+// file actions are applied in order in the child before the program is loaded
+typedef struct
+{
+	int32_t used;
+	struct spawn_action actions[SPAWN_FILE_ACTIONS_MAX];
+} posix_spawn_file_actions_t;
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef INCLUDE_VDSO_H
+#define INCLUDE_VDSO_H
+
+#include <stdint.h>
+
+// NOTE: MQ 2020-10-05
+// one read-only page is mapped at the same address in every process, kernel keeps it up-to-date
+// readers retry when seq is odd (writer in progress) or seq changes during the read
+#define VDSO_DATA_ADDR 0xBFFFE000
+
+#define VDSO_CLOCK_JIFFIES 0
+#define VDSO_CLOCK_TSC 1
+
+struct vdso_data
+{
+	volatile uint32_t seq;
+	uint32_t clock_mode;
+	// monotonic = ((rdtsc - tsc_start) * tsc_mult) >> tsc_shift
+	uint32_t tsc_mult;
+	uint32_t tsc_shift;
+	uint64_t tsc_start;
+	// monotonic = jiffies_ns
+	uint64_t jiffies_ns;
+	// realtime = monotonic + realtime_offset_ns
+	uint64_t realtime_offset_ns;
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "exception.h"
 
 #include <include/cdefs.h>
+#include <kernel/cpu/fpu.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
+#include <kernel/ipc/signal.h>
+#include <kernel/proc/task.h>
 #include <kernel/utils/printf.h>
 
 //! something is wrong--bail out
@@ -62,9 +65,10 @@ static int32_t invalid_opcode_fault(struct interrupt_registers *regs)
 	return IRQ_HANDLER_STOP;
 }
 
+// fpu/sse instruction with cr0.ts set -> lazily switch fpu state to current thread
 static int32_t no_device_fault(struct interrupt_registers *regs)
 {
-	kernel_panic("Device not found");
+	fpu_restore_current();
 	return IRQ_HANDLER_STOP;
 }
 
@@ -120,9 +124,14 @@ static int32_t page_fault(__unused struct interrupt_registers *regs)
 	return IRQ_HANDLER_STOP;
 }
 
+// an unmasked x87 exception of a user thread is its own business -> SIGFPE, only a kernel one is fatal
 static int32_t fpu_fault(struct interrupt_registers *regs)
 {
-	kernel_panic("FPU Fault");
+	if (regs->cs != 0x1B)
+		kernel_panic("FPU Fault");
+
+	fpu_clear_exceptions();
+	do_kill(current_process->pid, SIGFPE);
 	return IRQ_HANDLER_STOP;
 }
 
@@ -140,7 +149,10 @@ static int32_t machine_check_abort(struct interrupt_registers *regs)
 
 static int32_t simd_fpu_fault(struct interrupt_registers *regs)
 {
-	kernel_panic("FPU SIMD fault");
+	if (regs->cs != 0x1B)
+		kernel_panic("FPU SIMD fault");
+
+	do_kill(current_process->pid, SIGFPE);
 	return IRQ_HANDLER_STOP;
 }
 
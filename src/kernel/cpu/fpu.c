@@ -0,0 +1,187 @@
+#include "fpu.h"
+
+#include <kernel/cpu/hal.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/preempt.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+#define CPUID_FEAT_EDX_FXSR (1 << 24)
+#define CPUID_FEAT_EDX_SSE (1 << 25)
+
+// all sse exceptions masked, round to nearest
+#define MXCSR_DEFAULT 0x1F80
+
+#define fpu_area(th) ((void *)(((uint32_t)(th)->fpu_state + FPU_STATE_ALIGN - 1) & ~(FPU_STATE_ALIGN - 1)))
+
+static bool has_fxsr = false;
+static bool has_sse = false;
+// the thread whose fpu/sse registers are currently loaded in the cpu
+static struct thread *fpu_owner = NULL;
+
+static __inline void clts()
+{
+	__asm__ __volatile__("clts");
+}
+
+static __inline void stts()
+{
+	uint32_t cr0;
+	__asm__ __volatile__("mov %%cr0, %0"
+						 : "=r"(cr0));
+	__asm__ __volatile__("mov %0, %%cr0" ::"r"(cr0 | CR0_TS));
+}
+
+static void fpu_save(struct thread *th)
+{
+	if (has_fxsr)
+		__asm__ __volatile__("fxsave (%0)" ::"r"(fpu_area(th))
+							 : "memory");
+	else
+		__asm__ __volatile__("fnsave (%0)" ::"r"(fpu_area(th))
+							 : "memory");
+}
+
+static void fpu_restore(struct thread *th)
+{
+	if (has_fxsr)
+		__asm__ __volatile__("fxrstor (%0)" ::"r"(fpu_area(th)));
+	else
+		__asm__ __volatile__("frstor (%0)" ::"r"(fpu_area(th)));
+}
+
+static void fpu_alloc(struct thread *th)
+{
+	th->fpu_state = kcalloc(1, FPU_STATE_SIZE + FPU_STATE_ALIGN);
+}
+
+// NOTE: MQ 2020-10-10
+// fpu state is switched lazily, switching thread only sets cr0.ts
+// -> the first fpu/sse instruction after that traps into #NM (no_device_fault) which swaps state
+// -> threads which never touch fpu never pay for save/restore
+void fpu_switch(struct thread *prev, struct thread *next)
+{
+	if (next == fpu_owner)
+		clts();
+	else
+		stts();
+}
+
+void fpu_restore_current()
+{
+	clts();
+
+	struct thread *th = current_thread;
+	if (fpu_owner == th)
+		return;
+
+	if (fpu_owner)
+		fpu_save(fpu_owner);
+
+	if (th->fpu_state)
+		fpu_restore(th);
+	else
+	{
+		// fninit does not touch mxcsr, without loading it a new thread inherits the previous owner's
+		fpu_alloc(th);
+		__asm__ __volatile__("fninit");
+		if (has_sse)
+		{
+			uint32_t mxcsr = MXCSR_DEFAULT;
+			__asm__ __volatile__("ldmxcsr %0" ::"m"(mxcsr));
+		}
+	}
+	fpu_owner = th;
+}
+
+// pending x87 exceptions are cleared before the owner is signaled, otherwise its next fpu instruction faults again
+void fpu_clear_exceptions()
+{
+	__asm__ __volatile__("fnclex");
+}
+
+void fpu_fork(struct thread *parent, struct thread *child)
+{
+	if (!parent->fpu_state)
+		return;
+
+	uint32_t flags = local_irq_save();
+	if (fpu_owner == parent)
+	{
+		clts();
+		fpu_save(parent);
+		if (current_thread != parent)
+			stts();
+	}
+	local_irq_restore(flags);
+
+	fpu_alloc(child);
+	memcpy(fpu_area(child), fpu_area(parent), FPU_STATE_SIZE);
+}
+
+void fpu_exit(struct thread *th)
+{
+	if (fpu_owner == th)
+		fpu_owner = NULL;
+}
+
+// NOTE: MQ 2020-10-10
+// kernel code doesn't have its own fpu state, it borrows registers from the owner
+// -> save owner's state, run with ts cleared and leave ts set so owner reloads on next use
+void kernel_fpu_begin()
+{
+	preempt_disable();
+	clts();
+
+	if (fpu_owner)
+	{
+		fpu_save(fpu_owner);
+		fpu_owner = NULL;
+	}
+}
+
+void kernel_fpu_end()
+{
+	stts();
+	preempt_enable();
+}
+
+void fpu_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[fpu] - Initializing");
+
+	uint32_t eax, edx, cr0, cr4;
+	cpuid(1, &eax, &edx);
+	has_fxsr = edx & CPUID_FEAT_EDX_FXSR;
+
+	__asm__ __volatile__("mov %%cr0, %0"
+						 : "=r"(cr0));
+	cr0 &= ~(CR0_EM | CR0_TS);
+	cr0 |= CR0_MP | CR0_NE;
+	__asm__ __volatile__("mov %0, %%cr0" ::"r"(cr0));
+
+	if (has_fxsr)
+	{
+		__asm__ __volatile__("mov %%cr4, %0"
+							 : "=r"(cr4));
+		cr4 |= CR4_OSFXSR;
+		has_sse = edx & CPUID_FEAT_EDX_SSE;
+		if (has_sse)
+			cr4 |= CR4_OSXMMEXCPT;
+		__asm__ __volatile__("mov %0, %%cr4" ::"r"(cr4));
+	}
+
+	__asm__ __volatile__("fninit");
+	// nobody owns fpu yet, the first user traps into #NM
+	stts();
+
+	DEBUG &&debug_println(DEBUG_INFO, "[fpu] - Done");
+}
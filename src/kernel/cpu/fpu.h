@@ -0,0 +1,20 @@
+#ifndef CPU_FPU_H
+#define CPU_FPU_H
+
+#include <stdint.h>
+
+#define FPU_STATE_SIZE 512
+#define FPU_STATE_ALIGN 16
+
+struct thread;
+
+void fpu_init();
+void fpu_switch(struct thread *prev, struct thread *next);
+void fpu_restore_current();
+void fpu_fork(struct thread *parent, struct thread *child);
+void fpu_exit(struct thread *th);
+void fpu_clear_exceptions();
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+#endif
@@ -2,6 +2,7 @@
 #define CPU_HAL_H
 
 #include <include/cdefs.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -26,6 +27,34 @@ static __inline void disable_interrupts()
 	__asm__ __volatile__("cli");
 }
 
+//! disable hardware interrupts and return previous eflags
+static __inline uint32_t local_irq_save()
+{
+	uint32_t flags;
+	__asm__ __volatile__("pushf\n\tpop %0\n\tcli"
+						 : "=r"(flags)
+						 :
+						 : "memory");
+	return flags;
+}
+
+static __inline bool irqs_disabled()
+{
+	uint32_t flags;
+	__asm__ __volatile__("pushf\n\tpop %0"
+						 : "=r"(flags));
+	return !(flags & 0x200);
+}
+
+//! restore interrupt flag saved by local_irq_save
+static __inline void local_irq_restore(uint32_t flags)
+{
+	__asm__ __volatile__("push %0\n\tpopf"
+						 :
+						 : "g"(flags)
+						 : "memory", "cc");
+}
+
 static __inline void halt()
 {
 	__asm__ __volatile__("hlt");
@@ -110,6 +139,22 @@ static __inline void outportsw(uint16_t portid, const void *addr, size_t count)
 						 : "d"(portid));
 }
 
+static __inline uint64_t rdmsr(uint32_t msr)
+{
+	uint64_t rv;
+	__asm__ __volatile__("rdmsr"
+						 : "=A"(rv)
+						 : "c"(msr));
+	return rv;
+}
+
+static __inline void wrmsr(uint32_t msr, uint64_t value)
+{
+	__asm__ __volatile__("wrmsr"
+						 :
+						 : "c"(msr), "A"(value));
+}
+
 void cpuid(int code, uint32_t *a, uint32_t *d);
 const char *get_cpu_vender();
 
@@ -2,6 +2,8 @@
 
 #include <include/list.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include <kernel/system/softirq.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
@@ -176,4 +178,6 @@ void irq_ack(uint32_t irq_number)
 void irq_handler(struct interrupt_registers *reg)
 {
 	handle_interrupt(reg);
+	do_softirq();
+	preempt_schedule_irq();
 }
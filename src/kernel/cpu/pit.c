@@ -4,6 +4,7 @@
 #include <kernel/cpu/rtc.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/system/time.h>
+#include <kernel/system/vdso.h>
 #include <kernel/utils/printf.h>
 
 #include "idt.h"
@@ -36,6 +37,7 @@ static int32_t pit_interrupt_handler(struct interrupt_registers *regs)
 	// adjust ticks due to overhead and latency
 	if (jiffies % (PIT_TICKS_PER_SECOND / 2) == 0 && jiffies < (current_seconds - boot_seconds) * 1000)
 		jiffies = (current_seconds - boot_seconds) * 1000;
+	vdso_update();
 
 	irq_ack(regs->int_no);
 
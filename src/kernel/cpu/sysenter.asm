@@ -0,0 +1,45 @@
+[extern syscall_fast_dispatcher]
+[extern signal_handler]
+
+; NOTE: MQ 2020-10-08
+; libc enters with: push ebp, push <return eip>, mov ebp, esp, sysenter
+; -> ebp is user esp, [ebp] is where to return, [ebp + 4] is saved ebp
+; we lay out the same frame as int 0x7F (struct interrupt_registers) at the top of kernel stack
+; so fork, signals and schedule (which expect the frame there) work as usual,
+; it only costs a few pushes because there is no handler list and no copy into uregs
+[global sysenter_entry]
+sysenter_entry:
+    push 0x23             ; ss
+    push ebp              ; useresp, adjusted below
+    pushfd
+    or dword [esp], 0x200 ; user runs with interrupts enabled, sysenter cleared IF
+    push 0x1B             ; cs
+    push dword [ebp]      ; eip
+    push 0                ; err_code
+    push 0x7F             ; int_no, signal code treats it as a system call
+    pusha
+
+    ; data segments stay user's flat ones (base 0, limit 4GB), no need to reload
+    push ds
+    push es
+    push fs
+    push gs
+    add dword [esp + 17 * 4], 4 ; return past the pushed eip -> esp points to saved ebp
+
+    cld
+    push esp
+    call syscall_fast_dispatcher
+    call signal_handler
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8            ; int_no, err_code
+
+    mov edx, [esp]        ; eip
+    mov ecx, [esp + 12]   ; useresp
+    sti                   ; takes effect after sysexit
+    sysexit
@@ -0,0 +1,41 @@
+#include "sysenter.h"
+
+#include <kernel/cpu/hal.h>
+#include <kernel/utils/printf.h>
+#include <stdbool.h>
+
+#define CPUID_FEAT_EDX_SEP (1 << 11)
+
+extern void sysenter_entry();
+
+static bool sysenter_enabled = false;
+
+// NOTE: MQ 2020-10-08
+// sysenter loads esp from msr, it doesn't know about tss
+// -> msr has to follow tss.esp0 when switching thread
+void sysenter_set_stack(uint32_t kernel_esp)
+{
+	if (sysenter_enabled)
+		wrmsr(MSR_SYSENTER_ESP, kernel_esp);
+}
+
+// sysenter/sysexit requires gdt layout: kernel code, kernel data, user code, user data
+// -> 0x08, 0x10, 0x18 | 3, 0x20 | 3 which is exactly what gdt_init does
+void sysenter_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[sysenter] - Initializing");
+
+	uint32_t eax, edx;
+	cpuid(1, &eax, &edx);
+	if (!(edx & CPUID_FEAT_EDX_SEP))
+	{
+		DEBUG &&debug_println(DEBUG_WARNING, "\tSYSENTER is not supported, only int 0x7F is available");
+		return;
+	}
+
+	wrmsr(MSR_SYSENTER_CS, 0x08);
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+	sysenter_enabled = true;
+
+	DEBUG &&debug_println(DEBUG_INFO, "[sysenter] - Done");
+}
@@ -0,0 +1,13 @@
+#ifndef CPU_SYSENTER_H
+#define CPU_SYSENTER_H
+
+#include <stdint.h>
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+void sysenter_init();
+void sysenter_set_stack(uint32_t kernel_esp);
+
+#endif
@@ -0,0 +1,131 @@
+#include "tsc.h"
+
+#include <kernel/cpu/hal.h>
+#include <kernel/system/time.h>
+#include <kernel/utils/printf.h>
+
+#define PIT_TICK_RATE 1193182
+#define PIT_REG_CHANNEL2 0x42
+#define PIT_REG_COMMAND 0x43
+#define PIT_REG_CONTROL 0x61
+
+#define CALIBRATE_MS 50
+#define CALIBRATE_LATCH (PIT_TICK_RATE / (1000 / CALIBRATE_MS))
+#define CALIBRATE_ROUNDS 3
+#define CALIBRATE_MIN_LOOPS 1000
+
+#define CPUID_FEAT_EDX_TSC (1 << 4)
+#define TSC_SHIFT 22
+
+static bool tsc_available = false;
+static uint32_t tsc_khz = 0;
+static uint32_t tsc_mult = 0;
+static uint64_t tsc_start = 0;
+
+// NOTE: MQ 2020-10-03
+// pit channel 2 is gated by port 0x61 (bit 0) and its output is readable at bit 5 of the same port
+// -> program channel 2 in mode 0 (interrupt on terminal count) and spin until the output goes high
+// -> number of tsc cycles during that window is our frequency, no irq is needed
+static uint32_t pit_calibrate_tsc()
+{
+	// gate high, speaker off
+	outportb(PIT_REG_CONTROL, (inportb(PIT_REG_CONTROL) & ~0x02) | 0x01);
+
+	// channel 2, lobyte/hibyte, mode 0, binary
+	outportb(PIT_REG_COMMAND, 0xB0);
+	outportb(PIT_REG_CHANNEL2, CALIBRATE_LATCH & 0xff);
+	outportb(PIT_REG_CHANNEL2, (CALIBRATE_LATCH >> 8) & 0xff);
+
+	uint32_t loops = 0;
+	uint64_t start = rdtsc();
+	while ((inportb(PIT_REG_CONTROL) & 0x20) == 0)
+		loops++;
+	uint64_t end = rdtsc();
+
+	// pit is not connected or emulated too coarsely to be trusted
+	if (loops < CALIBRATE_MIN_LOOPS || end <= start)
+		return 0;
+
+	return (end - start) / CALIBRATE_MS;
+}
+
+// NOTE: MQ 2020-10-03 a * mul can overflow 64 bits, split into two 32x32 multiplications
+static uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+	uint32_t ah = a >> 32, al = a;
+	uint64_t ret = ((uint64_t)al * mul) >> shift;
+	if (ah)
+		ret += ((uint64_t)ah * mul) << (32 - shift);
+	return ret;
+}
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles)
+{
+	return mul_u64_u32_shr(cycles, tsc_mult, TSC_SHIFT);
+}
+
+uint64_t tsc_read_ns()
+{
+	return tsc_cycles_to_ns(rdtsc() - tsc_start);
+}
+
+bool tsc_is_available()
+{
+	return tsc_available;
+}
+
+uint32_t tsc_get_khz()
+{
+	return tsc_khz;
+}
+
+uint32_t tsc_get_mult()
+{
+	return tsc_mult;
+}
+
+uint32_t tsc_get_shift()
+{
+	return TSC_SHIFT;
+}
+
+uint64_t tsc_get_start()
+{
+	return tsc_start;
+}
+
+void tsc_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[tsc] - Initializing");
+
+	uint32_t eax, edx;
+	cpuid(1, &eax, &edx);
+	if (!(edx & CPUID_FEAT_EDX_TSC))
+	{
+		DEBUG &&debug_println(DEBUG_WARNING, "\tTSC is not supported, fallback to pit");
+		return;
+	}
+
+	// keep the smallest result, the larger ones are disturbed by smi or emulation
+	uint32_t khz = UINT32_MAX;
+	for (int i = 0; i < CALIBRATE_ROUNDS; ++i)
+	{
+		uint32_t k = pit_calibrate_tsc();
+		if (k && k < khz)
+			khz = k;
+	}
+
+	if (khz == UINT32_MAX)
+	{
+		DEBUG &&debug_println(DEBUG_WARNING, "\tFailed to calibrate TSC, fallback to pit");
+		return;
+	}
+
+	tsc_khz = khz;
+	tsc_mult = ((uint64_t)NSEC_PER_MSEC << TSC_SHIFT) / tsc_khz;
+	tsc_start = rdtsc();
+	tsc_available = true;
+
+	DEBUG &&debug_println(DEBUG_INFO, "\tTSC frequency %d kHz", tsc_khz);
+	DEBUG &&debug_println(DEBUG_INFO, "[tsc] - Done");
+}
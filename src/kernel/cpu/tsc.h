@@ -0,0 +1,24 @@
+#ifndef CPU_TSC_H
+#define CPU_TSC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+static __inline uint64_t rdtsc()
+{
+	uint64_t ret;
+	__asm__ __volatile__("rdtsc"
+						 : "=A"(ret));
+	return ret;
+}
+
+void tsc_init();
+bool tsc_is_available();
+uint32_t tsc_get_khz();
+uint64_t tsc_cycles_to_ns(uint64_t cycles);
+uint64_t tsc_read_ns();
+uint32_t tsc_get_mult();
+uint32_t tsc_get_shift();
+uint64_t tsc_get_start();
+
+#endif
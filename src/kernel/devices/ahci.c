@@ -0,0 +1,299 @@
+#include "ahci.h"
+
+#include <include/errno.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/cpu/idt.h>
+#include <kernel/devices/pci.h>
+#include <kernel/fs/block_dev.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+
+#define AHCI_SPIN_TIMEOUT 1000000
+#define AHCI_CMD_LIST_SIZE 1024
+
+static volatile struct ahci_hba_regs *hba;
+static struct ahci_port *ports[AHCI_MAX_PORTS];
+static uint32_t number_of_disks;
+
+static bool ahci_spin_until_clear(volatile uint32_t *reg, uint32_t mask)
+{
+	for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT; ++i)
+		if (!(*reg & mask))
+			return true;
+	return false;
+}
+
+static void ahci_stop_port(volatile struct ahci_port_regs *regs)
+{
+	regs->cmd &= ~AHCI_PxCMD_ST;
+	ahci_spin_until_clear(&regs->cmd, AHCI_PxCMD_CR);
+	regs->cmd &= ~AHCI_PxCMD_FRE;
+	ahci_spin_until_clear(&regs->cmd, AHCI_PxCMD_FR);
+}
+
+static void ahci_start_port(volatile struct ahci_port_regs *regs)
+{
+	ahci_spin_until_clear(&regs->cmd, AHCI_PxCMD_CR);
+	regs->cmd |= AHCI_PxCMD_FRE;
+	regs->cmd |= AHCI_PxCMD_ST;
+}
+
+// every prd covers the part of a buffer inside one page, frames of a kernel buffer are not contiguous
+static uint32_t ahci_fill_prdt(struct ahci_cmd_table *table, uint32_t iprd, char *data, uint32_t size)
+{
+	uint32_t vaddr = (uint32_t)data;
+	uint32_t end = vaddr + size;
+	while (vaddr < end)
+	{
+		uint32_t length = min_t(uint32_t, PMM_FRAME_SIZE - vaddr % PMM_FRAME_SIZE, end - vaddr);
+		table->prdt[iprd].dba = vmm_get_physical_address(vaddr, false);
+		table->prdt[iprd].dbau = 0;
+		table->prdt[iprd].dbc = length - 1;
+		vaddr += length;
+		iprd++;
+	}
+	return iprd;
+}
+
+static void ahci_setup_command(struct ahci_port *port, uint8_t slot, uint8_t command, sector_t lba, uint32_t count, bool is_write, uint32_t nprd)
+{
+	struct fis_reg_h2d *fis = (struct fis_reg_h2d *)port->cmd_tables[slot]->cfis;
+	memset(fis, 0, sizeof(struct fis_reg_h2d));
+	fis->fis_type = FIS_TYPE_REG_H2D;
+	fis->flags = FIS_H2D_COMMAND;
+	fis->command = command;
+	fis->device = ATA_DEVICE_LBA;
+	fis->lba0 = (uint8_t)lba;
+	fis->lba1 = (uint8_t)(lba >> 8);
+	fis->lba2 = (uint8_t)(lba >> 16);
+	fis->lba3 = (uint8_t)(lba >> 24);
+
+	// queued command carries sector count in feature registers and its tag in count register
+	if (command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED)
+	{
+		fis->featurel = (uint8_t)count;
+		fis->featureh = (uint8_t)(count >> 8);
+		fis->countl = slot << 3;
+	}
+	else
+	{
+		fis->countl = (uint8_t)count;
+		fis->counth = (uint8_t)(count >> 8);
+	}
+
+	struct ahci_cmd_header *header = &port->cmd_list[slot];
+	header->cfl = sizeof(struct fis_reg_h2d) / sizeof(uint32_t);
+	header->w = is_write;
+	header->prdtl = nprd;
+	header->prdbc = 0;
+}
+
+// only used while probing, interrupts of the port are not enabled yet
+static int32_t ahci_identify(struct ahci_port *port, uint16_t *identify)
+{
+	uint32_t nprd = ahci_fill_prdt(port->cmd_tables[0], 0, (char *)identify, 512);
+	ahci_setup_command(port, 0, ATA_CMD_IDENTIFY, 0, 0, false, nprd);
+
+	if (!ahci_spin_until_clear(&port->regs->tfd, AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ))
+		return -EBUSY;
+
+	port->regs->ci = 1;
+	if (!ahci_spin_until_clear(&port->regs->ci, 1) || (port->regs->tfd & AHCI_PxTFD_ERR))
+		return -EIO;
+	return 0;
+}
+
+/*
+  NOTE: MQ 2020-10-18
+  called by kblockd, a request is issued in a free command slot and completed in ahci_irq
+  queue depth of the block queue is the number of slots -> there is always a free one
+  with ncq, the disk reorders outstanding commands itself (READ/WRITE FPDMA QUEUED, tag = slot)
+*/
+static int32_t ahci_request(struct request_queue *q, struct request *rq)
+{
+	struct ahci_port *port = q->queuedata;
+
+	uint8_t slot = 0;
+	while (port->issued & (1 << slot))
+		slot++;
+
+	uint32_t nprd = 0;
+	struct bio *bio;
+	rq_for_each_bio(bio, rq)
+	{
+		if ((uint32_t)bio->bi_data & 1)
+			return -EINVAL;
+		nprd = ahci_fill_prdt(port->cmd_tables[slot], nprd, bio->bi_data, bio->bi_size);
+	}
+
+	bool is_write = rq->rw == WRITE;
+	uint8_t command = port->ncq
+						  ? (is_write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED)
+						  : (is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+	ahci_setup_command(port, slot, command, rq->sector, rq->nr_sectors, is_write, nprd);
+
+	uint32_t flags = local_irq_save();
+	port->slots[slot] = rq;
+	port->issued |= 1 << slot;
+	if (port->ncq)
+		port->regs->sact = 1 << slot;
+	port->regs->ci = 1 << slot;
+	local_irq_restore(flags);
+
+	return -EINPROGRESS;
+}
+
+static void ahci_complete_slots(struct ahci_port *port, uint32_t done, int32_t error)
+{
+	port->issued &= ~done;
+	for (uint8_t slot = 0; slot < AHCI_MAX_SLOTS; ++slot)
+	{
+		if (!(done & (1 << slot)))
+			continue;
+
+		blk_complete_request(port->slots[slot], error);
+		port->slots[slot] = NULL;
+	}
+}
+
+static void ahci_port_irq(struct ahci_port *port)
+{
+	uint32_t status = port->regs->is;
+	port->regs->is = status;
+
+	// hba stops processing the port on error, the failed ncq tag is not known without reading the log
+	// -> fail all outstanding commands and restart the port
+	if (status & AHCI_PxIS_ERROR)
+	{
+		uint32_t issued = port->issued;
+		ahci_stop_port(port->regs);
+		port->regs->serr = 0xFFFFFFFF;
+		port->regs->is = 0xFFFFFFFF;
+		ahci_start_port(port->regs);
+		ahci_complete_slots(port, issued, -EIO);
+		return;
+	}
+
+	// a finished command clears its bit in sact (ncq) or ci
+	uint32_t active = port->ncq ? port->regs->sact : port->regs->ci;
+	ahci_complete_slots(port, port->issued & ~active, 0);
+}
+
+static int32_t ahci_irq(struct interrupt_registers *regs)
+{
+	uint32_t status = hba->is;
+	for (uint8_t i = 0; i < AHCI_MAX_PORTS; ++i)
+	{
+		if ((status & (1 << i)) && ports[i])
+			ahci_port_irq(ports[i]);
+	}
+	hba->is = status;
+	irq_ack(regs->int_no);
+
+	return IRQ_HANDLER_CONTINUE;
+}
+
+static struct ahci_port *ahci_port_init(volatile struct ahci_port_regs *regs, uint32_t nslots, bool ncq)
+{
+	ahci_stop_port(regs);
+
+	struct ahci_port *port = kcalloc(1, sizeof(struct ahci_port));
+	port->regs = regs;
+
+	// command list and received fis share one page
+	uint32_t paddr;
+	char *page = dma_alloc_coherent(PMM_FRAME_SIZE, &paddr);
+	port->cmd_list = (struct ahci_cmd_header *)page;
+	regs->clb = paddr;
+	regs->clbu = 0;
+	regs->fb = paddr + AHCI_CMD_LIST_SIZE;
+	regs->fbu = 0;
+
+	for (uint32_t slot = 0; slot < nslots; ++slot)
+	{
+		port->cmd_tables[slot] = dma_alloc_coherent(PMM_FRAME_SIZE, &paddr);
+		port->cmd_list[slot].ctba = paddr;
+		port->cmd_list[slot].ctbau = 0;
+	}
+
+	// error and interrupt bits are cleared by writing 1
+	regs->serr = 0xFFFFFFFF;
+	regs->is = 0xFFFFFFFF;
+	ahci_start_port(regs);
+
+	uint16_t *identify = kcalloc(256, sizeof(uint16_t));
+	if (ahci_identify(port, identify) < 0)
+	{
+		DEBUG &&debug_println(DEBUG_WARNING, "[ahci] - Port does not answer identify");
+		ahci_stop_port(regs);
+		kfree(identify);
+		return NULL;
+	}
+
+	// word 76 bit 8: ncq is supported, word 75: queue depth - 1
+	port->ncq = ncq && (identify[76] & (1 << 8));
+	port->nslots = port->ncq ? min_t(uint32_t, nslots, (identify[75] & 0x1F) + 1) : nslots;
+	kfree(identify);
+
+	regs->is = 0xFFFFFFFF;
+	regs->ie = AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS | AHCI_PxIS_DPS | AHCI_PxIS_ERROR;
+	return port;
+}
+
+static void ahci_register_blkdev(struct ahci_port *port)
+{
+	sprintf(port->dev_name, "/dev/sd%c", 'a' + number_of_disks++);
+
+	struct block_device *bdev = kcalloc(1, sizeof(struct block_device));
+	bdev->name = port->dev_name;
+	bdev->queue = blk_init_queue(ahci_request, port, AHCI_MAX_SECTORS, port->nslots);
+	register_blkdev(bdev);
+}
+
+static bool ahci_port_has_disk(volatile struct ahci_port_regs *regs)
+{
+	uint32_t ssts = regs->ssts;
+	return (ssts & 0x0F) == AHCI_PxSSTS_DET_PRESENT && ((ssts >> 8) & 0x0F) == AHCI_PxSSTS_IPM_ACTIVE &&
+		   regs->sig == AHCI_SIG_ATA;
+}
+
+void ahci_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[ahci] - Initializing");
+
+	struct pci_device *dev = get_pci_device_by_class(PCI_CLASS_CODE_MASS_STORAGE, PCI_SUBCLASS_SATA);
+	if (!dev)
+	{
+		DEBUG &&debug_println(DEBUG_INFO, "[ahci] - Controller not found");
+		return;
+	}
+
+	uint32_t command_reg = pci_read_field(dev->address, PCI_COMMAND);
+	command_reg |= PCI_COMMAND_REG_MEMORY_SPACE | PCI_COMMAND_REG_BUS_MASTER;
+	command_reg &= ~PCI_COMMAND_REG_INTERRUPT_DISABLE;
+	pci_write_field(dev->address, PCI_COMMAND, command_reg);
+
+	// abar (bar5) is memory mapped registers
+	hba = ioremap(dev->bar5 & 0xFFFFFFF0, AHCI_ABAR_SIZE);
+	hba->ghc |= AHCI_GHC_AE;
+
+	register_interrupt_handler(32 + pci_get_interrupt_line(dev->address), ahci_irq);
+
+	uint32_t nslots = AHCI_CAP_NCS(hba->cap);
+	bool ncq = hba->cap & AHCI_CAP_SNCQ;
+	for (uint8_t i = 0; i < AHCI_MAX_PORTS; ++i)
+	{
+		if (!(hba->pi & (1 << i)) || !ahci_port_has_disk(&hba->ports[i]))
+			continue;
+
+		ports[i] = ahci_port_init(&hba->ports[i], nslots, ncq);
+		if (ports[i])
+			ahci_register_blkdev(ports[i]);
+	}
+
+	hba->is = 0xFFFFFFFF;
+	hba->ghc |= AHCI_GHC_IE;
+
+	DEBUG &&debug_println(DEBUG_INFO, "[ahci] - Done");
+}
@@ -0,0 +1,171 @@
+#ifndef DEVICE_AHCI_H
+#define DEVICE_AHCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AHCI_ABAR_SIZE 0x1100
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_SLOTS 32
+#define AHCI_PRDT_SIZE 248	// command table fills one page
+#define AHCI_MAX_SECTORS 120  // a request of 512-byte bios spanning two pages each still fits in prdt
+
+// hba capabilities
+#define AHCI_CAP_NCS(cap) ((((cap) >> 8) & 0x1F) + 1)
+#define AHCI_CAP_SNCQ (1 << 30)
+
+// global hba control
+#define AHCI_GHC_IE (1 << 1)
+#define AHCI_GHC_AE (1 << 31)
+
+// port command and status
+#define AHCI_PxCMD_ST (1 << 0)
+#define AHCI_PxCMD_FRE (1 << 4)
+#define AHCI_PxCMD_FR (1 << 14)
+#define AHCI_PxCMD_CR (1 << 15)
+
+// port interrupt status/enable
+#define AHCI_PxIS_DHRS (1 << 0)
+#define AHCI_PxIS_PSS (1 << 1)
+#define AHCI_PxIS_DSS (1 << 2)
+#define AHCI_PxIS_SDBS (1 << 3)
+#define AHCI_PxIS_DPS (1 << 5)
+#define AHCI_PxIS_IFS (1 << 27)
+#define AHCI_PxIS_HBDS (1 << 28)
+#define AHCI_PxIS_HBFS (1 << 29)
+#define AHCI_PxIS_TFES (1 << 30)
+#define AHCI_PxIS_ERROR (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_PxTFD_ERR 0x01
+#define AHCI_PxTFD_DRQ 0x08
+#define AHCI_PxTFD_BSY 0x80
+
+#define AHCI_PxSSTS_DET_PRESENT 0x3
+#define AHCI_PxSSTS_IPM_ACTIVE 0x1
+#define AHCI_SIG_ATA 0x00000101
+
+#define FIS_TYPE_REG_H2D 0x27
+#define FIS_H2D_COMMAND (1 << 7)
+
+#define ATA_CMD_IDENTIFY 0xEC
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+#define ATA_DEVICE_LBA (1 << 6)
+
+struct ahci_port_regs
+{
+	uint32_t clb;	// command list base address, 1K-byte aligned
+	uint32_t clbu;
+	uint32_t fb;  // fis base address, 256-byte aligned
+	uint32_t fbu;
+	uint32_t is;  // interrupt status
+	uint32_t ie;  // interrupt enable
+	uint32_t cmd;
+	uint32_t rsv0;
+	uint32_t tfd;  // task file data
+	uint32_t sig;
+	uint32_t ssts;	// sata status
+	uint32_t sctl;
+	uint32_t serr;
+	uint32_t sact;	// sata active, one bit per outstanding ncq tag
+	uint32_t ci;	// command issue
+	uint32_t sntf;
+	uint32_t fbs;
+	uint32_t rsv1[11];
+	uint32_t vendor[4];
+};
+
+struct ahci_hba_regs
+{
+	uint32_t cap;
+	uint32_t ghc;
+	uint32_t is;
+	uint32_t pi;  // ports implemented
+	uint32_t vs;
+	uint32_t ccc_ctl;
+	uint32_t ccc_pts;
+	uint32_t em_loc;
+	uint32_t em_ctl;
+	uint32_t cap2;
+	uint32_t bohc;
+	uint8_t rsv[0x74];
+	uint8_t vendor[0x60];
+	struct ahci_port_regs ports[AHCI_MAX_PORTS];
+};
+
+struct ahci_cmd_header
+{
+	uint8_t cfl : 5;  // command fis length in dwords
+	uint8_t a : 1;	  // atapi
+	uint8_t w : 1;	  // write, host to device
+	uint8_t p : 1;	  // prefetchable
+	uint8_t r : 1;
+	uint8_t b : 1;
+	uint8_t c : 1;
+	uint8_t rsv0 : 1;
+	uint8_t pmp : 4;
+	uint16_t prdtl;	 // prdt entries
+	volatile uint32_t prdbc;
+	uint32_t ctba;	// command table base address, 128-byte aligned
+	uint32_t ctbau;
+	uint32_t rsv1[4];
+} __attribute__((packed));
+
+struct ahci_prd
+{
+	uint32_t dba;  // data base address, word aligned
+	uint32_t dbau;
+	uint32_t rsv;
+	uint32_t dbc;  // byte count - 1
+} __attribute__((packed));
+
+struct ahci_cmd_table
+{
+	uint8_t cfis[64];
+	uint8_t acmd[16];
+	uint8_t rsv[48];
+	struct ahci_prd prdt[AHCI_PRDT_SIZE];
+} __attribute__((packed));
+
+struct fis_reg_h2d
+{
+	uint8_t fis_type;
+	uint8_t flags;	// bit 7: command
+	uint8_t command;
+	uint8_t featurel;
+	uint8_t lba0;
+	uint8_t lba1;
+	uint8_t lba2;
+	uint8_t device;
+	uint8_t lba3;
+	uint8_t lba4;
+	uint8_t lba5;
+	uint8_t featureh;
+	uint8_t countl;
+	uint8_t counth;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t rsv[4];
+} __attribute__((packed));
+
+struct request;
+
+struct ahci_port
+{
+	volatile struct ahci_port_regs *regs;
+	struct ahci_cmd_header *cmd_list;
+	struct ahci_cmd_table *cmd_tables[AHCI_MAX_SLOTS];
+	struct request *slots[AHCI_MAX_SLOTS];
+	volatile uint32_t issued;  // slots owned by hba
+	uint32_t nslots;
+	bool ncq;
+	char dev_name[16];
+};
+
+void ahci_init();
+
+#endif
@@ -3,7 +3,11 @@
 #include <include/errno.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
+#include <kernel/devices/pci.h>
+#include <kernel/fs/block_dev.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/math.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
@@ -12,6 +16,9 @@
 static struct ata_device devices[MAX_ATA_DEVICE];
 static uint8_t number_of_actived_devices = 0;
 static volatile bool ata_irq_called;
+static struct ata_channel channels[2];
+// aligned by its size -> a table never crosses page or 64K boundary
+static struct ata_prd prdts[2][ATA_PRDT_SIZE] __attribute__((aligned(ATA_PRDT_SIZE * sizeof(struct ata_prd))));
 
 static void ata_400ns_delays(struct ata_device *device)
 {
@@ -68,6 +75,13 @@ static uint8_t ata_polling_identify(struct ata_device *device)
 
 static int32_t ata_irq(struct interrupt_registers *regs)
 {
+	struct ata_channel *channel = &channels[regs->int_no == IRQ14 ? 0 : 1];
+	if (channel->dma_active && (inportb(channel->bmr_base + ATA_BMR_STATUS) & ATA_BMR_STATUS_IRQ))
+	{
+		channel->dma_active = false;
+		wake_up(&channel->wait);
+	}
+
 	ata_irq_called = true;
 	irq_ack(regs->int_no);
 
@@ -131,6 +145,131 @@ static uint8_t atapi_identify(struct ata_device *device)
 	return ATA_IDENTIFY_ERR;
 }
 
+static void ata_setup_transfer(struct ata_device *device, uint32_t lba, uint8_t n_sectors)
+{
+	outportb(device->io_base + 6, (device->is_master ? 0xE0 : 0xF0) | ((lba >> 24) & 0x0F));
+	ata_400ns_delays(device);
+
+	outportb(device->io_base + 1, 0x00);
+	outportb(device->io_base + 2, n_sectors);
+	outportb(device->io_base + 3, (uint8_t)lba);
+	outportb(device->io_base + 4, (uint8_t)(lba >> 8));
+	outportb(device->io_base + 5, (uint8_t)(lba >> 16));
+}
+
+// completion is signaled by irq, the thread sleeps until then -> interrupts must be on
+static bool ata_can_dma(struct ata_device *device, struct request *rq)
+{
+	if (!device->is_harddisk || !device->channel->bmr_base || irqs_disabled())
+		return false;
+
+	struct bio *bio;
+	rq_for_each_bio(bio, rq)
+	{
+		if ((uint32_t)bio->bi_data & 1)
+			return false;
+	}
+	return true;
+}
+
+/*
+  NOTE: MQ 2020-10-18
+  kernel buffer is virtually contiguous but its frames are not
+  -> every prd covers the part of a bio inside one page (this also keeps a region within 64K boundary)
+*/
+static void ata_fill_prdt(struct ata_channel *channel, struct request *rq)
+{
+	uint32_t iprd = 0;
+	struct bio *bio;
+	rq_for_each_bio(bio, rq)
+	{
+		uint32_t vaddr = (uint32_t)bio->bi_data;
+		uint32_t end = vaddr + bio->bi_size;
+		while (vaddr < end)
+		{
+			uint32_t length = min_t(uint32_t, PMM_FRAME_SIZE - vaddr % PMM_FRAME_SIZE, end - vaddr);
+			channel->prdt[iprd].addr = vmm_get_physical_address(vaddr, false);
+			channel->prdt[iprd].size = length;
+			channel->prdt[iprd].flags = 0;
+			vaddr += length;
+			iprd++;
+		}
+	}
+	channel->prdt[iprd - 1].flags = ATA_PRD_EOT;
+}
+
+static int8_t ata_dma_transfer(struct ata_device *device, struct request *rq)
+{
+	struct ata_channel *channel = device->channel;
+	uint16_t bmr_base = channel->bmr_base;
+	bool is_write = rq->rw == WRITE;
+
+	rt_mutex_lock(&channel->lock);
+
+	ata_fill_prdt(channel, rq);
+	outportb(bmr_base + ATA_BMR_COMMAND, 0);
+	outportl(bmr_base + ATA_BMR_PRDT, vmm_get_physical_address((uint32_t)channel->prdt, false));
+	// error and interrupt bits are cleared by writing 1
+	outportb(bmr_base + ATA_BMR_STATUS, ATA_BMR_STATUS_ERR | ATA_BMR_STATUS_IRQ);
+
+	ata_setup_transfer(device, rq->sector, rq->nr_sectors);
+	channel->dma_active = true;
+	outportb(device->io_base + 7, is_write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+	outportb(bmr_base + ATA_BMR_COMMAND, ATA_BMR_CMD_START | (is_write ? 0 : ATA_BMR_CMD_READ));
+
+	// checking and sleeping are not interrupted -> the completion irq cannot be missed
+	DEFINE_WAIT(wait);
+	add_wait_queue(&channel->wait, &wait);
+	uint32_t flags = local_irq_save();
+	while (channel->dma_active)
+	{
+		update_thread(current_thread, THREAD_WAITING);
+		local_irq_restore(flags);
+		schedule();
+		flags = local_irq_save();
+	}
+	local_irq_restore(flags);
+	remove_wait_queue(&channel->wait, &wait);
+
+	outportb(bmr_base + ATA_BMR_COMMAND, 0);
+	uint8_t bmr_status = inportb(bmr_base + ATA_BMR_STATUS);
+	outportb(bmr_base + ATA_BMR_STATUS, ATA_BMR_STATUS_ERR | ATA_BMR_STATUS_IRQ);
+	uint8_t status = inportb(device->io_base + 7);
+
+	rt_mutex_unlock(&channel->lock);
+
+	if ((bmr_status & ATA_BMR_STATUS_ERR) || (status & (ATA_SREG_ERR | ATA_SREG_DF)))
+		return -ENXIO;
+	return 0;
+}
+
+// called by kblockd, a request is one dma transfer or one pio command per bio
+static int32_t ata_request(struct request_queue *q, struct request *rq)
+{
+	struct ata_device *device = q->queuedata;
+	if (ata_can_dma(device, rq))
+		return ata_dma_transfer(device, rq);
+
+	struct bio *bio;
+	rq_for_each_bio(bio, rq)
+	{
+		int8_t ret = rq->rw == WRITE
+						 ? ata_write(device, bio->bi_sector, bio_sectors(bio), (uint16_t *)bio->bi_data)
+						 : ata_read(device, bio->bi_sector, bio_sectors(bio), (uint16_t *)bio->bi_data);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+static void ata_register_blkdev(struct ata_device *device)
+{
+	struct block_device *bdev = kcalloc(1, sizeof(struct block_device));
+	bdev->name = device->dev_name;
+	bdev->queue = blk_init_queue(ata_request, device, ATA_MAX_SECTORS, 1);
+	register_blkdev(bdev);
+}
+
 static struct ata_device *ata_detect(uint16_t io_addr1, uint16_t io_addr2, uint8_t irq, bool is_master, char *dev_name)
 {
 	struct ata_device *device = kcalloc(1, sizeof(struct ata_device));
@@ -138,12 +277,14 @@ static struct ata_device *ata_detect(uint16_t io_addr1, uint16_t io_addr2, uint8
 	device->associated_io_base = io_addr2;
 	device->irq = irq;
 	device->is_master = is_master;
+	device->channel = &channels[io_addr1 == ATA0_IO_ADDR1 ? 0 : 1];
 
 	if (ata_identify(device) == ATA_IDENTIFY_SUCCESS)
 	{
 		device->is_harddisk = true;
 		device->dev_name = dev_name;
 		devices[number_of_actived_devices++] = *device;
+		ata_register_blkdev(&devices[number_of_actived_devices - 1]);
 		return device;
 	}
 	else if (atapi_identify(device) == ATA_IDENTIFY_SUCCESS)
@@ -158,14 +299,7 @@ static struct ata_device *ata_detect(uint16_t io_addr1, uint16_t io_addr2, uint8
 
 int8_t ata_read(struct ata_device *device, uint32_t lba, uint8_t n_sectors, uint16_t *buffer)
 {
-	outportb(device->io_base + 6, (device->is_master ? 0xE0 : 0xF0) | ((lba >> 24) & 0x0F));
-	ata_400ns_delays(device);
-
-	outportb(device->io_base + 1, 0x00);
-	outportb(device->io_base + 2, n_sectors);
-	outportb(device->io_base + 3, (uint8_t)lba);
-	outportb(device->io_base + 4, (uint8_t)(lba >> 8));
-	outportb(device->io_base + 5, (uint8_t)(lba >> 16));
+	ata_setup_transfer(device, lba, n_sectors);
 	outportb(device->io_base + 7, 0x20);
 
 	if (ata_polling(device) == ATA_POLLING_ERR)
@@ -184,14 +318,7 @@ int8_t ata_read(struct ata_device *device, uint32_t lba, uint8_t n_sectors, uint
 
 int8_t ata_write(struct ata_device *device, uint32_t lba, uint8_t n_sectors, uint16_t *buffer)
 {
-	outportb(device->io_base + 6, (device->is_master ? 0xE0 : 0xF0) | ((lba >> 24) & 0x0F));
-	ata_400ns_delays(device);
-
-	outportb(device->io_base + 1, 0x00);
-	outportb(device->io_base + 2, n_sectors);
-	outportb(device->io_base + 3, (uint8_t)lba);
-	outportb(device->io_base + 4, (uint8_t)(lba >> 8));
-	outportb(device->io_base + 5, (uint8_t)(lba >> 16));
+	ata_setup_transfer(device, lba, n_sectors);
 	outportb(device->io_base + 7, 0x30);
 
 	if (ata_polling(device) == ATA_POLLING_ERR)
@@ -254,12 +381,40 @@ struct ata_device *get_ata_device(char *dev_name)
 	return NULL;
 }
 
+// bus master ide of the ide controller found by pci scan, without it ata falls back to pio
+static void ata_dma_init()
+{
+	for (uint8_t i = 0; i < 2; ++i)
+	{
+		channels[i].prdt = prdts[i];
+		INIT_LIST_HEAD(&channels[i].wait.list);
+		rt_mutex_init(&channels[i].lock);
+	}
+
+	struct pci_device *dev = get_pci_device_by_class(PCI_CLASS_CODE_MASS_STORAGE, PCI_SUBCLASS_IDE);
+	// bar4 has to be an io space bar
+	if (!dev || !(dev->bar4 & 0x1))
+		return;
+
+	uint32_t command_reg = pci_read_field(dev->address, PCI_COMMAND);
+	if (!(command_reg & PCI_COMMAND_REG_BUS_MASTER))
+	{
+		command_reg |= PCI_COMMAND_REG_BUS_MASTER;
+		pci_write_field(dev->address, PCI_COMMAND, command_reg);
+	}
+
+	uint16_t bmr_base = dev->bar4 & 0xFFFC;
+	channels[0].bmr_base = bmr_base;
+	channels[1].bmr_base = bmr_base + ATA_BMR_SECONDARY;
+}
+
 uint8_t ata_init()
 {
 	DEBUG &&debug_println(DEBUG_INFO, "[ata] - Initializing");
 
 	register_interrupt_handler(IRQ14, ata_irq);
 	register_interrupt_handler(IRQ15, ata_irq);
+	ata_dma_init();
 
 	ata_detect(ATA0_IO_ADDR1, ATA0_IO_ADDR2, ATA0_IRQ, true, "/dev/hda");
 	ata_detect(ATA0_IO_ADDR1, ATA0_IO_ADDR2, ATA0_IRQ, false, "/dev/hdb");
@@ -1,6 +1,8 @@
 #ifndef DEVICE_ATA_H
 #define DEVICE_ATA_H
 
+#include <kernel/locking/rt_mutex.h>
+#include <kernel/proc/wait.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -22,6 +24,25 @@
 #define ATA_SREG_DRQ 0x08
 #define ATA_SREG_BSY 0x80
 
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+
+// bus master ide registers (pci bar4), the secondary channel is at +8
+#define ATA_BMR_COMMAND 0x00
+#define ATA_BMR_STATUS 0x02
+#define ATA_BMR_PRDT 0x04
+#define ATA_BMR_SECONDARY 0x08
+
+#define ATA_BMR_CMD_START 0x01
+#define ATA_BMR_CMD_READ 0x08  // bus master writes to memory
+#define ATA_BMR_STATUS_ACTIVE 0x01
+#define ATA_BMR_STATUS_ERR 0x02
+#define ATA_BMR_STATUS_IRQ 0x04
+
+#define ATA_PRD_EOT 0x8000
+#define ATA_PRDT_SIZE 256
+#define ATA_MAX_SECTORS 128	 // a request of 512-byte bios spanning two pages each still fits in prdt
+
 #define ATA_POLLING_ERR 0
 #define ATA_POLLING_SUCCESS 1
 
@@ -29,6 +50,23 @@
 #define ATA_IDENTIFY_SUCCESS 1
 #define ATA_IDENTIFY_NOT_FOUND 2
 
+// physical region descriptor, a region must not cross 64K boundary
+struct ata_prd
+{
+	uint32_t addr;
+	uint16_t size;
+	uint16_t flags;
+} __attribute__((packed));
+
+struct ata_channel
+{
+	uint16_t bmr_base;	// 0 -> no bus master, only pio
+	struct ata_prd *prdt;
+	volatile bool dma_active;
+	struct wait_queue_head wait;
+	struct rt_mutex lock;
+};
+
 struct ata_device
 {
 	uint16_t io_base;
@@ -37,6 +75,7 @@ struct ata_device
 	char *dev_name;
 	bool is_master;
 	bool is_harddisk;
+	struct ata_channel *channel;
 };
 
 uint8_t ata_init();
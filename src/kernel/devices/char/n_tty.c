@@ -154,7 +154,7 @@ ssize_t ntty_read(struct tty_struct *tty, struct vfs_file *file, char *buf, size
 	}
 
 	DEFINE_WAIT(wait);
-	list_add_tail(&wait.sibling, &tty->read_wait.list);
+	add_wait_queue(&tty->read_wait, &wait);
 	int length;
 
 	while (true)
@@ -188,7 +188,7 @@ ssize_t ntty_read(struct tty_struct *tty, struct vfs_file *file, char *buf, size
 		update_thread(current_thread, THREAD_WAITING);
 		schedule();
 	}
-	list_del(&wait.sibling);
+	remove_wait_queue(&tty->read_wait, &wait);
 
 	if (!length || length > nr || length > tty->read_count)
 		return -EFAULT;
@@ -219,7 +219,7 @@ ssize_t ntty_write(struct tty_struct *tty, struct vfs_file *file, const char *bu
 	}
 
 	DEFINE_WAIT(wait);
-	list_add_tail(&wait.sibling, &tty->write_wait.list);
+	add_wait_queue(&tty->write_wait, &wait);
 
 	while (true)
 	{
@@ -232,7 +232,7 @@ ssize_t ntty_write(struct tty_struct *tty, struct vfs_file *file, const char *bu
 		schedule();
 	}
 
-	list_del(&wait.sibling);
+	remove_wait_queue(&tty->write_wait, &wait);
 	return nr;
 }
 
@@ -8,6 +8,7 @@
 #include <kernel/devices/mouse.h>
 #include <kernel/fs/char_dev.h>
 #include <kernel/proc/task.h>
+#include <kernel/system/workqueue.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
@@ -352,6 +353,13 @@ void kkybrd_set_leds(bool num, bool caps, bool scroll)
 static struct list_head nodelist;
 static struct wait_queue_head hwait;
 
+// irq handler only fills readers' queues, waking them up is deferred to kworker
+static void kybrd_wake_up_readers(struct work_struct *work)
+{
+	wake_up(&hwait);
+}
+static struct work_struct wake_up_work = WORK_INITIALIZER(kybrd_wake_up_readers);
+
 static void kybrd_notify_readers(struct key_event *event)
 {
 	struct kybrd_inode *iter;
@@ -369,7 +377,7 @@ static void kybrd_notify_readers(struct key_event *event)
 		iter->packets[iter->tail] = *event;
 		iter->ready = true;
 	}
-	wake_up(&hwait);
+	queue_work(&wake_up_work);
 }
 
 static int kybrd_open(struct vfs_inode *inode, struct vfs_file *file)
@@ -9,6 +9,7 @@
 #include <kernel/fs/vfs.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
+#include <kernel/system/workqueue.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
@@ -26,6 +27,13 @@ static struct mouse_event current_mouse_motion;
 static struct list_head nodelist;
 static struct wait_queue_head hwait;
 
+// irq handler only fills readers' queues, waking them up is deferred to kworker
+static void mouse_wake_up_readers(struct work_struct *work)
+{
+	wake_up(&hwait);
+}
+static struct work_struct wake_up_work = WORK_INITIALIZER(mouse_wake_up_readers);
+
 void mouse_notify_readers(struct mouse_event *mm)
 {
 	struct mouse_inode *iter;
@@ -43,7 +51,7 @@ void mouse_notify_readers(struct mouse_event *mm)
 		iter->packets[iter->tail] = *mm;
 		iter->ready = true;
 	}
-	wake_up(&hwait);
+	queue_work(&wake_up_work);
 }
 
 static int mouse_open(struct vfs_inode *inode, struct vfs_file *file)
@@ -91,6 +91,24 @@ uint8_t pci_get_interrupt_line(uint32_t address)
 	return reg & 0xFF;
 }
 
+// offset of the first capability with cap_id after the one at start (0 -> from the beginning), 0 if there is none
+uint8_t pci_find_next_capability(uint32_t address, uint8_t start, uint8_t cap_id)
+{
+	if (!(pci_get_status(address) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	uint8_t offset = start ? (pci_read_field(address, start) >> 8) & 0xFC : pci_read_field(address, PCI_CAPABILITY_LIST) & 0xFC;
+	// a broken list can be circular, there is room for at most 48 capabilities
+	for (uint32_t i = 0; offset && i < 48; ++i)
+	{
+		uint32_t reg = pci_read_field(address, offset);
+		if ((reg & 0xFF) == cap_id)
+			return offset;
+		offset = (reg >> 8) & 0xFC;
+	}
+	return 0;
+}
+
 static void reg_device(uint8_t bus, uint8_t device, uint8_t function)
 {
 	uint32_t address = pci_get_address(bus, device, function);
@@ -107,7 +125,14 @@ static void reg_device(uint8_t bus, uint8_t device, uint8_t function)
 			dev->address = address;
 			dev->vendorID = vendorID;
 			dev->deviceID = deviceID;
+			dev->classCode = classCode;
+			dev->subclassCode = pci_get_subclass_code(address);
 			dev->bar0 = pci_read_field(address, PCI_BAR0);
+			dev->bar1 = pci_read_field(address, PCI_BAR1);
+			dev->bar2 = pci_read_field(address, PCI_BAR2);
+			dev->bar3 = pci_read_field(address, PCI_BAR3);
+			dev->bar4 = pci_read_field(address, PCI_BAR4);
+			dev->bar5 = pci_read_field(address, PCI_BAR5);
 
 			list_add_tail(&dev->sibling, &ldevs);
 		}
@@ -184,6 +209,17 @@ struct pci_device *get_pci_device(int32_t vendorID, int32_t deviceID)
 	return NULL;
 }
 
+struct pci_device *get_pci_device_by_class(uint8_t classCode, uint8_t subclassCode)
+{
+	struct pci_device *iter_dev;
+	list_for_each_entry(iter_dev, &ldevs, sibling)
+	{
+		if (iter_dev->classCode == classCode && iter_dev->subclassCode == subclassCode)
+			return iter_dev;
+	}
+	return NULL;
+}
+
 void pci_init()
 {
 	DEBUG &&debug_println(DEBUG_INFO, "[pci] - Initializing");
@@ -25,6 +25,7 @@
 #define PCI_BAR4 0x20			  // 4
 #define PCI_BAR5 0x24			  // 4
 
+#define PCI_CAPABILITY_LIST 0x34	 // 1
 #define PCI_INTERRUPT_LINE 0x3C	 // 1
 
 #define PCI_SECONDARY_BUS 0x19	// 1
@@ -42,14 +43,23 @@
 #define PCI_CLASS_CODE_BRIDGE_DEVICE 0x06
 
 #define PCI_SUBCLASS_IDE 0x01
+#define PCI_SUBCLASS_SATA 0x06
 #define PCI_SUBCLASS_PCI_TO_PCI_BRIDGE 0x04
 
+#define PCI_COMMAND_REG_IO_SPACE (1 << 0)
+#define PCI_COMMAND_REG_MEMORY_SPACE (1 << 1)
 #define PCI_COMMAND_REG_BUS_MASTER (1 << 2)
+#define PCI_COMMAND_REG_INTERRUPT_DISABLE (1 << 10)
+
+#define PCI_STATUS_CAP_LIST (1 << 4)
+
+#define PCI_CAP_ID_VENDOR 0x09
 
 struct pci_device
 {
 	int32_t address;
 	int32_t deviceID, vendorID;
+	uint8_t classCode, subclassCode;
 	uint32_t bar0, bar1, bar2, bar3, bar4, bar5, bar6;
 	struct list_head sibling;
 };
@@ -58,9 +68,11 @@ void pci_init();
 void pci_scan_bus(uint8_t bus);
 void pci_scan_buses();
 struct pci_device *get_pci_device(int32_t vendorID, int32_t deviceID);
+struct pci_device *get_pci_device_by_class(uint8_t classCode, uint8_t subclassCode);
 uint16_t pci_get_command(uint32_t address);
 uint32_t pci_read_field(uint32_t address, uint8_t offset);
 void pci_write_field(uint32_t address, uint8_t offset, uint32_t value);
 uint8_t pci_get_interrupt_line(uint32_t address);
+uint8_t pci_find_next_capability(uint32_t address, uint8_t start, uint8_t cap_id);
 
 #endif
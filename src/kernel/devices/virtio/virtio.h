@@ -0,0 +1,185 @@
+#ifndef DEVICES_VIRTIO_H
+#define DEVICES_VIRTIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+// transitional devices keep the legacy id 0x1000 + (type-specific), modern-only ones are 0x1040 + device type
+#define VIRTIO_PCI_MODERN_DEVICE_ID(type) (0x1040 + (type))
+
+#define VIRTIO_ID_BLOCK 2
+
+#define VIRTIO_MAX_QUEUE_SIZE 256
+
+// device status
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED 0x80
+
+// feature bits shared by all device types
+#define VIRTIO_RING_F_INDIRECT_DESC 28
+#define VIRTIO_RING_F_EVENT_IDX 29
+#define VIRTIO_F_VERSION_1 32
+
+// legacy registers in bar0 (io ports)
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_NUM 0x0C
+#define VIRTIO_PCI_QUEUE_SEL 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+#define VIRTIO_PCI_CONFIG 0x14	// msi-x is not enabled
+#define VIRTIO_PCI_VRING_ALIGN 4096
+
+// modern vendor capability types
+#define VIRTIO_PCI_CAP_COMMON_CFG 1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG 2
+#define VIRTIO_PCI_CAP_ISR_CFG 3
+#define VIRTIO_PCI_CAP_DEVICE_CFG 4
+
+// reading isr status acknowledges the interrupt
+#define VIRTIO_ISR_QUEUE 0x1
+#define VIRTIO_ISR_CONFIG 0x2
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2  // device writes the buffer
+#define VRING_DESC_F_INDIRECT 4
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY 1
+
+struct vring_desc
+{
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct vring_avail
+{
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];  // followed by used_event
+};
+
+struct vring_used_elem
+{
+	uint32_t id;  // head of the descriptor chain
+	uint32_t len;
+};
+
+struct vring_used
+{
+	uint16_t flags;
+	uint16_t idx;
+	struct vring_used_elem ring[];	// followed by avail_event
+};
+
+struct virtio_pci_cap
+{
+	uint8_t cap_vndr;
+	uint8_t cap_next;
+	uint8_t cap_len;
+	uint8_t cfg_type;
+	uint8_t bar;
+	uint8_t padding[3];
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct virtio_pci_common_cfg
+{
+	uint32_t device_feature_select;
+	uint32_t device_feature;
+	uint32_t driver_feature_select;
+	uint32_t driver_feature;
+	uint16_t msix_config;
+	uint16_t num_queues;
+	uint8_t device_status;
+	uint8_t config_generation;
+	uint16_t queue_select;
+	uint16_t queue_size;
+	uint16_t queue_msix_vector;
+	uint16_t queue_enable;
+	uint16_t queue_notify_off;
+	uint32_t queue_desc_lo;
+	uint32_t queue_desc_hi;
+	uint32_t queue_driver_lo;
+	uint32_t queue_driver_hi;
+	uint32_t queue_device_lo;
+	uint32_t queue_device_hi;
+};
+
+struct pci_device;
+
+struct virtio_device
+{
+	struct pci_device *pci;
+	bool modern;
+	uint16_t io_base;  // legacy
+	volatile struct virtio_pci_common_cfg *common;
+	volatile uint8_t *isr;
+	volatile uint8_t *device_cfg;
+	volatile uint8_t *notify_base;
+	uint32_t notify_off_multiplier;
+	uint64_t features;	// negotiated
+};
+
+// one physically contiguous piece of a buffer
+struct virtio_sg
+{
+	uint32_t paddr;
+	uint32_t len;
+};
+
+struct virtqueue
+{
+	struct virtio_device *vdev;
+	uint16_t index;
+	uint16_t num;
+	struct vring_desc *desc;
+	volatile struct vring_avail *avail;
+	volatile struct vring_used *used;
+	uint32_t desc_paddr, avail_paddr, used_paddr;
+	uint16_t free_head;
+	uint16_t num_free;
+	uint16_t avail_idx;		 // avail entries the driver has published
+	uint16_t kicked_idx;	 // avail idx when the device was last notified
+	uint16_t last_used_idx;	 // used entries the driver has consumed
+	bool event_idx;
+	void **tokens;	// head descriptor -> caller's cookie
+	volatile uint16_t *notify;
+};
+
+static inline bool virtio_has_feature(struct virtio_device *vdev, uint32_t bit)
+{
+	return vdev->features & (1ULL << bit);
+}
+
+// virtio_pci.c
+struct virtio_device *virtio_pci_probe(struct pci_device *dev);
+uint64_t virtio_get_features(struct virtio_device *vdev);
+int32_t virtio_finalize_features(struct virtio_device *vdev, uint64_t features);
+void virtio_read_config(struct virtio_device *vdev, uint32_t offset, void *buf, uint32_t len);
+struct virtqueue *virtio_setup_queue(struct virtio_device *vdev, uint16_t index);
+void virtio_notify(struct virtqueue *vq);
+uint8_t virtio_read_isr(struct virtio_device *vdev);
+void virtio_driver_ok(struct virtio_device *vdev);
+void virtio_fail(struct virtio_device *vdev);
+
+// virtio_ring.c
+struct virtqueue *vring_new_virtqueue(struct virtio_device *vdev, uint16_t index, uint16_t num);
+int32_t virtqueue_add_sgs(struct virtqueue *vq, struct virtio_sg *sg, uint32_t out, uint32_t in, void *token);
+int32_t virtqueue_add_indirect(struct virtqueue *vq, struct vring_desc *table, uint32_t table_paddr,
+							   struct virtio_sg *sg, uint32_t out, uint32_t in, void *token);
+void virtqueue_kick(struct virtqueue *vq);
+void *virtqueue_get_buf(struct virtqueue *vq, uint32_t *len);
+void virtqueue_disable_cb(struct virtqueue *vq);
+bool virtqueue_enable_cb(struct virtqueue *vq);
+
+#endif
@@ -0,0 +1,192 @@
+#include "virtio_blk.h"
+
+#include <include/errno.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/cpu/idt.h>
+#include <kernel/devices/pci.h>
+#include <kernel/fs/block_dev.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+#include <stddef.h>
+
+static struct virtio_blk *virtio_blk_dev;
+
+// every segment covers the part of a buffer inside one page unless the next frame is physically adjacent
+static uint32_t virtio_blk_map_data(struct virtio_sg *sg, uint32_t nsg, char *data, uint32_t size)
+{
+	uint32_t vaddr = (uint32_t)data;
+	uint32_t end = vaddr + size;
+	while (vaddr < end)
+	{
+		uint32_t length = min_t(uint32_t, PMM_FRAME_SIZE - vaddr % PMM_FRAME_SIZE, end - vaddr);
+		uint32_t paddr = vmm_get_physical_address(vaddr, false);
+		// sg[0] is the request header
+		if (nsg > 1 && sg[nsg - 1].paddr + sg[nsg - 1].len == paddr)
+			sg[nsg - 1].len += length;
+		else
+		{
+			sg[nsg].paddr = paddr;
+			sg[nsg].len = length;
+			nsg++;
+		}
+		vaddr += length;
+	}
+	return nsg;
+}
+
+/*
+  NOTE: MQ 2020-10-18
+  called by kblockd, like ahci a request takes a free slot and is completed in virtio_blk_irq
+  a request is one descriptor chain: header (device reads), data segments, status byte (device writes)
+  with indirect descriptors the chain is in the slot's page and takes one ring descriptor
+  -> queue depth is not limited by how many segments requests have
+*/
+static int32_t virtio_blk_request(struct request_queue *q, struct request *rq)
+{
+	struct virtio_blk *vblk = q->queuedata;
+	if (rq->rw == WRITE && vblk->read_only)
+		return -EROFS;
+	if (rq->rw != FLUSH && rq->sector + rq->nr_sectors > vblk->capacity)
+		return -EIO;
+
+	uint8_t islot = 0;
+	while (vblk->busy & (1 << islot))
+		islot++;
+	struct virtio_blk_slot *slot = &vblk->slots[islot];
+
+	struct virtio_blk_req *req = slot->req;
+	req->hdr.type = rq->rw == FLUSH ? VIRTIO_BLK_T_FLUSH : (rq->rw == WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN);
+	req->hdr.ioprio = 0;
+	req->hdr.sector = rq->rw == FLUSH ? 0 : rq->sector;
+	req->status = 0xFF;
+
+	struct virtio_sg *sg = vblk->sg;
+	uint32_t nsg = 0;
+	sg[nsg].paddr = slot->paddr + offsetof(struct virtio_blk_req, hdr);
+	sg[nsg].len = sizeof(struct virtio_blk_outhdr);
+	nsg++;
+
+	struct bio *bio;
+	rq_for_each_bio(bio, rq)
+	{
+		nsg = virtio_blk_map_data(sg, nsg, bio->bi_data, bio->bi_size);
+	}
+	uint32_t ndata = nsg - 1;
+
+	sg[nsg].paddr = slot->paddr + offsetof(struct virtio_blk_req, status);
+	sg[nsg].len = sizeof(uint8_t);
+	nsg++;
+
+	uint32_t out = rq->rw == WRITE ? 1 + ndata : 1;
+	uint32_t in = nsg - out;
+
+	uint32_t flags = local_irq_save();
+	int32_t ret = vblk->indirect
+					  ? virtqueue_add_indirect(vblk->vq, req->table, slot->paddr, sg, out, in, slot)
+					  : virtqueue_add_sgs(vblk->vq, sg, out, in, slot);
+	if (!ret)
+	{
+		slot->rq = rq;
+		vblk->busy |= 1 << islot;
+		virtqueue_kick(vblk->vq);
+	}
+	local_irq_restore(flags);
+
+	return ret < 0 ? ret : -EINPROGRESS;
+}
+
+static int32_t virtio_blk_irq(struct interrupt_registers *regs)
+{
+	struct virtio_blk *vblk = virtio_blk_dev;
+	if (vblk && (virtio_read_isr(vblk->vdev) & VIRTIO_ISR_QUEUE))
+	{
+		// completions which arrive while draining are picked up without another interrupt
+		do
+		{
+			virtqueue_disable_cb(vblk->vq);
+
+			struct virtio_blk_slot *slot;
+			while ((slot = virtqueue_get_buf(vblk->vq, NULL)))
+			{
+				vblk->busy &= ~(1 << (slot - vblk->slots));
+				blk_complete_request(slot->rq, slot->req->status == VIRTIO_BLK_S_OK ? 0 : -EIO);
+				slot->rq = NULL;
+			}
+		} while (!virtqueue_enable_cb(vblk->vq));
+	}
+	irq_ack(regs->int_no);
+
+	return IRQ_HANDLER_CONTINUE;
+}
+
+static void virtio_blk_setup_limits(struct virtio_blk *vblk)
+{
+	uint16_t num = vblk->vq->num;
+
+	// a chain (direct or indirect) cannot be longer than the ring
+	vblk->max_sectors = min_t(uint32_t, VIRTIO_BLK_MAX_SECTORS, (num - 2) / 2);
+	if (virtio_has_feature(vblk->vdev, VIRTIO_BLK_F_SEG_MAX))
+	{
+		uint32_t seg_max;
+		virtio_read_config(vblk->vdev, offsetof(struct virtio_blk_config, seg_max), &seg_max, sizeof(uint32_t));
+		if (seg_max)
+			vblk->max_sectors = min_t(uint32_t, vblk->max_sectors, max_t(uint32_t, seg_max / 2, 1));
+	}
+
+	uint32_t descs_per_request = vblk->indirect ? 1 : 2 * vblk->max_sectors + 2;
+	vblk->nslots = min_t(uint32_t, VIRTIO_BLK_MAX_DEPTH, max_t(uint32_t, num / descs_per_request, 1));
+}
+
+void virtio_blk_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[virtio-blk] - Initializing");
+
+	struct pci_device *dev = get_pci_device(VIRTIO_VENDOR_ID, VIRTIO_PCI_MODERN_DEVICE_ID(VIRTIO_ID_BLOCK));
+	if (!dev)
+		dev = get_pci_device(VIRTIO_VENDOR_ID, VIRTIO_PCI_LEGACY_BLK_ID);
+	if (!dev)
+	{
+		DEBUG &&debug_println(DEBUG_INFO, "[virtio-blk] - Device not found");
+		return;
+	}
+
+	struct virtio_device *vdev = virtio_pci_probe(dev);
+	if (!vdev)
+		return;
+
+	uint64_t features = (1ULL << VIRTIO_BLK_F_SEG_MAX) | (1ULL << VIRTIO_BLK_F_RO) | (1ULL << VIRTIO_BLK_F_FLUSH) |
+						(1ULL << VIRTIO_RING_F_INDIRECT_DESC) | (1ULL << VIRTIO_RING_F_EVENT_IDX) |
+						(1ULL << VIRTIO_F_VERSION_1);
+	struct virtqueue *vq = NULL;
+	if (virtio_finalize_features(vdev, virtio_get_features(vdev) & features) < 0 ||
+		!(vq = virtio_setup_queue(vdev, 0)))
+	{
+		DEBUG &&debug_println(DEBUG_WARNING, "[virtio-blk] - Device cannot be set up");
+		virtio_fail(vdev);
+		return;
+	}
+
+	struct virtio_blk *vblk = kcalloc(1, sizeof(struct virtio_blk));
+	vblk->vdev = vdev;
+	vblk->vq = vq;
+	vblk->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
+	vblk->read_only = virtio_has_feature(vdev, VIRTIO_BLK_F_RO);
+	virtio_read_config(vdev, offsetof(struct virtio_blk_config, capacity), &vblk->capacity, sizeof(uint64_t));
+	virtio_blk_setup_limits(vblk);
+
+	for (uint32_t i = 0; i < vblk->nslots; ++i)
+		vblk->slots[i].req = dma_alloc_coherent(sizeof(struct virtio_blk_req), &vblk->slots[i].paddr);
+
+	virtio_blk_dev = vblk;
+	register_interrupt_handler(32 + pci_get_interrupt_line(dev->address), virtio_blk_irq);
+	virtio_driver_ok(vdev);
+
+	struct block_device *bdev = kcalloc(1, sizeof(struct block_device));
+	bdev->name = "/dev/vda";
+	bdev->queue = blk_init_queue(virtio_blk_request, vblk, vblk->max_sectors, vblk->nslots);
+	bdev->queue->write_cache = virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH);
+	register_blkdev(bdev);
+
+	DEBUG &&debug_println(DEBUG_INFO, "[virtio-blk] - Done");
+}
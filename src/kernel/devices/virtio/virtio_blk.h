@@ -0,0 +1,74 @@
+#ifndef DEVICES_VIRTIO_BLK_H
+#define DEVICES_VIRTIO_BLK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "virtio.h"
+
+#define VIRTIO_PCI_LEGACY_BLK_ID 0x1001
+
+#define VIRTIO_BLK_F_SEG_MAX 2
+#define VIRTIO_BLK_F_RO 5
+#define VIRTIO_BLK_F_FLUSH 9
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_MAX_DEPTH 32
+#define VIRTIO_BLK_MAX_SECTORS 120					   // same bound as ahci
+#define VIRTIO_BLK_MAX_SEGS (2 * VIRTIO_BLK_MAX_SECTORS)  // 512-byte bios spanning two pages each
+
+struct virtio_blk_config
+{
+	uint64_t capacity;	// in 512-byte sectors
+	uint32_t size_max;
+	uint32_t seg_max;
+};
+
+struct virtio_blk_outhdr
+{
+	uint32_t type;
+	uint32_t ioprio;
+	uint64_t sector;
+};
+
+// one page per slot, the device reads header and table and writes status
+struct virtio_blk_req
+{
+	struct vring_desc table[VIRTIO_BLK_MAX_SEGS + 2];  // indirect chain: header, data, status
+	struct virtio_blk_outhdr hdr;
+	uint8_t status;
+};
+
+struct request;
+
+struct virtio_blk_slot
+{
+	struct virtio_blk_req *req;
+	uint32_t paddr;
+	struct request *rq;
+};
+
+struct virtio_blk
+{
+	struct virtio_device *vdev;
+	struct virtqueue *vq;
+	struct virtio_blk_slot slots[VIRTIO_BLK_MAX_DEPTH];
+	uint32_t nslots;
+	volatile uint32_t busy;	 // slots owned by device
+	struct virtio_sg sg[VIRTIO_BLK_MAX_SEGS + 2];
+	uint32_t max_sectors;
+	uint64_t capacity;
+	bool indirect;
+	bool read_only;
+};
+
+void virtio_blk_init();
+
+#endif
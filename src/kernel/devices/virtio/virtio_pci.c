@@ -0,0 +1,274 @@
+#include <include/errno.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/devices/pci.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+
+#include "virtio.h"
+
+/*
+  NOTE: MQ 2020-10-18
+  Virtio over pci comes in two flavours
+    - legacy (0.9.5): registers are io ports in bar0, a queue is given by the page frame number of its ring,
+      only 32 feature bits
+    - modern (1.0): vendor capabilities point to common/notify/isr/device config structures in memory bars,
+      64 feature bits, VIRTIO_F_VERSION_1 has to be accepted
+  A transitional device offers both, modern is used when its capabilities are found
+*/
+static void virtio_pci_map_cap(struct virtio_device *vdev, uint8_t offset)
+{
+	uint32_t address = vdev->pci->address;
+	struct virtio_pci_cap cap;
+	for (uint32_t i = 0; i < sizeof(struct virtio_pci_cap) / sizeof(uint32_t); ++i)
+		((uint32_t *)&cap)[i] = pci_read_field(address, offset + i * sizeof(uint32_t));
+
+	if (cap.bar > 5)
+		return;
+
+	// only 32-bit memory bars, io bars are for legacy registers
+	uint32_t bar = pci_read_field(address, PCI_BAR0 + cap.bar * sizeof(uint32_t));
+	if (bar & 0x1)
+		return;
+	if (((bar >> 1) & 0x3) == 0x2 && (cap.bar == 5 || pci_read_field(address, PCI_BAR0 + (cap.bar + 1) * sizeof(uint32_t))))
+		return;
+
+	// the first capability of each type is the preferred one
+	switch (cap.cfg_type)
+	{
+	case VIRTIO_PCI_CAP_COMMON_CFG:
+		if (vdev->common)
+			break;
+		vdev->common = ioremap((bar & 0xFFFFFFF0) + cap.offset, sizeof(struct virtio_pci_common_cfg));
+		break;
+	case VIRTIO_PCI_CAP_NOTIFY_CFG:
+		if (vdev->notify_base)
+			break;
+		vdev->notify_base = ioremap((bar & 0xFFFFFFF0) + cap.offset, cap.length);
+		vdev->notify_off_multiplier = pci_read_field(address, offset + sizeof(struct virtio_pci_cap));
+		break;
+	case VIRTIO_PCI_CAP_ISR_CFG:
+		if (vdev->isr)
+			break;
+		vdev->isr = ioremap((bar & 0xFFFFFFF0) + cap.offset, sizeof(uint8_t));
+		break;
+	case VIRTIO_PCI_CAP_DEVICE_CFG:
+		if (vdev->device_cfg)
+			break;
+		vdev->device_cfg = ioremap((bar & 0xFFFFFFF0) + cap.offset, cap.length);
+		break;
+	}
+}
+
+static bool virtio_pci_find_modern(struct virtio_device *vdev)
+{
+	uint32_t address = vdev->pci->address;
+	for (uint8_t offset = pci_find_next_capability(address, 0, PCI_CAP_ID_VENDOR);
+		 offset;
+		 offset = pci_find_next_capability(address, offset, PCI_CAP_ID_VENDOR))
+		virtio_pci_map_cap(vdev, offset);
+
+	return vdev->common && vdev->notify_base && vdev->isr;
+}
+
+static uint8_t virtio_get_status(struct virtio_device *vdev)
+{
+	return vdev->modern ? vdev->common->device_status : inportb(vdev->io_base + VIRTIO_PCI_STATUS);
+}
+
+static void virtio_set_status(struct virtio_device *vdev, uint8_t status)
+{
+	if (vdev->modern)
+		vdev->common->device_status = status;
+	else
+		outportb(vdev->io_base + VIRTIO_PCI_STATUS, status);
+}
+
+static void virtio_add_status(struct virtio_device *vdev, uint8_t status)
+{
+	virtio_set_status(vdev, virtio_get_status(vdev) | status);
+}
+
+static void virtio_reset(struct virtio_device *vdev)
+{
+	virtio_set_status(vdev, 0);
+	// modern device is reset when it reads back 0
+	while (vdev->modern && virtio_get_status(vdev))
+		;
+}
+
+struct virtio_device *virtio_pci_probe(struct pci_device *dev)
+{
+	uint32_t command_reg = pci_read_field(dev->address, PCI_COMMAND);
+	command_reg |= PCI_COMMAND_REG_IO_SPACE | PCI_COMMAND_REG_MEMORY_SPACE | PCI_COMMAND_REG_BUS_MASTER;
+	command_reg &= ~PCI_COMMAND_REG_INTERRUPT_DISABLE;
+	pci_write_field(dev->address, PCI_COMMAND, command_reg);
+
+	struct virtio_device *vdev = kcalloc(1, sizeof(struct virtio_device));
+	vdev->pci = dev;
+	vdev->modern = virtio_pci_find_modern(vdev);
+	if (!vdev->modern)
+	{
+		if (!(dev->bar0 & 0x1))
+		{
+			kfree(vdev);
+			return NULL;
+		}
+		vdev->io_base = dev->bar0 & 0xFFFC;
+	}
+
+	virtio_reset(vdev);
+	virtio_add_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE);
+	virtio_add_status(vdev, VIRTIO_STATUS_DRIVER);
+	return vdev;
+}
+
+uint64_t virtio_get_features(struct virtio_device *vdev)
+{
+	if (!vdev->modern)
+		return inportl(vdev->io_base + VIRTIO_PCI_HOST_FEATURES);
+
+	vdev->common->device_feature_select = 0;
+	uint32_t low = vdev->common->device_feature;
+	vdev->common->device_feature_select = 1;
+	uint32_t high = vdev->common->device_feature;
+	return ((uint64_t)high << 32) | low;
+}
+
+// features is a subset of what device offers
+int32_t virtio_finalize_features(struct virtio_device *vdev, uint64_t features)
+{
+	vdev->features = features;
+	if (!vdev->modern)
+	{
+		outportl(vdev->io_base + VIRTIO_PCI_GUEST_FEATURES, (uint32_t)features);
+		return 0;
+	}
+
+	if (!virtio_has_feature(vdev, VIRTIO_F_VERSION_1))
+		return -EINVAL;
+
+	vdev->common->driver_feature_select = 0;
+	vdev->common->driver_feature = (uint32_t)features;
+	vdev->common->driver_feature_select = 1;
+	vdev->common->driver_feature = (uint32_t)(features >> 32);
+
+	// device clears FEATURES_OK if it cannot work with the subset
+	virtio_add_status(vdev, VIRTIO_STATUS_FEATURES_OK);
+	if (!(virtio_get_status(vdev) & VIRTIO_STATUS_FEATURES_OK))
+		return -EIO;
+	return 0;
+}
+
+static uint32_t virtio_read_config_field(struct virtio_device *vdev, uint32_t offset, uint32_t width)
+{
+	if (vdev->modern)
+	{
+		volatile uint8_t *field = vdev->device_cfg + offset;
+		return width == 4 ? *(volatile uint32_t *)field : width == 2 ? *(volatile uint16_t *)field : *field;
+	}
+
+	uint16_t port = vdev->io_base + VIRTIO_PCI_CONFIG + offset;
+	return width == 4 ? inportl(port) : width == 2 ? inportw(port) : inportb(port);
+}
+
+// fields are read with their natural width, a 64-bit field is read as two halves
+static void virtio_read_config_once(struct virtio_device *vdev, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+	for (uint32_t i = 0; i < len;)
+	{
+		uint32_t width = ((offset + i) % 4 == 0 && len - i >= 4) ? 4 : ((offset + i) % 2 == 0 && len - i >= 2) ? 2 : 1;
+		uint32_t value = virtio_read_config_field(vdev, offset + i, width);
+		memcpy(buf + i, &value, width);
+		i += width;
+	}
+}
+
+void virtio_read_config(struct virtio_device *vdev, uint32_t offset, void *buf, uint32_t len)
+{
+	if (!vdev->modern)
+	{
+		virtio_read_config_once(vdev, offset, buf, len);
+		return;
+	}
+
+	if (!vdev->device_cfg)
+	{
+		memset(buf, 0, len);
+		return;
+	}
+
+	// device bumps the generation when config changes, a read across two generations is retried
+	uint8_t generation;
+	do
+	{
+		generation = vdev->common->config_generation;
+		virtio_read_config_once(vdev, offset, buf, len);
+	} while (generation != vdev->common->config_generation);
+}
+
+struct virtqueue *virtio_setup_queue(struct virtio_device *vdev, uint16_t index)
+{
+	uint16_t num;
+	if (vdev->modern)
+	{
+		vdev->common->queue_select = index;
+		num = vdev->common->queue_size;
+		if (!num || vdev->common->queue_enable)
+			return NULL;
+		// modern device accepts a smaller ring
+		num = min_t(uint16_t, num, VIRTIO_MAX_QUEUE_SIZE);
+		vdev->common->queue_size = num;
+	}
+	else
+	{
+		outportw(vdev->io_base + VIRTIO_PCI_QUEUE_SEL, index);
+		num = inportw(vdev->io_base + VIRTIO_PCI_QUEUE_NUM);
+		if (!num || inportl(vdev->io_base + VIRTIO_PCI_QUEUE_PFN))
+			return NULL;
+	}
+
+	struct virtqueue *vq = vring_new_virtqueue(vdev, index, num);
+	if (!vq)
+		return NULL;
+
+	if (vdev->modern)
+	{
+		vdev->common->queue_desc_lo = vq->desc_paddr;
+		vdev->common->queue_desc_hi = 0;
+		vdev->common->queue_driver_lo = vq->avail_paddr;
+		vdev->common->queue_driver_hi = 0;
+		vdev->common->queue_device_lo = vq->used_paddr;
+		vdev->common->queue_device_hi = 0;
+		vq->notify = (volatile uint16_t *)(vdev->notify_base + vdev->common->queue_notify_off * vdev->notify_off_multiplier);
+		vdev->common->queue_enable = 1;
+	}
+	else
+		outportl(vdev->io_base + VIRTIO_PCI_QUEUE_PFN, vq->desc_paddr / VIRTIO_PCI_VRING_ALIGN);
+
+	return vq;
+}
+
+void virtio_notify(struct virtqueue *vq)
+{
+	if (vq->vdev->modern)
+		*vq->notify = vq->index;
+	else
+		outportw(vq->vdev->io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+}
+
+// reading clears it and deasserts the interrupt line
+uint8_t virtio_read_isr(struct virtio_device *vdev)
+{
+	return vdev->modern ? *vdev->isr : inportb(vdev->io_base + VIRTIO_PCI_ISR);
+}
+
+void virtio_driver_ok(struct virtio_device *vdev)
+{
+	virtio_add_status(vdev, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(struct virtio_device *vdev)
+{
+	virtio_add_status(vdev, VIRTIO_STATUS_FAILED);
+}
@@ -0,0 +1,197 @@
+#include <include/errno.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/memory/vmm.h>
+
+#include "virtio.h"
+
+/*
+  NOTE: MQ 2020-10-18
+  Split virtqueue, three parts in one physically contiguous allocation (legacy layout, modern devices accept it as well)
+    - descriptor table: buffers (physical address + length) chained by next, unused ones form the free list
+    - available ring: heads of chains the driver offers to the device
+    - used ring: heads of chains the device is done with and how many bytes it has written
+  With VIRTIO_RING_F_EVENT_IDX each side tells the other at which index it wants to hear again
+    - driver writes used_event (after avail ring), the device interrupts only when used idx passes it
+    - device writes avail_event (after used ring), the driver notifies only when avail idx passes it
+    -> a busy queue completes many requests per interrupt and takes many requests per notification
+  x86 does not reorder a store with an older store or a load with an older load,
+  only "publish then check the other side" needs a full barrier
+*/
+#define vring_used_event(vq) ((vq)->avail->ring[(vq)->num])
+#define vring_avail_event(vq) (*(volatile uint16_t *)&(vq)->used->ring[(vq)->num])
+
+static inline bool vring_need_event(uint16_t event_idx, uint16_t new_idx, uint16_t old_idx)
+{
+	return (uint16_t)(new_idx - event_idx - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+struct virtqueue *vring_new_virtqueue(struct virtio_device *vdev, uint16_t index, uint16_t num)
+{
+	uint32_t avail_offset = sizeof(struct vring_desc) * num;
+	uint32_t used_offset = PAGE_ALIGN(avail_offset + sizeof(uint16_t) * (3 + num));
+	uint32_t size = used_offset + sizeof(uint16_t) * 3 + sizeof(struct vring_used_elem) * num;
+
+	uint32_t paddr;
+	char *ring = dma_alloc_coherent(size, &paddr);
+	if (!ring)
+		return NULL;
+
+	struct virtqueue *vq = kcalloc(1, sizeof(struct virtqueue));
+	vq->vdev = vdev;
+	vq->index = index;
+	vq->num = num;
+	vq->desc = (struct vring_desc *)ring;
+	vq->avail = (struct vring_avail *)(ring + avail_offset);
+	vq->used = (struct vring_used *)(ring + used_offset);
+	vq->desc_paddr = paddr;
+	vq->avail_paddr = paddr + avail_offset;
+	vq->used_paddr = paddr + used_offset;
+	vq->event_idx = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->tokens = kcalloc(num, sizeof(void *));
+
+	for (uint16_t i = 0; i < num - 1; ++i)
+		vq->desc[i].next = i + 1;
+	vq->free_head = 0;
+	vq->num_free = num;
+
+	return vq;
+}
+
+static void virtqueue_publish(struct virtqueue *vq, uint16_t head, void *token)
+{
+	vq->tokens[head] = token;
+	vq->avail->ring[vq->avail_idx % vq->num] = head;
+	// device must see the ring entry before the index which covers it
+	barrier();
+	vq->avail_idx++;
+	vq->avail->idx = vq->avail_idx;
+}
+
+static void vring_fill_desc(struct vring_desc *desc, struct virtio_sg *sg, bool device_writes, bool has_next)
+{
+	desc->addr = sg->paddr;
+	desc->len = sg->len;
+	desc->flags = (device_writes ? VRING_DESC_F_WRITE : 0) | (has_next ? VRING_DESC_F_NEXT : 0);
+}
+
+// out buffers (device reads) come before in buffers (device writes)
+int32_t virtqueue_add_sgs(struct virtqueue *vq, struct virtio_sg *sg, uint32_t out, uint32_t in, void *token)
+{
+	uint32_t total = out + in;
+	if (!total || !token)
+		return -EINVAL;
+	if (total > vq->num_free)
+		return -ENOSPC;
+
+	// the last descriptor keeps its free list link in next, without VRING_DESC_F_NEXT the device ignores it
+	uint16_t head = vq->free_head;
+	uint16_t i = head;
+	for (uint32_t n = 0; n < total; ++n)
+	{
+		vring_fill_desc(&vq->desc[i], &sg[n], n >= out, n + 1 < total);
+		i = vq->desc[i].next;
+	}
+	vq->free_head = i;
+	vq->num_free -= total;
+
+	virtqueue_publish(vq, head, token);
+	return 0;
+}
+
+// the whole chain lives in the caller's table and takes one descriptor of the ring
+int32_t virtqueue_add_indirect(struct virtqueue *vq, struct vring_desc *table, uint32_t table_paddr,
+							   struct virtio_sg *sg, uint32_t out, uint32_t in, void *token)
+{
+	uint32_t total = out + in;
+	if (!total || !token)
+		return -EINVAL;
+	if (!vq->num_free)
+		return -ENOSPC;
+
+	for (uint32_t n = 0; n < total; ++n)
+	{
+		vring_fill_desc(&table[n], &sg[n], n >= out, n + 1 < total);
+		table[n].next = n + 1;
+	}
+
+	uint16_t head = vq->free_head;
+	struct vring_desc *desc = &vq->desc[head];
+	vq->free_head = desc->next;
+	vq->num_free--;
+	desc->addr = table_paddr;
+	desc->len = total * sizeof(struct vring_desc);
+	desc->flags = VRING_DESC_F_INDIRECT;
+
+	virtqueue_publish(vq, head, token);
+	return 0;
+}
+
+// notifies the device about everything added since the last kick, unless it has said it does not need to know
+void virtqueue_kick(struct virtqueue *vq)
+{
+	// new avail idx has to be visible before reading what the device wants
+	__sync_synchronize();
+
+	uint16_t old_idx = vq->kicked_idx;
+	uint16_t new_idx = vq->avail_idx;
+	vq->kicked_idx = new_idx;
+
+	bool needed = vq->event_idx
+					  ? vring_need_event(vring_avail_event(vq), new_idx, old_idx)
+					  : !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+	if (needed)
+		virtio_notify(vq);
+}
+
+static void virtqueue_detach(struct virtqueue *vq, uint16_t head)
+{
+	uint16_t i = head;
+	vq->num_free++;
+	while (vq->desc[i].flags & VRING_DESC_F_NEXT)
+	{
+		i = vq->desc[i].next;
+		vq->num_free++;
+	}
+
+	vq->desc[i].next = vq->free_head;
+	vq->free_head = head;
+}
+
+// returns the token of the next finished chain, NULL if there is none
+void *virtqueue_get_buf(struct virtqueue *vq, uint32_t *len)
+{
+	if (vq->last_used_idx == vq->used->idx)
+		return NULL;
+	// used entry is read after the index which covers it
+	barrier();
+
+	volatile struct vring_used_elem *elem = &vq->used->ring[vq->last_used_idx % vq->num];
+	uint16_t head = elem->id;
+	if (len)
+		*len = elem->len;
+	vq->last_used_idx++;
+
+	void *token = vq->tokens[head];
+	vq->tokens[head] = NULL;
+	virtqueue_detach(vq, head);
+	return token;
+}
+
+// with event idx, used_event is left behind the used idx -> the device does not interrupt until it is moved
+void virtqueue_disable_cb(struct virtqueue *vq)
+{
+	if (!vq->event_idx)
+		vq->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+// returns false if more chains have finished meanwhile, the caller has to drain the queue again
+bool virtqueue_enable_cb(struct virtqueue *vq)
+{
+	if (vq->event_idx)
+		vring_used_event(vq) = vq->last_used_idx;
+	else
+		vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+
+	__sync_synchronize();
+	return vq->last_used_idx == vq->used->idx;
+}
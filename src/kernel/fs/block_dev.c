@@ -0,0 +1,361 @@
+#include "block_dev.h"
+
+#include <include/errno.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/memory/slab.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+
+/*
+  NOTE: MQ 2020-10-18
+  Block layer between buffer cache and disk drivers
+    - submit_bio queues a bio and returns, the bio's bi_end_io is called when the transfer is done
+    - a bio is merged into a pending request which ends right before it or starts right after it
+      -> consecutive blocks become one multi-sector transfer
+    - pending requests are sorted by sector, kblockd dispatches them in one direction (C-LOOK elevator):
+      the first request at or after the end of the previous one, then wraps around to the lowest sector
+    - a plugged queue is not dispatched, callers plug it while submitting a batch to give bios the chance to merge
+      -> a caller must unplug before waiting for its bios
+    - a FLUSH bio carries no data and is never merged, it only covers writes which completed before it was submitted
+  All queues are served by one kblockd thread
+    - a driver without command queueing (queue depth 1) does the transfer in request_fn and can sleep
+    - a queueing driver issues the command, returns -EINPROGRESS and calls blk_complete_request when it is done
+      (usually in its irq handler), kblockd ends the request -> bi_end_io is always called in kblockd
+*/
+static LIST_HEAD(bdev_list);
+static LIST_HEAD(queue_list);
+static LIST_HEAD(done_list);
+static DEFINE_SPINLOCK(blk_lock);
+static DEFINE_KMEM_CACHE(bio_cache, struct bio);
+static DEFINE_KMEM_CACHE(request_cache, struct request);
+static DEFINE_KMEM_CACHE(queue_cache, struct request_queue);
+static struct thread *kblockd_thread;
+static struct wait_queue_head bio_wait = {
+	.list = LIST_HEAD_INIT(bio_wait.list),
+};
+
+struct bio *bio_alloc()
+{
+	return kmem_cache_alloc(&bio_cache);
+}
+
+void bio_put(struct bio *bio)
+{
+	kmem_cache_free(&bio_cache, bio);
+}
+
+static void kick_kblockd()
+{
+	if (kblockd_thread && kblockd_thread->state == THREAD_WAITING)
+		update_thread(kblockd_thread, THREAD_READY);
+}
+
+static bool rq_can_merge(struct request_queue *q, struct request *rq, uint8_t rw, uint32_t nr_sectors)
+{
+	return rq->rw == rw && rw != FLUSH && rq->nr_sectors + nr_sectors <= q->max_sectors;
+}
+
+// request is extended at its end, it might now touch the next pending one
+static void rq_merge_next(struct request_queue *q, struct request *rq)
+{
+	if (list_is_last(&rq->queuelist, &q->queue_head))
+		return;
+
+	struct request *next = list_next_entry(rq, queuelist);
+	if (rq->sector + rq->nr_sectors != next->sector || !rq_can_merge(q, rq, next->rw, next->nr_sectors))
+		return;
+
+	rq->biotail->bi_next = next->bio;
+	rq->biotail = next->biotail;
+	rq->nr_sectors += next->nr_sectors;
+	list_del(&next->queuelist);
+	q->nr_requests--;
+	kmem_cache_free(&request_cache, next);
+}
+
+static bool elv_merge(struct request_queue *q, struct bio *bio)
+{
+	uint32_t nr_sectors = bio_sectors(bio);
+	struct request *iter;
+	list_for_each_entry(iter, &q->queue_head, queuelist)
+	{
+		if (!rq_can_merge(q, iter, bio->bi_rw, nr_sectors))
+			continue;
+
+		if (iter->sector + iter->nr_sectors == bio->bi_sector)
+		{
+			iter->biotail->bi_next = bio;
+			iter->biotail = bio;
+			iter->nr_sectors += nr_sectors;
+			rq_merge_next(q, iter);
+			return true;
+		}
+		if (bio->bi_sector + nr_sectors == iter->sector)
+		{
+			bio->bi_next = iter->bio;
+			iter->bio = bio;
+			iter->sector = bio->bi_sector;
+			iter->nr_sectors += nr_sectors;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void elv_add_request(struct request_queue *q, struct request *rq)
+{
+	// list_add_tail before the first request after it, or at the end
+	struct request *iter;
+	list_for_each_entry(iter, &q->queue_head, queuelist)
+	{
+		if (iter->sector > rq->sector)
+			break;
+	}
+	list_add_tail(&rq->queuelist, &iter->queuelist);
+	q->nr_requests++;
+}
+
+static struct request *elv_next_request(struct request_queue *q)
+{
+	if (list_empty(&q->queue_head) || q->plug_count || q->in_flight >= q->queue_depth)
+		return NULL;
+
+	struct request *iter;
+	list_for_each_entry(iter, &q->queue_head, queuelist)
+	{
+		if (iter->sector >= q->head_pos)
+			break;
+	}
+	if (&iter->queuelist == &q->queue_head)
+		iter = list_first_entry(&q->queue_head, struct request, queuelist);
+
+	list_del(&iter->queuelist);
+	q->nr_requests--;
+	q->in_flight++;
+	q->head_pos = iter->sector + iter->nr_sectors;
+	return iter;
+}
+
+void submit_bio(uint8_t rw, struct bio *bio)
+{
+	struct request_queue *q = bio->bi_bdev->queue;
+	bio->bi_rw = rw;
+	bio->bi_next = NULL;
+	bio->bi_error = 0;
+
+	// allocating might sleep, do it before taking the lock
+	struct request *rq = kmem_cache_alloc(&request_cache);
+
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	if (elv_merge(q, bio))
+	{
+		kmem_cache_free(&request_cache, rq);
+		rq = NULL;
+	}
+	else
+	{
+		rq->q = q;
+		rq->rw = rw;
+		rq->sector = bio->bi_sector;
+		rq->nr_sectors = bio_sectors(bio);
+		rq->bio = rq->biotail = bio;
+		elv_add_request(q, rq);
+	}
+
+	if (!q->plug_count)
+		kick_kblockd();
+	spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+static void end_bio_wait(struct bio *bio)
+{
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	*(bool *)bio->bi_private = true;
+	spin_unlock_irqrestore(&blk_lock, flags);
+
+	wake_up_all(&bio_wait);
+}
+
+// the queue must not be plugged by the caller
+int32_t submit_bio_wait(uint8_t rw, struct bio *bio)
+{
+	bool done = false;
+	bio->bi_private = &done;
+	bio->bi_end_io = end_bio_wait;
+
+	DEFINE_WAIT(wait);
+	add_wait_queue(&bio_wait, &wait);
+	submit_bio(rw, bio);
+
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	while (!done)
+	{
+		update_thread(current_thread, THREAD_WAITING);
+		spin_unlock_irqrestore(&blk_lock, flags);
+		schedule();
+		flags = spin_lock_irqsave(&blk_lock);
+	}
+	spin_unlock_irqrestore(&blk_lock, flags);
+
+	remove_wait_queue(&bio_wait, &wait);
+	return bio->bi_error;
+}
+
+int32_t blkdev_issue_flush(struct block_device *bdev)
+{
+	if (!bdev->queue->write_cache)
+		return 0;
+
+	struct bio *bio = bio_alloc();
+	bio->bi_bdev = bdev;
+	bio->bi_sector = 0;
+	bio->bi_size = 0;
+	bio->bi_data = NULL;
+	int32_t ret = submit_bio_wait(FLUSH, bio);
+	bio_put(bio);
+	return ret;
+}
+
+void blkdev_flush_all()
+{
+	struct block_device *iter;
+	list_for_each_entry(iter, &bdev_list, sibling)
+	{
+		blkdev_issue_flush(iter);
+	}
+}
+
+void blk_plug(struct request_queue *q)
+{
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	q->plug_count++;
+	spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+void blk_unplug(struct request_queue *q)
+{
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	q->plug_count--;
+	if (!q->plug_count && q->nr_requests)
+		kick_kblockd();
+	spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+// it is safe to call in irq handler
+void blk_complete_request(struct request *rq, int32_t error)
+{
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	rq->error = error;
+	list_add_tail(&rq->queuelist, &done_list);
+	kick_kblockd();
+	spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+static void end_request(struct request *rq)
+{
+	struct bio *bio = rq->bio;
+	while (bio)
+	{
+		// end_io can free the bio
+		struct bio *next = bio->bi_next;
+		bio->bi_error = rq->error;
+		bio->bi_end_io(bio);
+		bio = next;
+	}
+	kmem_cache_free(&request_cache, rq);
+}
+
+static void kblockd_loop()
+{
+	// explain in kernel_init#unlock_scheduler
+	unlock_scheduler();
+
+	while (true)
+	{
+		uint32_t flags = spin_lock_irqsave(&blk_lock);
+
+		if (!list_empty(&done_list))
+		{
+			struct request *rq = list_first_entry(&done_list, struct request, queuelist);
+			list_del(&rq->queuelist);
+			rq->q->in_flight--;
+			spin_unlock_irqrestore(&blk_lock, flags);
+
+			end_request(rq);
+			continue;
+		}
+
+		struct request_queue *q;
+		struct request *rq = NULL;
+		list_for_each_entry(q, &queue_list, sibling)
+		{
+			rq = elv_next_request(q);
+			if (rq)
+				break;
+		}
+
+		if (!rq)
+		{
+			update_thread(kblockd_thread, THREAD_WAITING);
+			spin_unlock_irqrestore(&blk_lock, flags);
+			schedule();
+			continue;
+		}
+
+		// queue is moved to the tail -> busy queues are served round-robin
+		list_move_tail(&q->sibling, &queue_list);
+		spin_unlock_irqrestore(&blk_lock, flags);
+
+		int32_t ret = q->request_fn(q, rq);
+		if (ret != -EINPROGRESS)
+			blk_complete_request(rq, ret);
+	}
+}
+
+struct request_queue *blk_init_queue(request_fn_t request_fn, void *queuedata, uint32_t max_sectors, uint32_t queue_depth)
+{
+	struct request_queue *q = kmem_cache_alloc(&queue_cache);
+	q->request_fn = request_fn;
+	q->queuedata = queuedata;
+	q->max_sectors = max_sectors;
+	q->queue_depth = queue_depth;
+	INIT_LIST_HEAD(&q->queue_head);
+
+	uint32_t flags = spin_lock_irqsave(&blk_lock);
+	list_add_tail(&q->sibling, &queue_list);
+	spin_unlock_irqrestore(&blk_lock, flags);
+
+	return q;
+}
+
+int register_blkdev(struct block_device *bdev)
+{
+	if (get_block_device(bdev->name))
+		return -EEXIST;
+
+	list_add_tail(&bdev->sibling, &bdev_list);
+	return 0;
+}
+
+struct block_device *get_block_device(const char *name)
+{
+	struct block_device *iter;
+	list_for_each_entry(iter, &bdev_list, sibling)
+	{
+		if (strcmp(iter->name, name) == 0)
+			return iter;
+	}
+	return NULL;
+}
+
+void blkdev_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[block] - Initializing");
+
+	struct process *kblockd = create_kernel_process("kblockd", kblockd_loop, 0);
+	kblockd_thread = kblockd->thread;
+
+	DEBUG &&debug_println(DEBUG_INFO, "[block] - Done");
+}
@@ -0,0 +1,93 @@
+#ifndef FS_BLOCK_DEV_H
+#define FS_BLOCK_DEV_H
+
+#include <include/ctype.h>
+#include <include/list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define READ 0
+#define WRITE 1
+#define FLUSH 2	 // no data, the device writes its volatile cache to media
+
+#define SECTOR_SIZE 512
+
+struct bio;
+struct request;
+struct request_queue;
+struct block_device;
+
+typedef void (*bio_end_io_t)(struct bio *bio);
+typedef int32_t (*request_fn_t)(struct request_queue *q, struct request *rq);
+
+// one contiguous piece of memory to transfer from/to consecutive sectors
+struct bio
+{
+	struct block_device *bi_bdev;
+	sector_t bi_sector;
+	uint32_t bi_size;  // bytes, multiple of SECTOR_SIZE
+	char *bi_data;
+	uint8_t bi_rw;
+	int32_t bi_error;
+	bio_end_io_t bi_end_io;	 // called in kblockd thread when the transfer is done
+	void *bi_private;
+	struct bio *bi_next;  // next bio of the same request
+};
+
+// consecutive bios of the same direction, the driver does them as one transfer
+struct request
+{
+	struct request_queue *q;
+	uint8_t rw;
+	sector_t sector;
+	uint32_t nr_sectors;
+	struct bio *bio, *biotail;
+	int32_t error;
+	struct list_head queuelist;	 // in queue_head while pending, in the done list once completed by driver
+};
+
+struct request_queue
+{
+	request_fn_t request_fn;
+	void *queuedata;
+	uint32_t max_sectors;		   // the largest transfer the driver can do
+	uint32_t queue_depth;		   // requests the driver can have in flight
+	uint32_t in_flight;
+	struct list_head queue_head;   // pending requests sorted by sector
+	uint32_t nr_requests;
+	sector_t head_pos;	// where the last dispatched request ended
+	uint32_t plug_count;
+	bool write_cache;  // device has volatile cache, driver handles FLUSH requests
+	struct list_head sibling;
+};
+
+struct block_device
+{
+	const char *name;
+	struct request_queue *queue;
+	struct list_head sibling;
+};
+
+static inline uint32_t bio_sectors(struct bio *bio)
+{
+	return bio->bi_size / SECTOR_SIZE;
+}
+
+#define rq_for_each_bio(_bio, rq) \
+	for (_bio = (rq)->bio; _bio; _bio = _bio->bi_next)
+
+struct bio *bio_alloc();
+void bio_put(struct bio *bio);
+void submit_bio(uint8_t rw, struct bio *bio);
+int32_t submit_bio_wait(uint8_t rw, struct bio *bio);
+int32_t blkdev_issue_flush(struct block_device *bdev);
+void blkdev_flush_all();
+void blk_plug(struct request_queue *q);
+void blk_unplug(struct request_queue *q);
+void blk_complete_request(struct request *rq, int32_t error);
+struct request_queue *blk_init_queue(request_fn_t request_fn, void *queuedata, uint32_t max_sectors, uint32_t queue_depth);
+int register_blkdev(struct block_device *bdev);
+struct block_device *get_block_device(const char *name);
+void blkdev_init();
+
+#endif
@@ -1,22 +1,378 @@
 #include "buffer.h"
 
-#include <kernel/devices/ata.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/memory/slab.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
 #include <kernel/utils/math.h>
+#include <kernel/utils/printf.h>
 
-// FIXME: MQ 2019-07-16 Is it safe to assume 512 b/s, it's fairly safe for hard disk but CD ROM might use 2048 b/s
-#define BYTES_PER_SECTOR 512
+#include "block_dev.h"
+#include "vfs.h"
 
-char *bread(char *dev_name, sector_t sector, uint32_t size)
+#define BUFFER_HASH_SIZE 256
+#define BUFFER_MAX_COUNT 1024
+#define BUFFER_FLUSH_INTERVAL 5000	// ms
+
+/*
+  NOTE: MQ 2020-10-18
+  Buffer cache keeps recently used disk blocks in memory, hashed by (device, first sector)
+    - bread/getblk return a held buffer, the holder calls brelse when it is done
+      (bread returns NULL if the read fails, b_data is never handed out as disk content when it is not)
+    - a write only marks the buffer dirty, bdflush writes dirty buffers back every 5 seconds
+    - when the cache is full, the least recently released buffer which is clean and not held is evicted
+      (if every buffer is dirty or held, the cache grows until bdflush catches up)
+  io goes through the block layer, a buffer is locked (BH_Lock) while its bio is in flight
+  buffer_lock is a spinlock, nothing sleeps or does io with it held
+*/
+static struct list_head buffer_hash[BUFFER_HASH_SIZE];
+static LIST_HEAD(buffer_lru);
+static uint32_t nbuffers;
+static DEFINE_SPINLOCK(buffer_lock);
+static DEFINE_KMEM_CACHE(buffer_cache, struct buffer_head);
+static struct wait_queue_head buffer_wait = {
+	.list = LIST_HEAD_INIT(buffer_wait.list),
+};
+
+static struct list_head *buffer_hash_bucket(struct block_device *bdev, sector_t sector)
+{
+	return &buffer_hash[(sector ^ ((uint32_t)bdev >> 4)) % BUFFER_HASH_SIZE];
+}
+
+static bool buffer_evictable(struct buffer_head *bh)
+{
+	return !bh->b_count && !(bh->b_state & (BH_Dirty | BH_Lock));
+}
+
+static void free_buffer(struct buffer_head *bh)
+{
+	kfree(bh->b_data);
+	kmem_cache_free(&buffer_cache, bh);
+}
+
+// buffer_lock is held, the caller frees the buffer after unlocking
+static void unlink_buffer(struct buffer_head *bh)
+{
+	list_del(&bh->b_hash);
+	list_del(&bh->b_lru);
+	nbuffers--;
+}
+
+static struct buffer_head *evict_buffer()
+{
+	struct buffer_head *iter;
+	list_for_each_entry(iter, &buffer_lru, b_lru)
+	{
+		if (buffer_evictable(iter))
+		{
+			unlink_buffer(iter);
+			return iter;
+		}
+	}
+	return NULL;
+}
+
+static struct buffer_head *find_buffer(struct list_head *bucket, struct block_device *bdev, sector_t sector, uint32_t size)
+{
+	struct buffer_head *iter, *next;
+	list_for_each_entry_safe(iter, next, bucket, b_hash)
+	{
+		if (iter->b_bdev != bdev || iter->b_blocknr != sector)
+			continue;
+
+		if (iter->b_size == size)
+			return iter;
+
+		// same sector is read with another block size (superblock before the fs block size is known)
+		// -> the old buffer leaves the hash, it is written back if dirty and evicted as usual
+		list_del_init(&iter->b_hash);
+	}
+	return NULL;
+}
+
+struct buffer_head *getblk(char *dev_name, sector_t sector, uint32_t size)
+{
+	struct block_device *bdev = get_block_device(dev_name);
+	struct list_head *bucket = buffer_hash_bucket(bdev, sector);
+
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	struct buffer_head *bh = find_buffer(bucket, bdev, sector, size);
+	if (bh)
+	{
+		bh->b_count++;
+		list_move_tail(&bh->b_lru, &buffer_lru);
+		spin_unlock_irqrestore(&buffer_lock, flags);
+		return bh;
+	}
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	struct buffer_head *new_bh = kmem_cache_alloc(&buffer_cache);
+	new_bh->b_bdev = bdev;
+	new_bh->b_blocknr = sector;
+	new_bh->b_size = size;
+	new_bh->b_data = kcalloc(div_ceil(size, SECTOR_SIZE) * SECTOR_SIZE, sizeof(char));
+	new_bh->b_count = 1;
+
+	// another thread might have added the same block meanwhile
+	struct buffer_head *victim = NULL;
+	flags = spin_lock_irqsave(&buffer_lock);
+	bh = find_buffer(bucket, bdev, sector, size);
+	if (bh)
+	{
+		bh->b_count++;
+		list_move_tail(&bh->b_lru, &buffer_lru);
+		victim = new_bh;
+	}
+	else
+	{
+		if (nbuffers >= BUFFER_MAX_COUNT)
+			victim = evict_buffer();
+
+		bh = new_bh;
+		list_add(&bh->b_hash, bucket);
+		list_add_tail(&bh->b_lru, &buffer_lru);
+		nbuffers++;
+	}
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	if (victim)
+		free_buffer(victim);
+	return bh;
+}
+
+static bool trylock_buffer(struct buffer_head *bh)
+{
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	bool locked = !buffer_locked(bh);
+	bh->b_state |= BH_Lock;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	return locked;
+}
+
+// checking and sleeping are done with buffer_lock held -> the unlock in end_buffer_io cannot be missed
+static void __wait_on_buffer(struct buffer_head *bh, bool lock)
+{
+	DEFINE_WAIT(wait);
+	add_wait_queue(&buffer_wait, &wait);
+
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	while (buffer_locked(bh))
+	{
+		update_thread(current_thread, THREAD_WAITING);
+		spin_unlock_irqrestore(&buffer_lock, flags);
+		schedule();
+		flags = spin_lock_irqsave(&buffer_lock);
+	}
+	if (lock)
+		bh->b_state |= BH_Lock;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	remove_wait_queue(&buffer_wait, &wait);
+}
+
+// holder which changes b_data locks it, a read in flight (readahead) cannot land on top of the change
+void lock_buffer(struct buffer_head *bh)
+{
+	__wait_on_buffer(bh, true);
+}
+
+void wait_on_buffer(struct buffer_head *bh)
+{
+	__wait_on_buffer(bh, false);
+}
+
+void unlock_buffer(struct buffer_head *bh)
+{
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	bh->b_state &= ~BH_Lock;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	wake_up_all(&buffer_wait);
+}
+
+static void end_buffer_io(struct bio *bio)
+{
+	struct buffer_head *bh = bio->bi_private;
+
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	if (bio->bi_rw == READ && !bio->bi_error)
+		bh->b_state |= BH_Uptodate;
+	else if (bio->bi_rw == WRITE && bio->bi_error)
+		bh->b_state |= BH_Dirty;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	bio_put(bio);
+	unlock_buffer(bh);
+}
+
+// buffer is locked by the caller, it is unlocked when the io is done
+static void submit_bh(uint8_t rw, struct buffer_head *bh)
+{
+	struct bio *bio = bio_alloc();
+	bio->bi_bdev = bh->b_bdev;
+	bio->bi_sector = bh->b_blocknr;
+	bio->bi_size = div_ceil(bh->b_size, SECTOR_SIZE) * SECTOR_SIZE;
+	bio->bi_data = bh->b_data;
+	bio->bi_end_io = end_buffer_io;
+	bio->bi_private = bh;
+	submit_bio(rw, bio);
+}
+
+// dirty bit is cleared when the write is submitted, a holder changing the buffer meanwhile marks it dirty again
+static bool test_clear_buffer_dirty(struct buffer_head *bh)
+{
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	bool dirty = buffer_dirty(bh);
+	bh->b_state &= ~BH_Dirty;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	return dirty;
+}
+
+/*
+  NOTE: MQ 2020-10-18
+  submit reads of not uptodate buffers (or writes of dirty buffers) without waiting
+  buffers with io in flight are skipped, queues are plugged meanwhile -> neighbouring blocks are merged into one request
+*/
+void ll_rw_block(uint8_t rw, uint32_t nr, struct buffer_head *bhs[])
+{
+	for (uint32_t i = 0; i < nr; ++i)
+		blk_plug(bhs[i]->b_bdev->queue);
+
+	for (uint32_t i = 0; i < nr; ++i)
+	{
+		struct buffer_head *bh = bhs[i];
+		if (!trylock_buffer(bh))
+			continue;
+
+		if (rw == READ && !buffer_uptodate(bh))
+			submit_bh(READ, bh);
+		else if (rw == WRITE && test_clear_buffer_dirty(bh))
+			submit_bh(WRITE, bh);
+		else
+			unlock_buffer(bh);
+	}
+
+	for (uint32_t i = 0; i < nr; ++i)
+		blk_unplug(bhs[i]->b_bdev->queue);
+}
+
+struct buffer_head *bread(char *dev_name, sector_t sector, uint32_t size)
 {
-	struct ata_device *device = get_ata_device(dev_name);
-	char *buf = kcalloc(div_ceil(size, BYTES_PER_SECTOR) * BYTES_PER_SECTOR, sizeof(char));
-	ata_read(device, sector, div_ceil(size, BYTES_PER_SECTOR), (uint16_t *)buf);
-	return buf;
+	struct buffer_head *bh = getblk(dev_name, sector, size);
+	if (buffer_uptodate(bh))
+		return bh;
+
+	lock_buffer(bh);
+	if (buffer_uptodate(bh))
+	{
+		unlock_buffer(bh);
+		return bh;
+	}
+
+	submit_bh(READ, bh);
+	wait_on_buffer(bh);
+	if (!buffer_uptodate(bh))
+	{
+		brelse(bh);
+		return NULL;
+	}
+	return bh;
 }
 
-void bwrite(char *dev_name, sector_t sector, char *buf, uint32_t size)
+void brelse(struct buffer_head *bh)
 {
-	struct ata_device *device = get_ata_device(dev_name);
-	ata_write(device, sector, div_ceil(size, BYTES_PER_SECTOR), (uint16_t *)buf);
+	if (!bh)
+		return;
+
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	bh->b_count--;
+	bool drop = list_empty(&bh->b_hash) && buffer_evictable(bh);
+	if (drop)
+		unlink_buffer(bh);
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	if (drop)
+		free_buffer(bh);
+}
+
+void mark_buffer_dirty(struct buffer_head *bh)
+{
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	bh->b_state |= BH_Uptodate | BH_Dirty;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+}
+
+void sync_dirty_buffer(struct buffer_head *bh)
+{
+	lock_buffer(bh);
+	if (test_clear_buffer_dirty(bh))
+	{
+		submit_bh(WRITE, bh);
+		wait_on_buffer(bh);
+	}
+	else
+		unlock_buffer(bh);
+}
+
+// dirty buffers are submitted as one batch -> the elevator sorts and merges them
+void sync_buffers()
+{
+	uint32_t flags = spin_lock_irqsave(&buffer_lock);
+	uint32_t capacity = nbuffers;
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	struct buffer_head **bhs = kcalloc(capacity + 1, sizeof(struct buffer_head *));
+	uint32_t nr = 0;
+
+	flags = spin_lock_irqsave(&buffer_lock);
+	struct buffer_head *iter;
+	list_for_each_entry(iter, &buffer_lru, b_lru)
+	{
+		if (nr == capacity)
+			break;
+		if (!buffer_dirty(iter))
+			continue;
+
+		iter->b_count++;
+		bhs[nr++] = iter;
+	}
+	spin_unlock_irqrestore(&buffer_lock, flags);
+
+	ll_rw_block(WRITE, nr, bhs);
+	for (uint32_t i = 0; i < nr; ++i)
+	{
+		wait_on_buffer(bhs[i]);
+		brelse(bhs[i]);
+	}
+	kfree(bhs);
+
+	// written blocks might still sit in a volatile disk cache
+	if (nr)
+		blkdev_flush_all();
+}
+
+static void bdflush_loop()
+{
+	// explain in kernel_init#unlock_scheduler
+	unlock_scheduler();
+
+	while (true)
+	{
+		thread_sleep(BUFFER_FLUSH_INTERVAL);
+		sync_supers();
+		sync_buffers();
+	}
+}
+
+void buffer_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[buffer] - Initializing");
+
+	for (uint32_t i = 0; i < BUFFER_HASH_SIZE; ++i)
+		INIT_LIST_HEAD(&buffer_hash[i]);
+	create_kernel_process("bdflush", bdflush_loop, 0);
+
+	DEBUG &&debug_println(DEBUG_INFO, "[buffer] - Done");
 }
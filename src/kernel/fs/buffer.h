@@ -2,9 +2,53 @@
 #define FS_BUFFER_H
 
 #include <include/ctype.h>
+#include <include/list.h>
+#include <stdbool.h>
 #include <stdint.h>
 
-char *bread(char *dev_name, sector_t block, uint32_t size);
-void bwrite(char *dev_name, sector_t block, char *buf, uint32_t size);
+#define BH_Uptodate 0x1	 // b_data has the content of disk (or newer)
+#define BH_Dirty 0x2	 // b_data is newer than disk, has to be written back before eviction
+#define BH_Lock 0x4		 // io is in flight
+
+struct block_device;
+
+struct buffer_head
+{
+	struct block_device *b_bdev;
+	sector_t b_blocknr;	 // first sector
+	uint32_t b_size;
+	char *b_data;
+	uint32_t b_count;  // holders, a held buffer is never evicted
+	uint32_t b_state;
+	struct list_head b_hash;
+	struct list_head b_lru;	 // the least recently released is at the head
+};
+
+static inline bool buffer_uptodate(struct buffer_head *bh)
+{
+	return bh->b_state & BH_Uptodate;
+}
+
+static inline bool buffer_dirty(struct buffer_head *bh)
+{
+	return bh->b_state & BH_Dirty;
+}
+
+static inline bool buffer_locked(struct buffer_head *bh)
+{
+	return bh->b_state & BH_Lock;
+}
+
+struct buffer_head *getblk(char *dev_name, sector_t sector, uint32_t size);
+struct buffer_head *bread(char *dev_name, sector_t sector, uint32_t size);
+void ll_rw_block(uint8_t rw, uint32_t nr, struct buffer_head *bhs[]);
+void wait_on_buffer(struct buffer_head *bh);
+void lock_buffer(struct buffer_head *bh);
+void unlock_buffer(struct buffer_head *bh);
+void brelse(struct buffer_head *bh);
+void mark_buffer_dirty(struct buffer_head *bh);
+void sync_dirty_buffer(struct buffer_head *bh);
+void sync_buffers();
+void buffer_init();
 
 #endif
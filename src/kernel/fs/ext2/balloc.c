@@ -0,0 +1,236 @@
+#include <kernel/fs/buffer.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/utils/math.h>
+#include <kernel/utils/string.h>
+
+#include "ext2.h"
+
+/*
+  NOTE: MQ 2020-10-18
+  Block allocator
+    - bitmap of a group is read once and held in buffer cache, free counts of groups are in memory
+      -> a group without free blocks is skipped without reading its bitmap
+    - an allocation starts at a goal (the block after the inode's previous one or the inode's group),
+      takes a run of consecutive free blocks there and falls back to the following groups
+    - a regular file gets EXT2_PREALLOC_BLOCKS more than it asks for, they are marked in bitmap but belong
+      to the inode's preallocation window -> appends are laid out contiguously even when files grow together,
+      the window is given back when the file is closed
+    - changed bitmaps are only marked dirty, superblock and descriptors are written back in ext2_write_super
+*/
+static uint32_t group_first_block(struct ext2_superblock *es, uint32_t group)
+{
+	return es->s_first_data_block + group * es->s_blocks_per_group;
+}
+
+// the last group can be shorter
+static uint32_t group_nblocks(struct ext2_superblock *es, uint32_t group)
+{
+	return min_t(uint32_t, es->s_blocks_per_group, es->s_blocks_count - group_first_block(es, group));
+}
+
+static bool test_bit(uint8_t *bitmap, uint32_t nr)
+{
+	return bitmap[nr / 8] & (1 << (nr % 8));
+}
+
+// first zero bit in [start, end), end if there is none
+uint32_t ext2_find_next_zero_bit(uint8_t *bitmap, uint32_t start, uint32_t end)
+{
+	uint32_t nr = start;
+	while (nr < end)
+	{
+		// full bytes are skipped as a whole
+		if (nr % 8 == 0 && bitmap[nr / 8] == 0xFF)
+		{
+			nr += 8;
+			continue;
+		}
+		if (!test_bit(bitmap, nr))
+			return nr;
+		nr++;
+	}
+	return end;
+}
+
+// first fully free byte (8 free blocks) in [start, end), end if there is none
+static uint32_t find_next_zero_byte(uint8_t *bitmap, uint32_t start, uint32_t end)
+{
+	for (uint32_t nr = div_ceil(start, 8) * 8; nr + 8 <= end; nr += 8)
+	{
+		if (!bitmap[nr / 8])
+			return nr;
+	}
+	return end;
+}
+
+static struct buffer_head *read_block_bitmap(struct vfs_superblock *sb, uint32_t group)
+{
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+	if (!sbi->s_block_bitmap[group])
+		sbi->s_block_bitmap[group] = ext2_bread_block(sb, sbi->s_group_desc[group].bg_block_bitmap);
+	return sbi->s_block_bitmap[group];
+}
+
+// up to *count blocks in a run from the goal in group, 0 if group is full
+static uint32_t try_alloc_in_group(struct vfs_superblock *sb, uint32_t group, int32_t goal, uint32_t *count)
+{
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+	struct ext2_group_desc *gdp = &sbi->s_group_desc[group];
+	if (!gdp->bg_free_blocks_count)
+		return 0;
+
+	struct buffer_head *bh = read_block_bitmap(sb, group);
+	if (!bh)
+		return 0;
+	uint8_t *bitmap = (uint8_t *)bh->b_data;
+	uint32_t nblocks = group_nblocks(&sbi->s_es, group);
+
+	// the goal itself, a free byte after it (room to grow), any free block after it, any free block
+	uint32_t start = nblocks;
+	if (goal >= 0 && !test_bit(bitmap, goal))
+		start = goal;
+	if (start == nblocks)
+		start = find_next_zero_byte(bitmap, max_t(int32_t, goal, 0), nblocks);
+	if (start == nblocks)
+		start = ext2_find_next_zero_bit(bitmap, max_t(int32_t, goal, 0), nblocks);
+	if (start == nblocks && goal > 0)
+		start = ext2_find_next_zero_bit(bitmap, 0, goal);
+	if (start == nblocks)
+		return 0;
+
+	uint32_t n = 0;
+	while (n < *count && start + n < nblocks && !test_bit(bitmap, start + n))
+	{
+		bitmap[(start + n) / 8] |= 1 << ((start + n) % 8);
+		n++;
+	}
+	mark_buffer_dirty(bh);
+
+	gdp->bg_free_blocks_count -= n;
+	sbi->s_es.s_free_blocks_count -= n;
+	sbi->s_dirty = true;
+
+	*count = n;
+	return group_first_block(&sbi->s_es, group) + start;
+}
+
+// allocates a run of at most *count blocks near goal, *count is set to its length, returns 0 if disk is full
+uint32_t ext2_new_blocks(struct vfs_superblock *sb, uint32_t goal, uint32_t *count)
+{
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+	struct ext2_superblock *es = &sbi->s_es;
+
+	if (goal < es->s_first_data_block || goal >= es->s_blocks_count)
+		goal = es->s_first_data_block;
+	uint32_t group = get_group_from_block(es, goal);
+	int32_t relative_goal = get_relative_block_in_group(es, goal);
+
+	rt_mutex_lock(&sbi->s_alloc_lock);
+	uint32_t block = 0;
+	for (uint32_t i = 0; i < sbi->s_groups_count && !block; ++i)
+	{
+		uint32_t want = *count;
+		block = try_alloc_in_group(sb, (group + i) % sbi->s_groups_count, i ? -1 : relative_goal, &want);
+		if (block)
+			*count = want;
+	}
+	rt_mutex_unlock(&sbi->s_alloc_lock);
+
+	if (!block)
+		*count = 0;
+	return block;
+}
+
+void ext2_free_blocks(struct vfs_superblock *sb, uint32_t block, uint32_t count)
+{
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+	struct ext2_superblock *es = &sbi->s_es;
+
+	rt_mutex_lock(&sbi->s_alloc_lock);
+	while (count)
+	{
+		uint32_t group = get_group_from_block(es, block);
+		uint32_t relative_block = get_relative_block_in_group(es, block);
+		uint32_t n = min_t(uint32_t, count, group_nblocks(es, group) - relative_block);
+
+		// blocks whose bitmap cannot be read stay allocated (leaked) rather than risking a wrong bitmap
+		struct buffer_head *bh = read_block_bitmap(sb, group);
+		if (bh)
+		{
+			for (uint32_t i = relative_block; i < relative_block + n; ++i)
+				bh->b_data[i / 8] &= ~(1 << (i % 8));
+			mark_buffer_dirty(bh);
+
+			sbi->s_group_desc[group].bg_free_blocks_count += n;
+			es->s_free_blocks_count += n;
+		}
+		block += n;
+		count -= n;
+	}
+	sbi->s_dirty = true;
+	rt_mutex_unlock(&sbi->s_alloc_lock);
+}
+
+// the caller holds i_map_lock, like for ext2_alloc_blocks
+void ext2_discard_prealloc(struct vfs_inode *inode)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	if (!ei->i_prealloc_count)
+		return;
+
+	ext2_free_blocks(inode->i_sb, ei->i_prealloc_block, ei->i_prealloc_count);
+	ei->i_prealloc_count = 0;
+}
+
+// block after the previous allocation when the file is written sequentially, otherwise the inode's group
+uint32_t ext2_find_goal(struct vfs_inode *inode, uint32_t iblock)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	if (iblock == ei->i_next_alloc_block && ei->i_next_alloc_goal)
+		return ei->i_next_alloc_goal;
+
+	return group_first_block(EXT2_SB(inode->i_sb), ei->i_block_group);
+}
+
+// allocates a run of at most *count blocks from goal for inode, *count is set to its length, returns 0 if disk is full
+uint32_t ext2_alloc_blocks(struct vfs_inode *inode, uint32_t goal, uint32_t *count)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	if (ei->i_prealloc_count && ei->i_prealloc_block == goal)
+	{
+		uint32_t block = ei->i_prealloc_block;
+		*count = min_t(uint32_t, *count, ei->i_prealloc_count);
+		ei->i_prealloc_block += *count;
+		ei->i_prealloc_count -= *count;
+		return block;
+	}
+
+	// an out-of-order write does not continue the window, the window is given back
+	ext2_discard_prealloc(inode);
+
+	uint32_t want = *count + (S_ISREG(inode->i_mode) ? EXT2_PREALLOC_BLOCKS : 0);
+	uint32_t block = ext2_new_blocks(inode->i_sb, goal, &want);
+	if (block && want > *count)
+	{
+		ei->i_prealloc_block = block + *count;
+		ei->i_prealloc_count = want - *count;
+	}
+	else
+		*count = want;
+	return block;
+}
+
+// allocates a block for logical block iblock of inode, returns 0 if disk is full
+uint32_t ext2_alloc_block(struct vfs_inode *inode, uint32_t iblock)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	uint32_t count = 1;
+	uint32_t block = ext2_alloc_blocks(inode, ext2_find_goal(inode, iblock), &count);
+	if (block)
+	{
+		ei->i_next_alloc_block = iblock + 1;
+		ei->i_next_alloc_goal = block + 1;
+	}
+	return block;
+}
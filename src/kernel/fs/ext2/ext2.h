@@ -1,6 +1,7 @@
 #ifndef FS_EXT2_H
 #define FS_EXT2_H
 
+#include <kernel/fs/buffer.h>
 #include <kernel/fs/vfs.h>
 #include <stdint.h>
 
@@ -171,21 +172,88 @@ enum
 	EXT2_FT_MAX
 };
 
-static inline struct ext2_superblock *EXT2_SB(struct vfs_superblock *sb)
+/*
+ * Constants relative to the data blocks
+ */
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK EXT2_NDIR_BLOCKS
+#define EXT2_DIND_BLOCK (EXT2_IND_BLOCK + 1)
+#define EXT2_TIND_BLOCK (EXT2_DIND_BLOCK + 1)
+#define EXT2_N_BLOCKS (EXT2_TIND_BLOCK + 1)
+
+#define EXT2_SUPERBLOCK_OFFSET 1024
+#define EXT2_PREALLOC_BLOCKS 8
+#define EXT2_EXTENT_CACHE_SIZE 4
+
+// in-memory state of a mounted file system
+struct ext2_sb_info
+{
+	struct ext2_superblock s_es;		   // free counts are only written back by ext2_write_super
+	uint32_t s_groups_count;
+	struct ext2_group_desc *s_group_desc;  // in-memory copy of descriptor table, written back like s_es
+	struct buffer_head **s_block_bitmap;   // loaded on first use and held while mounted
+	struct buffer_head **s_inode_bitmap;
+	uint32_t s_last_dir_group;	// where the search for the next top-level directory starts
+	bool s_dirty;				// s_es or s_group_desc has changed since last write back
+	struct rt_mutex s_alloc_lock;
+};
+
+// logical blocks [e_lblock, e_lblock + e_len) are on disk at [e_pblock, e_pblock + e_len)
+struct ext2_extent
+{
+	uint32_t e_lblock;
+	uint32_t e_pblock;
+	uint32_t e_len;
+};
+
+// in-memory state of an inode
+struct ext2_inode_info
+{
+	struct ext2_inode i_raw;
+	struct ext2_extent i_extents[EXT2_EXTENT_CACHE_SIZE];  // recently mapped runs, e_len 0 is unused
+	uint32_t i_extent_next;								   // slot which is replaced next
+	struct buffer_head *i_path_bh[EXT2_N_BLOCKS - EXT2_NDIR_BLOCKS];  // indirect blocks of the last lookup per level, held
+	uint32_t i_path_block[EXT2_N_BLOCKS - EXT2_NDIR_BLOCKS];
+	uint32_t i_block_group;
+	uint32_t i_next_alloc_block;  // logical block which follows the last allocated one
+	uint32_t i_next_alloc_goal;	  // physical block which follows the last allocated one
+	uint32_t i_prealloc_block;	  // blocks reserved in bitmap for coming appends
+	uint32_t i_prealloc_count;
+	struct rt_mutex i_map_lock;	 // block mapping, held path buffers and preallocation of all openers
+};
+
+static inline struct ext2_sb_info *EXT2_SB_INFO(struct vfs_superblock *sb)
 {
 	return sb->s_fs_info;
 }
 
-static inline struct ext2_inode *EXT2_INODE(struct vfs_inode *inode)
+static inline struct ext2_superblock *EXT2_SB(struct vfs_superblock *sb)
+{
+	return &EXT2_SB_INFO(sb)->s_es;
+}
+
+static inline struct ext2_inode_info *EXT2_I(struct vfs_inode *inode)
 {
 	return inode->i_fs_info;
 }
 
+static inline struct ext2_inode *EXT2_INODE(struct vfs_inode *inode)
+{
+	return &EXT2_I(inode)->i_raw;
+}
+
 #define EXT2_MIN_BLOCK_SIZE 1024
 #define EXT2_MAX_BLOCK_SIZE 4096
+#define EXT2_MIN_BLOCK_LOG_SIZE 10
 
-#define EXT2_BLOCK_SIZE(sb) (EXT2_MIN_BLOCK_SIZE << sb->s_log_block_size)
-#define EXT2_INODES_PER_BLOCK(sb) (EXT2_BLOCK_SIZE(sb) / sb->s_inode_size)
+// revision 0 has fixed 128-byte inodes, later ones give the size in superblock
+#define EXT2_GOOD_OLD_REV 0
+#define EXT2_GOOD_OLD_INODE_SIZE 128
+
+#define EXT2_BLOCK_SIZE(sb) (EXT2_MIN_BLOCK_SIZE << (sb)->s_log_block_size)
+#define EXT2_INODE_SIZE(sb) ((sb)->s_rev_level == EXT2_GOOD_OLD_REV ? EXT2_GOOD_OLD_INODE_SIZE : (sb)->s_inode_size)
+#define EXT2_INODES_PER_BLOCK(sb) (EXT2_BLOCK_SIZE(sb) / EXT2_INODE_SIZE(sb))
+#define EXT2_ADDR_PER_BLOCK(sb) (EXT2_BLOCK_SIZE(sb) / sizeof(uint32_t))
 #define EXT2_GROUPS_PER_BLOCK(sb) (EXT2_BLOCK_SIZE(sb) / sizeof(struct ext2_group_desc))
 
 #define get_group_from_inode(sb, ino) ((ino - EXT2_STARTING_INO) / sb->s_inodes_per_group)
@@ -197,21 +265,33 @@ static inline struct ext2_inode *EXT2_INODE(struct vfs_inode *inode)
 extern struct vfs_super_operations ext2_super_operations;
 void init_ext2_fs();
 void exit_ext2_fs();
-char *ext2_bread_block(struct vfs_superblock *sb, uint32_t iblock);
-char *ext2_bread(struct vfs_superblock *sb, uint32_t iblock, uint32_t size);
-void ext2_bwrite_block(struct vfs_superblock *sb, uint32_t iblock, char *buf);
-void ext2_bwrite(struct vfs_superblock *sb, uint32_t iblock, char *buf, uint32_t size);
+struct buffer_head *ext2_bread_block(struct vfs_superblock *sb, uint32_t iblock);
+struct buffer_head *ext2_bread(struct vfs_superblock *sb, uint32_t iblock, uint32_t size);
+struct buffer_head *ext2_getblk(struct vfs_superblock *sb, uint32_t iblock);
 struct vfs_inode *ext2_alloc_inode(struct vfs_superblock *sb);
-void ext2_read_inode(struct vfs_inode *);
+int ext2_read_inode(struct vfs_inode *);
 void ext2_write_inode(struct vfs_inode *);
 struct ext2_group_desc *ext2_get_group_desc(struct vfs_superblock *sb, uint32_t block_group);
-void ext2_write_group_desc(struct vfs_superblock *sb, struct ext2_group_desc *gdp);
 
 // vfs_inode.c
 extern struct vfs_inode_operations ext2_dir_inode_operations;
 extern struct vfs_inode_operations ext2_file_inode_operations;
 extern struct vfs_inode_operations ext2_special_inode_operations;
-uint32_t ext2_create_block(struct vfs_superblock *sb);
+uint32_t ext2_create_block(struct vfs_inode *inode, uint32_t iblock);
+int32_t ext2_get_blocks(struct vfs_inode *inode, uint32_t iblock, uint32_t max_blocks, uint32_t *bno, bool create, bool *new);
+void ext2_release_block_map(struct vfs_inode *inode);
+
+// balloc.c
+uint32_t ext2_find_next_zero_bit(uint8_t *bitmap, uint32_t start, uint32_t end);
+uint32_t ext2_new_blocks(struct vfs_superblock *sb, uint32_t goal, uint32_t *count);
+void ext2_free_blocks(struct vfs_superblock *sb, uint32_t block, uint32_t count);
+uint32_t ext2_find_goal(struct vfs_inode *inode, uint32_t iblock);
+uint32_t ext2_alloc_blocks(struct vfs_inode *inode, uint32_t goal, uint32_t *count);
+uint32_t ext2_alloc_block(struct vfs_inode *inode, uint32_t iblock);
+void ext2_discard_prealloc(struct vfs_inode *inode);
+
+// ialloc.c
+uint32_t ext2_new_inode(struct vfs_inode *dir, mode_t mode);
 
 // file.c
 extern struct vfs_file_operations ext2_file_operations;
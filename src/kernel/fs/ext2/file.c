@@ -1,11 +1,16 @@
 #include <include/errno.h>
+#include <kernel/fs/block_dev.h>
 #include <kernel/fs/vfs.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
 #include <kernel/system/time.h>
 #include <kernel/utils/math.h>
 #include <kernel/utils/string.h>
 
 #include "ext2.h"
 
+#define EXT2_WRITE_RUN_BLOCKS 64
+
 static loff_t ext2_llseek_file(struct vfs_file *file, loff_t ppos)
 {
 	struct vfs_inode *inode = file->f_dentry->d_inode;
@@ -17,119 +22,187 @@ static loff_t ext2_llseek_file(struct vfs_file *file, loff_t ppos)
 	return ppos;
 }
 
-static void ext2_read_direct_block(struct vfs_superblock *sb, struct ext2_inode *ei, uint32_t block, char **iter_buf, loff_t ppos, uint32_t *p, size_t count)
+// blocks are submitted in batches without waiting -> consecutive blocks become one disk transfer
+static void ext2_submit_blocks(struct vfs_inode *inode, uint32_t first, uint32_t last)
 {
-	char *block_buf = ext2_bread_block(sb, block);
-	int32_t pstart = (ppos > *p) ? ppos - *p : 0;
-	uint32_t pend = ((ppos + count) < (*p + sb->s_blocksize)) ? (*p + sb->s_blocksize - ppos - count) : 0;
-	memcpy(*iter_buf, block_buf + pstart, sb->s_blocksize - pstart - pend);
-	ext2_bwrite_block(sb, block, block_buf);
-	*p += sb->s_blocksize;
-	*iter_buf += sb->s_blocksize - pstart - pend;
-}
+	struct vfs_superblock *sb = inode->i_sb;
+	struct buffer_head *bhs[RA_MAX_BLOCKS];
+	while (first < last)
+	{
+		uint32_t nr = 0;
+		while (first < last && nr < RA_MAX_BLOCKS)
+		{
+			uint32_t block;
+			int32_t count = ext2_get_blocks(inode, first, min_t(uint32_t, last - first, RA_MAX_BLOCKS - nr), &block, false, NULL);
+			if (count <= 0)
+			{
+				first++;
+				continue;
+			}
+			for (int32_t i = 0; i < count; ++i)
+				bhs[nr++] = ext2_getblk(sb, block + i);
+			first += count;
+		}
 
-static void ext2_read_indirect_block(struct vfs_superblock *sb, struct ext2_inode *ei, uint32_t block, char **iter_buf, loff_t ppos, uint32_t *p, size_t count)
-{
-	uint32_t *block_buf = (uint32_t *)ext2_bread_block(sb, block);
-	for (uint32_t i = 0; *p < ppos + count && i < 256; ++i)
-		ext2_read_direct_block(sb, ei, block_buf[i], iter_buf, ppos, p, count);
+		ll_rw_block(READ, nr, bhs);
+		for (uint32_t i = 0; i < nr; ++i)
+			brelse(bhs[i]);
+	}
 }
 
-static void ext2_read_doubly_indirect_block(struct vfs_superblock *sb, struct ext2_inode *ei, uint32_t block, char **iter_buf, loff_t ppos, uint32_t *p, size_t count)
+// blocks of the read itself and the readahead window are in flight before the copy waits on the first one
+static void ext2_readahead(struct vfs_file *file, loff_t ppos, size_t count)
 {
-	uint32_t *block_buf = (uint32_t *)ext2_bread_block(sb, block);
-	for (uint32_t i = 0; *p < ppos + count && i < 256; ++i)
-		ext2_read_indirect_block(sb, ei, block_buf[i], iter_buf, ppos, p, count);
-}
+	struct vfs_inode *inode = file->f_dentry->d_inode;
+	struct vfs_superblock *sb = inode->i_sb;
 
-static void ext2_read_triply_indirect_block(struct vfs_superblock *sb, struct ext2_inode *ei, uint32_t block, char **iter_buf, loff_t ppos, uint32_t *p, size_t count)
-{
-	uint32_t *block_buf = (uint32_t *)ext2_bread_block(sb, block);
-	for (uint32_t i = 0; *p < ppos + count && i < 256; ++i)
-		ext2_read_triply_indirect_block(sb, ei, block_buf[i], iter_buf, ppos, p, count);
+	uint32_t nblocks = div_ceil(inode->i_size, sb->s_blocksize);
+	uint32_t first = ppos / sb->s_blocksize;
+	uint32_t last = div_ceil(ppos + count, sb->s_blocksize);
+
+	uint32_t ra_start;
+	uint32_t ra_size = file_ra_advance(&file->f_ra, first, last, &ra_start);
+
+	ext2_submit_blocks(inode, first, min_t(uint32_t, last, nblocks));
+	if (ra_size)
+		ext2_submit_blocks(inode, ra_start, min_t(uint32_t, ra_start + ra_size, nblocks));
 }
 
+// like a write, a read goes run by run as ext2_get_blocks maps it, a hole reads as zeroes
 static ssize_t ext2_read_file(struct vfs_file *file, char *buf, size_t count, loff_t ppos)
 {
 	struct vfs_inode *inode = file->f_dentry->d_inode;
-	struct ext2_inode *ei = EXT2_INODE(inode);
 	struct vfs_superblock *sb = inode->i_sb;
 
+	ext2_readahead(file, ppos, count);
+
+	uint32_t last = div_ceil(ppos + count, sb->s_blocksize);
 	uint32_t p = (ppos / sb->s_blocksize) * sb->s_blocksize;
 	char *iter_buf = buf;
 	while (p < ppos + count)
 	{
 		uint32_t relative_block = p / sb->s_blocksize;
-		if (relative_block < 12)
-		{
-			uint32_t block = ei->i_block[relative_block];
-			ext2_read_direct_block(sb, ei, block, &iter_buf, ppos, &p, count);
-		}
-		else if (relative_block < 268)
-		{
-			uint32_t block = ei->i_block[12];
-			ext2_read_indirect_block(sb, ei, block, &iter_buf, ppos, &p, count);
-		}
-		else if (relative_block < 65804)
-		{
-			uint32_t block = ei->i_block[13];
-			ext2_read_doubly_indirect_block(sb, ei, block, &iter_buf, ppos, &p, count);
-		}
-		else if (relative_block < 16843020)
+		uint32_t block;
+		int32_t ret = ext2_get_blocks(inode, relative_block, last - relative_block, &block, false, NULL);
+		if (ret == -EFBIG)
+			break;
+		// what is read so far is returned, the error only when nothing is
+		if (ret < 0)
+			return iter_buf != buf ? iter_buf - buf : ret;
+
+		for (int32_t i = 0; i < max_t(int32_t, ret, 1); ++i)
 		{
-			uint32_t block = ei->i_block[14];
-			ext2_read_triply_indirect_block(sb, ei, block, &iter_buf, ppos, &p, count);
+			uint32_t pstart = (ppos > p) ? ppos - p : 0;
+			uint32_t pend = ((ppos + count) < (p + sb->s_blocksize)) ? (p + sb->s_blocksize - ppos - count) : 0;
+			if (ret > 0)
+			{
+				struct buffer_head *bh = ext2_bread_block(sb, block + i);
+				if (!bh)
+					return iter_buf != buf ? iter_buf - buf : -EIO;
+				memcpy(iter_buf, bh->b_data + pstart, sb->s_blocksize - pstart - pend);
+				brelse(bh);
+			}
+			else
+				memset(iter_buf, 0, sb->s_blocksize - pstart - pend);
+			p += sb->s_blocksize;
+			iter_buf += sb->s_blocksize - pstart - pend;
 		}
+
+		// large reads go run by run, give other threads a chance
+		cond_resched();
 	}
-	return count;
+	return iter_buf - buf;
 }
 
+/*
+  NOTE: MQ 2020-10-18
+  a write goes run by run, a run is what ext2_get_blocks maps (or allocates) contiguously on disk
+    - a new block is not read, whatever the write does not cover is zeroed
+    - blocks of a run longer than one block are submitted together right away (write-behind)
+      -> a large write leaves as a few big disk transfers instead of waiting for bdflush
+*/
 static ssize_t ext2_write_file(struct vfs_file *file, const char *buf, size_t count, loff_t ppos)
 {
 	struct vfs_inode *inode = file->f_dentry->d_inode;
-	struct ext2_inode *ei = EXT2_INODE(inode);
 	struct vfs_superblock *sb = inode->i_sb;
+	struct buffer_head *bhs[EXT2_WRITE_RUN_BLOCKS];
 
-	if (ppos + count > inode->i_size)
-	{
-		inode->i_size = ppos + count;
-		inode->i_blocks = div_ceil(ppos + count, 512);
-		sb->s_op->write_inode(inode);
-	}
-
+	uint32_t last = div_ceil(ppos + count, sb->s_blocksize);
 	uint32_t p = (ppos / sb->s_blocksize) * sb->s_blocksize;
-	char *iter_buf = buf;
+	const char *iter_buf = buf;
+	int32_t ret = 0;
 	while (p < ppos + count)
 	{
 		uint32_t relative_block = p / sb->s_blocksize;
-		uint32_t block = 0;
-		// FIXME: MQ 2019-07-18 Only support direct blocks
-		if (relative_block < 12)
+		uint32_t block;
+		bool new;
+		ret = ext2_get_blocks(inode, relative_block, min_t(uint32_t, last - relative_block, EXT2_WRITE_RUN_BLOCKS), &block, true, &new);
+		if (ret < 0)
+			break;
+
+		int32_t nr = 0;
+		for (; nr < ret; ++nr)
 		{
-			block = ei->i_block[relative_block];
-			if (!block)
-			{
-				block = ext2_create_block(sb);
-				ei->i_block[relative_block] = block;
-				inode->i_mtime.tv_sec = get_seconds(NULL);
-				sb->s_op->write_inode(inode);
-			}
+			uint32_t pstart = (ppos > p) ? ppos - p : 0;
+			uint32_t pend = ((ppos + count) < (p + sb->s_blocksize)) ? (p + sb->s_blocksize - ppos - count) : 0;
+			// a new or a whole overwritten block -> no need to read it first
+			struct buffer_head *bh = (!new && (pstart || pend)) ? ext2_bread_block(sb, block + nr) : ext2_getblk(sb, block + nr);
+			if (!bh)
+				break;
+			// a readahead of this block may still be in flight, it would overwrite the copy when it completes
+			// -> the copy waits for it, once the buffer is dirty (and uptodate) it is not read again
+			lock_buffer(bh);
+			if (new && (pstart || pend))
+				memset(bh->b_data, 0, sb->s_blocksize);
+			memcpy(bh->b_data + pstart, iter_buf, sb->s_blocksize - pstart - pend);
+			mark_buffer_dirty(bh);
+			unlock_buffer(bh);
+			bhs[nr] = bh;
+			p += sb->s_blocksize;
+			iter_buf += sb->s_blocksize - pstart - pend;
+		}
+
+		if (nr > 1)
+			ll_rw_block(WRITE, nr, bhs);
+		for (int32_t i = 0; i < nr; ++i)
+			brelse(bhs[i]);
+		if (nr < ret)
+		{
+			ret = -EIO;
+			break;
 		}
-		char *block_buf = ext2_bread_block(sb, block);
-		uint32_t pstart = (ppos > p) ? ppos - p : 0;
-		uint32_t pend = ((ppos + count) < (p + sb->s_blocksize)) ? (p + sb->s_blocksize - ppos - count) : 0;
-		memcpy(block_buf + pstart, iter_buf, sb->s_blocksize - pstart - pend);
-		ext2_bwrite_block(sb, block, block_buf);
-		p += sb->s_blocksize;
-		iter_buf += sb->s_blocksize - pstart - pend;
+		cond_resched();
 	}
-	return count;
+
+	size_t written = iter_buf - buf;
+	if (ppos + written > inode->i_size)
+		inode->i_size = ppos + written;
+	inode->i_mtime.tv_sec = get_seconds(NULL);
+	sb->s_op->write_inode(inode);
+
+	if (!written)
+		return ret;
+	update_cache_pages(inode, buf, written, ppos);
+	return written;
+}
+
+// blocks preallocated for appends and held indirect blocks are given back when the file is closed
+// -> they belong to the inode, other openers lose them too but only between two lookups (i_map_lock)
+static int ext2_release_file(struct vfs_inode *inode, struct vfs_file *file)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	rt_mutex_lock(&ei->i_map_lock);
+	ext2_discard_prealloc(inode);
+	ext2_release_block_map(inode);
+	rt_mutex_unlock(&ei->i_map_lock);
+	return 0;
 }
 
 struct vfs_file_operations ext2_file_operations = {
 	.llseek = ext2_llseek_file,
 	.read = ext2_read_file,
 	.write = ext2_write_file,
+	.release = ext2_release_file,
 };
 
 struct vfs_file_operations ext2_dir_operations = {};
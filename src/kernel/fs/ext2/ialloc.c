@@ -0,0 +1,125 @@
+#include <kernel/fs/buffer.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/memory/vmm.h>
+
+#include "ext2.h"
+
+/*
+  NOTE: MQ 2020-10-18
+  Inode allocator, like for blocks bitmaps are held in buffer cache and free counts are in memory
+    - a file goes into the group of its directory if that has free inodes and blocks, otherwise groups are
+      probed quadratically (parent + 1, + 2, + 4 ...) then linearly -> files of a directory stay together
+    - a directory under root is spread (Orlov): among groups with at least average free inodes and blocks,
+      the one with fewest directories -> top-level trees start in different parts of disk
+    - a deeper directory stays in its parent's group while that has at least average free inodes and blocks
+*/
+static struct buffer_head *read_inode_bitmap(struct vfs_superblock *sb, uint32_t group)
+{
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+	if (!sbi->s_inode_bitmap[group])
+		sbi->s_inode_bitmap[group] = ext2_bread_block(sb, sbi->s_group_desc[group].bg_inode_bitmap);
+	return sbi->s_inode_bitmap[group];
+}
+
+static int32_t find_group_any(struct ext2_sb_info *sbi, uint32_t parent_group)
+{
+	for (uint32_t i = 0; i < sbi->s_groups_count; ++i)
+	{
+		uint32_t group = (parent_group + i) % sbi->s_groups_count;
+		if (sbi->s_group_desc[group].bg_free_inodes_count)
+			return group;
+	}
+	return -1;
+}
+
+static int32_t find_group_other(struct ext2_sb_info *sbi, uint32_t parent_group)
+{
+	for (uint32_t i = 0; i < sbi->s_groups_count; i = i ? i << 1 : 1)
+	{
+		struct ext2_group_desc *gdp = &sbi->s_group_desc[(parent_group + i) % sbi->s_groups_count];
+		if (gdp->bg_free_inodes_count && gdp->bg_free_blocks_count)
+			return (parent_group + i) % sbi->s_groups_count;
+	}
+	return find_group_any(sbi, parent_group);
+}
+
+static int32_t find_group_orlov(struct ext2_sb_info *sbi, struct vfs_inode *dir)
+{
+	uint32_t avefreei = sbi->s_es.s_free_inodes_count / sbi->s_groups_count;
+	uint32_t avefreeb = sbi->s_es.s_free_blocks_count / sbi->s_groups_count;
+	uint32_t parent_group = EXT2_I(dir)->i_block_group;
+
+	if (dir->i_ino == EXT2_ROOT_INO)
+	{
+		int32_t best = -1;
+		uint32_t best_ndirs = UINT32_MAX;
+		for (uint32_t i = 0; i < sbi->s_groups_count; ++i)
+		{
+			uint32_t group = (sbi->s_last_dir_group + i) % sbi->s_groups_count;
+			struct ext2_group_desc *gdp = &sbi->s_group_desc[group];
+			if (!gdp->bg_free_inodes_count || gdp->bg_free_inodes_count < avefreei || gdp->bg_free_blocks_count < avefreeb)
+				continue;
+			if (gdp->bg_used_dirs_count < best_ndirs)
+			{
+				best = group;
+				best_ndirs = gdp->bg_used_dirs_count;
+			}
+		}
+		if (best >= 0)
+		{
+			sbi->s_last_dir_group = best + 1;
+			return best;
+		}
+	}
+	else
+	{
+		for (uint32_t i = 0; i < sbi->s_groups_count; ++i)
+		{
+			uint32_t group = (parent_group + i) % sbi->s_groups_count;
+			struct ext2_group_desc *gdp = &sbi->s_group_desc[group];
+			if (gdp->bg_free_inodes_count && gdp->bg_free_inodes_count >= avefreei && gdp->bg_free_blocks_count >= avefreeb)
+				return group;
+		}
+	}
+	return find_group_any(sbi, parent_group);
+}
+
+// returns 0 if there is no free inode
+uint32_t ext2_new_inode(struct vfs_inode *dir, mode_t mode)
+{
+	struct vfs_superblock *sb = dir->i_sb;
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+
+	rt_mutex_lock(&sbi->s_alloc_lock);
+	int32_t group = S_ISDIR(mode) ? find_group_orlov(sbi, dir) : find_group_other(sbi, EXT2_I(dir)->i_block_group);
+	if (group < 0)
+	{
+		rt_mutex_unlock(&sbi->s_alloc_lock);
+		return 0;
+	}
+
+	struct buffer_head *bh = read_inode_bitmap(sb, group);
+	if (!bh)
+	{
+		rt_mutex_unlock(&sbi->s_alloc_lock);
+		return 0;
+	}
+	uint32_t bit = ext2_find_next_zero_bit((uint8_t *)bh->b_data, 0, sbi->s_es.s_inodes_per_group);
+	if (bit == sbi->s_es.s_inodes_per_group)
+	{
+		rt_mutex_unlock(&sbi->s_alloc_lock);
+		return 0;
+	}
+	bh->b_data[bit / 8] |= 1 << (bit % 8);
+	mark_buffer_dirty(bh);
+
+	struct ext2_group_desc *gdp = &sbi->s_group_desc[group];
+	gdp->bg_free_inodes_count--;
+	if (S_ISDIR(mode))
+		gdp->bg_used_dirs_count++;
+	sbi->s_es.s_free_inodes_count--;
+	sbi->s_dirty = true;
+	rt_mutex_unlock(&sbi->s_alloc_lock);
+
+	return group * sbi->s_es.s_inodes_per_group + bit + EXT2_STARTING_INO;
+}
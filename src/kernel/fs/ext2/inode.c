@@ -2,102 +2,266 @@
 #include <kernel/fs/buffer.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
 #include <kernel/system/time.h>
 #include <kernel/utils/math.h>
 #include <kernel/utils/string.h>
 
 #include "ext2.h"
 
-static uint32_t find_unused_block_number(struct vfs_superblock *sb)
+// allocates and zeroes the block for logical block iblock of inode, returns 0 if disk is full
+uint32_t ext2_create_block(struct vfs_inode *inode, uint32_t iblock)
 {
-	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	rt_mutex_lock(&ei->i_map_lock);
+	uint32_t block = ext2_alloc_block(inode, iblock);
+	rt_mutex_unlock(&ei->i_map_lock);
+	if (!block)
+		return 0;
+
+	// clear block data, the block is not read from disk
+	struct buffer_head *data_bh = ext2_getblk(inode->i_sb, block);
+	memset(data_bh->b_data, 0, inode->i_sb->s_blocksize);
+	mark_buffer_dirty(data_bh);
+	brelse(data_bh);
 
-	uint32_t number_of_groups = div_ceil(ext2_sb->s_blocks_count, ext2_sb->s_blocks_per_group);
-	for (uint32_t group = 0; group < number_of_groups; group += 1)
-	{
-		struct ext2_group_desc *gdp = ext2_get_group_desc(sb, group);
-		unsigned char *block_bitmap = (unsigned char *)ext2_bread_block(sb, gdp->bg_block_bitmap);
-
-		for (uint32_t i = 0; i < sb->s_blocksize; ++i)
-			if (block_bitmap[i] != 0xff)
-				for (int j = 0; j < 8; ++j)
-					if (!(block_bitmap[i] & (1 << j)))
-						return group * ext2_sb->s_blocks_per_group + i * 8 + j + ext2_sb->s_first_data_block;
-	}
-	return -ENOSPC;
+	return block;
 }
 
-uint32_t ext2_create_block(struct vfs_superblock *sb)
+// path of logical block iblock in the block tree: offsets[0] indexes i_block, the following ones indirect blocks
+// returns its depth (0 if iblock is beyond triple indirect), *boundary is how many entries follow the last offset
+static uint32_t ext2_block_to_path(struct vfs_superblock *sb, uint32_t iblock, uint32_t offsets[4], uint32_t *boundary)
 {
-	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
-	uint32_t block = find_unused_block_number(sb);
+	uint32_t per_block = EXT2_ADDR_PER_BLOCK(EXT2_SB(sb));
+	uint32_t depth = 0;
+	uint32_t final;
 
-	// superblock
-	ext2_sb->s_free_blocks_count -= 1;
-	sb->s_op->write_super(sb);
+	if (iblock < EXT2_NDIR_BLOCKS)
+	{
+		offsets[depth++] = iblock;
+		final = EXT2_NDIR_BLOCKS;
+	}
+	else if ((iblock -= EXT2_NDIR_BLOCKS) < per_block)
+	{
+		offsets[depth++] = EXT2_IND_BLOCK;
+		offsets[depth++] = iblock;
+		final = per_block;
+	}
+	else if ((iblock -= per_block) < per_block * per_block)
+	{
+		offsets[depth++] = EXT2_DIND_BLOCK;
+		offsets[depth++] = iblock / per_block;
+		offsets[depth++] = iblock % per_block;
+		final = per_block;
+	}
+	else if ((iblock -= per_block * per_block) / per_block < per_block * per_block)
+	{
+		offsets[depth++] = EXT2_TIND_BLOCK;
+		offsets[depth++] = iblock / (per_block * per_block);
+		offsets[depth++] = (iblock / per_block) % per_block;
+		offsets[depth++] = iblock % per_block;
+		final = per_block;
+	}
+	else
+		return 0;
 
-	// group
-	struct ext2_group_desc *gdp = ext2_get_group_desc(sb, get_group_from_block(ext2_sb, block));
-	gdp->bg_free_blocks_count -= 1;
-	ext2_write_group_desc(sb, gdp);
+	*boundary = final - 1 - offsets[depth - 1];
+	return depth;
+}
 
-	// block bitmap
-	char *bitmap_buf = ext2_bread_block(sb, gdp->bg_block_bitmap);
-	uint32_t relative_block = get_relative_block_in_group(ext2_sb, block);
-	bitmap_buf[relative_block / 8] |= 1 << (relative_block % 8);
-	ext2_bwrite_block(sb, gdp->bg_block_bitmap, bitmap_buf);
+// finds a cached run which covers iblock, returns its length from iblock (at most max_blocks), 0 if none does
+static uint32_t ext2_extent_lookup(struct ext2_inode_info *ei, uint32_t iblock, uint32_t max_blocks, uint32_t *bno)
+{
+	for (uint32_t i = 0; i < EXT2_EXTENT_CACHE_SIZE; ++i)
+	{
+		struct ext2_extent *ext = &ei->i_extents[i];
+		if (iblock >= ext->e_lblock && iblock - ext->e_lblock < ext->e_len)
+		{
+			*bno = ext->e_pblock + (iblock - ext->e_lblock);
+			return min_t(uint32_t, ext->e_len - (iblock - ext->e_lblock), max_blocks);
+		}
+	}
+	return 0;
+}
 
-	// clear block data
-	char *data_buf = kcalloc(sb->s_blocksize, sizeof(char));
-	ext2_bwrite_block(sb, block, data_buf);
+// a run which continues a cached one (an append) extends it, otherwise it replaces the oldest slot
+static void ext2_extent_insert(struct ext2_inode_info *ei, uint32_t iblock, uint32_t bno, uint32_t len)
+{
+	for (uint32_t i = 0; i < EXT2_EXTENT_CACHE_SIZE; ++i)
+	{
+		struct ext2_extent *ext = &ei->i_extents[i];
+		if (ext->e_len && ext->e_lblock + ext->e_len == iblock && ext->e_pblock + ext->e_len == bno)
+		{
+			ext->e_len += len;
+			return;
+		}
+	}
 
-	return block;
+	struct ext2_extent *ext = &ei->i_extents[ei->i_extent_next];
+	ext->e_lblock = iblock;
+	ext->e_pblock = bno;
+	ext->e_len = len;
+	ei->i_extent_next = (ei->i_extent_next + 1) % EXT2_EXTENT_CACHE_SIZE;
 }
 
-static uint32_t find_unused_inode_number(struct vfs_superblock *sb)
+// indirect block at level (1 is the one i_block points to) of the path, the last one used per level stays held
+static struct buffer_head *ext2_path_buffer(struct vfs_inode *inode, uint32_t level, uint32_t block, struct buffer_head *bh)
 {
-	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	struct buffer_head **cached = &ei->i_path_bh[level - 1];
+	if (*cached && ei->i_path_block[level - 1] == block && !bh)
+		return *cached;
+
+	if (*cached)
+		brelse(*cached);
+	*cached = bh ? bh : ext2_bread_block(inode->i_sb, block);
+	ei->i_path_block[level - 1] = block;
+	return *cached;	 // NULL if it cannot be read, nothing is held at this level then
+}
 
-	uint32_t number_of_groups = div_ceil(ext2_sb->s_blocks_count, ext2_sb->s_blocks_per_group);
-	for (uint32_t group = 0; group < number_of_groups; group += 1)
+// held indirect blocks are given back when a file is closed, the next lookup reads them again
+// the caller holds i_map_lock
+void ext2_release_block_map(struct vfs_inode *inode)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	for (uint32_t i = 0; i < EXT2_N_BLOCKS - EXT2_NDIR_BLOCKS; ++i)
 	{
-		struct ext2_group_desc *gdp = ext2_get_group_desc(sb, group);
-		unsigned char *inode_bitmap = (unsigned char *)ext2_bread_block(sb, gdp->bg_inode_bitmap);
-
-		for (uint32_t i = 0; i < sb->s_blocksize; ++i)
-			if (inode_bitmap[i] != 0xff)
-				for (uint8_t j = 0; j < 8; ++j)
-					if (!(inode_bitmap[i] & (1 << j)))
-						return group * ext2_sb->s_inodes_per_group + i * 8 + j + EXT2_STARTING_INO;
+		if (ei->i_path_bh[i])
+			brelse(ei->i_path_bh[i]);
+		ei->i_path_bh[i] = NULL;
 	}
-	return -ENOSPC;
 }
 
-static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename, mode_t mode)
+/*
+  NOTE: MQ 2020-10-18
+  maps up to max_blocks logical blocks from iblock, returns how many of them are physically contiguous from *bno
+    - without create, 0 for a hole
+    - with create, missing indirect blocks are allocated first and data blocks follow them as one run from the goal
+      -> a sequential writer gets indirect and data blocks laid out contiguously with one allocation per run
+  a run never crosses the end of its leaf array, the next call goes on with the next indirect block
+  lookups are cached per inode on two levels
+    - runs which were mapped recently (extent cache) -> a sequential reader walks the tree once per run
+    - indirect blocks of the last walked path stay held -> the next run under the same parents costs no bread
+  blocks of a file are never freed (truncate does nothing yet), so cached runs never become stale
+  the caller writes the inode back after an allocation
+  both caches are shared by every opener and the walk sleeps (bread, s_alloc_lock)
+    -> the whole lookup runs under i_map_lock (not i_sem, read_cache_page holds it while mapping)
+*/
+static int32_t __ext2_get_blocks(struct vfs_inode *inode, uint32_t iblock, uint32_t max_blocks, uint32_t *bno, bool create, bool *new)
 {
-	struct ext2_superblock *ext2_sb = EXT2_SB(dir->i_sb);
-	uint32_t ino = find_unused_inode_number(dir->i_sb);
-	struct ext2_group_desc *gdp = ext2_get_group_desc(dir->i_sb, get_group_from_inode(ext2_sb, ino));
+	struct vfs_superblock *sb = inode->i_sb;
+	struct ext2_inode_info *ei = EXT2_I(inode);
+
+	uint32_t count = ext2_extent_lookup(ei, iblock, max_blocks, bno);
+	if (count)
+	{
+		if (new)
+			*new = false;
+		return count;
+	}
+
+	uint32_t offsets[4];
+	uint32_t boundary;
+	uint32_t depth = ext2_block_to_path(sb, iblock, offsets, &boundary);
+	if (!depth)
+		return -EFBIG;
+
+	// walk down as long as the path exists, array is i_block at level 0 and a held indirect block (array_bh) below
+	uint32_t *array = ei->i_raw.i_block;
+	struct buffer_head *array_bh = NULL;
+	uint32_t level = 0;
+	while (level < depth - 1 && array[offsets[level]])
+	{
+		array_bh = ext2_path_buffer(inode, level + 1, array[offsets[level]], NULL);
+		if (!array_bh)
+			return -EIO;
+		array = (uint32_t *)array_bh->b_data;
+		level++;
+	}
 
-	// superblock
-	ext2_sb->s_free_inodes_count -= 1;
-	dir->i_sb->s_op->write_super(dir->i_sb);
+	uint32_t *leaf = array + offsets[level];
+	if (level == depth - 1 && *leaf)
+	{
+		count = 1;
+		while (count < max_blocks && count <= boundary && leaf[count] == leaf[0] + count)
+			count++;
+		*bno = leaf[0];
+		if (new)
+			*new = false;
+	}
+	else if (create)
+	{
+		uint32_t goal = ext2_find_goal(inode, iblock);
+		uint32_t sectors_per_block = sb->s_blocksize / 512;
 
-	// group descriptor
-	gdp->bg_free_inodes_count -= 1;
-	if (S_ISDIR(mode))
-		gdp->bg_used_dirs_count += 1;
-	ext2_write_group_desc(dir->i_sb, gdp);
+		// missing indirect blocks, zeroed -> their entries are holes
+		for (; level < depth - 1; level++)
+		{
+			uint32_t n = 1;
+			uint32_t block = ext2_alloc_blocks(inode, goal, &n);
+			if (!block)
+				break;
+
+			struct buffer_head *bh = ext2_getblk(sb, block);
+			memset(bh->b_data, 0, sb->s_blocksize);
+			mark_buffer_dirty(bh);
+			array[offsets[level]] = block;
+			if (array_bh)
+				mark_buffer_dirty(array_bh);
+			array_bh = ext2_path_buffer(inode, level + 1, block, bh);
+			array = (uint32_t *)array_bh->b_data;
+			inode->i_blocks += sectors_per_block;
+			goal = block + 1;
+		}
+		if (level < depth - 1)
+			return -ENOSPC;
 
-	// inode bitmap
-	char *inode_bitmap_buf = ext2_bread_block(dir->i_sb, gdp->bg_inode_bitmap);
-	uint32_t relative_inode = get_relative_inode_in_group(ext2_sb, ino);
-	inode_bitmap_buf[relative_inode / 8] |= 1 << (relative_inode % 8);
-	ext2_bwrite_block(dir->i_sb, gdp->bg_inode_bitmap, inode_bitmap_buf);
+		leaf = array + offsets[level];
+		while (count < max_blocks && count <= boundary && !leaf[count])
+			count++;
+
+		uint32_t block = ext2_alloc_blocks(inode, goal, &count);
+		if (!block)
+			return -ENOSPC;
+		for (uint32_t i = 0; i < count; ++i)
+			leaf[i] = block + i;
+		if (array_bh)
+			mark_buffer_dirty(array_bh);
+
+		ei->i_next_alloc_block = iblock + count;
+		ei->i_next_alloc_goal = block + count;
+		inode->i_blocks += count * sectors_per_block;
+		*bno = block;
+		if (new)
+			*new = true;
+	}
+
+	if (count)
+		ext2_extent_insert(ei, iblock, *bno, count);
+	return count;
+}
+
+int32_t ext2_get_blocks(struct vfs_inode *inode, uint32_t iblock, uint32_t max_blocks, uint32_t *bno, bool create, bool *new)
+{
+	struct ext2_inode_info *ei = EXT2_I(inode);
+	rt_mutex_lock(&ei->i_map_lock);
+	int32_t ret = __ext2_get_blocks(inode, iblock, max_blocks, bno, create, new);
+	rt_mutex_unlock(&ei->i_map_lock);
+	return ret;
+}
+
+static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename, mode_t mode)
+{
+	struct ext2_superblock *ext2_sb = EXT2_SB(dir->i_sb);
+	uint32_t ino = ext2_new_inode(dir, mode);
+	if (!ino)
+		return NULL;
 
 	// inode table
-	struct ext2_inode *ei_new = kcalloc(1, sizeof(struct ext2_inode));
-	ei_new->i_links_count = 1;
+	struct ext2_inode_info *ei_new = kcalloc(1, sizeof(struct ext2_inode_info));
+	ei_new->i_raw.i_links_count = 1;
+	ei_new->i_block_group = get_group_from_inode(ext2_sb, ino);
+	rt_mutex_init(&ei_new->i_map_lock);
 	struct vfs_inode *inode = dir->i_sb->s_op->alloc_inode(dir->i_sb);
 	inode->i_ino = ino;
 	inode->i_mode = mode;
@@ -121,13 +285,18 @@ static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename
 		inode->i_fop = &ext2_dir_operations;
 
 		struct ext2_inode *ei = EXT2_INODE(inode);
-		uint32_t block = ext2_create_block(inode->i_sb);
+		uint32_t block = ext2_create_block(inode, 0);
+		if (!block)
+			return NULL;
 		ei->i_block[0] = block;
-		inode->i_blocks += 2;
-		inode->i_size += 1024;
+		inode->i_blocks += inode->i_sb->s_blocksize / 512;
+		inode->i_size += inode->i_sb->s_blocksize;
 		ext2_write_inode(inode);
 
-		char *block_buf = ext2_bread_block(inode->i_sb, block);
+		struct buffer_head *bh = ext2_bread_block(inode->i_sb, block);
+		if (!bh)
+			return NULL;
+		char *block_buf = bh->b_data;
 
 		struct ext2_dir_entry *c_entry = (struct ext2_dir_entry *)block_buf;
 		c_entry->ino = inode->i_ino;
@@ -140,10 +309,11 @@ static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename
 		p_entry->ino = dir->i_ino;
 		memcpy(p_entry->name, "..", 2);
 		p_entry->name_len = 2;
-		p_entry->rec_len = 1024 - c_entry->rec_len;
+		p_entry->rec_len = inode->i_sb->s_blocksize - c_entry->rec_len;
 		p_entry->file_type = 2;
 
-		ext2_bwrite_block(inode->i_sb, block, block_buf);
+		mark_buffer_dirty(bh);
+		brelse(bh);
 	}
 	dir->i_sb->s_op->write_inode(inode);
 
@@ -154,15 +324,21 @@ static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename
 		int block = ei->i_block[i];
 		if (!block)
 		{
-			block = ext2_create_block(dir->i_sb);
+			block = ext2_create_block(dir, i);
+			if (!block)
+				return NULL;
 			ei->i_block[i] = block;
-			dir->i_blocks += 2;
-			dir->i_size += 1024;
+			dir->i_blocks += dir->i_sb->s_blocksize / 512;
+			dir->i_size += dir->i_sb->s_blocksize;
 			ext2_write_inode(dir);
 		}
-		char *block_buf = ext2_bread_block(dir->i_sb, block);
+		struct buffer_head *bh = ext2_bread_block(dir->i_sb, block);
+		if (!bh)
+			return NULL;
+		char *block_buf = bh->b_data;
 
-		uint32_t size = 0, new_rec_len = 0;
+		// an empty entry at the start of a new block spans the whole block
+		uint32_t size = 0, new_rec_len = dir->i_sb->s_blocksize;
 		struct ext2_dir_entry *entry = (struct ext2_dir_entry *)block_buf;
 		while (size < dir->i_sb->s_blocksize && (char *)entry < block_buf + dir->i_sb->s_blocksize)
 		{
@@ -181,7 +357,8 @@ static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename
 				memcpy(entry->name, filename, entry->name_len);
 				entry->rec_len = new_rec_len;
 
-				ext2_bwrite_block(dir->i_sb, block, block_buf);
+				mark_buffer_dirty(bh);
+				brelse(bh);
 				return inode;
 			}
 			if (EXT2_DIR_REC_LEN(strlen(filename)) + EXT2_DIR_REC_LEN(entry->name_len) < entry->rec_len)
@@ -194,10 +371,11 @@ static struct vfs_inode *ext2_create_inode(struct vfs_inode *dir, char *filename
 			else
 			{
 				size += entry->rec_len;
-				new_rec_len = 1024 - size;
+				new_rec_len = dir->i_sb->s_blocksize - size;
 				entry = (struct ext2_dir_entry *)((char *)entry + entry->rec_len);
 			}
 		}
+		brelse(bh);
 	}
 	return NULL;
 }
@@ -210,7 +388,10 @@ static struct vfs_inode *ext2_lookup_inode(struct vfs_inode *dir, char *filename
 		int block = ei->i_block[i];
 		if (!block)
 			continue;
-		char *block_buf = ext2_bread_block(dir->i_sb, block);
+		struct buffer_head *bh = ext2_bread_block(dir->i_sb, block);
+		if (!bh)
+			return NULL;
+		char *block_buf = bh->b_data;
 
 		uint32_t size = 0;
 		struct ext2_dir_entry *entry = (struct ext2_dir_entry *)block_buf;
@@ -223,13 +404,19 @@ static struct vfs_inode *ext2_lookup_inode(struct vfs_inode *dir, char *filename
 			{
 				struct vfs_inode *inode = dir->i_sb->s_op->alloc_inode(dir->i_sb);
 				inode->i_ino = entry->ino;
-				ext2_read_inode(inode);
+				brelse(bh);
+				if (ext2_read_inode(inode) < 0)
+				{
+					kfree(inode);
+					return NULL;
+				}
 				return inode;
 			}
 
 			entry = (struct ext2_dir_entry *)((char *)entry + entry->rec_len);
 			size = size + entry->rec_len;
 		}
+		brelse(bh);
 	}
 	return NULL;
 }
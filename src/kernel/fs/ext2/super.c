@@ -9,38 +9,24 @@
 
 #include "ext2.h"
 
+// in-memory descriptor, a change is written back with the superblock -> set s_dirty after changing it
 struct ext2_group_desc *ext2_get_group_desc(struct vfs_superblock *sb, uint32_t group)
 {
-	struct ext2_group_desc *gdp = kcalloc(1, sizeof(struct ext2_group_desc));
-	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
-	uint32_t block = ext2_sb->s_first_data_block + 1 + group / EXT2_GROUPS_PER_BLOCK(ext2_sb);
-	char *group_block_buf = ext2_bread_block(sb, block);
-	uint32_t offset = group % EXT2_GROUPS_PER_BLOCK(ext2_sb) * sizeof(struct ext2_group_desc);
-	memcpy(gdp, group_block_buf + offset, sizeof(struct ext2_group_desc));
-	return gdp;
-}
-
-void ext2_write_group_desc(struct vfs_superblock *sb, struct ext2_group_desc *gdp)
-{
-	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
-	uint32_t group = get_group_from_block(ext2_sb, gdp->bg_block_bitmap);
-	uint32_t block = ext2_sb->s_first_data_block + 1 + group / EXT2_GROUPS_PER_BLOCK(ext2_sb);
-	uint32_t offset = group % EXT2_GROUPS_PER_BLOCK(ext2_sb) * sizeof(struct ext2_group_desc);
-	char *group_block_buf = ext2_bread_block(sb, block);
-	memcpy(group_block_buf + offset, gdp, sizeof(struct ext2_group_desc));
-	ext2_bwrite_block(sb, block, group_block_buf);
+	return &EXT2_SB_INFO(sb)->s_group_desc[group];
 }
 
-static struct ext2_inode *ext2_get_inode(struct vfs_superblock *sb, ino_t ino)
+static struct ext2_inode *ext2_get_inode(struct vfs_superblock *sb, ino_t ino, struct buffer_head **bh)
 {
 	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
 	uint32_t group = get_group_from_inode(ext2_sb, ino);
 	struct ext2_group_desc *gdp = ext2_get_group_desc(sb, group);
 	uint32_t block = gdp->bg_inode_table + get_relative_inode_in_group(ext2_sb, ino) / EXT2_INODES_PER_BLOCK(ext2_sb);
-	uint32_t offset = (get_relative_inode_in_group(ext2_sb, ino) % EXT2_INODES_PER_BLOCK(ext2_sb)) * sizeof(struct ext2_inode);
-	char *table_buf = ext2_bread_block(sb, block);
+	uint32_t offset = (get_relative_inode_in_group(ext2_sb, ino) % EXT2_INODES_PER_BLOCK(ext2_sb)) * EXT2_INODE_SIZE(ext2_sb);
 
-	return (struct ext2_inode *)(table_buf + offset);
+	*bh = ext2_bread_block(sb, block);
+	if (!*bh)
+		return NULL;
+	return (struct ext2_inode *)((*bh)->b_data + offset);
 }
 
 struct vfs_inode *ext2_alloc_inode(struct vfs_superblock *sb)
@@ -52,9 +38,20 @@ struct vfs_inode *ext2_alloc_inode(struct vfs_superblock *sb)
 	return i;
 }
 
-void ext2_read_inode(struct vfs_inode *i)
+int ext2_read_inode(struct vfs_inode *i)
 {
-	struct ext2_inode *raw_node = ext2_get_inode(i->i_sb, i->i_ino);
+	// in-memory copy, the inode table buffer can be evicted once it is released
+	struct buffer_head *bh;
+	struct ext2_inode *raw_disk = ext2_get_inode(i->i_sb, i->i_ino, &bh);
+	if (!raw_disk)
+		return -EIO;
+
+	struct ext2_inode_info *ei_info = kcalloc(1, sizeof(struct ext2_inode_info));
+	struct ext2_inode *raw_node = &ei_info->i_raw;
+	memcpy(raw_node, raw_disk, sizeof(struct ext2_inode));
+	brelse(bh);
+	ei_info->i_block_group = get_group_from_inode(EXT2_SB(i->i_sb), i->i_ino);
+	rt_mutex_init(&ei_info->i_map_lock);
 
 	i->i_mode = raw_node->i_mode;
 	i->i_gid = raw_node->i_gid;
@@ -70,7 +67,7 @@ void ext2_read_inode(struct vfs_inode *i)
 	i->i_blksize = PMM_FRAME_SIZE; /* This is the optimal IO size (for stat), not the fs block size */
 	i->i_blocks = raw_node->i_blocks;
 	i->i_flags = raw_node->i_flags;
-	i->i_fs_info = raw_node;
+	i->i_fs_info = ei_info;
 
 	if (S_ISREG(i->i_mode))
 	{
@@ -87,11 +84,11 @@ void ext2_read_inode(struct vfs_inode *i)
 		i->i_op = &ext2_special_inode_operations;
 		init_special_inode(i, i->i_mode, raw_node->i_block[0]);
 	}
+	return 0;
 }
 
 void ext2_write_inode(struct vfs_inode *i)
 {
-	struct ext2_superblock *ext2_sb = EXT2_SB(i->i_sb);
 	struct ext2_inode *ei = EXT2_INODE(i);
 
 	ei->i_mode = i->i_mode;
@@ -111,20 +108,57 @@ void ext2_write_inode(struct vfs_inode *i)
 		ei->i_block[0] = i->i_rdev;
 	}
 
-	uint32_t group = get_group_from_inode(ext2_sb, i->i_ino);
-	struct ext2_group_desc *gdp = ext2_get_group_desc(i->i_sb, group);
-	uint32_t block = gdp->bg_inode_table + get_relative_inode_in_group(ext2_sb, i->i_ino) / EXT2_INODES_PER_BLOCK(ext2_sb);
-	uint32_t offset = (get_relative_inode_in_group(ext2_sb, i->i_ino) % EXT2_INODES_PER_BLOCK(ext2_sb)) * sizeof(struct ext2_inode);
-	char *buf = ext2_bread_block(i->i_sb, block);
-
-	memcpy(buf + offset, ei, sizeof(struct ext2_inode));
-	ext2_bwrite_block(i->i_sb, block, buf);
+	// the in-memory copy stays, the next write_inode tries again
+	struct buffer_head *bh;
+	struct ext2_inode *raw_disk = ext2_get_inode(i->i_sb, i->i_ino, &bh);
+	if (!raw_disk)
+		return;
+	memcpy(raw_disk, ei, sizeof(struct ext2_inode));
+	mark_buffer_dirty(bh);
+	brelse(bh);
 }
 
+// NOTE: MQ 2020-10-18
+// allocations only change free counts in memory, superblock and descriptor table are copied into their buffers
+// here (called periodically by bdflush through sync_supers) -> many allocations cost one write of each
 static void ext2_write_super(struct vfs_superblock *sb)
 {
-	struct ext2_superblock *ext2_sb = EXT2_SB(sb);
-	ext2_bwrite_block(sb, ext2_sb->s_first_data_block, (char *)ext2_sb);
+	struct ext2_sb_info *sbi = EXT2_SB_INFO(sb);
+	rt_mutex_lock(&sbi->s_alloc_lock);
+	if (!sbi->s_dirty)
+	{
+		rt_mutex_unlock(&sbi->s_alloc_lock);
+		return;
+	}
+
+	// a block which cannot be read is not overwritten, s_dirty stays and the next call tries again
+	bool failed = false;
+	uint32_t gdt_block = sbi->s_es.s_first_data_block + 1;
+	uint32_t descs_per_block = EXT2_GROUPS_PER_BLOCK(&sbi->s_es);
+	for (uint32_t group = 0; group < sbi->s_groups_count; group += descs_per_block)
+	{
+		struct buffer_head *bh = ext2_bread_block(sb, gdt_block + group / descs_per_block);
+		if (!bh)
+		{
+			failed = true;
+			continue;
+		}
+		uint32_t count = min_t(uint32_t, descs_per_block, sbi->s_groups_count - group);
+		memcpy(bh->b_data, &sbi->s_group_desc[group], count * sizeof(struct ext2_group_desc));
+		mark_buffer_dirty(bh);
+		brelse(bh);
+	}
+
+	struct buffer_head *bh = bread(sb->mnt_devname, EXT2_SUPERBLOCK_OFFSET / 512, sizeof(struct ext2_superblock));
+	if (bh)
+	{
+		memcpy(bh->b_data, &sbi->s_es, sizeof(struct ext2_superblock));
+		mark_buffer_dirty(bh);
+		brelse(bh);
+	}
+
+	sbi->s_dirty = failed || !bh;
+	rt_mutex_unlock(&sbi->s_alloc_lock);
 }
 
 struct vfs_super_operations ext2_super_operations = {
@@ -136,18 +170,54 @@ struct vfs_super_operations ext2_super_operations = {
 
 static int ext2_fill_super(struct vfs_superblock *sb)
 {
-	struct ext2_superblock *ext2_sb = (struct ext2_superblock *)kcalloc(1, sizeof(struct ext2_superblock));
-	char *buf = ext2_bread_block(sb, 1);
-	memcpy(ext2_sb, (struct ext2_superblock *)buf, sb->s_blocksize);
+	struct ext2_sb_info *sbi = kcalloc(1, sizeof(struct ext2_sb_info));
+	struct ext2_superblock *ext2_sb = &sbi->s_es;
+	// superblock is 1024 bytes into the disk whatever the block size is, ext2_write_super uses the same buffer
+	struct buffer_head *bh = bread(sb->mnt_devname, EXT2_SUPERBLOCK_OFFSET / 512, sizeof(struct ext2_superblock));
+	if (!bh)
+	{
+		kfree(sbi);
+		return -EIO;
+	}
+	memcpy(ext2_sb, bh->b_data, sizeof(struct ext2_superblock));
+	brelse(bh);
 
-	if (ext2_sb->s_magic != EXT2_SUPER_MAGIC)
+	if (ext2_sb->s_magic != EXT2_SUPER_MAGIC || EXT2_BLOCK_SIZE(ext2_sb) > EXT2_MAX_BLOCK_SIZE)
+	{
+		kfree(sbi);
 		return -EINVAL;
+	}
 
-	sb->s_fs_info = ext2_sb;
+	sb->s_fs_info = sbi;
 	sb->s_op = &ext2_super_operations;
 	sb->s_blocksize = EXT2_BLOCK_SIZE(ext2_sb);
-	sb->s_blocksize_bits = ext2_sb->s_log_block_size;
+	sb->s_blocksize_bits = EXT2_MIN_BLOCK_LOG_SIZE + ext2_sb->s_log_block_size;
 	sb->s_magic = EXT2_SUPER_MAGIC;
+
+	// descriptor table is kept in memory, bitmaps are loaded when a group is first allocated from
+	sbi->s_groups_count = div_ceil(ext2_sb->s_blocks_count - ext2_sb->s_first_data_block, ext2_sb->s_blocks_per_group);
+	sbi->s_group_desc = kcalloc(sbi->s_groups_count, sizeof(struct ext2_group_desc));
+	sbi->s_block_bitmap = kcalloc(sbi->s_groups_count, sizeof(struct buffer_head *));
+	sbi->s_inode_bitmap = kcalloc(sbi->s_groups_count, sizeof(struct buffer_head *));
+	rt_mutex_init(&sbi->s_alloc_lock);
+
+	uint32_t descs_per_block = EXT2_GROUPS_PER_BLOCK(ext2_sb);
+	for (uint32_t group = 0; group < sbi->s_groups_count; group += descs_per_block)
+	{
+		bh = ext2_bread_block(sb, ext2_sb->s_first_data_block + 1 + group / descs_per_block);
+		if (!bh)
+		{
+			sb->s_fs_info = NULL;
+			kfree(sbi->s_group_desc);
+			kfree(sbi->s_block_bitmap);
+			kfree(sbi->s_inode_bitmap);
+			kfree(sbi);
+			return -EIO;
+		}
+		uint32_t count = min_t(uint32_t, descs_per_block, sbi->s_groups_count - group);
+		memcpy(&sbi->s_group_desc[group], bh->b_data, count * sizeof(struct ext2_group_desc));
+		brelse(bh);
+	}
 	return 0;
 }
 
@@ -158,11 +228,19 @@ static struct vfs_mount *ext2_mount(struct vfs_file_system_type *fs_type,
 	sb->s_blocksize = EXT2_MIN_BLOCK_SIZE;
 	sb->mnt_devname = dev_name;
 	sb->s_type = fs_type;
-	ext2_fill_super(sb);
+	if (ext2_fill_super(sb) < 0)
+	{
+		kfree(sb);
+		return NULL;
+	}
 
 	struct vfs_inode *i_root = ext2_alloc_inode(sb);
 	i_root->i_ino = EXT2_ROOT_INO;
-	ext2_read_inode(i_root);
+	if (ext2_read_inode(i_root) < 0)
+	{
+		kfree(i_root);
+		return NULL;
+	}
 
 	struct vfs_dentry *d_root = alloc_dentry(NULL, dir_name);
 	d_root->d_inode = i_root;
@@ -193,22 +271,17 @@ void exit_ext2_fs()
 	unregister_filesystem(&ext2_fs_type);
 }
 
-char *ext2_bread_block(struct vfs_superblock *sb, uint32_t block)
+struct buffer_head *ext2_bread_block(struct vfs_superblock *sb, uint32_t block)
 {
 	return ext2_bread(sb, block, sb->s_blocksize);
 }
 
-char *ext2_bread(struct vfs_superblock *sb, uint32_t block, uint32_t size)
+struct buffer_head *ext2_bread(struct vfs_superblock *sb, uint32_t block, uint32_t size)
 {
 	return bread(sb->mnt_devname, block * (sb->s_blocksize / 512), size);
 }
 
-void ext2_bwrite_block(struct vfs_superblock *sb, uint32_t block, char *buf)
-{
-	return ext2_bwrite(sb, block, buf, sb->s_blocksize);
-}
-
-void ext2_bwrite(struct vfs_superblock *sb, uint32_t block, char *buf, uint32_t size)
+struct buffer_head *ext2_getblk(struct vfs_superblock *sb, uint32_t block)
 {
-	return bwrite(sb->mnt_devname, block * (sb->s_blocksize / 512), buf, size);
+	return getblk(sb->mnt_devname, block * (sb->s_blocksize / 512), sb->s_blocksize);
 }
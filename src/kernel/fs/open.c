@@ -1,3 +1,4 @@
+#include <include/fcntl.h>
 #include <include/limits.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
@@ -18,7 +19,9 @@ struct vfs_dentry *alloc_dentry(struct vfs_dentry *parent, char *name)
 	return d;
 }
 
-struct nameidata *path_walk(const char *path, mode_t mode)
+// a missing component is created (as a directory, the last one with mode) unless create is false,
+// then the walk stops and returns NULL
+static struct nameidata *do_path_walk(const char *path, mode_t mode, bool create)
 {
 	struct nameidata *nd = kcalloc(1, sizeof(struct nameidata));
 	nd->dentry = current_process->fs->d_root;
@@ -50,6 +53,13 @@ struct nameidata *path_walk(const char *path, mode_t mode)
 			struct vfs_inode *inode = NULL;
 			if (nd->dentry->d_inode->i_op->lookup)
 				inode = nd->dentry->d_inode->i_op->lookup(nd->dentry->d_inode, d_child->d_name);
+			if (inode == NULL && !create)
+			{
+				kfree(d_child);
+				kfree(part_name);
+				kfree(nd);
+				return NULL;
+			}
 			if (inode == NULL)
 			{
 				uint32_t part_mode = S_IFDIR;
@@ -69,6 +79,16 @@ struct nameidata *path_walk(const char *path, mode_t mode)
 	return nd;
 }
 
+struct nameidata *path_walk(const char *path, mode_t mode)
+{
+	return do_path_walk(path, mode, true);
+}
+
+struct nameidata *path_lookup(const char *path)
+{
+	return do_path_walk(path, 0, false);
+}
+
 struct vfs_file *get_empty_filp()
 {
 	struct vfs_file *file = kcalloc(1, sizeof(struct vfs_file));
@@ -77,29 +97,65 @@ struct vfs_file *get_empty_filp()
 	return file;
 }
 
-int32_t vfs_open(const char *path, int32_t flags)
+static struct vfs_file *dentry_open(struct nameidata *nd, int32_t flags)
 {
-	int fd = find_unused_fd_slot();
-	struct nameidata *nd = path_walk(path, S_IFREG);
-
 	struct vfs_file *file = get_empty_filp();
 	file->f_dentry = nd->dentry;
 	file->f_vfsmnt = nd->mnt;
 	file->f_flags = flags;
 	file->f_op = nd->dentry->d_inode->i_fop;
+	kfree(nd);
 
 	if (file->f_op && file->f_op->open)
-		file->f_op->open(nd->dentry->d_inode, file);
+		file->f_op->open(file->f_dentry->d_inode, file);
+
+	return file;
+}
+
+// opened file is not installed in fd table (kernel internal use like mapping elf)
+struct vfs_file *filp_open(const char *path, int32_t flags)
+{
+	return dentry_open(path_walk(path, S_IFREG), flags);
+}
+
+// program or library to load, unlike filp_open a missing path is not created, returns NULL instead
+struct vfs_file *open_exec(const char *path)
+{
+	struct nameidata *nd = path_lookup(path);
+	return nd ? dentry_open(nd, O_RDONLY) : NULL;
+}
+
+// drops a reference which is not in an fd table (mapped areas, kernel users), the last one releases the file
+void fput(struct vfs_file *file)
+{
+	if (!atomic_dec_and_test(&file->f_count))
+		return;
+
+	if (file->f_op && file->f_op->release)
+		file->f_op->release(file->f_dentry->d_inode, file);
+	kfree(file);
+}
+
+// mode only has effect when the file does not exist and is created
+int32_t vfs_open_mode(const char *path, int32_t flags, mode_t mode)
+{
+	int fd = find_unused_fd_slot();
+	struct vfs_file *file = dentry_open(path_walk(path, S_IFREG | (mode & ~S_IFMT)), flags);
 
 	current_process->files->fd[fd] = file;
 	return fd;
 }
 
+int32_t vfs_open(const char *path, int32_t flags)
+{
+	return vfs_open_mode(path, flags, 0);
+}
+
 int32_t vfs_close(int32_t fd)
 {
 	struct files_struct *files = current_process->files;
 
-	acquire_semaphore(&files->lock);
+	rt_mutex_lock(&files->lock);
 
 	struct vfs_file *f = files->fd[fd];
 	atomic_dec(&f->f_count);
@@ -107,7 +163,7 @@ int32_t vfs_close(int32_t fd)
 		f->f_op->release(f->f_dentry->d_inode, f);
 	files->fd[fd] = NULL;
 
-	release_semaphore(&files->lock);
+	rt_mutex_unlock(&files->lock);
 	return 0;
 }
 
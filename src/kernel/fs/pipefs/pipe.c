@@ -3,7 +3,7 @@
 #include <include/errno.h>
 #include <include/fcntl.h>
 #include <kernel/fs/vfs.h>
-#include <kernel/locking/semaphore.h>
+#include <kernel/locking/rt_mutex.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
 #include <kernel/system/time.h>
@@ -15,10 +15,10 @@ static ssize_t pipe_read(struct vfs_file *file, char *buf, size_t count, loff_t
 		return -EINVAL;
 
 	struct pipe *p = file->f_dentry->d_inode->i_pipe;
-	acquire_semaphore(&p->mutex);
+	rt_mutex_lock(&p->mutex);
 	for (uint32_t i = 0; i < count; ++i)
 		circular_buf_get(p->buf, buf + i);
-	release_semaphore(&p->mutex);
+	rt_mutex_unlock(&p->mutex);
 	return 0;
 }
 
@@ -28,10 +28,10 @@ static ssize_t pipe_write(struct vfs_file *file, const char *buf, size_t count,
 		return -EINVAL;
 
 	struct pipe *p = file->f_dentry->d_inode->i_pipe;
-	acquire_semaphore(&p->mutex);
+	rt_mutex_lock(&p->mutex);
 	for (uint32_t i = 0; i < count; ++i)
 		circular_buf_put(p->buf, buf[i]);
-	release_semaphore(&p->mutex);
+	rt_mutex_unlock(&p->mutex);
 	return 0;
 }
 
@@ -39,7 +39,7 @@ static int pipe_open(struct vfs_inode *inode, struct vfs_file *file)
 {
 	struct pipe *p = inode->i_pipe;
 
-	acquire_semaphore(&p->mutex);
+	rt_mutex_lock(&p->mutex);
 	switch (file->f_flags)
 	{
 	case O_RDONLY:
@@ -50,7 +50,7 @@ static int pipe_open(struct vfs_inode *inode, struct vfs_file *file)
 		p->writers++;
 		break;
 	}
-	release_semaphore(&p->mutex);
+	rt_mutex_unlock(&p->mutex);
 	return 0;
 }
 
@@ -58,7 +58,7 @@ static int pipe_release(struct vfs_inode *inode, struct vfs_file *file)
 {
 	struct pipe *p = inode->i_pipe;
 
-	acquire_semaphore(&p->mutex);
+	rt_mutex_lock(&p->mutex);
 	p->files--;
 	switch (file->f_flags)
 	{
@@ -70,7 +70,7 @@ static int pipe_release(struct vfs_inode *inode, struct vfs_file *file)
 		p->writers--;
 		break;
 	}
-	release_semaphore(&p->mutex);
+	rt_mutex_unlock(&p->mutex);
 
 	if (!p->files && !p->writers && !p->readers)
 	{
@@ -95,7 +95,7 @@ static struct pipe *alloc_pipe()
 	p->readers = 0;
 	p->writers = 0;
 
-	sema_init(&p->mutex, 1);
+	rt_mutex_init(&p->mutex);
 
 	char *buf = kcalloc(PIPE_SIZE, sizeof(char));
 	p->buf = circular_buf_init(buf, PIPE_SIZE);
@@ -116,7 +116,7 @@ static struct vfs_inode *get_pipe_inode()
 	inode->i_ctime.tv_sec = get_seconds(NULL);
 	inode->i_mtime.tv_sec = get_seconds(NULL);
 	inode->i_pipe = p;
-	sema_init(&inode->i_sem, 1);
+	rt_mutex_init(&inode->i_sem);
 	inode->i_fop = &pipe_fops;
 
 	return inode;
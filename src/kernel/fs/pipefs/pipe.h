@@ -1,7 +1,7 @@
 #ifndef FS_PIPE_H
 #define FS_PIPE_H
 
-#include <kernel/locking/semaphore.h>
+#include <kernel/locking/rt_mutex.h>
 #include <kernel/utils/circular_buffer.h>
 
 #include "kernel/fs/vfs.h"
@@ -11,7 +11,7 @@
 struct pipe
 {
 	struct circular_buf_t *buf;
-	struct semaphore mutex;
+	struct rt_mutex mutex;
 	uint32_t files;
 	uint32_t readers;
 	uint32_t writers;
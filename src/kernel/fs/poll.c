@@ -3,31 +3,40 @@
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
 
+static void poll_table_init(struct poll_table *pt)
+{
+	INIT_LIST_HEAD(&pt->list);
+	pt->inline_index = 0;
+}
+
 static void poll_table_free(struct poll_table *pt)
 {
 	struct poll_table_entry *iter, *next;
 
 	list_for_each_entry_safe(iter, next, &pt->list, sibling)
 	{
-		list_del(&iter->wait.sibling);
+		remove_wait_queue(iter->wait_head, &iter->wait);
 		list_del(&iter->sibling);
-		kfree(iter);
+		if (iter < pt->inline_entries || iter >= pt->inline_entries + N_INLINE_POLL_ENTRIES)
+			kfree(iter);
 	}
-	kfree(pt);
-}
-
-void poll_wakeup(struct thread *t)
-{
-	update_thread(t, THREAD_READY);
+	pt->inline_index = 0;
 }
 
 void poll_wait(struct vfs_file *file, struct wait_queue_head *wh, struct poll_table *pt)
 {
-	struct poll_table_entry *pe = kcalloc(sizeof(struct poll_table_entry), 1);
+	struct poll_table_entry *pe;
+	if (pt->inline_index < N_INLINE_POLL_ENTRIES)
+		pe = &pt->inline_entries[pt->inline_index++];
+	else
+		pe = kcalloc(sizeof(struct poll_table_entry), 1);
+
 	pe->file = file;
-	pe->wait.func = poll_wakeup;
+	pe->wait_head = wh;
+	pe->wait.flags = 0;
+	pe->wait.func = default_wake_function;
 	pe->wait.thread = current_thread;
-	list_add_tail(&pe->wait.sibling, &wh->list);
+	add_wait_queue(wh, &pe->wait);
 	list_add_tail(&pe->sibling, &pt->list);
 }
 
@@ -35,11 +44,12 @@ int do_poll(struct pollfd *fds, uint32_t nfds)
 {
 	int32_t nr;
 
+	struct poll_table table;
+	struct poll_table *pt = &table;
+
+	poll_table_init(pt);
 	while (true)
 	{
-		struct poll_table *pt = kcalloc(sizeof(struct poll_table), 1);
-		INIT_LIST_HEAD(&pt->list);
-
 		nr = 0;
 		for (uint32_t i = 0; i < nfds; ++i)
 		{
@@ -18,18 +18,25 @@
 #define POLLMSG 0x0400
 #define POLLREMOVE 0x1000
 
-struct poll_table
-{
-	struct list_head list;
-};
-
 struct poll_table_entry
 {
 	struct vfs_file *file;
+	struct wait_queue_head *wait_head;
 	struct wait_queue_entry wait;
 	struct list_head sibling;
 };
 
+// NOTE: MQ 2020-10-15
+// poll table lives on do_poll's stack, first entries are inline and only larger polls fall back to kcalloc
+#define N_INLINE_POLL_ENTRIES 8
+
+struct poll_table
+{
+	struct list_head list;
+	uint32_t inline_index;
+	struct poll_table_entry inline_entries[N_INLINE_POLL_ENTRIES];
+};
+
 struct pollfd
 {
 	int32_t fd;		 /* file descriptor */
@@ -39,6 +46,5 @@ struct pollfd
 
 int do_poll(struct pollfd *fds, uint32_t nfds);
 void poll_wait(struct vfs_file *file, struct wait_queue_head *wh, struct poll_table *pt);
-void poll_wakeup(struct thread *t);
 
 #endif
@@ -38,3 +38,51 @@ loff_t vfs_flseek(int32_t fd, loff_t offset)
 	struct vfs_file *file = current_process->files->fd[fd];
 	return file->f_op->llseek(file, offset);
 }
+
+/*
+  NOTE: MQ 2020-10-18
+  Readahead policy, a file system reads blocks [first, last) of a file and then the window this returns
+    - a read continuing the previous one (or inside the window) is sequential (hit)
+      the first one opens a window right after itself, twice as large as the read (at least RA_MIN_BLOCKS)
+      once the reader reaches the window, the next one is read ahead and doubled up to RA_MAX_BLOCKS
+      -> disk streams the file while the reader consumes the previous window
+    - any other read is random (miss), the window shrinks to a quarter, below RA_MIN_BLOCKS nothing is read ahead
+  returns the number of blocks to read ahead from *ra_start
+*/
+uint32_t file_ra_advance(struct file_ra_state *ra, uint32_t first, uint32_t last, uint32_t *ra_start)
+{
+	// small reads continue in the last block of the previous one
+	bool sequential = (first <= ra->prev_block && first + 1 >= ra->prev_block) ||
+					  (first >= ra->start && first < ra->start + ra->size);
+	ra->prev_block = last;
+
+	uint32_t nr = 0;
+	if (sequential)
+	{
+		ra->hits++;
+		if (!ra->size)
+		{
+			ra->start = last;
+			ra->size = min_t(uint32_t, max_t(uint32_t, 2 * (last - first), RA_MIN_BLOCKS), RA_MAX_BLOCKS);
+			nr = ra->size;
+		}
+		else if (last > ra->start)
+		{
+			ra->start = max_t(uint32_t, ra->start + ra->size, last);
+			ra->size = min_t(uint32_t, 2 * ra->size, RA_MAX_BLOCKS);
+			nr = ra->size;
+		}
+	}
+	else
+	{
+		ra->misses++;
+		ra->size /= 4;
+		if (ra->size < RA_MIN_BLOCKS)
+			ra->size = 0;
+		ra->start = last;
+		nr = ra->size;
+	}
+
+	*ra_start = ra->start;
+	return nr;
+}
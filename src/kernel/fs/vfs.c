@@ -65,7 +65,8 @@ struct vfs_inode *init_inode()
 	struct vfs_inode *i = kcalloc(1, sizeof(struct vfs_inode));
 	i->i_blocks = 0;
 	i->i_size = 0;
-	sema_init(&i->i_sem, 1);
+	rt_mutex_init(&i->i_sem);
+	INIT_LIST_HEAD(&i->i_data.pages);
 
 	return i;
 }
@@ -108,9 +109,22 @@ struct vfs_mount *do_mount(const char *fstype, int flags, const char *path)
 	return mnt;
 }
 
+// super blocks keep allocation state in memory, bdflush calls this before writing dirty buffers back
+void sync_supers()
+{
+	struct vfs_mount *iter;
+	list_for_each_entry(iter, &vfsmntlist, sibling)
+	{
+		struct vfs_superblock *sb = iter->mnt_sb;
+		if (sb && sb->s_op && sb->s_op->write_super)
+			sb->s_op->write_super(sb);
+	}
+}
+
 static void init_rootfs(struct vfs_file_system_type *fs_type, char *dev_name)
 {
 	struct vfs_mount *mnt = fs_type->mount(fs_type, dev_name, "/");
+	assert(mnt);
 	list_add_tail(&mnt->sibling, &vfsmntlist);
 
 	current_process->fs->d_root = mnt->mnt_root;
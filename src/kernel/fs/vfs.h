@@ -5,7 +5,7 @@
 #include <include/ctype.h>
 #include <include/list.h>
 #include <kernel/fs/poll.h>
-#include <kernel/locking/semaphore.h>
+#include <kernel/locking/rt_mutex.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -117,7 +117,7 @@ struct vfs_superblock
 struct vfs_super_operations
 {
 	struct vfs_inode *(*alloc_inode)(struct vfs_superblock *sb);
-	void (*read_inode)(struct vfs_inode *);
+	int (*read_inode)(struct vfs_inode *);
 	void (*write_inode)(struct vfs_inode *);
 	void (*write_super)(struct vfs_superblock *);
 };
@@ -138,7 +138,7 @@ struct vfs_inode
 	unsigned long i_blksize;
 	uint32_t i_flags;
 	uint32_t i_size;
-	struct semaphore i_sem;
+	struct rt_mutex i_sem;
 	struct pipe *i_pipe;
 	struct address_space i_data;
 	struct vfs_inode_operations *i_op;
@@ -168,6 +168,19 @@ struct vfs_dentry
 	struct list_head d_sibling;
 };
 
+#define RA_MIN_BLOCKS 4
+#define RA_MAX_BLOCKS 128
+
+// readahead window of an open file, in file system blocks
+struct file_ra_state
+{
+	uint32_t start;		  // first block of the last window read ahead
+	uint32_t size;		  // blocks of that window, 0 -> access looks random, nothing is read ahead
+	uint32_t prev_block;  // block after the previous read, a sequential reader continues there
+	uint32_t hits;		  // reads which continued sequentially
+	uint32_t misses;	  // reads which jumped elsewhere
+};
+
 struct vfs_file
 {
 	struct vfs_dentry *f_dentry;
@@ -179,6 +192,7 @@ struct vfs_file
 	void *private_data;
 	mode_t f_mode;
 	loff_t f_pos;
+	struct file_ra_state f_ra;
 };
 
 struct vfs_file_operations
@@ -207,15 +221,21 @@ void vfs_init(struct vfs_file_system_type *fs, char *dev_name);
 struct vfs_inode *init_inode();
 void init_special_inode(struct vfs_inode *inode, umode_t mode, dev_t dev);
 struct vfs_mount *do_mount(const char *fstype, int flags, const char *name);
+void sync_supers();
 
 // open.c
 struct vfs_dentry *alloc_dentry(struct vfs_dentry *parent, char *name);
+struct vfs_file *filp_open(const char *path, int32_t flags);
+struct vfs_file *open_exec(const char *path);
+void fput(struct vfs_file *file);
 int32_t vfs_open(const char *path, int32_t flags);
+int32_t vfs_open_mode(const char *path, int32_t flags, mode_t mode);
 int32_t vfs_close(int32_t fd);
 int vfs_stat(const char *path, struct kstat *stat);
 int vfs_fstat(int32_t fd, struct kstat *stat);
 int vfs_mknod(const char *path, int mode, dev_t dev);
 struct nameidata *path_walk(const char *path, mode_t mode);
+struct nameidata *path_lookup(const char *path);
 int vfs_truncate(const char *path, int32_t length);
 int vfs_ftruncate(int32_t fd, int32_t length);
 struct vfs_file *get_empty_filp();
@@ -226,5 +246,6 @@ ssize_t vfs_fread(int32_t fd, char *buf, size_t count);
 int vfs_write(const char *path, const char *buf, size_t count);
 ssize_t vfs_fwrite(int32_t fd, const char *buf, size_t count);
 loff_t vfs_flseek(int32_t fd, loff_t offset);
+uint32_t file_ra_advance(struct file_ra_state *ra, uint32_t first, uint32_t last, uint32_t *ra_start);
 
 #endif
@@ -68,7 +68,6 @@ int32_t mq_unlink(const char *name)
 	list_for_each_entry_safe(siter, snext, &mq->senders, sibling)
 	{
 		list_del(&siter->sibling);
-		kfree(siter);
 		update_thread(siter->sender, THREAD_READY);
 	}
 
@@ -76,7 +75,6 @@ int32_t mq_unlink(const char *name)
 	list_for_each_entry_safe(riter, rnext, &mq->receivers, sibling)
 	{
 		list_del(&riter->sibling);
-		kfree(riter);
 		update_thread(riter->receiver, THREAD_READY);
 	}
 
@@ -133,6 +131,12 @@ static void mq_add_receiver(struct message_queue *mq, struct mq_receiver *mqr)
 		list_add(&mqr->sibling, iter->sibling.prev);
 }
 
+// mq_unlink frees the queue and wakes its waiters, a woken waiter must not touch mq afterwards
+static bool mq_is_unlinked(struct vfs_file *file, struct message_queue *mq)
+{
+	return hashmap_get(&mq_map, file->f_dentry->d_name) != mq;
+}
+
 int32_t mq_send(int32_t fd, char *user_buf, uint32_t priority, uint32_t msize)
 {
 	struct vfs_file *file = current_thread->parent->files->fd[fd];
@@ -148,16 +152,23 @@ int32_t mq_send(int32_t fd, char *user_buf, uint32_t priority, uint32_t msize)
 	assert(mq->attr->mq_curmsgs <= mq->attr->mq_maxmsg);
 	if (mq->attr->mq_curmsgs == mq->attr->mq_maxmsg)
 	{
-		if (mq->attr->mq_flags & O_NONBLOCK == 0)
+		if ((mq->attr->mq_flags & O_NONBLOCK) == 0)
 		{
-			struct mq_sender *mqs;
-			wait_until_with_setup(list_is_poison(&mqs->sibling) && mq->attr->mq_curmsgs < mq->attr->mq_maxmsg, ({
-									  mqs = kcalloc(1, sizeof(struct mq_sender));
-									  mqs->sender = current_thread;
-									  mqs->priority = priority;
-									  mq_add_sender(mq, mqs);
-								  }),
-								  kfree(mqs));
+			// waiter record is on the stack, it is unlinked by the receiver (or unlink) before we are woken
+			// sibling starts poisoned (not queued), a queued record is never queued again
+			struct mq_sender mqs = {
+				.sender = current_thread,
+				.priority = priority,
+				.sibling = {LIST_POISON1, LIST_POISON2},
+			};
+			wait_until_with_prework(list_is_poison(&mqs.sibling) &&
+										(mq_is_unlinked(file, mq) || mq->attr->mq_curmsgs < mq->attr->mq_maxmsg),
+									({
+										if (list_is_poison(&mqs.sibling))
+											mq_add_sender(mq, &mqs);
+									}));
+			if (mq_is_unlinked(file, mq))
+				return -ESHUTDOWN;
 		}
 		else
 			return -EAGAIN;
@@ -207,22 +218,27 @@ int32_t mq_receive(int32_t fd, char *user_buf, uint32_t priority, uint32_t msize
 		struct mq_sender *mqs = list_first_entry_or_null(&mq->senders, struct mq_sender, sibling);
 		if (mqs)
 		{
-			list_del(mqs);
+			list_del(&mqs->sibling);
 			update_thread(mqs->sender, THREAD_READY);
 		}
 	}
 	else if (mq->attr->mq_curmsgs == 0)
 	{
-		if (mq->attr->mq_flags & O_NONBLOCK == 0)
+		if ((mq->attr->mq_flags & O_NONBLOCK) == 0)
 		{
-			struct mq_receiver *mqr;
-			wait_until_with_setup(mq->attr->mq_curmsgs > 0 && list_is_poison(&mqr->sibling), ({
-									  mqr = kcalloc(1, sizeof(struct mq_receiver));
-									  mqr->priority = priority;
-									  mqr->receiver = current_thread;
-									  mq_add_receiver(mq, mqr);
-								  }),
-								  kfree(mqr));
+			struct mq_receiver mqr = {
+				.receiver = current_thread,
+				.priority = priority,
+				.sibling = {LIST_POISON1, LIST_POISON2},
+			};
+			wait_until_with_prework(list_is_poison(&mqr.sibling) &&
+										(mq_is_unlinked(file, mq) || mq->attr->mq_curmsgs > 0),
+									({
+										if (list_is_poison(&mqr.sibling))
+											mq_add_receiver(mq, &mqr);
+									}));
+			if (mq_is_unlinked(file, mq))
+				return -ESHUTDOWN;
 		}
 		else
 			return -EAGAIN;
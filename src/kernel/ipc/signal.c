@@ -90,7 +90,13 @@ int do_kill(pid_t pid, int32_t signum)
 	if (pid > 0)
 	{
 		struct process *proc = find_process_by_pid(pid);
+		if (!proc)
+			return -ESRCH;
+
+		// zombie, its thread is already released
 		struct thread *th = proc->thread;
+		if (!th)
+			return 0;
 
 		if (signum == SIGCONT)
 		{
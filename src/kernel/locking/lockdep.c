@@ -0,0 +1,156 @@
+#ifdef CONFIG_LOCKDEP
+
+#include "lockdep.h"
+
+#include <kernel/cpu/hal.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+#include <stdbool.h>
+
+#include "spinlock.h"
+
+#define LOCKDEP_MAX_CLASSES 64
+#define LOCKDEP_MAX_HELD 16
+
+struct lock_class
+{
+	const char *name;
+	// bit n is set when class n was taken while holding this class
+	uint32_t after[LOCKDEP_MAX_CLASSES / 32];
+};
+
+static struct lock_class lock_classes[LOCKDEP_MAX_CLASSES];
+static uint32_t nr_lock_classes;
+static struct spinlock *held_locks[LOCKDEP_MAX_HELD];
+static uint32_t nr_held_locks;
+// after the first report, the checker turns itself off to not flood the log
+static bool lockdep_off;
+
+static void lockdep_report(const char *reason, struct spinlock *held, struct spinlock *lock)
+{
+	lockdep_off = true;
+	DEBUG &&debug_println(DEBUG_ERROR, "[lockdep] %s: %s -> %s", reason, held ? held->name : "", lock->name);
+	for (uint32_t i = 0; i < nr_held_locks; ++i)
+		DEBUG &&debug_println(DEBUG_ERROR, "\theld %s", held_locks[i]->name);
+}
+
+static struct lock_class *lock_class_of(struct spinlock *lock)
+{
+	if (lock->class)
+		return lock->class;
+
+	for (uint32_t i = 0; i < nr_lock_classes; ++i)
+		if (!strcmp(lock_classes[i].name, lock->name))
+			return lock->class = &lock_classes[i];
+
+	if (nr_lock_classes >= LOCKDEP_MAX_CLASSES)
+		return NULL;
+
+	struct lock_class *class = &lock_classes[nr_lock_classes++];
+	class->name = lock->name;
+	return lock->class = class;
+}
+
+static inline uint32_t class_index(struct lock_class *class)
+{
+	return class - lock_classes;
+}
+
+static inline bool class_is_after(struct lock_class *class, uint32_t idx)
+{
+	return class->after[idx / 32] & (1 << (idx % 32));
+}
+
+// is `to` taken (directly or transitively) while `from` is held
+static bool class_reaches(struct lock_class *from, struct lock_class *to, uint32_t *visited)
+{
+	uint32_t from_idx = class_index(from);
+	if (visited[from_idx / 32] & (1 << (from_idx % 32)))
+		return false;
+	visited[from_idx / 32] |= 1 << (from_idx % 32);
+
+	uint32_t to_idx = class_index(to);
+	if (class_is_after(from, to_idx))
+		return true;
+
+	for (uint32_t i = 0; i < nr_lock_classes; ++i)
+		if (class_is_after(from, i) && class_reaches(&lock_classes[i], to, visited))
+			return true;
+	return false;
+}
+
+void lockdep_acquire(struct spinlock *lock)
+{
+	if (lockdep_off)
+		return;
+
+	uint32_t flags = local_irq_save();
+
+	struct lock_class *class = lock_class_of(lock);
+	if (!class)
+	{
+		DEBUG &&debug_println(DEBUG_WARNING, "[lockdep] too many lock classes, turning off");
+		lockdep_off = true;
+		local_irq_restore(flags);
+		return;
+	}
+
+	for (uint32_t i = 0; i < nr_held_locks && !lockdep_off; ++i)
+	{
+		struct spinlock *held = held_locks[i];
+		struct lock_class *held_class = held->class;
+
+		if (held == lock)
+			lockdep_report("recursive locking", held, lock);
+		// objects of the same class (two semaphores, two sockets) are not ordered
+		else if (held_class == class)
+			continue;
+		else
+		{
+			uint32_t visited[LOCKDEP_MAX_CLASSES / 32] = {0};
+			if (class_reaches(class, held_class, visited))
+				lockdep_report("lock order inversion", held, lock);
+			else
+				held_class->after[class_index(class) / 32] |= 1 << (class_index(class) % 32);
+		}
+	}
+
+	if (nr_held_locks < LOCKDEP_MAX_HELD)
+		held_locks[nr_held_locks++] = lock;
+	else
+		lockdep_report("too many held locks", NULL, lock);
+
+	local_irq_restore(flags);
+}
+
+void lockdep_release(struct spinlock *lock)
+{
+	if (lockdep_off)
+		return;
+
+	uint32_t flags = local_irq_save();
+
+	for (int32_t i = nr_held_locks - 1; i >= 0; --i)
+	{
+		if (held_locks[i] != lock)
+			continue;
+
+		for (; i + 1 < (int32_t)nr_held_locks; ++i)
+			held_locks[i] = held_locks[i + 1];
+		nr_held_locks--;
+		local_irq_restore(flags);
+		return;
+	}
+
+	lockdep_report("releasing unheld lock", NULL, lock);
+	local_irq_restore(flags);
+}
+
+// spinlocks are not sleeping locks, switching thread while holding one deadlocks the next taker
+void lockdep_assert_no_locks_held()
+{
+	if (!lockdep_off && nr_held_locks)
+		lockdep_report("scheduling while holding lock", held_locks[nr_held_locks - 1], held_locks[nr_held_locks - 1]);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef LOCKING_LOCKDEP_H
+#define LOCKING_LOCKDEP_H
+
+struct spinlock;
+
+// NOTE: MQ 2020-10-12
+// lock order checker, build with CONFIG_LOCKDEP (`make LOCKDEP=1`)
+// locks are grouped into classes by name, each "A held while taking B" is recorded
+// taking B while holding A after "B -> ... -> A" was seen is reported as a potential deadlock
+#ifdef CONFIG_LOCKDEP
+void lockdep_acquire(struct spinlock *lock);
+void lockdep_release(struct spinlock *lock);
+void lockdep_assert_no_locks_held();
+#else
+#define lockdep_acquire(lock) ((void)(lock))
+#define lockdep_release(lock) ((void)(lock))
+#define lockdep_assert_no_locks_held() ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,212 @@
+#include "rt_mutex.h"
+
+#include <kernel/proc/task.h>
+#include <kernel/utils/printf.h>
+
+#include "spinlock.h"
+
+#define MAX_PI_CHAIN_DEPTH 16
+// policy is the major key, priority inside a class is clamped to the stride
+#define PI_CLASS_STRIDE (1 << 28)
+
+// protects every rt_mutex's owner/wait_list and threads' pi state, it is taken before rq_lock
+static DEFINE_SPINLOCK(pi_lock);
+
+static int pi_key(enum thread_policy policy, int32_t prio)
+{
+	if (prio < -PI_CLASS_STRIDE / 2)
+		prio = -PI_CLASS_STRIDE / 2;
+	else if (prio >= PI_CLASS_STRIDE / 2)
+		prio = PI_CLASS_STRIDE / 2 - 1;
+
+	return (int)policy * PI_CLASS_STRIDE + prio;
+}
+
+static int thread_pi_key(struct thread *th)
+{
+	return pi_key(th->policy, th->sched_sibling.prio);
+}
+
+static int thread_normal_key(struct thread *th)
+{
+	if (th->pi_boosted)
+		return pi_key(th->normal_policy, th->normal_prio);
+	return thread_pi_key(th);
+}
+
+static struct rt_mutex_waiter *rt_mutex_top_waiter(struct rt_mutex *lock)
+{
+	if (plist_head_empty(&lock->wait_list))
+		return NULL;
+	return plist_first_entry(&lock->wait_list, struct rt_mutex_waiter, list_entry);
+}
+
+static struct rt_mutex_waiter *task_top_pi_waiter(struct thread *task)
+{
+	if (plist_head_empty(&task->pi_waiters))
+		return NULL;
+	return plist_first_entry(&task->pi_waiters, struct rt_mutex_waiter, pi_list_entry);
+}
+
+// boost task to its top pi waiter or restore its own class/priority
+static void rt_mutex_adjust_prio(struct thread *task)
+{
+	struct rt_mutex_waiter *top = task_top_pi_waiter(task);
+
+	if (top && top->pi_list_entry.prio < thread_normal_key(task))
+	{
+		if (!task->pi_boosted)
+		{
+			task->normal_policy = task->policy;
+			task->normal_prio = task->sched_sibling.prio;
+			task->pi_boosted = true;
+		}
+		sched_set_prio(task, top->task->policy, top->task->sched_sibling.prio);
+	}
+	else if (task->pi_boosted)
+	{
+		task->pi_boosted = false;
+		sched_set_prio(task, task->normal_policy, task->normal_prio);
+	}
+}
+
+// propagate a priority change of task through the locks it is blocked on
+static void rt_mutex_adjust_prio_chain(struct thread *task)
+{
+	for (int depth = 0; depth < MAX_PI_CHAIN_DEPTH; ++depth)
+	{
+		rt_mutex_adjust_prio(task);
+
+		struct rt_mutex_waiter *waiter = task->pi_blocked_on;
+		if (!waiter)
+			break;
+
+		int key = thread_pi_key(task);
+		if (waiter->list_entry.prio == key)
+			break;
+
+		struct rt_mutex *lock = waiter->lock;
+		struct rt_mutex_waiter *prev_top = rt_mutex_top_waiter(lock);
+		plist_del(&waiter->list_entry, &lock->wait_list);
+		waiter->list_entry.prio = key;
+		plist_add(&waiter->list_entry, &lock->wait_list);
+
+		// owner only sees the top waiter of each lock
+		struct rt_mutex_waiter *top = rt_mutex_top_waiter(lock);
+		if (top != prev_top || top == waiter)
+		{
+			plist_del(&prev_top->pi_list_entry, &lock->owner->pi_waiters);
+			top->pi_list_entry.prio = top->list_entry.prio;
+			plist_add(&top->pi_list_entry, &lock->owner->pi_waiters);
+		}
+		else
+			break;
+
+		task = lock->owner;
+	}
+}
+
+void rt_mutex_lock(struct rt_mutex *lock)
+{
+	struct thread *self = (struct thread *)current_thread;
+	uint32_t flags = spin_lock_irqsave(&pi_lock);
+
+	assert(lock->owner != self);
+	if (!lock->owner)
+	{
+		lock->owner = self;
+		spin_unlock_irqrestore(&pi_lock, flags);
+		return;
+	}
+
+	struct rt_mutex_waiter waiter = {
+		.task = self,
+		.lock = lock,
+	};
+	plist_node_init(&waiter.list_entry, thread_pi_key(self));
+	plist_node_init(&waiter.pi_list_entry, thread_pi_key(self));
+
+	struct rt_mutex_waiter *prev_top = rt_mutex_top_waiter(lock);
+	plist_add(&waiter.list_entry, &lock->wait_list);
+	self->pi_blocked_on = &waiter;
+
+	if (rt_mutex_top_waiter(lock) == &waiter)
+	{
+		struct thread *owner = lock->owner;
+		if (prev_top)
+			plist_del(&prev_top->pi_list_entry, &owner->pi_waiters);
+		plist_add(&waiter.pi_list_entry, &owner->pi_waiters);
+		rt_mutex_adjust_prio_chain(owner);
+	}
+
+	// unlock hands the lock over to the top waiter and dequeues it
+	while (lock->owner != self)
+	{
+		update_thread(self, THREAD_WAITING);
+		spin_unlock_irqrestore(&pi_lock, flags);
+		schedule();
+		flags = spin_lock_irqsave(&pi_lock);
+	}
+
+	spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+int rt_mutex_trylock(struct rt_mutex *lock)
+{
+	int ret = 0;
+	uint32_t flags = spin_lock_irqsave(&pi_lock);
+
+	if (!lock->owner)
+	{
+		lock->owner = (struct thread *)current_thread;
+		ret = 1;
+	}
+
+	spin_unlock_irqrestore(&pi_lock, flags);
+	return ret;
+}
+
+void rt_mutex_unlock(struct rt_mutex *lock)
+{
+	struct thread *self = (struct thread *)current_thread;
+	uint32_t flags = spin_lock_irqsave(&pi_lock);
+
+	assert(lock->owner == self);
+	struct rt_mutex_waiter *waiter = rt_mutex_top_waiter(lock);
+	if (!waiter)
+		lock->owner = NULL;
+	else
+	{
+		plist_del(&waiter->list_entry, &lock->wait_list);
+		plist_del(&waiter->pi_list_entry, &self->pi_waiters);
+
+		struct thread *next_owner = waiter->task;
+		next_owner->pi_blocked_on = NULL;
+		lock->owner = next_owner;
+
+		// remaining waiters now boost the new owner
+		struct rt_mutex_waiter *next_top = rt_mutex_top_waiter(lock);
+		if (next_top)
+		{
+			next_top->pi_list_entry.prio = next_top->list_entry.prio;
+			plist_add(&next_top->pi_list_entry, &next_owner->pi_waiters);
+			rt_mutex_adjust_prio(next_owner);
+		}
+		update_thread(next_owner, THREAD_READY);
+	}
+
+	rt_mutex_adjust_prio(self);
+	spin_unlock_irqrestore(&pi_lock, flags);
+
+	// dropped boost or woke a higher class waiter
+	cond_resched();
+}
+
+// priority of a blocked task is changed from outside (setpriority, deadline parameters)
+void rt_mutex_adjust_pi(struct thread *task)
+{
+	uint32_t flags = spin_lock_irqsave(&pi_lock);
+	if (task->pi_blocked_on)
+		rt_mutex_adjust_prio_chain(task);
+	spin_unlock_irqrestore(&pi_lock, flags);
+}
@@ -0,0 +1,51 @@
+#ifndef LOCKING_RT_MUTEX_H
+#define LOCKING_RT_MUTEX_H
+
+#include <kernel/utils/plist.h>
+#include <stdint.h>
+
+struct thread;
+
+// NOTE: MQ 2020-10-16
+// sleeping lock with a single owner, waiters are ordered by priority and the owner inherits the top waiter's
+// class/priority until it releases the lock -> system threads don't stall behind a preempted app thread
+struct rt_mutex
+{
+	struct thread *owner;
+	struct plist_head wait_list;
+};
+
+struct rt_mutex_waiter
+{
+	struct plist_node list_entry;	 // in lock->wait_list
+	struct plist_node pi_list_entry;  // in owner->pi_waiters, only for the top waiter of the lock
+	struct thread *task;
+	struct rt_mutex *lock;
+};
+
+#define __RT_MUTEX_INITIALIZER(name)                     \
+	{                                                    \
+		.owner = NULL,                                   \
+		.wait_list = PLIST_HEAD_INIT((name).wait_list), \
+	}
+
+#define DEFINE_RT_MUTEX(name) \
+	struct rt_mutex name = __RT_MUTEX_INITIALIZER(name)
+
+static inline void rt_mutex_init(struct rt_mutex *lock)
+{
+	lock->owner = NULL;
+	plist_head_init(&lock->wait_list);
+}
+
+static inline bool rt_mutex_is_locked(struct rt_mutex *lock)
+{
+	return lock->owner != NULL;
+}
+
+void rt_mutex_lock(struct rt_mutex *lock);
+int rt_mutex_trylock(struct rt_mutex *lock);
+void rt_mutex_unlock(struct rt_mutex *lock);
+void rt_mutex_adjust_pi(struct thread *task);
+
+#endif
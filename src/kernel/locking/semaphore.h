@@ -2,6 +2,7 @@
 #define LOCKING_SEMAPHORE_H
 
 #include <include/list.h>
+#include <kernel/proc/wait.h>
 #include <stdint.h>
 
 #include "spinlock.h"
@@ -11,15 +12,15 @@ struct semaphore
 	spinlock_t lock;
 	uint32_t count;
 	uint32_t capacity;
-	struct list_head wait_list;
+	struct wait_queue_head wait;
 };
 
 #define __SEMAPHORE_INITIALIZER(name, n)               \
 	{                                                  \
-		.lock = 0,                                     \
+		.lock = SPINLOCK_INITIALIZER("semaphore"),     \
 		.count = n,                                    \
 		.capacity = n,                                 \
-		.wait_list = LIST_HEAD_INIT((name).wait_list), \
+		.wait.list = LIST_HEAD_INIT((name).wait.list), \
 	}
 
 #define DEFINE_SEMAPHORE(name) \
@@ -1,6 +1,10 @@
 #ifndef LOCKING_SPINLOCK_H
 #define LOCKING_SPINLOCK_H
 
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/lockdep.h>
+#include <stdint.h>
+
 #define barrier() asm volatile("" \
 							   :  \
 							   :  \
@@ -25,29 +29,77 @@ static inline unsigned short xchg_8(void *ptr, unsigned char x)
 #define SPINLOCK_UNLOCKED 0
 #define SPINLOCK_LOCK 1
 
-typedef unsigned char spinlock_t;
+// NOTE: MQ 2020-10-12
+// kernel is uniprocessor, a spinlock which is also taken in irq/softirq must be held with interrupts off
+// -> use spin_lock_irqsave, it restores the previous interrupt flag so sections nest (unlike lock_scheduler)
+typedef struct spinlock
+{
+	volatile unsigned char locked;
+#ifdef CONFIG_LOCKDEP
+	const char *name;
+	struct lock_class *class;
+#endif
+} spinlock_t;
+
+#ifdef CONFIG_LOCKDEP
+#define SPINLOCK_INITIALIZER(_name)  \
+	{                                \
+		.locked = SPINLOCK_UNLOCKED, \
+		.name = (_name),             \
+		.class = NULL,               \
+	}
+#else
+#define SPINLOCK_INITIALIZER(_name)  \
+	{                                \
+		.locked = SPINLOCK_UNLOCKED, \
+	}
+#endif
+
+#define DEFINE_SPINLOCK(x) spinlock_t x = SPINLOCK_INITIALIZER(#x)
+
+#define spin_lock_init(lock) (*(lock) = (spinlock_t)SPINLOCK_INITIALIZER(#lock))
 
 static inline void spin_lock(spinlock_t *lock)
 {
+	lockdep_acquire(lock);
+
 	while (1)
 	{
-		if (!xchg_8(lock, SPINLOCK_LOCK))
+		if (!xchg_8(&lock->locked, SPINLOCK_LOCK))
 			return;
 
-		while (*lock)
+		while (lock->locked)
 			cpu_relax();
 	}
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
+	lockdep_release(lock);
+
 	barrier();
-	*lock = 0;
+	lock->locked = SPINLOCK_UNLOCKED;
 }
 
 static inline int spin_trylock(spinlock_t *lock)
 {
-	return xchg_8(lock, SPINLOCK_LOCK);
+	int locked = xchg_8(&lock->locked, SPINLOCK_LOCK);
+	if (!locked)
+		lockdep_acquire(lock);
+	return locked;
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t *lock)
+{
+	uint32_t flags = local_irq_save();
+	spin_lock(lock);
+	return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags)
+{
+	spin_unlock(lock);
+	local_irq_restore(flags);
 }
 
 #endif
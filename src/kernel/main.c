@@ -4,18 +4,24 @@
 #include <stdint.h>
 
 #include "cpu/exception.h"
+#include "cpu/fpu.h"
 #include "cpu/gdt.h"
 #include "cpu/hal.h"
 #include "cpu/idt.h"
 #include "cpu/pit.h"
 #include "cpu/rtc.h"
 #include "cpu/tss.h"
+#include "cpu/tsc.h"
+#include "devices/ahci.h"
 #include "devices/ata.h"
 #include "devices/char/memory.h"
 #include "devices/char/tty.h"
 #include "devices/kybrd.h"
 #include "devices/mouse.h"
 #include "devices/pci.h"
+#include "devices/virtio/virtio_blk.h"
+#include "fs/block_dev.h"
+#include "fs/buffer.h"
 #include "fs/ext2/ext2.h"
 #include "fs/vfs.h"
 #include "ipc/message_queue.h"
@@ -30,9 +36,12 @@
 #include "net/tcp.h"
 #include "proc/task.h"
 #include "system/framebuffer.h"
+#include "system/softirq.h"
 #include "system/sysapi.h"
 #include "system/time.h"
 #include "system/timer.h"
+#include "system/vdso.h"
+#include "system/workqueue.h"
 #include "utils/math.h"
 #include "utils/printf.h"
 #include "utils/string.h"
@@ -65,6 +74,9 @@ void kernel_init()
 	// -> trigger manually at the beginning of thread path
 	unlock_scheduler();
 
+	softirq_init();
+	workqueue_init();
+	reaper_init();
 	timer_init();
 
 	// setup random's seed
@@ -72,10 +84,16 @@ void kernel_init()
 
 	// FIXME: MQ 2019-11-19 ata_init is not called in pci_scan_buses without enabling -O2
 	pci_init();
+	blkdev_init();
 	ata_init();
+	ahci_init();
+	virtio_blk_init();
+	buffer_init();
 
-	vfs_init(&ext2_fs_type, "/dev/hda");
+	// root is on virtio disk when running in a virtual machine which has one
+	vfs_init(&ext2_fs_type, get_block_device("/dev/vda") ? "/dev/vda" : "/dev/hda");
 	chrdev_memory_init();
+	schedstat_init();
 	tty_init();
 
 	/// init keyboard and mouse
@@ -145,10 +163,13 @@ int kernel_main(uint32_t addr, uint32_t magic)
 	vmm_init();
 
 	exception_init();
+	fpu_init();
 
 	// timer
 	rtc_init();
 	pit_init();
+	tsc_init();
+	vdso_init();
 
 	framebuffer_init(multiboot_framebuffer);
 
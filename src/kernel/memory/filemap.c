@@ -0,0 +1,77 @@
+#include <kernel/fs/vfs.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/string.h>
+
+#include "vmm.h"
+
+// NOTE: MQ 2020-10-18
+// page cache of regular files lives in inode->i_data, a page is filled from the file at the first lookup
+// and is never dropped -> all processes mapping the same file (program text) share its frames
+struct page *find_get_page(struct address_space *mapping, uint32_t index)
+{
+	struct page *iter;
+	list_for_each_entry(iter, &mapping->pages, sibling)
+	{
+		if (iter->index == index)
+			return iter;
+	}
+
+	return NULL;
+}
+
+struct page *read_cache_page(struct vfs_file *file, uint32_t index)
+{
+	struct vfs_inode *inode = file->f_dentry->d_inode;
+	uint32_t pos = index * PMM_FRAME_SIZE;
+
+	rt_mutex_lock(&inode->i_sem);
+	struct page *page = find_get_page(&inode->i_data, index);
+	if (page || pos >= inode->i_size)
+	{
+		rt_mutex_unlock(&inode->i_sem);
+		return page;
+	}
+
+	// file system may sleep when reading, kmap slot is only held for the copy
+	size_t count = min_t(uint32_t, PMM_FRAME_SIZE, inode->i_size - pos);
+	char *buf = kcalloc(PMM_FRAME_SIZE, sizeof(char));
+	file->f_op->read(file, buf, count, pos);
+
+	page = kcalloc(1, sizeof(struct page));
+	page->frame = (uint32_t)pmm_alloc_block();
+	page->index = index;
+	kmap(page);
+	memcpy((char *)page->virtual, buf, PMM_FRAME_SIZE);
+	kunmap(page);
+	kfree(buf);
+
+	list_add_tail(&page->sibling, &inode->i_data.pages);
+	inode->i_data.npages++;
+	rt_mutex_unlock(&inode->i_sem);
+
+	return page;
+}
+
+// file system wrote to disk directly, keep already cached pages in sync
+void update_cache_pages(struct vfs_inode *inode, const char *buf, size_t count, loff_t ppos)
+{
+	if (!inode->i_data.npages)
+		return;
+
+	rt_mutex_lock(&inode->i_sem);
+	uint32_t end = ppos + count;
+	for (uint32_t pos = ppos; pos < end;)
+	{
+		uint32_t offset = pos % PMM_FRAME_SIZE;
+		size_t length = min_t(uint32_t, PMM_FRAME_SIZE - offset, end - pos);
+		struct page *page = find_get_page(&inode->i_data, pos / PMM_FRAME_SIZE);
+		if (page)
+		{
+			kmap(page);
+			memcpy((char *)page->virtual + offset, buf + (pos - ppos), length);
+			kunmap(page);
+		}
+		pos += length;
+	}
+	rt_mutex_unlock(&inode->i_sem);
+}
@@ -1,3 +1,4 @@
+#include <kernel/locking/spinlock.h>
 #include <kernel/proc/task.h>
 
 #include "vmm.h"
@@ -6,6 +7,7 @@
 #define LAST_PKMAP 1024
 
 uint32_t pkmap[LAST_PKMAP];
+static DEFINE_SPINLOCK(pkmap_lock);
 
 void pkmap_bitmap_set(uint32_t block)
 {
@@ -72,22 +74,27 @@ int get_pkmaps_free(size_t size)
 
 void kmap(struct page *p)
 {
+	uint32_t flags = spin_lock_irqsave(&pkmap_lock);
 	uint32_t block = get_pkmap_free();
-	uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
-
 	pkmap_bitmap_set(block);
+	spin_unlock_irqrestore(&pkmap_lock, flags);
+
+	uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
 	vmm_map_address(current_process->pdir, vaddr, p->frame, I86_PTE_PRESENT | I86_PTE_WRITABLE);
 	p->virtual = vaddr;
 }
 
 void kmaps(struct pages *p)
 {
+	uint32_t flags = spin_lock_irqsave(&pkmap_lock);
 	uint32_t block = get_pkmaps_free(p->number_of_frames);
-	uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
+	for (uint32_t i = 0; i < p->number_of_frames; ++i)
+		pkmap_bitmap_set(block + i);
+	spin_unlock_irqrestore(&pkmap_lock, flags);
 
+	uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
 	for (uint32_t i = 0; i < p->number_of_frames; ++i)
 	{
-		pkmap_bitmap_set(block + i);
 		vmm_map_address(current_process->pdir, vaddr + i * PMM_FRAME_SIZE, p->paddr + i * PMM_FRAME_SIZE, I86_PTE_PRESENT | I86_PTE_WRITABLE);
 	}
 	p->vaddr = vaddr;
@@ -99,8 +106,11 @@ void kunmap(struct page *p)
 		return;
 
 	uint32_t block = (p->virtual - PKMAP_BASE) / PMM_FRAME_SIZE;
-	pkmap_bitmap_unset(block);
 	vmm_unmap_address(current_process->pdir, p->virtual);
+
+	uint32_t flags = spin_lock_irqsave(&pkmap_lock);
+	pkmap_bitmap_unset(block);
+	spin_unlock_irqrestore(&pkmap_lock, flags);
 }
 
 void kunmaps(struct pages *p)
@@ -110,8 +120,10 @@ void kunmaps(struct pages *p)
 
 	uint32_t block = (p->vaddr - PKMAP_BASE) / PMM_FRAME_SIZE;
 	for (uint32_t i = 0; i < p->number_of_frames; ++i)
-	{
-		pkmap_bitmap_unset(block + i);
 		vmm_unmap_address(current_process->pdir, p->vaddr + i * PMM_FRAME_SIZE);
-	}
+
+	uint32_t flags = spin_lock_irqsave(&pkmap_lock);
+	for (uint32_t i = 0; i < p->number_of_frames; ++i)
+		pkmap_bitmap_unset(block + i);
+	spin_unlock_irqrestore(&pkmap_lock, flags);
 }
@@ -0,0 +1,62 @@
+#include <kernel/locking/spinlock.h>
+#include <kernel/utils/math.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+
+#include "vmm.h"
+
+// NOTE: MQ 2020-10-18
+// device drivers region is handed out bottom-up and never given back,
+// drivers map their registers and allocate their dma memory once when a device is probed
+static uint32_t device_vaddr_next = DEVICE_DRIVERS_BOTTOM;
+static DEFINE_SPINLOCK(device_vaddr_lock);
+
+static uint32_t alloc_device_vaddr(uint32_t npages)
+{
+	uint32_t flags = spin_lock_irqsave(&device_vaddr_lock);
+	uint32_t vaddr = device_vaddr_next;
+	device_vaddr_next += npages * PMM_FRAME_SIZE;
+	assert(device_vaddr_next <= DEVICE_DRIVERS_TOP);
+	spin_unlock_irqrestore(&device_vaddr_lock, flags);
+
+	return vaddr;
+}
+
+// memory mapped registers, uncached
+void *ioremap(uint32_t paddr, uint32_t size)
+{
+	uint32_t offset = paddr % PMM_FRAME_SIZE;
+	uint32_t npages = div_ceil(offset + size, PMM_FRAME_SIZE);
+	uint32_t vaddr = alloc_device_vaddr(npages);
+
+	for (uint32_t i = 0; i < npages; ++i)
+		vmm_map_address(
+			vmm_get_directory(),
+			vaddr + i * PMM_FRAME_SIZE,
+			paddr - offset + i * PMM_FRAME_SIZE,
+			I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_NOT_CACHEABLE);
+
+	return (void *)(vaddr + offset);
+}
+
+// zeroed physically contiguous memory which device and cpu share (descriptor rings, command tables ...)
+// x86 dma is cache coherent -> it is mapped cacheable
+void *dma_alloc_coherent(uint32_t size, uint32_t *paddr)
+{
+	uint32_t npages = div_ceil(size, PMM_FRAME_SIZE);
+	uint32_t frames = (uint32_t)pmm_alloc_blocks(npages);
+	if (!frames)
+		return NULL;
+
+	uint32_t vaddr = alloc_device_vaddr(npages);
+	for (uint32_t i = 0; i < npages; ++i)
+		vmm_map_address(
+			vmm_get_directory(),
+			vaddr + i * PMM_FRAME_SIZE,
+			frames + i * PMM_FRAME_SIZE,
+			I86_PTE_PRESENT | I86_PTE_WRITABLE);
+	memset((char *)vaddr, 0, npages * PMM_FRAME_SIZE);
+
+	*paddr = frames;
+	return (void *)vaddr;
+}
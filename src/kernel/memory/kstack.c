@@ -0,0 +1,56 @@
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/printf.h>
+
+#include "vmm.h"
+
+// guard page (never mapped) + stack
+#define KERNEL_STACK_SLOT (PMM_FRAME_SIZE + STACK_SIZE)
+
+// NOTE: MQ 2020-10-18
+// kernel stacks live in their own region, each one sits right above an unmapped guard page
+// -> overflowing a stack faults instead of silently corrupting heap objects next to it
+// freed stacks keep their frames and are linked through their lowest word, the next thread reuses them as is
+static uint32_t kstack_next = KERNEL_STACK_BOTTOM;
+static uint32_t kstack_free = 0;
+static uint32_t kstack_nfree = 0;
+static DEFINE_SPINLOCK(kstack_lock);
+
+// returns top of the stack
+uint32_t alloc_kernel_stack()
+{
+	uint32_t flags = spin_lock_irqsave(&kstack_lock);
+	uint32_t top = kstack_free;
+	if (top)
+	{
+		kstack_free = *(uint32_t *)(top - STACK_SIZE);
+		kstack_nfree--;
+		spin_unlock_irqrestore(&kstack_lock, flags);
+		return top;
+	}
+
+	uint32_t slot = kstack_next;
+	kstack_next += KERNEL_STACK_SLOT;
+	spin_unlock_irqrestore(&kstack_lock, flags);
+
+	assert(slot + KERNEL_STACK_SLOT <= KERNEL_STACK_TOP);
+
+	// page tables of kernel space are shared -> the stack is mapped in every address space
+	for (uint32_t addr = slot + PMM_FRAME_SIZE; addr < slot + KERNEL_STACK_SLOT; addr += PMM_FRAME_SIZE)
+		vmm_map_address(vmm_get_directory(), addr, (uint32_t)pmm_alloc_block(), I86_PTE_PRESENT | I86_PTE_WRITABLE);
+
+	return slot + KERNEL_STACK_SLOT;
+}
+
+// stack must not be in use anymore (its thread is switched out for good)
+void free_kernel_stack(uint32_t top)
+{
+	if (!top)
+		return;
+
+	uint32_t flags = spin_lock_irqsave(&kstack_lock);
+	*(uint32_t *)(top - STACK_SIZE) = kstack_free;
+	kstack_free = top;
+	kstack_nfree++;
+	spin_unlock_irqrestore(&kstack_lock, flags);
+}
@@ -1,4 +1,5 @@
 #include <include/errno.h>
+#include <kernel/locking/spinlock.h>
 #include <kernel/utils/math.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
@@ -19,6 +20,8 @@ struct block_meta
 };
 
 static struct block_meta *kblocklist = NULL;
+// kmalloc is also used by softirq actions
+static DEFINE_SPINLOCK(kheap_lock);
 
 void assert_kblock_valid(struct block_meta *block)
 {
@@ -75,6 +78,7 @@ void *kmalloc(size_t size)
 	if (size <= 0)
 		return NULL;
 
+	uint32_t flags = spin_lock_irqsave(&kheap_lock);
 	struct block_meta *block;
 
 	if (kblocklist)
@@ -96,6 +100,7 @@ void *kmalloc(size_t size)
 	}
 
 	assert_kblock_valid(block);
+	spin_unlock_irqrestore(&kheap_lock, flags);
 
 	if (block)
 		return block + 1;
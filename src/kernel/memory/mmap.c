@@ -1,3 +1,4 @@
+#include <include/errno.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
@@ -84,7 +85,12 @@ int do_munmap(struct mm_struct *mm, uint32_t addr, size_t len)
 	if (vma->vm_end - vma->vm_start >= len)
 		vma->vm_end = addr;
 	else
+	{
 		list_del(&vma->vm_sibling);
+		if (vma->vm_file)
+			fput(vma->vm_file);
+		kfree(vma);
+	}
 
 	return 0;
 }
@@ -96,10 +102,13 @@ int32_t do_mmap(uint32_t addr,
 	struct vfs_file *file = fd >= 0 ? current_process->files->fd[fd] : NULL;
 	struct vm_area_struct *vma = get_unmapped_area(addr, len);
 
+	vma->vm_flags = VM_READ | VM_WRITE | VM_EXEC;
 	if (file)
 	{
 		file->f_op->mmap(file, vma);
 		vma->vm_file = file;
+		atomic_inc(&file->f_count);
+		vma->vm_flags |= VM_SHARED;
 	}
 	else
 		for (uint32_t vaddr = vma->vm_start; vaddr < vma->vm_end; vaddr += PMM_FRAME_SIZE)
@@ -191,3 +200,90 @@ uint32_t do_brk(uint32_t addr, size_t len)
 
 	return 0;
 }
+
+static int do_anonymous_page(struct vm_area_struct *vma, uint32_t address)
+{
+	struct page page = {.frame = (uint32_t)pmm_alloc_block()};
+	kmap(&page);
+	memset((char *)page.virtual, 0, PMM_FRAME_SIZE);
+	kunmap(&page);
+
+	vmm_map_address(current_process->pdir, address, page.frame, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
+	return 0;
+}
+
+// copy frame which is mapped at `address` (page cache page or shared with parent) into a private one
+static int do_wp_page(struct vm_area_struct *vma, uint32_t address)
+{
+	struct page old_page = {.frame = vmm_get_physical_address(address, true) & I86_PTE_FRAME};
+	struct page new_page = {.frame = (uint32_t)pmm_alloc_block()};
+
+	kmap(&old_page);
+	kmap(&new_page);
+	memcpy((char *)new_page.virtual, (char *)old_page.virtual, PMM_FRAME_SIZE);
+	kunmap(&old_page);
+	kunmap(&new_page);
+
+	vmm_map_address(current_process->pdir, address, new_page.frame, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
+	vmm_flush_tlb_entry(address);
+	return 0;
+}
+
+/*
+  NOTE: MQ 2020-10-18 Private file mapping (elf segments)
+  - read fault -> page cache frame is mapped read-only, all processes share it
+  - write fault or write to shared frame -> private copy
+  - page which contains vm_file_end is always private, the tail is bss and has to be zeroed
+*/
+static int do_file_page(struct vm_area_struct *vma, uint32_t address, bool write)
+{
+	uint32_t index = vma->vm_pgoff + (address - vma->vm_start) / PMM_FRAME_SIZE;
+	struct page *page = read_cache_page(vma->vm_file, index);
+	if (!page)
+		return -EFAULT;
+
+	uint32_t pte_flags = I86_PTE_PRESENT | I86_PTE_USER | ((vma->vm_flags & VM_WRITE) ? I86_PTE_WRITABLE : 0);
+	bool partial = address + PMM_FRAME_SIZE > vma->vm_file_end;
+	if (!write && !partial)
+	{
+		vmm_map_address(current_process->pdir, address, page->frame, I86_PTE_PRESENT | I86_PTE_USER);
+		return 0;
+	}
+
+	struct page new_page = {.frame = (uint32_t)pmm_alloc_block()};
+	kmap(page);
+	kmap(&new_page);
+	memcpy((char *)new_page.virtual, (char *)page->virtual, PMM_FRAME_SIZE);
+	if (partial)
+	{
+		uint32_t offset = vma->vm_file_end > address ? vma->vm_file_end - address : 0;
+		memset((char *)new_page.virtual + offset, 0, PMM_FRAME_SIZE - offset);
+	}
+	kunmap(page);
+	kunmap(&new_page);
+
+	vmm_map_address(current_process->pdir, address, new_page.frame, pte_flags);
+	return 0;
+}
+
+int handle_mm_fault(struct mm_struct *mm, uint32_t address, uint32_t error_code)
+{
+	struct vm_area_struct *vma = find_vma(mm, address);
+	if (!vma)
+		return -EFAULT;
+
+	bool write = error_code & PAGE_FAULT_WRITE;
+	if (write && !(vma->vm_flags & VM_WRITE))
+		return -EFAULT;
+
+	address &= PAGE_MASK;
+	if (error_code & PAGE_FAULT_PRESENT)
+		return write ? do_wp_page(vma, address) : -EFAULT;
+
+	// page table is shared by other areas in the same 4MB, it has to be writable
+	vmm_create_page_table(current_process->pdir, address, I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_USER);
+	if (vma->vm_file)
+		return (vma->vm_flags & VM_SHARED) ? -EFAULT : do_file_page(vma, address, write);
+
+	return do_anonymous_page(vma, address);
+}
@@ -1,5 +1,6 @@
 #include "pmm.h"
 
+#include <kernel/locking/spinlock.h>
 #include <kernel/utils/math.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
@@ -9,6 +10,7 @@ static uint32_t max_frames = 0;
 static uint32_t used_frames = 0;
 static uint32_t memory_size = 0;
 static uint32_t memory_bitmap_size = 0;
+static DEFINE_SPINLOCK(pmm_lock);
 
 void pmm_regions(struct multiboot_tag_mmap *multiboot_mmap);
 void pmm_init_region(uint32_t addr, uint32_t length);
@@ -136,16 +138,18 @@ void pmm_deinit_region(uint32_t addr, uint32_t length)
 
 void *pmm_alloc_block()
 {
-	if (max_frames <= used_frames)
-		return 0;
-
-	int frame = memory_bitmap_first_free();
+	uint32_t flags = spin_lock_irqsave(&pmm_lock);
+	int frame = max_frames <= used_frames ? -1 : memory_bitmap_first_free();
 
 	if (frame == -1)
+	{
+		spin_unlock_irqrestore(&pmm_lock, flags);
 		return 0;
+	}
 
 	memory_bitmap_set(frame);
 	used_frames++;
+	spin_unlock_irqrestore(&pmm_lock, flags);
 
 	uint32_t addr = frame * PMM_FRAME_SIZE;
 	return (void *)addr;
@@ -153,19 +157,21 @@ void *pmm_alloc_block()
 
 void *pmm_alloc_blocks(size_t size)
 {
-	if (max_frames - used_frames < size)
-		return 0;
-
-	int frame = memory_bitmap_first_frees(size);
+	uint32_t flags = spin_lock_irqsave(&pmm_lock);
+	int frame = max_frames - used_frames < size ? -1 : memory_bitmap_first_frees(size);
 
 	if (frame == -1)
+	{
+		spin_unlock_irqrestore(&pmm_lock, flags);
 		return 0;
+	}
 
 	for (uint32_t i = 0; i < size; ++i)
 	{
 		memory_bitmap_set(frame + i);
 		used_frames++;
 	}
+	spin_unlock_irqrestore(&pmm_lock, flags);
 
 	uint32_t addr = frame * PMM_FRAME_SIZE;
 	return (void *)addr;
@@ -176,19 +182,23 @@ void pmm_free_block(void *p)
 	uint32_t addr = (uint32_t)p;
 	uint32_t frame = addr / PMM_FRAME_SIZE;
 
+	uint32_t flags = spin_lock_irqsave(&pmm_lock);
 	memory_bitmap_unset(frame);
-
 	used_frames--;
+	spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 void pmm_mark_used_addr(uint32_t paddr)
 {
 	uint32_t frame = paddr / PMM_FRAME_SIZE;
+
+	uint32_t flags = spin_lock_irqsave(&pmm_lock);
 	if (!memory_bitmap_test(frame))
 	{
 		memory_bitmap_set(frame);
 		used_frames++;
 	}
+	spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 uint32_t get_total_frames()
@@ -0,0 +1,37 @@
+#include <kernel/utils/string.h>
+
+#include "slab.h"
+#include "vmm.h"
+
+// NOTE: MQ 2020-10-18
+// object cache keeps freed objects of one type on a free list instead of returning them to the heap
+// -> allocating a hot object (thread, process ...) is a list pop, the free list is threaded through freed objects
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	uint32_t flags = spin_lock_irqsave(&cache->lock);
+	struct list_head *obj = NULL;
+	if (!list_empty(&cache->free_list))
+	{
+		obj = cache->free_list.next;
+		list_del(obj);
+		cache->nfree--;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (!obj)
+		return kcalloc(1, max_t(size_t, cache->size, sizeof(struct list_head)));
+
+	memset(obj, 0, cache->size);
+	return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	if (!obj)
+		return;
+
+	uint32_t flags = spin_lock_irqsave(&cache->lock);
+	list_add((struct list_head *)obj, &cache->free_list);
+	cache->nfree++;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
@@ -0,0 +1,32 @@
+#ifndef MEMORY_SLAB_H
+#define MEMORY_SLAB_H
+
+#include <include/list.h>
+#include <kernel/locking/spinlock.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct kmem_cache
+{
+	const char *name;
+	size_t size;
+	struct list_head free_list;
+	uint32_t nfree;
+	spinlock_t lock;
+};
+
+#define KMEM_CACHE_INIT(_name, _size)                   \
+	{                                                   \
+		.name = #_name,                                 \
+		.size = (_size),                                \
+		.free_list = LIST_HEAD_INIT((_name).free_list), \
+		.nfree = 0,                                     \
+		.lock = SPINLOCK_INITIALIZER(#_name),           \
+	}
+
+#define DEFINE_KMEM_CACHE(name, type) struct kmem_cache name = KMEM_CACHE_INIT(name, sizeof(type))
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#endif
@@ -1,5 +1,8 @@
 #include "vmm.h"
 
+#include <include/vdso.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/proc/task.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
@@ -17,7 +20,6 @@ void pt_entry_add_attrib(pt_entry *, uint32_t);
 void pt_entry_set_frame(pt_entry *, uint32_t);
 void pd_entry_add_attrib(pd_entry *, uint32_t);
 void pd_entry_set_frame(pd_entry *, uint32_t);
-void vmm_create_page_table(struct pdirectory *dir, uint32_t virt, uint32_t flags);
 void vmm_paging(struct pdirectory *, uint32_t);
 
 static struct pdirectory *_current_dir;
@@ -34,6 +36,8 @@ void vmm_flush_tlb_entry(uint32_t addr)
   | Page table mapping      |
   |_________________________| 0xFFC00000
   |                         |
+  |-------------------------| 0xF8000000
+  | Kernel stacks           |
   |-------------------------| 0xF0000000
   |                         |
   | Device drivers          |
@@ -52,6 +56,8 @@ void vmm_flush_tlb_entry(uint32_t addr)
   |                         |
   | Page for page faults    |
   |_________________________| 0xBFFFF000
+  | Vdso data (read-only)   |
+  |_________________________| 0xBFFFE000
   |                         |
   |                         |
   |                         |
@@ -121,6 +127,7 @@ void vmm_init_and_map(struct pdirectory *va_dir, uint32_t vaddr, uint32_t paddr)
 	*entry = pa_table | I86_PDE_PRESENT | I86_PDE_WRITABLE;
 }
 
+// NOTE: MQ 2020-10-18 cr0.wp is set -> kernel writes to read-only user pages also fault (copy-on-write)
 void vmm_paging(struct pdirectory *va_dir, uint32_t pa_dir)
 {
 	_current_dir = va_dir;
@@ -131,7 +138,7 @@ void vmm_paging(struct pdirectory *va_dir, uint32_t pa_dir)
 		"and $~0x00000010, %%ecx \n"
 		"mov %%ecx, %%cr4        \n"
 		"mov %%cr0, %%ecx        \n"
-		"or $0x80000000, %%ecx   \n"
+		"or $0x80010000, %%ecx   \n"
 		"mov %%ecx, %%cr0        \n" ::"r"(pa_dir));
 }
 
@@ -168,9 +175,12 @@ uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page)
 
 struct pdirectory *vmm_create_address_space(struct pdirectory *current)
 {
-	char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
 	// NOTE: MQ 2019-11-24 page directory, page table have to be aligned by 4096
+	// no allocation may sneak in between padding and directory
+	uint32_t flags = local_irq_save();
+	char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
 	struct pdirectory *va_dir = kcalloc(1, sizeof(struct pdirectory));
+	local_irq_restore(flags);
 	if (aligned_object)
 		kfree(aligned_object);
 
@@ -186,6 +196,14 @@ struct pdirectory *vmm_create_address_space(struct pdirectory *current)
 	return va_dir;
 }
 
+// switch the running thread to another page directory (exec of a vfork child)
+void vmm_load_address_space(struct pdirectory *va_dir)
+{
+	uint32_t pa_dir = vmm_get_physical_address((uint32_t)va_dir, true);
+	__asm__ __volatile__("mov %0, %%cr3" ::"r"(pa_dir)
+						 : "memory");
+}
+
 struct pdirectory *vmm_get_directory()
 {
 	return _current_dir;
@@ -256,48 +274,57 @@ void vmm_unmap_range(struct pdirectory *va_dir, uint32_t vm_start, uint32_t vm_e
 		vmm_unmap_address(va_dir, addr);
 }
 
+// NOTE: MQ 2020-10-14
+// pages are copied through kmap windows, so heap stays usable and the loop can be preempted
 struct pdirectory *vmm_fork(struct pdirectory *va_dir)
 {
 	struct pdirectory *forked_dir = vmm_create_address_space(va_dir);
-	char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
-	uint32_t heap_current = (uint32_t)sbrk(0);
 
-	// NOTE: MQ 2019-12-15 Any heap changes via malloc is forbidden
 	for (uint32_t ipd = 0; ipd < 768; ++ipd)
 		if (is_page_enabled(va_dir->m_entries[ipd]))
 		{
-			struct ptable *forked_pt = (struct ptable *)heap_current;
-			uint32_t forked_pt_paddr = (uint32_t)pmm_alloc_block();
-			vmm_map_address(va_dir, (uint32_t)forked_pt, forked_pt_paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
+			struct page forked_pt_page = {.frame = (uint32_t)pmm_alloc_block()};
+			kmap(&forked_pt_page);
+			struct ptable *forked_pt = (struct ptable *)forked_pt_page.virtual;
 			memset(forked_pt, 0, sizeof(struct ptable));
 
-			heap_current += sizeof(struct ptable);
 			struct ptable *pt = (struct ptable *)(PAGE_TABLE_BASE + ipd * PMM_FRAME_SIZE);
 			for (uint32_t ipt = 0; ipt < PAGES_PER_TABLE; ++ipt)
 			{
-				if (is_page_enabled(pt->m_entries[ipt]))
+				// vdso page is shared by all processes, it is only updated by kernel
+				// read-only pages come from page cache (program text), writing to them copies first
+				if (is_page_enabled(pt->m_entries[ipt]) &&
+					((ipd << 22 | ipt << 12) == VDSO_DATA_ADDR || !(pt->m_entries[ipt] & I86_PTE_WRITABLE)))
+					forked_pt->m_entries[ipt] = pt->m_entries[ipt];
+				else if (is_page_enabled(pt->m_entries[ipt]))
 				{
-					char *pte = (char *)heap_current;
-					char *forked_pte = pte + PMM_FRAME_SIZE;
-					heap_current = (uint32_t)(forked_pte + PMM_FRAME_SIZE);
-					uint32_t forked_pte_paddr = (uint32_t)pmm_alloc_block();
-
-					vmm_map_address(va_dir, (uint32_t)pte, pt->m_entries[ipt], I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
-					vmm_map_address(va_dir, (uint32_t)forked_pte, forked_pte_paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
-
-					memcpy(forked_pte, pte, PMM_FRAME_SIZE);
+					struct page page = {.frame = pt->m_entries[ipt] & I86_PTE_FRAME};
+					struct page forked_page = {.frame = (uint32_t)pmm_alloc_block()};
 
-					vmm_unmap_address(va_dir, (uint32_t)pte);
-					vmm_unmap_address(va_dir, (uint32_t)forked_pte);
+					kmap(&page);
+					kmap(&forked_page);
+					memcpy((char *)forked_page.virtual, (char *)page.virtual, PMM_FRAME_SIZE);
+					kunmap(&page);
+					kunmap(&forked_page);
 
-					forked_pt->m_entries[ipt] = forked_pte_paddr | I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER;
+					forked_pt->m_entries[ipt] = forked_page.frame | I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER;
+					cond_resched();
 				}
 			}
-			vmm_unmap_address(va_dir, (uint32_t)forked_pt);
-			forked_dir->m_entries[ipd] = forked_pt_paddr | I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_USER;
+			kunmap(&forked_pt_page);
+			forked_dir->m_entries[ipd] = forked_pt_page.frame | I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_USER;
 		}
 
-	if (aligned_object)
-		kfree(aligned_object);
 	return forked_dir;
 }
+
+// page tables of user space (vdso included) are private to an address space, kernel ones are shared and stay
+// address space must not be loaded anymore
+void vmm_destroy_address_space(struct pdirectory *va_dir)
+{
+	for (uint32_t ipd = 0; ipd < 768; ++ipd)
+		if (is_page_enabled(va_dir->m_entries[ipd]))
+			pmm_free_block((void *)(va_dir->m_entries[ipd] & I86_PDE_FRAME));
+
+	kfree(va_dir);
+}
@@ -1,6 +1,7 @@
 #ifndef MEMORY_VMM_H
 #define MEMORY_VMM_H
 
+#include <include/ctype.h>
 #include <include/list.h>
 #include <stdint.h>
 
@@ -9,10 +10,17 @@
 
 #define KERNEL_HEAP_TOP 0xF0000000
 #define KERNEL_HEAP_BOTTOM 0xD0000000
+#define KERNEL_STACK_TOP 0xF8000000
+#define KERNEL_STACK_BOTTOM 0xF0000000
+#define DEVICE_DRIVERS_TOP 0xF0000000
+#define DEVICE_DRIVERS_BOTTOM 0xE8000000
 #define USER_HEAP_TOP 0x40000000
 
 struct vm_area_struct;
 struct mm_struct;
+struct address_space;
+struct vfs_file;
+struct vfs_inode;
 
 //! i86 architecture defines this format so be careful if you modify it
 enum PAGE_PTE_FLAGS
@@ -52,6 +60,11 @@ enum PAGE_PDE_FLAGS
 
 typedef uint32_t pd_entry;
 
+// page fault error code
+#define PAGE_FAULT_PRESENT 0x1
+#define PAGE_FAULT_WRITE 0x2
+#define PAGE_FAULT_USER 0x4
+
 //! i86 architecture defines 1024 entries per table--do not change
 #define PAGES_PER_TABLE 1024
 #define PAGES_PER_DIR 1024
@@ -61,6 +74,7 @@ struct page
 	uint32_t frame;
 	struct list_head sibling;
 	uint32_t virtual;
+	uint32_t index;	 // offset in file (in pages) when the page belongs to page cache
 };
 
 struct pages
@@ -83,12 +97,15 @@ struct pdirectory
 void vmm_init();
 struct pdirectory *vmm_get_directory();
 void vmm_map_address(struct pdirectory *dir, uint32_t virt, uint32_t phys, uint32_t flags);
+void vmm_create_page_table(struct pdirectory *dir, uint32_t virt, uint32_t flags);
 void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt);
 void vmm_unmap_range(struct pdirectory *va_dir, uint32_t vm_start, uint32_t vm_end);
-void *create_kernel_stack(int32_t blocks);
 struct pdirectory *vmm_create_address_space(struct pdirectory *dir);
 uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page);
+void vmm_flush_tlb_entry(uint32_t addr);
 struct pdirectory *vmm_fork(struct pdirectory *va_dir);
+void vmm_destroy_address_space(struct pdirectory *va_dir);
+void vmm_load_address_space(struct pdirectory *va_dir);
 
 // malloc.c
 void *sbrk(size_t n);
@@ -106,6 +123,21 @@ int32_t do_mmap(uint32_t addr,
 				uint32_t flag, int32_t fd);
 int do_munmap(struct mm_struct *mm, uint32_t addr, size_t len);
 uint32_t do_brk(uint32_t addr, size_t len);
+struct vm_area_struct *find_vma(struct mm_struct *mm, uint32_t addr);
+int handle_mm_fault(struct mm_struct *mm, uint32_t address, uint32_t error_code);
+
+// filemap.c
+struct page *find_get_page(struct address_space *mapping, uint32_t index);
+struct page *read_cache_page(struct vfs_file *file, uint32_t index);
+void update_cache_pages(struct vfs_inode *inode, const char *buf, size_t count, loff_t ppos);
+
+// kstack.c
+uint32_t alloc_kernel_stack();
+void free_kernel_stack(uint32_t top);
+
+// ioremap.c
+void *ioremap(uint32_t paddr, uint32_t size);
+void *dma_alloc_coherent(uint32_t size, uint32_t *paddr);
 
 // highmem.c
 void kmap(struct page *p);
@@ -7,6 +7,7 @@
 #include <kernel/memory/vmm.h>
 #include <kernel/net/net.h>
 #include <kernel/proc/task.h>
+#include <kernel/system/softirq.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
@@ -27,11 +28,11 @@ void rtl8139_send_packet(void *payload, uint32_t size)
 	tx_counter = tx_counter >= 3 ? 0 : tx_counter + 1;
 }
 
-void rtl8139_receive_packet(struct interrupt_registers *regs)
+static void rtl8139_poll(struct net_device *dev)
 {
-	while ((inportb(rtl_netdev->base_addr + RTL8139_ChipCmd) & RTL8139_RxBufEmpty) == 0)
+	while ((inportb(dev->base_addr + RTL8139_ChipCmd) & RTL8139_RxBufEmpty) == 0)
 	{
-		uint16_t rx_buf_ptr = inportw(rtl_netdev->base_addr + RTL8139_RxBufPtr) + 0x10;
+		uint16_t rx_buf_ptr = inportw(dev->base_addr + RTL8139_RxBufPtr) + 0x10;
 		uint32_t rx_read_ptr = (uint32_t)rx_buffer + rx_buf_ptr;
 		struct rtl8139_rx_header *rx_header = (struct rtl8139_rx_header *)rx_read_ptr;
 
@@ -44,17 +45,10 @@ void rtl8139_receive_packet(struct interrupt_registers *regs)
 		else
 		{
 			uint8_t *buf = (uint8_t *)(rx_read_ptr + sizeof(struct rtl8139_rx_header));
-			uint8_t *payload = kcalloc(1, rx_header->size);
-
-			memcpy(payload, buf, rx_header->size);
-			push_rx_queue(payload, rx_header->size);
-			kfree(payload);
+			push_rx_queue(buf, rx_header->size);
 		}
-		outportw(rtl_netdev->base_addr + RTL8139_RxBufPtr, rx_buf_ptr - 0x10);
+		outportw(dev->base_addr + RTL8139_RxBufPtr, rx_buf_ptr - 0x10);
 	}
-
-	irq_ack(regs->int_no);
-	net_switch();
 }
 
 int32_t rtl8139_irq_handler(struct interrupt_registers *regs)
@@ -66,10 +60,9 @@ int32_t rtl8139_irq_handler(struct interrupt_registers *regs)
 
 	outportw(rtl_netdev->base_addr + RTL8139_IntrStatus, status);
 
-	if (status & TOK)
-		irq_ack(regs->int_no);
 	if (status & ROK)
-		rtl8139_receive_packet(regs);
+		raise_softirq(NET_RX_SOFTIRQ);
+	irq_ack(regs->int_no);
 
 	return IRQ_HANDLER_CONTINUE;
 }
@@ -135,6 +128,7 @@ void rtl8139_init()
 	memcpy(rtl_netdev->dev_addr, mac_addr, 6);
 	memcpy(rtl_netdev->broadcast_addr, broadcast_mac_addr, 6);
 	memset(rtl_netdev->zero_addr, 0, 6);
+	rtl_netdev->poll = rtl8139_poll;
 
 	register_net_device(rtl_netdev);
 
@@ -12,16 +12,19 @@
 #include <kernel/net/neighbour.h>
 #include <kernel/net/sk_buff.h>
 #include <kernel/proc/task.h>
+#include <kernel/system/softirq.h>
+#include <kernel/system/time.h>
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 
 extern volatile uint32_t scheduler_lock_counter;
 
-struct thread *backup_thread;
 struct process *net_process;
 struct thread *net_thread;
 struct list_head lrx_skb;
 struct list_head lsocket;
+static DEFINE_SPINLOCK(rx_lock);
+static DEFINE_SPINLOCK(sock_list_lock);
 struct net_device *current_netdev;
 
 // NOTE: MQ 2020-06-04
@@ -33,7 +36,10 @@ void push_rx_queue(uint8_t *data, uint32_t size)
 
 	skb_put(skb, size);
 	memcpy(skb->data, data, size);
+
+	uint32_t flags = spin_lock_irqsave(&rx_lock);
 	list_add_tail(&skb->sibling, &lrx_skb);
+	spin_unlock_irqrestore(&rx_lock, flags);
 }
 
 void sock_setup(struct socket *sock, int32_t family)
@@ -69,14 +75,24 @@ void socket_setup(int32_t family, enum socket_type type, int32_t protocal, struc
 	else if (family == PF_PACKET)
 		sock->ops = &packet_proto_ops;
 
+	local_bh_disable();
+	spin_lock(&sock_list_lock);
 	list_add_tail(&sock->sibling, &lsocket);
+	spin_unlock(&sock_list_lock);
+	local_bh_enable();
+
 	sock_setup(sock, family);
 }
 
 int socket_shutdown(struct socket *sock)
 {
 	sock->state = SS_DISCONNECTED;
+
+	local_bh_disable();
+	spin_lock(&sock_list_lock);
 	list_del(&sock->sibling);
+	spin_unlock(&sock_list_lock);
+	local_bh_enable();
 	return 0;
 }
 
@@ -247,6 +263,18 @@ int net_default_rx_handler(struct sk_buff *skb)
 	return 0;
 }
 
+// NOTE: MQ 2020-10-08
+// rx irq only raises NET_RX_SOFTIRQ, copying packets out of the card and protocol handling are done in net thread
+// `rx_pending` is set before waking up -> an irq between polling and sleeping is not lost
+static volatile bool rx_pending;
+
+static void net_rx_action()
+{
+	rx_pending = true;
+	if (net_thread && net_thread->state == THREAD_WAITING)
+		update_thread(net_thread, THREAD_READY);
+}
+
 void net_rx_loop()
 {
 	// explain in kernel_init#unlock_scheduler
@@ -254,18 +282,25 @@ void net_rx_loop()
 
 	while (true)
 	{
-		lock_scheduler();
-
-		struct sk_buff *skb;
-		struct sk_buff *prev_skb = NULL;
-		list_for_each_entry(skb, &lrx_skb, sibling)
+		rx_pending = false;
+		if (current_netdev && current_netdev->poll)
+			current_netdev->poll(current_netdev);
+
+		struct list_head rx_list;
+		INIT_LIST_HEAD(&rx_list);
+		uint32_t flags = spin_lock_irqsave(&rx_lock);
+		list_splice_init(&lrx_skb, &rx_list);
+		spin_unlock_irqrestore(&rx_lock, flags);
+
+		// NOTE: MQ 2020-10-12
+		// socket state is shared with tcp timers and tcp_transmit, bottom halves are disabled instead of interrupts
+		// -> irqs are still served during protocol processing and net thread can't be preempted
+		local_bh_disable();
+		spin_lock(&sock_list_lock);
+
+		struct sk_buff *skb, *next_skb;
+		list_for_each_entry_safe(skb, next_skb, &rx_list, sibling)
 		{
-			if (prev_skb)
-			{
-				list_del(&prev_skb->sibling);
-				skb_free(prev_skb);
-			}
-
 			struct socket *sock;
 			list_for_each_entry(sock, &lsocket, sibling)
 			{
@@ -277,49 +312,27 @@ void net_rx_loop()
 			if (current_netdev->state & NETDEV_STATE_CONNECTED)
 				net_default_rx_handler(skb);
 
-			prev_skb = skb;
-		}
-		if (prev_skb)
-		{
-			list_del(&prev_skb->sibling);
-			skb_free(prev_skb);
+			list_del(&skb->sibling);
+			skb_free(skb);
 		}
 
-		if (backup_thread)
-		{
-			update_thread(backup_thread, THREAD_READY);
-			backup_thread = NULL;
-		}
-		update_thread(net_thread, THREAD_WAITING);
-		unlock_scheduler();
-		schedule();
-	}
-}
+		spin_unlock(&sock_list_lock);
+		local_bh_enable();
 
-void net_switch()
-{
-	if (list_empty(&lrx_skb))
-		return;
-	if (net_thread != current_thread)
-	{
-		if (current_thread->state == THREAD_RUNNING)
-		{
-			backup_thread = current_thread;
-			update_thread(current_thread, THREAD_WAITING);
-		}
-		else
-			backup_thread = NULL;
-		update_thread(net_thread, THREAD_READY);
+		// softirq mustn't slip in between checking rx_pending and going to sleep
+		flags = local_irq_save();
+		if (!rx_pending)
+			update_thread(net_thread, THREAD_WAITING);
+		local_irq_restore(flags);
 		schedule();
 	}
-	else
-		update_thread(net_thread, THREAD_READY);
 }
 
 void net_init()
 {
 	INIT_LIST_HEAD(&lsocket);
 	INIT_LIST_HEAD(&lrx_skb);
+	open_softirq(NET_RX_SOFTIRQ, net_rx_action);
 
 	DEBUG &&debug_println(DEBUG_INFO, "[net] - Setup neighbour");
 	neighbour_init();
@@ -327,4 +340,11 @@ void net_init()
 	DEBUG &&debug_println(DEBUG_INFO, "[net] - Setup net process");
 	net_process = create_kernel_process("net", net_rx_loop, 0);
 	net_thread = net_process->thread;
+	// bounded packet latency even when apps saturate the cpu: 2ms every 10ms
+	sched_setattr(net_thread, &(struct sched_attr){
+								  .sched_policy = SCHED_DEADLINE,
+								  .sched_runtime = 2 * NSEC_PER_MSEC,
+								  .sched_deadline = 10 * NSEC_PER_MSEC,
+								  .sched_period = 10 * NSEC_PER_MSEC,
+							  });
 }
@@ -188,11 +188,13 @@ struct net_device
 	uint32_t local_ip;
 	uint32_t subnet_mask;
 	uint32_t lease_time;
+
+	// drain the card's rx ring into `push_rx_queue`, run by net thread
+	void (*poll)(struct net_device *dev);
 };
 
 void net_init();
 void net_rx_loop();
-void net_switch();
 void push_rx_queue(uint8_t *data, uint32_t size);
 void socket_setup(int32_t family, enum socket_type type, int32_t protocal, struct vfs_file *file);
 int socket_shutdown(struct socket *sock);
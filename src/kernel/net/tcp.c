@@ -218,12 +218,12 @@ int tcp_return_code(struct socket *sock, int success_code)
 	}
 }
 
+// NOTE: MQ 2020-10-03 rtt, srtt and rttvar are in microseconds, rto is still in milliseconds
+// kernel doesn't use fpu (it belongs to user threads), beta = 1/4 and alpha = 1/8 are done in integer
 void tcp_calculate_rto(struct socket *sock, uint32_t rtt)
 {
 #define K 4
-#define G 100
-#define beta 0.25
-#define alpha 0.125
+#define G 1000
 
 	struct tcp_sock *tsk = tcp_sk(sock->sk);
 
@@ -234,10 +234,10 @@ void tcp_calculate_rto(struct socket *sock, uint32_t rtt)
 	}
 	else
 	{
-		tsk->rttvar = (1 - beta) * tsk->rttvar + beta * abs((long)tsk->srtt - (long)rtt);
-		tsk->srtt = (1 - alpha) * tsk->srtt + alpha * rtt;
+		tsk->rttvar = (3 * tsk->rttvar + abs((long)tsk->srtt - (long)rtt)) / 4;
+		tsk->srtt = (7 * tsk->srtt + rtt) / 8;
 	}
-	tsk->rto = max_t(uint32_t, tsk->srtt + max_t(uint32_t, G, K * tsk->rttvar), 1000);
+	tsk->rto = max_t(uint32_t, (tsk->srtt + max_t(uint32_t, G, K * tsk->rttvar)) / 1000, 1000);
 }
 
 void tcp_calculate_congestion(struct socket *sock, uint32_t seg_ack)
@@ -80,7 +80,7 @@ struct tcp_sock
 	// timer
 	uint32_t rto;  // millisecon is the calculation unit
 	struct timer_list retransmit_timer;
-	uint32_t srtt;
+	uint32_t srtt;	 // microsecond
 	uint32_t rttvar;
 
 	struct timer_list persist_timer;
@@ -88,7 +88,7 @@ struct tcp_sock
 
 	// rtt
 	uint32_t rtt_end_seq;
-	uint64_t rtt_time;
+	uint64_t rtt_time;	// monotonic nanosecond when the measured segment is sent
 	uint8_t syn_retries;
 };
 
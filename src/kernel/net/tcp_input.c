@@ -83,7 +83,7 @@ void tcp_accept_ack(struct socket *sock, uint32_t ack_number, bool is_acked_all)
 
 	if (tsk->rtt_time && tsk->rtt_end_seq < ack_number)
 	{
-		uint32_t rtt = get_milliseconds(NULL) - tsk->rtt_time;
+		uint32_t rtt = (ktime_get_ns() - tsk->rtt_time) / NSEC_PER_USEC;
 		tcp_calculate_rto(sock, rtt);
 		tsk->rtt_time = 0;
 	}
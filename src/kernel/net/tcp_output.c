@@ -1,5 +1,6 @@
 #include <kernel/net/neighbour.h>
 #include <kernel/proc/task.h>
+#include <kernel/system/softirq.h>
 #include <kernel/system/time.h>
 #include <kernel/utils/math.h>
 #include <kernel/utils/string.h>
@@ -86,7 +87,8 @@ void tcp_transmit(struct socket *sock)
 	while (!list_empty(&sock->sk->tx_queue))
 	{
 		// NOTE: MQ 2020-07-20
-		// we lock scheduler (interrupt) until sending all pending packets (on queue not yet sent)
+		// we disable bottom halves until sending all pending packets (on queue not yet sent)
+		// -> net thread and tcp timers cannot run, interrupts are still served
 		// -> tx_queue now only contains outstanding packets
 		// measure sending with 65535 avaliable window takes ~ 2ms (which less than average RTT for each packet)
 		// the reason is prevent interrupting the sending flow which causes unexpected behaviors
@@ -101,7 +103,7 @@ void tcp_transmit(struct socket *sock)
 		// - send all segments but get interrutped when just out of loop and haven't updated/scheduled yet
 		// - receive ack for all segments -> back to interrupted point above
 		// -> schedule again which don't have anything to wait -> thread is waiting forever
-		lock_scheduler();
+		local_bh_disable();
 		while (tcp_sender_available_window(tsk) > 0 && sock->sk->send_head)
 		{
 			struct sk_buff *skb = list_entry(sock->sk->send_head, struct sk_buff, sibling);
@@ -118,11 +120,11 @@ void tcp_transmit(struct socket *sock)
 				assert(&skb->sibling == sock->sk->tx_queue.next);
 				struct tcp_skb_cb *cb = TCP_SKB_CB(skb);
 				tsk->rtt_end_seq = cb->end_seq;
-				tsk->rtt_time = cb->when;
+				tsk->rtt_time = ktime_get_ns();
 			}
 		}
 		update_thread(current_thread, THREAD_WAITING);
-		unlock_scheduler();
+		local_bh_enable();
 		schedule();
 	}
 };
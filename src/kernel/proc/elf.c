@@ -1,10 +1,13 @@
 #include "elf.h"
 
 #include <include/errno.h>
+#include <include/fcntl.h>
 #include <include/mman.h>
 #include <kernel/memory/pmm.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
+#include <kernel/system/sysapi.h>
+#include <kernel/system/vdso.h>
 #include <kernel/utils/string.h>
 
 #define NO_ERROR 0
@@ -14,6 +17,10 @@
 #define ERR_WRONG_VERSION 4
 #define ERR_NOT_SUPPORTED_TYPE 5
 
+// position independent program is placed here, between programs linked at 0x00100000 and ld.so at 0x38000000
+// -> never at 0 (an emptied address space has the whole range free) where it would cover the null page
+#define ELF_ET_DYN_BASE 0x10000000
+
 static int elf_verify(struct Elf32_Ehdr *elf_header)
 {
 	if (!(elf_header->e_ident[EI_MAG0] == ELFMAG0 &&
@@ -34,12 +41,191 @@ static int elf_verify(struct Elf32_Ehdr *elf_header)
 	if (elf_header->e_machine != EM_386)
 		return -ERR_NOT_SUPPORTED_PLATFORM;
 
-	if (elf_header->e_type != ET_EXEC)
+	if (elf_header->e_type != ET_EXEC && elf_header->e_type != ET_DYN)
 		return -ERR_NOT_SUPPORTED_TYPE;
 
 	return NO_ERROR;
 }
 
+static int elf_read(struct vfs_file *file, void *buf, size_t count, loff_t ppos)
+{
+	if (ppos + count > file->f_dentry->d_inode->i_size)
+		return -ENOEXEC;
+
+	file->f_op->read(file, buf, count, ppos);
+	return 0;
+}
+
+static int elf_read_header(struct vfs_file *file, struct Elf32_Ehdr *elf_header)
+{
+	if (elf_read(file, elf_header, sizeof(struct Elf32_Ehdr), 0) < 0 ||
+		elf_verify(elf_header) != NO_ERROR || elf_header->e_phoff == 0)
+		return -ENOEXEC;
+
+	return 0;
+}
+
+static char *elf_read_phdrs(struct vfs_file *file, struct Elf32_Ehdr *elf_header)
+{
+	uint32_t phsize = elf_header->e_phentsize * elf_header->e_phnum;
+	char *phbuf = kcalloc(phsize, sizeof(char));
+	if (elf_read(file, phbuf, phsize, elf_header->e_phoff) < 0)
+	{
+		kfree(phbuf);
+		return NULL;
+	}
+	return phbuf;
+}
+
+#define for_each_phdr(ph, elf_header, phbuf) \
+	for (struct Elf32_Phdr *ph = (struct Elf32_Phdr *)(phbuf); (char *)ph < (phbuf) + (elf_header)->e_phentsize * (elf_header)->e_phnum; ++ph)
+
+// path of the program interpreter (PT_INTERP), NULL for a statically linked program
+static char *elf_read_interp(struct vfs_file *file, struct Elf32_Ehdr *elf_header, char *phbuf)
+{
+	for_each_phdr(ph, elf_header, phbuf)
+	{
+		if (ph->p_type != PT_INTERP)
+			continue;
+
+		char *interp = kcalloc(ph->p_filesz + 1, sizeof(char));
+		if (elf_read(file, interp, ph->p_filesz, ph->p_offset) < 0)
+		{
+			kfree(interp);
+			return NULL;
+		}
+		return interp;
+	}
+	return NULL;
+}
+
+// NOTE: MQ 2020-10-18
+// everything elf_load can fail on is checked here, before exec drops the old address space
+// -> program and its interpreter (headers and program headers) are readable and supported
+int elf_check(struct vfs_file *file)
+{
+	struct Elf32_Ehdr elf_header;
+	char *phbuf;
+	if (elf_read_header(file, &elf_header) < 0 || !(phbuf = elf_read_phdrs(file, &elf_header)))
+		return -ENOEXEC;
+
+	char *interp = elf_read_interp(file, &elf_header, phbuf);
+	kfree(phbuf);
+	if (!interp)
+		return 0;
+
+	struct vfs_file *interp_file = open_exec(interp);
+	kfree(interp);
+	if (!interp_file)
+		return -ENOENT;
+
+	struct Elf32_Ehdr interp_header;
+	char *interp_phbuf = NULL;
+	int32_t ret = 0;
+	if (elf_read_header(interp_file, &interp_header) < 0 || !(interp_phbuf = elf_read_phdrs(interp_file, &interp_header)))
+		ret = -ENOEXEC;
+	kfree(interp_phbuf);
+	fput(interp_file);
+	return ret;
+}
+
+// segment is mapped from page cache when its file offset and address have the same offset in page, otherwise it is copied
+static void elf_map_segment(struct vfs_file *file, struct Elf32_Phdr *ph, uint32_t bias)
+{
+	uint32_t vm_flags = ((ph->p_flags & PF_R) ? VM_READ : 0) |
+						((ph->p_flags & PF_W) ? VM_WRITE : 0) |
+						((ph->p_flags & PF_X) ? VM_EXEC : 0);
+	uint32_t vaddr = ph->p_vaddr + bias;
+	uint32_t start = vaddr & PAGE_MASK;
+	uint32_t file_end = vaddr + ph->p_filesz;
+	uint32_t mem_end = PAGE_ALIGN(vaddr + ph->p_memsz);
+
+	if ((vaddr ^ ph->p_offset) & ~PAGE_MASK)
+	{
+		// NOTE: MQ 2019-11-26 According to elf's spec, p_memsz may be larger than p_filesz due to bss section
+		do_mmap(start, mem_end - start, 0, 0, -1);
+		memset((char *)vaddr, 0, ph->p_memsz);
+		file->f_op->read(file, (char *)vaddr, ph->p_filesz, ph->p_offset);
+		return;
+	}
+
+	if (ph->p_filesz)
+	{
+		struct vm_area_struct *vma = get_unmapped_area(start, PAGE_ALIGN(file_end) - start);
+		vma->vm_flags = vm_flags;
+		// every area holds its own reference, it is dropped when the area is unmapped
+		vma->vm_file = file;
+		atomic_inc(&file->f_count);
+		vma->vm_pgoff = ph->p_offset / PMM_FRAME_SIZE;
+		vma->vm_file_end = ph->p_memsz > ph->p_filesz ? file_end : vma->vm_end;
+		start = vma->vm_end;
+	}
+
+	// bss after the last file page is demand-zero
+	if (mem_end > start)
+	{
+		struct vm_area_struct *vma = get_unmapped_area(start, mem_end - start);
+		vma->vm_flags = vm_flags;
+	}
+}
+
+// executable is mapped at its link address, shared object is placed at the first free range from base which fits
+// all segments (base 0 is the first free range after the ones which are already mapped)
+static uint32_t elf_load_bias(struct Elf32_Ehdr *elf_header, char *phbuf, uint32_t base)
+{
+	if (elf_header->e_type != ET_DYN)
+		return 0;
+
+	uint32_t start = UINT32_MAX, end = 0;
+	for_each_phdr(ph, elf_header, phbuf)
+	{
+		if (ph->p_type != PT_LOAD)
+			continue;
+		start = min(start, ph->p_vaddr & PAGE_MASK);
+		end = max(end, PAGE_ALIGN(ph->p_vaddr + ph->p_memsz));
+	}
+
+	struct vm_area_struct *area = get_unmapped_area(base, end - start);
+	uint32_t bias = area->vm_start - start;
+	list_del(&area->vm_sibling);
+	kfree(area);
+
+	return bias;
+}
+
+static void elf_map_object(struct vfs_file *file, struct Elf32_Ehdr *elf_header, char *phbuf, uint32_t bias)
+{
+	for_each_phdr(ph, elf_header, phbuf)
+	{
+		if (ph->p_type == PT_LOAD)
+			elf_map_segment(file, ph, bias);
+	}
+}
+
+// NOTE: MQ 2020-10-18
+// interpreter gets program headers, entry and its own base via auxiliary vector which is put in heap
+// -> entry is where the program is actually mapped (e_entry + bias), not its link address
+static uint32_t elf_setup_auxv(struct Elf32_Ehdr *elf_header, char *phbuf, uint32_t bias, uint32_t interp_base)
+{
+	uint32_t phsize = elf_header->e_phentsize * elf_header->e_phnum;
+	char *user_phdr = (char *)sys_sbrk(phsize);
+	memcpy(user_phdr, phbuf, phsize);
+
+	struct Elf32_auxv auxv[] = {
+		{AT_PHDR, (uint32_t)user_phdr},
+		{AT_PHENT, elf_header->e_phentsize},
+		{AT_PHNUM, elf_header->e_phnum},
+		{AT_PAGESZ, PMM_FRAME_SIZE},
+		{AT_BASE, interp_base},
+		{AT_ENTRY, elf_header->e_entry + bias},
+		{AT_NULL, 0},
+	};
+	struct Elf32_auxv *user_auxv = (struct Elf32_auxv *)sys_sbrk(sizeof(auxv));
+	memcpy(user_auxv, auxv, sizeof(auxv));
+
+	return (uint32_t)user_auxv;
+}
+
 /*
 * 	+---------------+ 	/
 * 	| stack pointer | grows toward lower addresses
@@ -59,19 +245,21 @@ static int elf_verify(struct Elf32_Ehdr *elf_header)
 * 	+---------------+
 */
 
-struct Elf32_Layout *elf_load(char *buf)
+// NOTE: MQ 2020-10-18
+// segments are not copied, they are mapped from page cache and faulted in when touched (see handle_mm_fault)
+struct Elf32_Layout *elf_load(struct vfs_file *file)
 {
-	struct Elf32_Ehdr *elf_header = (struct Elf32_Ehdr *)buf;
-
-	if (elf_verify(elf_header) != NO_ERROR || elf_header->e_phoff == 0)
+	struct Elf32_Ehdr elf_header;
+	char *phbuf;
+	if (elf_read_header(file, &elf_header) < 0 || !(phbuf = elf_read_phdrs(file, &elf_header)))
 		return NULL;
 
 	struct mm_struct *mm = current_process->mm;
 	struct Elf32_Layout *layout = kcalloc(1, sizeof(struct Elf32_Layout));
-	layout->entry = elf_header->e_entry;
-	for (struct Elf32_Phdr *ph = (struct Elf32_Phdr *)(buf + elf_header->e_phoff);
-		 ph && (char *)ph < (buf + elf_header->e_phoff + elf_header->e_phentsize * elf_header->e_phnum);
-		 ++ph)
+	uint32_t bias = elf_load_bias(&elf_header, phbuf, ELF_ET_DYN_BASE);
+	char *interp = elf_read_interp(file, &elf_header, phbuf);
+	layout->entry = elf_header.e_entry + bias;
+	for_each_phdr(ph, &elf_header, phbuf)
 	{
 		if (ph->p_type != PT_LOAD)
 			continue;
@@ -79,24 +267,46 @@ struct Elf32_Layout *elf_load(char *buf)
 		// text segment
 		if ((ph->p_flags & PF_X) != 0 && (ph->p_flags & PF_R) != 0)
 		{
-			do_mmap(ph->p_vaddr, ph->p_memsz, 0, 0, -1);
-			mm->start_code = ph->p_vaddr;
-			mm->end_code = ph->p_vaddr + ph->p_memsz;
+			mm->start_code = ph->p_vaddr + bias;
+			mm->end_code = ph->p_vaddr + bias + ph->p_memsz;
 		}
 		// data segment
 		else if ((ph->p_flags & PF_W) != 0 && (ph->p_flags & PF_R) != 0)
 		{
-			do_mmap(ph->p_vaddr, ph->p_memsz, 0, 0, -1);
-			mm->start_data = ph->p_vaddr;
-			mm->end_data = ph->p_memsz;
+			mm->start_data = ph->p_vaddr + bias;
+			mm->end_data = ph->p_vaddr + bias + ph->p_memsz;
 		}
-		// eh frame
-		else
-			do_mmap(ph->p_vaddr, ph->p_memsz, 0, 0, -1);
 
-		// NOTE: MQ 2019-11-26 According to elf's spec, p_memsz may be larger than p_filesz due to bss section
-		memset((char *)ph->p_vaddr, 0, ph->p_memsz);
-		memcpy((char *)ph->p_vaddr, buf + ph->p_offset, ph->p_filesz);
+		elf_map_segment(file, ph, bias);
+	}
+
+	// dynamically linked program starts in its interpreter (ld.so), which loads libraries and relocates
+	// NOTE: MQ 2020-10-18 ld.so is ET_EXEC linked at 0x38000000 (apps/ld/linker.ld) -> bias is 0 and it is always
+	// mapped there, only an ET_DYN interpreter would be placed at the first free range like a shared object
+	bool dynamic = interp != NULL;
+	uint32_t interp_base = 0;
+	if (dynamic)
+	{
+		struct vfs_file *interp_file = open_exec(interp);
+		struct Elf32_Ehdr interp_header;
+		char *interp_phbuf;
+		kfree(interp);
+
+		if (!interp_file || elf_read_header(interp_file, &interp_header) < 0 ||
+			!(interp_phbuf = elf_read_phdrs(interp_file, &interp_header)))
+		{
+			if (interp_file)
+				fput(interp_file);
+			kfree(phbuf);
+			kfree(layout);
+			return NULL;
+		}
+		interp_base = elf_load_bias(&interp_header, interp_phbuf, 0);
+		elf_map_object(interp_file, &interp_header, interp_phbuf, interp_base);
+		layout->entry = interp_header.e_entry + interp_base;
+		kfree(interp_phbuf);
+		// its mapped areas keep the interpreter open
+		fput(interp_file);
 	}
 
 	uint32_t heap_start = do_mmap(0, UHEAP_SIZE, 0, 0, -1);
@@ -107,9 +317,31 @@ struct Elf32_Layout *elf_load(char *buf)
 	uint32_t stack_start = do_mmap(0, STACK_SIZE, 0, 0, -1);
 	layout->stack = stack_start + STACK_SIZE;
 
+	vdso_map(current_process->pdir);
+
+	if (dynamic)
+		layout->auxv = elf_setup_auxv(&elf_header, phbuf, bias, interp_base);
+	kfree(phbuf);
+
 	return layout;
 }
 
+// map a shared object for the dynamic linker (uselib), returns the address it is loaded at
+int32_t elf_load_library(struct vfs_file *file)
+{
+	struct Elf32_Ehdr elf_header;
+	char *phbuf;
+	if (elf_read_header(file, &elf_header) < 0 || elf_header.e_type != ET_DYN ||
+		!(phbuf = elf_read_phdrs(file, &elf_header)))
+		return -ENOEXEC;
+
+	uint32_t bias = elf_load_bias(&elf_header, phbuf, 0);
+	elf_map_object(file, &elf_header, phbuf, bias);
+	kfree(phbuf);
+
+	return bias;
+}
+
 void elf_unload()
 {
 	// caught signals are reset
@@ -119,11 +351,12 @@ void elf_unload()
 	struct vm_area_struct *iter, *next;
 	list_for_each_entry_safe(iter, next, &current_process->mm->mmap, vm_sibling)
 	{
-		if (!iter->vm_file && (iter->vm_flags & MAP_SHARED) == 0)
-		{
+		if (!(iter->vm_flags & VM_SHARED))
 			vmm_unmap_range(current_process->pdir, iter->vm_start, iter->vm_end);
-			list_del(&iter->vm_sibling);
-		}
+		list_del(&iter->vm_sibling);
+		if (iter->vm_file)
+			fput(iter->vm_file);
+		kfree(iter);
 	}
 	memset(current_process->mm, 0, sizeof(struct mm_struct));
 	INIT_LIST_HEAD(&current_process->mm->mmap);
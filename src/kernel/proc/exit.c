@@ -1,18 +1,25 @@
 #include <include/atomic.h>
+#include <kernel/cpu/fpu.h>
 #include <kernel/devices/char/tty.h>
 #include <kernel/ipc/signal.h>
 
+#include <kernel/utils/printf.h>
+
 #include "task.h"
 
+static struct thread *reaper_thread;
+
 static void exit_mm(struct process *proc)
 {
 	struct vm_area_struct *iter, *next;
 	list_for_each_entry_safe(iter, next, &proc->mm->mmap, vm_sibling)
 	{
-		if (!iter->vm_file)
+		if (!(iter->vm_flags & VM_SHARED))
 			vmm_unmap_range(proc->pdir, iter->vm_start, iter->vm_end);
 
 		list_del(&iter->vm_sibling);
+		if (iter->vm_file)
+			fput(iter->vm_file);
 		kfree(iter);
 	}
 }
@@ -23,11 +30,9 @@ static void exit_files(struct process *proc)
 	{
 		struct vfs_file *file = proc->files->fd[i];
 
-		if (file && atomic_read(&file->f_count) == 1 && file->f_op->release)
-		{
-			file->f_op->release(file->f_dentry->d_inode, file);
-			kfree(file);
-		}
+		// the last holder (another process or a mapped area) releases it
+		if (file)
+			fput(file);
 	}
 }
 
@@ -37,16 +42,15 @@ static void exit_thread(struct process *proc)
 
 	update_thread(th, THREAD_TERMINATED);
 	del_timer(&th->sleep_timer);
-	vmm_unmap_range(proc->pdir, th->user_stack - STACK_SIZE, th->user_stack);
+	fpu_exit(th);
+	// vfork child runs on parent's stack
+	if (!proc->vfork_shared)
+		vmm_unmap_range(proc->pdir, th->user_stack - STACK_SIZE, th->user_stack);
 }
 
 static void exit_notify(struct process *proc)
 {
-	struct process *iter;
-	list_for_each_entry(iter, &proc->children, sibling)
-	{
-		iter->parent = find_process_by_pid(INIT_PID);
-	}
+	reparent_children(proc);
 	if (!proc->caused_signal)
 		proc->flags |= EXIT_TERMINATED;
 
@@ -61,23 +65,71 @@ static void exit_notify(struct process *proc)
 	wake_up(&proc->parent->wait_chld);
 }
 
+// NOTE: MQ 2020-10-18
+// exiting thread cannot free the kernel stack it runs on, reaper releases it after the thread is switched out
+static void wake_up_reaper()
+{
+	if (reaper_thread && reaper_thread->state == THREAD_WAITING)
+		update_thread(reaper_thread, THREAD_READY);
+}
+
 void do_exit(int32_t code)
 {
-	exit_mm(current_process);
+	// vfork child's mm (and page directory) are parent's
+	if (current_process->vfork_shared)
+		current_process->mm = NULL;
+	else
+		exit_mm(current_process);
 	exit_files(current_process);
 	exit_thread(current_process);
+	vfork_release(current_process);
 
 	current_process->exit_code = code;
 	exit_notify(current_process);
 
+	wake_up_reaper();
 	schedule();
 }
 
+static void reaper_loop()
+{
+	// explain in kernel_init#unlock_scheduler
+	unlock_scheduler();
+
+	while (true)
+	{
+		// checking and sleeping are not interrupted -> a thread terminated in between cannot be missed
+		uint32_t flags = local_irq_save();
+		struct thread *th = pop_terminated_thread();
+
+		if (!th)
+		{
+			update_thread(reaper_thread, THREAD_WAITING);
+			local_irq_restore(flags);
+			schedule();
+			continue;
+		}
+		local_irq_restore(flags);
+
+		release_thread(th);
+	}
+}
+
+void reaper_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[reaper] - Initializing");
+
+	struct process *reaper = create_kernel_process("reaper", reaper_loop, 0);
+	reaper_thread = reaper->thread;
+
+	DEBUG &&debug_println(DEBUG_INFO, "[reaper] - Done");
+}
+
 int32_t do_wait(idtype_t idtype, id_t id, struct infop *infop, int options)
 {
 	int32_t ret = -1;
 	DEFINE_WAIT(wait);
-	list_add_tail(&wait.sibling, &current_process->wait_chld.list);
+	add_wait_queue(&current_process->wait_chld, &wait);
 
 	struct process *pchild = NULL;
 	while (true)
@@ -105,7 +157,7 @@ int32_t do_wait(idtype_t idtype, id_t id, struct infop *infop, int options)
 		update_thread(current_thread, THREAD_WAITING);
 		schedule();
 	}
-	list_del(&wait.sibling);
+	remove_wait_queue(&current_process->wait_chld, &wait);
 
 	if (pchild)
 	{
@@ -124,6 +176,9 @@ int32_t do_wait(idtype_t idtype, id_t id, struct infop *infop, int options)
 			infop->si_status = pchild->exit_code;
 		}
 		ret = 0;
+
+		if (pchild->flags & (SIGNAL_TERMINATED | EXIT_TERMINATED) && !(options & WNOWAIT))
+			release_process(pchild);
 	}
 
 	return ret;
@@ -0,0 +1,28 @@
+#ifndef PROC_PREEMPT_H
+#define PROC_PREEMPT_H
+
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/task.h>
+
+// NOTE: MQ 2020-10-14
+// a thread with preempt_count > 0 keeps the cpu until it calls preempt_enable
+// irqsave spinlocks and bottom-half sections don't need it, they are already not preemptible
+static inline void preempt_disable()
+{
+	current_thread->preempt_count++;
+	barrier();
+}
+
+static inline void preempt_enable_no_resched()
+{
+	barrier();
+	current_thread->preempt_count--;
+}
+
+static inline void preempt_enable()
+{
+	preempt_enable_no_resched();
+	cond_resched();
+}
+
+#endif
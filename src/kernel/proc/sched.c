@@ -1,11 +1,15 @@
+#include <include/errno.h>
 #include <include/limits.h>
+#include <kernel/cpu/fpu.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
 #include <kernel/cpu/pic.h>
 #include <kernel/cpu/tss.h>
 #include <kernel/fs/poll.h>
 #include <kernel/ipc/signal.h>
+#include <kernel/locking/spinlock.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/system/softirq.h>
 #include <kernel/system/time.h>
 
 #include "task.h"
@@ -14,8 +18,24 @@ extern void irq_task_handler();
 extern void do_switch(uint32_t *addr_current_kernel_esp, uint32_t next_kernel_esp, uint32_t cr3);
 
 struct plist_head terminated_list, waiting_list;
-struct plist_head kernel_ready_list, system_ready_list, app_ready_list;
+struct plist_head kernel_ready_list, deadline_ready_list, system_ready_list, app_ready_list;
 uint32_t volatile scheduler_lock_counter = 0;
+// protects ready/waiting/terminated lists, threads' state and priority
+static DEFINE_SPINLOCK(rq_lock);
+
+// deadline threads which used up their budget, they are replenished and requeued at their deadline
+static LIST_HEAD(dl_throttled_list);
+// sum of admitted dl_bw, at most BW_LIMIT so other classes are never starved completely
+#define BW_SHIFT 20
+#define BW_UNIT (1 << BW_SHIFT)
+#define BW_LIMIT (BW_UNIT * 95 / 100)
+static uint32_t dl_total_bw;
+
+// NOTE: MQ 2020-10-18 uniprocessor -> one set of cpu statistics, protected by rq_lock like threads' statistics
+static uint64_t nr_switches;
+static uint64_t idle_time;
+static uint64_t switch_second;
+static uint32_t switches_in_second, switch_rate;
 
 void lock_scheduler()
 {
@@ -41,6 +61,8 @@ static struct thread *get_next_thread_from_list(struct plist_head *list)
 static struct thread *get_next_thread_to_run()
 {
 	struct thread *nt = get_next_thread_from_list(&kernel_ready_list);
+	if (!nt)
+		nt = get_next_thread_from_list(&deadline_ready_list);
 	if (!nt)
 		nt = get_next_thread_from_list(&system_ready_list);
 	if (!nt)
@@ -61,21 +83,82 @@ static struct thread *pop_next_thread_from_list(struct plist_head *list)
 
 static struct thread *pop_next_thread_to_run()
 {
+	spin_lock(&rq_lock);
+
 	struct thread *nt = pop_next_thread_from_list(&kernel_ready_list);
+	if (!nt)
+		nt = pop_next_thread_from_list(&deadline_ready_list);
 	if (!nt)
 		nt = pop_next_thread_from_list(&system_ready_list);
 	if (!nt)
 		nt = pop_next_thread_from_list(&app_ready_list);
 
+	spin_unlock(&rq_lock);
 	return nt;
 }
 
+// NOTE: MQ 2020-10-18
+// only total run time is measured, it is split into user/system time in proportion to ticks sampled in each mode
+void thread_rusage(struct thread *th, struct task_rusage *ru)
+{
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+
+	uint64_t runtime = th->sum_exec_runtime;
+	if (th == current_thread)
+		runtime += ktime_get_ns() - th->exec_start;
+	uint32_t utime_ticks = th->stats.utime_ticks;
+	uint32_t stime_ticks = th->stats.stime_ticks;
+	ru->nvcsw = th->stats.nvcsw;
+	ru->nivcsw = th->stats.nivcsw;
+
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	// microseconds keep the product in 64 bits
+	uint64_t runtime_us = runtime / NSEC_PER_USEC;
+	if (!stime_ticks)
+		ru->utime = runtime;
+	else if (!utime_ticks)
+		ru->utime = 0;
+	else
+		ru->utime = runtime_us * utime_ticks / (utime_ticks + stime_ticks) * NSEC_PER_USEC;
+	ru->stime = runtime - ru->utime;
+}
+
+void sched_get_cpu_stats(struct sched_cpu_stats *stats)
+{
+	uint64_t second = ktime_get_ns() / NSEC_PER_SEC;
+
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+	stats->nr_switches = nr_switches;
+	stats->idle_time = idle_time;
+	// no switch since the last roll-over -> the counted second may already be over
+	if (second == switch_second)
+		stats->switch_rate = switch_rate;
+	else if (second == switch_second + 1)
+		stats->switch_rate = switches_in_second;
+	else
+		stats->switch_rate = 0;
+	spin_unlock_irqrestore(&rq_lock, flags);
+}
+
+// reaper takes terminated threads off the list one by one
+struct thread *pop_terminated_thread()
+{
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+	struct thread *th = pop_next_thread_from_list(&terminated_list);
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	return th;
+}
+
 static struct plist_head *get_list_from_thread(enum thread_state state, enum thread_policy policy)
 {
 	if (state == THREAD_READY)
 	{
 		if (policy == THREAD_KERNEL_POLICY)
 			return &kernel_ready_list;
+		else if (policy == THREAD_DEADLINE_POLICY)
+			return &deadline_ready_list;
 		else if (policy == THREAD_SYSTEM_POLICY)
 			return &system_ready_list;
 		else
@@ -101,42 +184,243 @@ int get_top_priority_from_list(enum thread_state state, enum thread_policy polic
 	return INT_MAX;
 }
 
-void queue_thread(struct thread *th)
+// accounting and throttling only apply to threads with deadline parameters, not to ones boosted into the class
+static bool dl_task(struct thread *th)
+{
+	return th->policy == THREAD_DEADLINE_POLICY && !th->pi_boosted;
+}
+
+// NOTE: MQ 2020-10-16 deadline_ready_list is ordered by absolute deadline in milliseconds (wraps after ~24 days of uptime)
+static int dl_key(uint64_t deadline)
+{
+	return (int)(deadline / NSEC_PER_MSEC);
+}
+
+static bool dl_earlier(struct thread *a, struct thread *b)
+{
+	return a->policy == THREAD_DEADLINE_POLICY && b->policy == THREAD_DEADLINE_POLICY && a->dl.deadline < b->dl.deadline;
+}
+
+// throttled thread is off the ready list until it is replenished
+static bool thread_is_queued(struct thread *th)
+{
+	return !(th->state == THREAD_READY && th->dl.dl_throttled);
+}
+
+static void __queue_thread(struct thread *th)
 {
+	if (!thread_is_queued(th))
+		return;
+
 	struct plist_head *h = get_list_from_thread(th->state, th->policy);
 
 	if (h)
 		plist_add(&th->sched_sibling, h);
 }
 
+void queue_thread(struct thread *th)
+{
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+	__queue_thread(th);
+	spin_unlock_irqrestore(&rq_lock, flags);
+}
+
 static void remove_thread(struct thread *th)
 {
+	if (!thread_is_queued(th))
+		return;
+
 	struct plist_head *h = get_list_from_thread(th->state, th->policy);
 
 	if (h)
 		plist_del(&th->sched_sibling, h);
 }
 
+// give bandwidth of an exiting deadline thread back
+static void dl_release(struct thread *th)
+{
+	dl_total_bw -= th->dl.dl_bw;
+	th->dl.dl_bw = 0;
+	if (th->dl.dl_throttled)
+	{
+		list_del(&th->dl.throttled_sibling);
+		th->dl.dl_throttled = false;
+	}
+}
+
+// CBS wake-up rule: keep the current deadline only if the remaining budget fits in it without exceeding the bandwidth
+static void dl_wakeup(struct thread *th, uint64_t now)
+{
+	struct sched_dl_entity *dl = &th->dl;
+
+	if (dl->deadline <= now ||
+		(uint64_t)(dl->runtime >> 10) * (dl->dl_period >> 10) > ((dl->deadline - now) >> 10) * (dl->dl_runtime >> 10))
+	{
+		dl->deadline = now + dl->dl_deadline;
+		dl->runtime = dl->dl_runtime;
+	}
+	th->sched_sibling.prio = dl_key(dl->deadline);
+}
+
+// ready thread starts waiting for cpu, rq_lock is held
+static void update_stats_wait(struct thread *th, uint8_t state, uint64_t now)
+{
+	if (state == THREAD_READY && th->state != THREAD_READY)
+	{
+		th->stats.wait_start = now;
+		th->stats.wakeup = th->state != THREAD_RUNNING;
+	}
+	else if (state != THREAD_READY)
+		th->stats.wait_start = 0;
+}
+
+static uint32_t latency_bucket(uint64_t delta)
+{
+	uint32_t bucket = 0;
+	for (uint64_t bound = 10 * NSEC_PER_USEC; delta >= bound && bucket < SCHED_LAT_BUCKETS - 1; bound *= 10)
+		bucket++;
+	return bucket;
+}
+
+// previous thread gives cpu up voluntarily unless it is still ready (preempted), next thread's wait ends, rq_lock is held
+static void update_stats_switch(struct thread *pt, struct thread *nt, uint64_t now)
+{
+	if (pt->state == THREAD_READY)
+		pt->stats.nivcsw++;
+	else
+		pt->stats.nvcsw++;
+
+	struct sched_statistics *stats = &nt->stats;
+	if (stats->wait_start)
+	{
+		uint64_t delta = now - stats->wait_start;
+		stats->wait_sum += delta;
+		stats->wait_max = max_t(uint64_t, stats->wait_max, delta);
+		stats->wait_count++;
+		if (stats->wakeup)
+			stats->lat_hist[latency_bucket(delta)]++;
+		stats->wait_start = 0;
+	}
+
+	nr_switches++;
+	uint64_t second = now / NSEC_PER_SEC;
+	if (second != switch_second)
+	{
+		switch_rate = second == switch_second + 1 ? switches_in_second : 0;
+		switch_second = second;
+		switches_in_second = 0;
+	}
+	switches_in_second++;
+}
+
 void update_thread(struct thread *th, uint8_t state)
 {
 	if (th->state == state)
 		return;
 
-	lock_scheduler();
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+	uint64_t now = state == THREAD_READY ? ktime_get_ns() : 0;
 
 	remove_thread(th);
+	if (state == THREAD_READY && th->state != THREAD_RUNNING && dl_task(th) && !th->dl.dl_throttled)
+		dl_wakeup(th, now);
+	else if (state == THREAD_TERMINATED && th->policy == THREAD_DEADLINE_POLICY)
+		dl_release(th);
+	update_stats_wait(th, state, now);
 	th->state = state;
-	queue_thread(th);
+	__queue_thread(th);
 
-	unlock_scheduler();
+	// woken thread has higher class (or earlier deadline) than the running one -> switch at the next irq return/preemption point
+	if (state == THREAD_READY && th != current_thread && thread_is_queued(th) &&
+		(th->policy < current_thread->policy || dl_earlier(th, current_thread)))
+		current_thread->need_resched = true;
+
+	spin_unlock_irqrestore(&rq_lock, flags);
+}
+
+// change class/priority of a thread wherever it is queued
+void sched_set_prio(struct thread *th, enum thread_policy policy, int32_t prio)
+{
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+
+	remove_thread(th);
+	th->policy = policy;
+	th->sched_sibling.prio = prio;
+	__queue_thread(th);
+
+	struct thread *nt = get_next_thread_to_run();
+	if (th == current_thread && nt && nt->policy < th->policy)
+		th->need_resched = true;
+	else if (th != current_thread && th->state == THREAD_READY && th->policy < current_thread->policy)
+		current_thread->need_resched = true;
+
+	spin_unlock_irqrestore(&rq_lock, flags);
+}
+
+static void dl_throttle(struct thread *th)
+{
+	// a waiting thread stays on waiting_list, it is only kept off the ready list
+	if (th->state == THREAD_READY)
+		remove_thread(th);
+	th->dl.dl_throttled = true;
+	list_add_tail(&th->dl.throttled_sibling, &dl_throttled_list);
+}
+
+static void dl_replenish(struct thread *th)
+{
+	struct sched_dl_entity *dl = &th->dl;
+
+	while (dl->runtime <= 0)
+	{
+		dl->deadline += dl->dl_period;
+		dl->runtime += dl->dl_runtime;
+	}
+	th->sched_sibling.prio = dl_key(dl->deadline);
+
+	list_del(&dl->throttled_sibling);
+	dl->dl_throttled = false;
+	if (th->state == THREAD_READY)
+		__queue_thread(th);
+}
+
+// charge the time since the last update to the running thread, rq_lock is held
+static void update_curr(struct thread *th, uint64_t now)
+{
+	uint64_t delta = now - th->exec_start;
+
+	th->sum_exec_runtime += delta;
+	th->exec_start = now;
+
+	if (!dl_task(th) || th->dl.dl_throttled)
+		return;
+
+	th->dl.runtime -= delta;
+	if (th->dl.runtime <= 0)
+	{
+		dl_throttle(th);
+		th->need_resched = true;
+	}
 }
 
 static void switch_thread(struct thread *nt)
 {
+	// current thread was woken up before it had a chance to sleep and popped itself from ready list
 	if (current_thread == nt)
+	{
+		nt->state = THREAD_RUNNING;
+		nt->stats.wait_start = 0;
 		return;
+	}
 
 	struct thread *pt = current_thread;
+	uint64_t now = ktime_get_ns();
+
+	spin_lock(&rq_lock);
+	update_curr(pt, now);
+	update_stats_switch(pt, nt, now);
+	spin_unlock(&rq_lock);
+	pt->need_resched = false;
+	nt->exec_start = now;
 
 	current_thread = nt;
 	current_thread->time_slice = 0;
@@ -145,6 +429,7 @@ static void switch_thread(struct thread *nt)
 
 	uint32_t paddr_cr3 = vmm_get_physical_address((uint32_t)current_thread->parent->pdir, true);
 	tss_set_stack(0x10, current_thread->kernel_stack);
+	fpu_switch(pt, current_thread);
 	do_switch(&pt->esp, current_thread->esp, paddr_cr3);
 }
 
@@ -153,11 +438,14 @@ void schedule()
 	if (current_thread->state == THREAD_RUNNING)
 		return;
 
+	lockdep_assert_no_locks_held();
+
 	lock_scheduler();
 	struct thread *nt = pop_next_thread_to_run();
 
 	if (!nt)
 	{
+		uint64_t idle_start = ktime_get_ns();
 		do
 		{
 			unlock_scheduler();
@@ -171,6 +459,7 @@ void schedule()
 			if (!nt && current_thread->state == THREAD_RUNNING)
 				nt = current_thread;
 		} while (!nt);
+		idle_time += ktime_get_ns() - idle_start;
 	}
 
 	switch_thread(nt);
@@ -184,60 +473,226 @@ void schedule()
 }
 
 #define SLICE_THRESHOLD 8
+// NOTE: MQ 2020-10-14
+// tick only marks current thread, switching happens at irq return (preempt_schedule_irq) or a preemption point
+// -> a thread inside a non-preemptible section keeps running and is switched out as soon as it leaves
 int32_t irq_schedule_handler(struct interrupt_registers *regs)
 {
-	if (current_thread->policy != THREAD_APP_POLICY)
+	struct thread *th = current_thread;
+
+	if (th->state != THREAD_RUNNING)
 		return IRQ_HANDLER_CONTINUE;
 
-	lock_scheduler();
+	// privilege level of the interrupted code
+	if (regs->cs & 0x3)
+		th->stats.utime_ticks++;
+	else
+		th->stats.stime_ticks++;
+#ifndef CONFIG_PREEMPT
+	if (th->policy != THREAD_APP_POLICY)
+		return IRQ_HANDLER_CONTINUE;
+#endif
 
-	bool is_schedulable = false;
-	current_thread->time_slice++;
+	th->time_slice++;
 
-	if (current_thread->time_slice >= SLICE_THRESHOLD)
+	spin_lock(&rq_lock);
+
+	struct thread *nt = get_next_thread_to_run();
+	// kernel/system threads woken by bottom halves (net, kworker) don't wait for the slice
+	if (nt && nt->policy < th->policy)
+		th->need_resched = true;
+	else if (nt && th->policy == THREAD_APP_POLICY && th->time_slice >= SLICE_THRESHOLD)
 	{
-		struct thread *nt = get_next_thread_to_run();
+		// 1. if all threads have the same priority -> increase its priorty
+		// 2. otherwise -> swap each element and move current to the last
+		struct thread *first_thd = plist_first_entry(&app_ready_list, struct thread, sched_sibling);
+		struct thread *last_thd = plist_last_entry(&app_ready_list, struct thread, sched_sibling);
 
-		if (nt)
+		if (last_thd->sched_sibling.prio == first_thd->sched_sibling.prio && last_thd->sched_sibling.prio == th->sched_sibling.prio)
+			th->sched_sibling.prio++;
+		else
 		{
-			// 1. if next thread to run is not app policy -> step 4
-			// 2. if all threads have the same priority -> increase its priorty -> step 4
-			// 3. otherwise -> swap each element and move current to the last
-			// 4. update thread
-			if (nt->policy == THREAD_APP_POLICY)
-			{
-				struct thread *first_thd = plist_first_entry(&app_ready_list, struct thread, sched_sibling);
-				struct thread *last_thd = plist_last_entry(&app_ready_list, struct thread, sched_sibling);
-
-				if (last_thd->sched_sibling.prio == first_thd->sched_sibling.prio && last_thd->sched_sibling.prio == current_thread->sched_sibling.prio)
-					current_thread->sched_sibling.prio++;
-				else
-				{
-					int32_t swap = last_thd->sched_sibling.prio;
-					last_thd->sched_sibling.prio = current_thread->sched_sibling.prio;
-					current_thread->sched_sibling.prio = swap;
-				}
-			}
-			update_thread(current_thread, THREAD_READY);
-			is_schedulable = true;
+			int32_t swap = last_thd->sched_sibling.prio;
+			last_thd->sched_sibling.prio = th->sched_sibling.prio;
+			th->sched_sibling.prio = swap;
 		}
+		th->need_resched = true;
 	}
 
-	unlock_scheduler();
+	spin_unlock(&rq_lock);
 
+	return IRQ_HANDLER_CONTINUE;
+}
+
+// current thread can be switched out involuntarily
+bool preemptible()
+{
 	// NOTE: MQ 2019-10-15 If counter is 1, it means that there is not running scheduler
-	if (is_schedulable && !scheduler_lock_counter)
-		schedule();
+	return current_thread->state == THREAD_RUNNING &&
+		   !current_thread->preempt_count &&
+		   !scheduler_lock_counter &&
+		   !in_softirq();
+}
+
+static void preempt_current()
+{
+	current_thread->need_resched = false;
+	update_thread(current_thread, THREAD_READY);
+	schedule();
+}
+
+// explicit preemption point for long loops in kernel code (and preempt_enable)
+void cond_resched()
+{
+	if (current_thread->need_resched && preemptible() && !irqs_disabled())
+		preempt_current();
+}
+
+// called at the end of irq_handler, interrupts are disabled
+void preempt_schedule_irq()
+{
+	if (!current_thread->need_resched || !preemptible())
+		return;
+#ifndef CONFIG_PREEMPT
+	// without preemptible kernel, only app threads and deadline threads (budget enforcement) are switched out at irq return
+	if (current_thread->policy != THREAD_APP_POLICY && !dl_task(current_thread))
+		return;
+#endif
+	preempt_current();
+}
+
+// NOTE: MQ 2020-10-16
+// runs on pit (1ms), rtc tick is too coarse to enforce budgets of a few milliseconds
+int32_t irq_deadline_handler(struct interrupt_registers *regs)
+{
+	struct thread *th = current_thread;
+	uint64_t now = ktime_get_ns();
+
+	spin_lock(&rq_lock);
+
+	if (th->state == THREAD_RUNNING)
+		update_curr(th, now);
+
+	struct thread *iter, *next;
+	list_for_each_entry_safe(iter, next, &dl_throttled_list, dl.throttled_sibling)
+	{
+		if (iter->dl.deadline > now)
+			continue;
+
+		dl_replenish(iter);
+		if (iter->state == THREAD_READY && (iter->policy < th->policy || dl_earlier(iter, th)))
+			th->need_resched = true;
+	}
+
+	spin_unlock(&rq_lock);
 
 	return IRQ_HANDLER_CONTINUE;
 }
 
+static bool dl_valid_attr(struct sched_attr *attr)
+{
+	// period/runtime below 1ms can't be enforced by the pit tick
+	return attr->sched_runtime >= NSEC_PER_MSEC &&
+		   attr->sched_runtime <= attr->sched_deadline &&
+		   attr->sched_deadline <= attr->sched_period;
+}
+
+// NOTE: MQ 2020-10-16
+// admission control: the sum of runtime/period of all deadline threads must stay under BW_LIMIT
+int32_t sched_setattr(struct thread *th, struct sched_attr *attr)
+{
+	if (attr->sched_policy != SCHED_NORMAL && attr->sched_policy != SCHED_DEADLINE)
+		return -EINVAL;
+	if (attr->sched_policy == SCHED_DEADLINE && !dl_valid_attr(attr))
+		return -EINVAL;
+	// priority inheritance owns policy/prio while boosted
+	if (th->pi_boosted)
+		return -EBUSY;
+
+	uint32_t new_bw = attr->sched_policy == SCHED_DEADLINE ? (attr->sched_runtime << BW_SHIFT) / attr->sched_period : 0;
+	uint32_t old_bw = th->policy == THREAD_DEADLINE_POLICY ? th->dl.dl_bw : 0;
+
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+
+	if (dl_total_bw - old_bw + new_bw > BW_LIMIT)
+	{
+		spin_unlock_irqrestore(&rq_lock, flags);
+		return -EBUSY;
+	}
+	dl_total_bw = dl_total_bw - old_bw + new_bw;
+
+	remove_thread(th);
+	if (th->dl.dl_throttled)
+	{
+		list_del(&th->dl.throttled_sibling);
+		th->dl.dl_throttled = false;
+	}
+
+	struct sched_dl_entity *dl = &th->dl;
+	if (attr->sched_policy == SCHED_DEADLINE)
+	{
+		if (th->policy != THREAD_DEADLINE_POLICY)
+		{
+			dl->normal_policy = th->policy;
+			dl->normal_prio = th->sched_sibling.prio;
+		}
+		dl->dl_runtime = attr->sched_runtime;
+		dl->dl_deadline = attr->sched_deadline;
+		dl->dl_period = attr->sched_period;
+		dl->dl_bw = new_bw;
+		dl->runtime = 0;
+		dl->deadline = 0;
+		th->policy = THREAD_DEADLINE_POLICY;
+		dl_wakeup(th, ktime_get_ns());
+	}
+	else if (th->policy == THREAD_DEADLINE_POLICY)
+	{
+		th->policy = dl->normal_policy;
+		th->sched_sibling.prio = dl->normal_prio;
+		memset(dl, 0, sizeof(struct sched_dl_entity));
+	}
+
+	__queue_thread(th);
+	if (th != current_thread && th->state == THREAD_READY && th->policy < current_thread->policy)
+		current_thread->need_resched = true;
+
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	rt_mutex_adjust_pi(th);
+	return 0;
+}
+
+int32_t sched_getattr(struct thread *th, struct sched_attr *attr)
+{
+	memset(attr, 0, sizeof(struct sched_attr));
+	attr->size = sizeof(struct sched_attr);
+
+	uint32_t flags = spin_lock_irqsave(&rq_lock);
+	if (th->policy == THREAD_DEADLINE_POLICY && !th->pi_boosted)
+	{
+		attr->sched_policy = SCHED_DEADLINE;
+		attr->sched_runtime = th->dl.dl_runtime;
+		attr->sched_deadline = th->dl.dl_deadline;
+		attr->sched_period = th->dl.dl_period;
+	}
+	else
+		attr->sched_policy = SCHED_NORMAL;
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	return 0;
+}
+
 int32_t thread_page_fault(struct interrupt_registers *regs)
 {
 	uint32_t faultAddr = 0;
 	__asm__ __volatile__("mov %%cr2, %0"
 						 : "=r"(faultAddr));
 
+	// demand paging and copy-on-write of user pages, kernel also faults in them when accessing user buffers
+	if (faultAddr < KERNEL_HIGHER_HALF && current_process && current_process->mm &&
+		handle_mm_fault(current_process->mm, faultAddr, regs->err_code) == 0)
+		return IRQ_HANDLER_STOP;
+
 	if (regs->cs == 0x1B)
 	{
 		if (faultAddr == PROCESS_TRAPPED_PAGE_FAULT)
@@ -251,18 +706,105 @@ int32_t thread_page_fault(struct interrupt_registers *regs)
 	return IRQ_HANDLER_CONTINUE;
 }
 
-void wake_up(struct wait_queue_head *hq)
+int default_wake_function(struct wait_queue_entry *wait)
+{
+	struct thread *th = wait->thread;
+	if (th->state != THREAD_WAITING)
+		return 0;
+
+	update_thread(th, THREAD_READY);
+	return 1;
+}
+
+int autoremove_wake_function(struct wait_queue_entry *wait)
+{
+	int ret = default_wake_function(wait);
+	if (ret)
+		list_del_init(&wait->sibling);
+	return ret;
+}
+
+void add_wait_queue(struct wait_queue_head *wh, struct wait_queue_entry *wait)
+{
+	uint32_t flags = local_irq_save();
+	wait->flags &= ~WQ_FLAG_EXCLUSIVE;
+	list_add(&wait->sibling, &wh->list);
+	local_irq_restore(flags);
+}
+
+// exclusive waiters are queued after non-exclusive ones, wake_up_nr stops after waking nr of them
+void add_wait_queue_exclusive(struct wait_queue_head *wh, struct wait_queue_entry *wait)
 {
+	uint32_t flags = local_irq_save();
+	wait->flags |= WQ_FLAG_EXCLUSIVE;
+	list_add_tail(&wait->sibling, &wh->list);
+	local_irq_restore(flags);
+}
+
+void remove_wait_queue(struct wait_queue_head *wh, struct wait_queue_entry *wait)
+{
+	uint32_t flags = local_irq_save();
+	list_del_init(&wait->sibling);
+	local_irq_restore(flags);
+}
+
+void prepare_to_wait(struct wait_queue_head *wh, struct wait_queue_entry *wait)
+{
+	uint32_t flags = local_irq_save();
+	wait->flags &= ~WQ_FLAG_EXCLUSIVE;
+	if (list_empty(&wait->sibling))
+		list_add(&wait->sibling, &wh->list);
+	local_irq_restore(flags);
+}
+
+void prepare_to_wait_exclusive(struct wait_queue_head *wh, struct wait_queue_entry *wait)
+{
+	uint32_t flags = local_irq_save();
+	wait->flags |= WQ_FLAG_EXCLUSIVE;
+	if (list_empty(&wait->sibling))
+		list_add_tail(&wait->sibling, &wh->list);
+	local_irq_restore(flags);
+}
+
+void finish_wait(struct wait_queue_head *wh, struct wait_queue_entry *wait)
+{
+	uint32_t flags = local_irq_save();
+	if (!list_empty(&wait->sibling))
+		list_del_init(&wait->sibling);
+	local_irq_restore(flags);
+}
+
+// nr = 0 wakes every exclusive waiter
+void wake_up_nr(struct wait_queue_head *hq, int nr)
+{
+	uint32_t flags = local_irq_save();
+
 	struct wait_queue_entry *iter, *next;
 	list_for_each_entry_safe(iter, next, &hq->list, sibling)
 	{
-		iter->func(iter->thread);
+		uint32_t wflags = iter->flags;
+
+		if (iter->func(iter) && (wflags & WQ_FLAG_EXCLUSIVE) && !--nr)
+			break;
 	}
+
+	local_irq_restore(flags);
+}
+
+void wake_up(struct wait_queue_head *hq)
+{
+	wake_up_nr(hq, 1);
+}
+
+void wake_up_all(struct wait_queue_head *hq)
+{
+	wake_up_nr(hq, 0);
 }
 
 void sched_init()
 {
 	plist_head_init(&kernel_ready_list);
+	plist_head_init(&deadline_ready_list);
 	plist_head_init(&system_ready_list);
 	plist_head_init(&app_ready_list);
 	plist_head_init(&waiting_list);
@@ -0,0 +1,142 @@
+#include <include/errno.h>
+#include <kernel/fs/char_dev.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/system/time.h>
+#include <kernel/utils/hashmap.h>
+#include <kernel/utils/printf.h>
+#include <kernel/utils/string.h>
+
+#include "preempt.h"
+#include "task.h"
+
+#define SCHEDSTAT_MAJOR 10
+#define SCHEDSTAT_MINOR 0
+#define SCHEDSTAT_HEADER_SIZE 512
+#define SCHEDSTAT_LINE_SIZE 256
+
+struct schedstat_snapshot
+{
+	char *buf;
+	size_t length;
+};
+
+static const char *thread_state_names[] = {
+	[THREAD_NEW] = "new",
+	[THREAD_READY] = "ready",
+	[THREAD_RUNNING] = "running",
+	[THREAD_WAITING] = "waiting",
+	[THREAD_TERMINATED] = "terminated",
+};
+
+static const char *thread_policy_names[] = {
+	[THREAD_KERNEL_POLICY] = "kernel",
+	[THREAD_DEADLINE_POLICY] = "deadline",
+	[THREAD_SYSTEM_POLICY] = "system",
+	[THREAD_APP_POLICY] = "app",
+};
+
+static uint32_t ns_to_ms(uint64_t ns)
+{
+	return ns / NSEC_PER_MSEC;
+}
+
+// line is cut to fit in size (a long process name), it always ends with newline
+static size_t schedstat_thread(char *buf, size_t size, struct process *proc, struct thread *th)
+{
+	struct sched_statistics *stats = &th->stats;
+	struct task_rusage ru;
+	thread_rusage(th, &ru);
+
+	// keep room for newline
+	size_t length = scnprintf(buf, size - 1, "%d %d %s %s %s %d %u %u %u %u %u %u %u",
+							proc->pid, th->tid, proc->name,
+							thread_state_names[th->state], thread_policy_names[th->policy], th->sched_sibling.prio,
+							ns_to_ms(ru.utime), ns_to_ms(ru.stime), ns_to_ms(stats->wait_sum),
+							(uint32_t)(stats->wait_max / NSEC_PER_USEC), stats->wait_count, stats->nvcsw, stats->nivcsw);
+	for (uint32_t i = 0; i < SCHED_LAT_BUCKETS; ++i)
+		length += scnprintf(buf + length, size - 1 - length, " %u", stats->lat_hist[i]);
+	length += sprintf(buf + length, "\n");
+
+	return length;
+}
+
+/*
+  NOTE: MQ 2020-10-18
+  snapshot is taken at open, reading it in pieces stays consistent
+    cpu0 <idle ms> <uptime ms> <context switches> <context switches in the last second>
+    pid tid name state policy prio utime_ms stime_ms wait_ms wait_max_us waits nvcsw nivcsw <latency histogram ...>
+  latency histogram counts wakeup-to-run latencies: < 10us, < 100us, < 1ms, < 10ms, < 100ms, < 1s, >= 1s
+*/
+static int schedstat_open(struct vfs_inode *inode, struct vfs_file *file)
+{
+	uint32_t size = SCHEDSTAT_HEADER_SIZE + hashmap_size(mprocess) * SCHEDSTAT_LINE_SIZE;
+	char *buf = kcalloc(size, sizeof(char));
+	if (!buf)
+		return -ENOMEM;
+
+	struct sched_cpu_stats cpu_stats;
+	sched_get_cpu_stats(&cpu_stats);
+	size_t length = sprintf(buf, "cpu0 %u %u %u %u\n",
+							ns_to_ms(cpu_stats.idle_time), ns_to_ms(ktime_get_ns()),
+							(uint32_t)cpu_stats.nr_switches, cpu_stats.switch_rate);
+
+	// reaper cannot release a thread meanwhile
+	preempt_disable();
+	struct process *proc;
+	for_each_process(proc)
+	{
+		if (proc->thread && length + SCHEDSTAT_LINE_SIZE <= size)
+			length += schedstat_thread(buf + length, SCHEDSTAT_LINE_SIZE, proc, proc->thread);
+	}
+	preempt_enable();
+
+	struct schedstat_snapshot *snapshot = kcalloc(1, sizeof(struct schedstat_snapshot));
+	snapshot->buf = buf;
+	snapshot->length = length;
+	file->private_data = snapshot;
+	return 0;
+}
+
+static int schedstat_release(struct vfs_inode *inode, struct vfs_file *file)
+{
+	struct schedstat_snapshot *snapshot = file->private_data;
+	kfree(snapshot->buf);
+	kfree(snapshot);
+	file->private_data = NULL;
+	return 0;
+}
+
+static loff_t schedstat_llseek(struct vfs_file *file, loff_t ppos)
+{
+	file->f_pos = ppos;
+	return ppos;
+}
+
+static ssize_t schedstat_read(struct vfs_file *file, char *buf, size_t count, loff_t ppos)
+{
+	struct schedstat_snapshot *snapshot = file->private_data;
+	if (ppos >= snapshot->length)
+		return 0;
+
+	count = min_t(size_t, count, snapshot->length - ppos);
+	memcpy(buf, snapshot->buf + ppos, count);
+	file->f_pos = ppos + count;
+	return count;
+}
+
+static struct vfs_file_operations schedstat_fops = {
+	.llseek = schedstat_llseek,
+	.read = schedstat_read,
+	.open = schedstat_open,
+	.release = schedstat_release,
+};
+
+static struct char_device cdev_schedstat = (struct char_device)DECLARE_CHRDEV("schedstat", SCHEDSTAT_MAJOR, SCHEDSTAT_MINOR, 1, &schedstat_fops);
+
+void schedstat_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[dev] - Mount schedstat");
+	register_chrdev(&cdev_schedstat);
+	vfs_mknod("/dev/schedstat", S_IFCHR, cdev_schedstat.dev);
+}
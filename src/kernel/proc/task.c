@@ -1,11 +1,16 @@
 #include "task.h"
+#include <include/errno.h>
+#include <include/fcntl.h>
 
+#include <kernel/cpu/fpu.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
 #include <kernel/cpu/pic.h>
 #include <kernel/cpu/tss.h>
 #include <kernel/fs/vfs.h>
+#include <kernel/locking/spinlock.h>
 #include <kernel/memory/pmm.h>
+#include <kernel/memory/slab.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/elf.h>
 #include <kernel/system/sysapi.h>
@@ -19,10 +24,19 @@ extern void return_usermode(struct interrupt_registers *regs);
 
 static uint32_t next_pid = 0;
 static uint32_t next_tid = 0;
+// protects pid/tid counters, process hashmap and children lists
+static DEFINE_SPINLOCK(process_lock);
 volatile struct thread *current_thread = NULL;
 volatile struct process *current_process = NULL;
 volatile struct hashmap *mprocess = NULL;
 
+// NOTE: MQ 2020-10-18 objects of exited processes are recycled by fork/spawn, see release_thread
+static DEFINE_KMEM_CACHE(thread_cache, struct thread);
+static DEFINE_KMEM_CACHE(process_cache, struct process);
+static DEFINE_KMEM_CACHE(files_cache, struct files_struct);
+static DEFINE_KMEM_CACHE(fs_cache, struct fs_struct);
+static DEFINE_KMEM_CACHE(mm_cache, struct mm_struct);
+
 struct process *find_process_by_pid(pid_t pid)
 {
 	return hashmap_get(mprocess, &pid);
@@ -30,7 +44,7 @@ struct process *find_process_by_pid(pid_t pid)
 
 static struct files_struct *clone_file_descriptor_table(struct process *parent)
 {
-	struct files_struct *files = kcalloc(1, sizeof(struct files_struct));
+	struct files_struct *files = kmem_cache_alloc(&files_cache);
 
 	if (parent)
 	{
@@ -40,13 +54,13 @@ static struct files_struct *clone_file_descriptor_table(struct process *parent)
 			if (parent->files->fd[i])
 				atomic_inc(&parent->files->fd[i]->f_count);
 	}
-	sema_init(&files->lock, 1);
+	rt_mutex_init(&files->lock);
 	return files;
 }
 
 static struct mm_struct *clone_mm_struct(struct process *parent)
 {
-	struct mm_struct *mm = kcalloc(1, sizeof(struct mm_struct));
+	struct mm_struct *mm = kmem_cache_alloc(&mm_cache);
 	memcpy(mm, parent->mm, sizeof(struct mm_struct));
 	INIT_LIST_HEAD(&mm->mmap);
 
@@ -57,7 +71,11 @@ static struct mm_struct *clone_mm_struct(struct process *parent)
 		clone->vm_start = iter->vm_start;
 		clone->vm_end = iter->vm_end;
 		clone->vm_file = iter->vm_file;
+		if (clone->vm_file)
+			atomic_inc(&clone->vm_file->f_count);
 		clone->vm_flags = iter->vm_flags;
+		clone->vm_pgoff = iter->vm_pgoff;
+		clone->vm_file_end = iter->vm_file_end;
 		clone->vm_mm = mm;
 		list_add_tail(&clone->vm_sibling, &mm->mmap);
 	}
@@ -74,7 +92,7 @@ static void kernel_thread_entry(struct thread *t, void *flow())
 static void thread_sleep_timer(struct timer_list *timer)
 {
 	struct thread *th = from_timer(th, timer, sleep_timer);
-	list_del(&timer->sibling);
+	del_timer(timer);
 	update_thread(th, THREAD_READY);
 }
 
@@ -85,18 +103,39 @@ void thread_sleep(uint32_t ms)
 	schedule();
 }
 
-struct thread *create_kernel_thread(struct process *parent, uint32_t eip, enum thread_state state, int priority)
+static uint32_t alloc_tid()
+{
+	uint32_t flags = spin_lock_irqsave(&process_lock);
+	uint32_t tid = next_tid++;
+	spin_unlock_irqrestore(&process_lock, flags);
+
+	return tid;
+}
+
+static void register_process(struct process *proc, struct process *parent)
 {
-	lock_scheduler();
+	uint32_t flags = spin_lock_irqsave(&process_lock);
+
+	proc->pid = next_pid++;
+	if (parent)
+		list_add_tail(&proc->sibling, &parent->children);
+	hashmap_put(mprocess, &proc->pid, proc);
+
+	spin_unlock_irqrestore(&process_lock, flags);
+}
 
-	struct thread *th = kcalloc(1, sizeof(struct thread));
-	th->tid = next_tid++;
-	th->kernel_stack = (uint32_t)(kcalloc(STACK_SIZE, sizeof(char)) + STACK_SIZE);
+// NOTE: MQ 2020-10-12 new thread is private until it is queued, only ids need the lock
+struct thread *create_kernel_thread(struct process *parent, uint32_t eip, enum thread_state state, int priority)
+{
+	struct thread *th = kmem_cache_alloc(&thread_cache);
+	th->tid = alloc_tid();
+	th->kernel_stack = alloc_kernel_stack();
 	th->parent = parent;
 	th->state = state;
 	th->policy = THREAD_KERNEL_POLICY;
 	th->esp = th->kernel_stack - sizeof(struct trap_frame);
 	plist_node_init(&th->sched_sibling, priority);
+	plist_head_init(&th->pi_waiters);
 	th->sleep_timer = (struct timer_list)TIMER_INITIALIZER(thread_sleep_timer, UINT32_MAX);
 
 	struct trap_frame *frame = (struct trap_frame *)th->esp;
@@ -118,17 +157,12 @@ struct thread *create_kernel_thread(struct process *parent, uint32_t eip, enum t
 
 	parent->thread = th;
 
-	unlock_scheduler();
-
 	return th;
 }
 
 static struct process *create_process(struct process *parent, const char *name, struct pdirectory *pdir)
 {
-	lock_scheduler();
-
-	struct process *proc = kcalloc(1, sizeof(struct process));
-	proc->pid = next_pid++;
+	struct process *proc = kmem_cache_alloc(&process_cache);
 	proc->name = strdup(name);
 	if (pdir)
 		proc->pdir = vmm_create_address_space(pdir);
@@ -136,9 +170,10 @@ static struct process *create_process(struct process *parent, const char *name,
 		proc->pdir = vmm_get_directory();
 	proc->parent = parent;
 	proc->files = clone_file_descriptor_table(parent);
-	proc->fs = kcalloc(1, sizeof(struct fs_struct));
-	proc->mm = kcalloc(1, sizeof(struct mm_struct));
+	proc->fs = kmem_cache_alloc(&fs_cache);
+	proc->mm = kmem_cache_alloc(&mm_cache);
 	INIT_LIST_HEAD(&proc->wait_chld.list);
+	INIT_LIST_HEAD(&proc->vfork_done.list);
 	INIT_LIST_HEAD(&proc->mm->mmap);
 
 	for (int i = 0; i < NSIG; ++i)
@@ -149,18 +184,125 @@ static struct process *create_process(struct process *parent, const char *name,
 		proc->gid = parent->gid;
 		proc->sid = parent->sid;
 		memcpy(proc->fs, parent->fs, sizeof(struct fs_struct));
-		list_add_tail(&proc->sibling, &parent->children);
 	}
 
 	INIT_LIST_HEAD(&proc->children);
 
-	hashmap_put(mprocess, &proc->pid, proc);
-
-	unlock_scheduler();
+	register_process(proc, parent);
 
 	return proc;
 }
 
+// zombie's parent moves to init, init's children list keeps them reachable after the parent itself is released
+void reparent_children(struct process *proc)
+{
+	struct process *init = find_process_by_pid(INIT_PID);
+	uint32_t flags = spin_lock_irqsave(&process_lock);
+
+	struct process *iter, *next;
+	list_for_each_entry_safe(iter, next, &proc->children, sibling)
+	{
+		iter->parent = init;
+		list_move_tail(&iter->sibling, &init->children);
+	}
+
+	spin_unlock_irqrestore(&process_lock, flags);
+}
+
+/*
+  NOTE: MQ 2020-10-18
+  an exited process is torn down in two steps which can happen in any order
+    - reaper releases its thread (with kernel stack) and resources once the thread is switched out for good
+    - parent waits for it, then the process is unlinked and marked EXIT_DEAD
+  whichever comes last frees the process itself
+*/
+void release_thread(struct thread *th)
+{
+	struct process *proc = th->parent;
+
+	if (proc->flags & (EXIT_TERMINATED | SIGNAL_TERMINATED))
+	{
+		kmem_cache_free(&files_cache, proc->files);
+		kmem_cache_free(&fs_cache, proc->fs);
+		// vfork child which exited without execve doesn't own its mm and page directory
+		if (proc->mm)
+		{
+			kmem_cache_free(&mm_cache, proc->mm);
+			vmm_destroy_address_space(proc->pdir);
+		}
+		proc->files = NULL;
+		proc->fs = NULL;
+		proc->mm = NULL;
+		proc->pdir = NULL;
+	}
+
+	// parent may release the process (and read its usage) as soon as it has no thread
+	uint32_t flags = spin_lock_irqsave(&process_lock);
+	if (proc->thread == th)
+	{
+		thread_rusage(th, &proc->exit_usage);
+		proc->thread = NULL;
+	}
+	bool dead = proc->flags & EXIT_DEAD;
+	spin_unlock_irqrestore(&process_lock, flags);
+
+	free_kernel_stack(th->kernel_stack);
+	kfree(th->fpu_state);
+	kmem_cache_free(&thread_cache, th);
+
+	if (dead)
+	{
+		kfree(proc->name);
+		kmem_cache_free(&process_cache, proc);
+	}
+}
+
+static void add_rusage(struct task_rusage *total, struct task_rusage *ru)
+{
+	total->utime += ru->utime;
+	total->stime += ru->stime;
+	total->nvcsw += ru->nvcsw;
+	total->nivcsw += ru->nivcsw;
+}
+
+static void __process_rusage(struct process *proc, bool children, struct task_rusage *ru)
+{
+	if (children)
+		*ru = proc->children_usage;
+	else if (proc->thread)
+		thread_rusage(proc->thread, ru);
+	else
+		*ru = proc->exit_usage;
+}
+
+void process_rusage(struct process *proc, bool children, struct task_rusage *ru)
+{
+	uint32_t flags = spin_lock_irqsave(&process_lock);
+	__process_rusage(proc, children, ru);
+	spin_unlock_irqrestore(&process_lock, flags);
+}
+
+// parent waited for the process, its usage (with its children's) is charged to the parent
+void release_process(struct process *proc)
+{
+	struct task_rusage ru;
+	uint32_t flags = spin_lock_irqsave(&process_lock);
+	__process_rusage(proc, false, &ru);
+	add_rusage(&proc->parent->children_usage, &ru);
+	add_rusage(&proc->parent->children_usage, &proc->children_usage);
+	list_del(&proc->sibling);
+	hashmap_remove(mprocess, &proc->pid);
+	proc->flags |= EXIT_DEAD;
+	bool released = !proc->thread;
+	spin_unlock_irqrestore(&process_lock, flags);
+
+	if (released)
+	{
+		kfree(proc->name);
+		kmem_cache_free(&process_cache, proc);
+	}
+}
+
 static void setup_swapper_process()
 {
 	current_process = create_process(NULL, "swapper", NULL);
@@ -183,6 +325,7 @@ void task_init(void *func)
 	hashmap_init(mprocess, hashmap_hash_uint32, hashmap_compare_uint32, 0);
 	sched_init();
 	register_interrupt_handler(IRQ8, irq_schedule_handler);
+	register_interrupt_handler(IRQ0, irq_deadline_handler);
 	register_interrupt_handler(14, thread_page_fault);
 
 	DEBUG &&debug_println(DEBUG_INFO, "\tSetup swapper process");
@@ -210,42 +353,61 @@ static void user_thread_entry(struct thread *th)
 	return_usermode(&th->uregs);
 }
 
+// interpreter of dynamically linked program pops auxv from the top of stack,
+// the rest (return address, arguments) is left for the program's entry
+static void start_user_program(struct Elf32_Layout *elf_layout)
+{
+	uint32_t return_address = PROCESS_TRAPPED_PAGE_FAULT;
+	if (elf_layout->auxv)
+	{
+		elf_layout->stack -= 4;
+		*(uint32_t *)elf_layout->stack = return_address;
+		return_address = elf_layout->auxv;
+	}
+	enter_usermode(elf_layout->stack, elf_layout->entry, return_address);
+}
+
 static void user_thread_elf_entry(struct thread *th, const char *path, void (*setup)(struct Elf32_Layout *))
 {
 	// explain in kernel_init#unlock_scheduler
 	unlock_scheduler();
 
-	char *buf = vfs_read(path);
-	struct Elf32_Layout *elf_layout = elf_load(buf);
+	struct vfs_file *file = open_exec(path);
+	struct Elf32_Layout *elf_layout = file ? elf_load(file) : NULL;
+	if (file)
+		fput(file);
+	if (!elf_layout)
+		do_exit(-ENOEXEC);
 	th->user_stack = elf_layout->stack;
 	tss_set_stack(0x10, th->kernel_stack);
 	if (setup)
 		setup(elf_layout);
-	enter_usermode(elf_layout->stack, elf_layout->entry, PROCESS_TRAPPED_PAGE_FAULT);
+	start_user_program(elf_layout);
 }
 
-struct thread *create_user_thread(struct process *parent, const char *path, enum thread_state state, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *))
+// user thread starts in kernel at `entry(th, param2, param3)`, which loads the program and enters user mode
+static struct thread *__create_user_thread(struct process *parent, enum thread_state state, enum thread_policy policy, int priority,
+										   void *entry, uint32_t param2, uint32_t param3)
 {
-	lock_scheduler();
-
-	struct thread *th = kcalloc(1, sizeof(struct thread));
-	th->tid = next_tid++;
+	struct thread *th = kmem_cache_alloc(&thread_cache);
+	th->tid = alloc_tid();
 	th->parent = parent;
 	th->state = state;
 	th->policy = policy;
-	th->kernel_stack = (uint32_t)(kcalloc(STACK_SIZE, sizeof(char)) + STACK_SIZE);
+	th->kernel_stack = alloc_kernel_stack();
 	th->esp = th->kernel_stack - sizeof(struct trap_frame);
 	plist_node_init(&th->sched_sibling, priority);
+	plist_head_init(&th->pi_waiters);
 	th->sleep_timer = (struct timer_list)TIMER_INITIALIZER(thread_sleep_timer, UINT32_MAX);
 
 	struct trap_frame *frame = (struct trap_frame *)th->esp;
 	memset(frame, 0, sizeof(struct trap_frame));
 
-	frame->parameter3 = (uint32_t)setup;
-	frame->parameter2 = (uint32_t)strdup(path);
+	frame->parameter3 = param3;
+	frame->parameter2 = param2;
 	frame->parameter1 = (uint32_t)th;
 	frame->return_address = PROCESS_TRAPPED_PAGE_FAULT;
-	frame->eip = (uint32_t)user_thread_elf_entry;
+	frame->eip = (uint32_t)entry;
 
 	frame->eax = 0;
 	frame->ecx = 0;
@@ -258,11 +420,14 @@ struct thread *create_user_thread(struct process *parent, const char *path, enum
 
 	parent->thread = th;
 
-	unlock_scheduler();
-
 	return th;
 }
 
+struct thread *create_user_thread(struct process *parent, const char *path, enum thread_state state, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *))
+{
+	return __create_user_thread(parent, state, policy, priority, user_thread_elf_entry, (uint32_t)strdup(path), (uint32_t)setup);
+}
+
 void process_load(const char *pname, const char *path, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *))
 {
 	struct process *proc = create_process(current_process, pname, current_process->pdir);
@@ -270,47 +435,26 @@ void process_load(const char *pname, const char *path, enum thread_policy policy
 	queue_thread(th);
 }
 
-struct process *process_fork(struct process *parent)
+// child thread returns to user mode with parent's registers and 0 as the result of the system call
+static struct thread *clone_thread(struct process *proc, struct thread *parent_thread)
 {
-	lock_scheduler();
-
-	// fork process
-	struct process *proc = kcalloc(1, sizeof(struct process));
-	proc->pid = next_pid++;
-	proc->gid = parent->gid;
-	proc->sid = parent->sid;
-	proc->name = strdup(parent->name);
-	proc->parent = parent;
-	proc->tty = parent->tty;
-	proc->mm = clone_mm_struct(parent);
-	memcpy(&proc->sighand, &parent->sighand, sizeof(parent->sighand));
-
-	INIT_LIST_HEAD(&proc->children);
-
-	list_add_tail(&proc->sibling, &parent->children);
-
-	proc->fs = kcalloc(1, sizeof(struct fs_struct));
-	memcpy(proc->fs, parent->fs, sizeof(struct fs_struct));
-
-	proc->files = clone_file_descriptor_table(parent);
-	proc->pdir = vmm_fork(parent->pdir);
-
-	// copy active parent's thread
-	struct thread *parent_thread = parent->thread;
-	struct thread *th = kcalloc(1, sizeof(struct thread));
-	th->tid = next_tid++;
+	struct thread *th = kmem_cache_alloc(&thread_cache);
+	th->tid = alloc_tid();
 	th->state = THREAD_READY;
 	th->policy = THREAD_APP_POLICY;
 	th->time_slice = 0;
 	th->parent = proc;
-	th->kernel_stack = (uint32_t)(kcalloc(STACK_SIZE, sizeof(char)) + STACK_SIZE);
+	th->kernel_stack = alloc_kernel_stack();
 	th->user_stack = parent_thread->user_stack;
 	// NOTE: MQ 2019-12-18 Setup trap frame
 	th->esp = th->kernel_stack - sizeof(struct trap_frame);
-	plist_node_init(&th->sched_sibling, parent_thread->sched_sibling.prio);
+	plist_node_init(&th->sched_sibling, parent_thread->pi_boosted ? parent_thread->normal_prio : parent_thread->sched_sibling.prio);
+	plist_head_init(&th->pi_waiters);
+	th->sleep_timer = (struct timer_list)TIMER_INITIALIZER(thread_sleep_timer, UINT32_MAX);
 
 	memcpy(&th->uregs, &parent_thread->uregs, sizeof(struct interrupt_registers));
 	th->uregs.eax = 0;
+	fpu_fork(parent_thread, th);
 
 	struct trap_frame *frame = (struct trap_frame *)th->esp;
 	frame->parameter1 = (uint32_t)th;
@@ -326,52 +470,140 @@ struct process *process_fork(struct process *parent)
 	frame->esi = 0;
 	frame->edi = 0;
 
-	proc->thread = th;
-	hashmap_put(mprocess, &proc->pid, proc);
+	return th;
+}
 
-	unlock_scheduler();
+static struct process *clone_process(struct process *parent)
+{
+	struct process *proc = kmem_cache_alloc(&process_cache);
+	proc->gid = parent->gid;
+	proc->sid = parent->sid;
+	proc->name = strdup(parent->name);
+	proc->parent = parent;
+	proc->tty = parent->tty;
+	memcpy(&proc->sighand, &parent->sighand, sizeof(parent->sighand));
+
+	INIT_LIST_HEAD(&proc->children);
+	INIT_LIST_HEAD(&proc->wait_chld.list);
+	INIT_LIST_HEAD(&proc->vfork_done.list);
+
+	proc->fs = kmem_cache_alloc(&fs_cache);
+	memcpy(proc->fs, parent->fs, sizeof(struct fs_struct));
 
+	proc->files = clone_file_descriptor_table(parent);
 	return proc;
 }
 
-int32_t process_execve(const char *pathname, char *const argv[], char *const envp[])
+struct process *process_fork(struct process *parent)
 {
-	int argv_length = count_array_of_pointers(argv);
-	char **kernel_argv = kcalloc(argv_length, sizeof(char *));
-	for (int i = 0; i < argv_length; ++i)
-	{
-		int ilength = strlen(argv[i]);
-		kernel_argv[i] = kcalloc(ilength + 1, sizeof(char));
-		memcpy(kernel_argv[i], argv[i], ilength);
-	}
+	struct process *proc = clone_process(parent);
+	proc->mm = clone_mm_struct(parent);
+	proc->pdir = vmm_fork(parent->pdir);
+
+	// copy active parent's thread
+	proc->thread = clone_thread(proc, parent->thread);
+	register_process(proc, parent);
+
+	return proc;
+}
 
-	int envp_length = count_array_of_pointers(envp);
-	char **kernel_envp = kcalloc(envp_length, sizeof(char *));
-	for (int i = 0; i < envp_length; ++i)
+// NOTE: MQ 2020-10-17
+// vfork child runs in parent's address space (even on its user stack) until it calls execve or exits,
+// parent sleeps meanwhile -> nothing is copied, which is all a fork+exec needs
+struct process *process_vfork(struct process *parent)
+{
+	struct process *proc = clone_process(parent);
+	proc->mm = parent->mm;
+	proc->pdir = parent->pdir;
+	proc->vfork_shared = true;
+
+	proc->thread = clone_thread(proc, parent->thread);
+	register_process(proc, parent);
+
+	return proc;
+}
+
+void vfork_wait_for_child(struct process *child)
+{
+	DEFINE_WAIT(wait);
+	add_wait_queue(&child->vfork_done, &wait);
+
+	while (true)
 	{
-		int ilength = strlen(envp[i]);
-		kernel_envp[i] = kcalloc(ilength + 1, sizeof(char));
-		memcpy(kernel_envp[i], envp[i], ilength);
+		// child can release us between checking and sleeping
+		uint32_t flags = local_irq_save();
+		if (!child->vfork_shared)
+		{
+			local_irq_restore(flags);
+			break;
+		}
+		update_thread(current_thread, THREAD_WAITING);
+		local_irq_restore(flags);
+		schedule();
 	}
 
-	char *buf = vfs_read(pathname);
-	elf_unload();
-	struct Elf32_Layout *elf_layout = elf_load(buf);
+	remove_wait_queue(&child->vfork_done, &wait);
+}
+
+// parent's mm/page directory are not used by the child anymore
+void vfork_release(struct process *proc)
+{
+	if (!proc->vfork_shared)
+		return;
+
+	uint32_t flags = local_irq_save();
+	proc->vfork_shared = false;
+	wake_up(&proc->vfork_done);
+	local_irq_restore(flags);
+}
+
+// vfork child gets its own (empty) address space, the parent's one is left untouched
+static void exec_mmap()
+{
+	struct process *proc = current_process;
+
+	proc->mm = kmem_cache_alloc(&mm_cache);
+	INIT_LIST_HEAD(&proc->mm->mmap);
+	proc->pdir = vmm_create_address_space(proc->pdir);
+	vmm_load_address_space(proc->pdir);
+	sigemptyset(&proc->thread->pending);
+
+	vfork_release(proc);
+}
+
+static char **copy_strings(char *const arr[], int *count)
+{
+	int length = count_array_of_pointers((void *)arr);
+	char **kernel_arr = kcalloc(length + 1, sizeof(char *));
+	for (int i = 0; i < length; ++i)
+		kernel_arr[i] = strdup(arr[i]);
 
-	// copy argv back to userspace
-	char **user_argv = (char **)sys_sbrk(argv_length + 1);
-	memset(user_argv, 0, argv_length + 1);
-	for (int i = 0; i < argv_length; ++i)
+	*count = length;
+	return kernel_arr;
+}
+
+static void free_strings(char **arr, int count)
+{
+	for (int i = 0; i < count; ++i)
+		kfree(arr[i]);
+	kfree(arr);
+}
+
+// copy argv/envp into the new program's heap and push argc, argv, envp on its stack
+static void setup_user_arguments(struct Elf32_Layout *elf_layout, int argc, char **kernel_argv, int envc, char **kernel_envp)
+{
+	char **user_argv = (char **)sys_sbrk((argc + 1) * sizeof(char *));
+	memset(user_argv, 0, (argc + 1) * sizeof(char *));
+	for (int i = 0; i < argc; ++i)
 	{
 		int ilength = strlen(kernel_argv[i]);
 		user_argv[i] = kcalloc(ilength + 1, sizeof(char));
 		memcpy(user_argv[i], kernel_argv[i], ilength);
 	}
 
-	// copy envp back to userspace
-	char **user_envp = (char **)sys_sbrk(envp_length + 1);
-	memset(user_envp, 0, envp_length + 1);
-	for (int i = 0; i < envp_length; ++i)
+	char **user_envp = (char **)sys_sbrk((envc + 1) * sizeof(char *));
+	memset(user_envp, 0, (envc + 1) * sizeof(char *));
+	for (int i = 0; i < envc; ++i)
 	{
 		int ilength = strlen(kernel_envp[i]);
 		user_envp[i] = kcalloc(ilength + 1, sizeof(char));
@@ -385,9 +617,160 @@ int32_t process_execve(const char *pathname, char *const argv[], char *const env
 	elf_layout->stack -= 4;
 	*(uint32_t *)elf_layout->stack = (uint32_t)user_argv;
 	elf_layout->stack -= 4;
-	*(uint32_t *)elf_layout->stack = argv_length;
+	*(uint32_t *)elf_layout->stack = argc;
+}
+
+int32_t process_execve(const char *pathname, char *const argv[], char *const envp[])
+{
+	int argc, envc;
+	char **kernel_argv = copy_strings(argv, &argc);
+	char **kernel_envp = copy_strings(envp, &envc);
+
+	struct vfs_file *file = open_exec(pathname);
+	int32_t ret = !file ? -ENOENT : elf_check(file);
+	if (ret < 0)
+	{
+		if (file)
+			fput(file);
+		free_strings(kernel_argv, argc);
+		free_strings(kernel_envp, envc);
+		return ret;
+	}
+
+	if (current_process->vfork_shared)
+		exec_mmap();
+	else
+		elf_unload();
+	struct Elf32_Layout *elf_layout = elf_load(file);
+	// mapped segments hold their own references
+	fput(file);
+	// the old address space is gone, there is nothing to return to
+	if (!elf_layout)
+	{
+		free_strings(kernel_argv, argc);
+		free_strings(kernel_envp, envc);
+		do_exit(-ENOEXEC);
+	}
+
+	setup_user_arguments(elf_layout, argc, kernel_argv, envc, kernel_envp);
+	free_strings(kernel_argv, argc);
+	free_strings(kernel_envp, envc);
 
 	tss_set_stack(0x10, current_thread->kernel_stack);
-	enter_usermode(elf_layout->stack, elf_layout->entry, PROCESS_TRAPPED_PAGE_FAULT);
+	start_user_program(elf_layout);
 	return 0;
 }
+
+struct spawn_args
+{
+	struct vfs_file *file;	// program checked by process_spawn, the child loads it without another lookup
+	int argc, envc;
+	char **argv, **envp;
+	int32_t nr_actions;
+	struct spawn_action actions[SPAWN_FILE_ACTIONS_MAX];
+};
+
+static void spawn_file_actions(struct spawn_args *args)
+{
+	struct files_struct *files = current_process->files;
+
+	for (int32_t i = 0; i < args->nr_actions; ++i)
+	{
+		struct spawn_action *action = &args->actions[i];
+
+		if (action->type == SPAWN_DO_CLOSE && files->fd[action->fd])
+			vfs_close(action->fd);
+		else if (action->type == SPAWN_DO_DUP2 && files->fd[action->fd] && action->fd != action->newfd)
+		{
+			if (files->fd[action->newfd])
+				vfs_close(action->newfd);
+			files->fd[action->newfd] = files->fd[action->fd];
+			atomic_inc(&files->fd[action->newfd]->f_count);
+		}
+		else if (action->type == SPAWN_DO_OPEN)
+		{
+			int32_t fd = vfs_open_mode(action->path, action->oflag, action->mode);
+			if (fd >= 0 && fd != action->fd)
+			{
+				if (files->fd[action->fd])
+					vfs_close(action->fd);
+				files->fd[action->fd] = files->fd[fd];
+				files->fd[fd] = NULL;
+			}
+			kfree((char *)action->path);
+		}
+	}
+}
+
+static void user_thread_spawn_entry(struct thread *th, struct spawn_args *args)
+{
+	// explain in kernel_init#unlock_scheduler
+	unlock_scheduler();
+
+	spawn_file_actions(args);
+
+	struct Elf32_Layout *elf_layout = elf_load(args->file);
+	fput(args->file);
+	if (elf_layout)
+		setup_user_arguments(elf_layout, args->argc, args->argv, args->envc, args->envp);
+
+	free_strings(args->argv, args->argc);
+	free_strings(args->envp, args->envc);
+	kfree(args);
+	if (!elf_layout)
+		do_exit(-ENOEXEC);
+
+	tss_set_stack(0x10, th->kernel_stack);
+	start_user_program(elf_layout);
+}
+
+// NOTE: MQ 2020-10-17
+// new process starts with an empty address space and loads the program itself, parent's pages are never touched
+// -> arguments and file actions are copied into kernel while the parent's memory is still accessible
+pid_t process_spawn(const char *path, const posix_spawn_file_actions_t *file_actions, char *const argv[], char *const envp[],
+					enum thread_policy policy, int priority)
+{
+	if (file_actions)
+	{
+		if (file_actions->used < 0 || file_actions->used > SPAWN_FILE_ACTIONS_MAX)
+			return -EINVAL;
+
+		for (int32_t i = 0; i < file_actions->used; ++i)
+		{
+			const struct spawn_action *action = &file_actions->actions[i];
+			if (action->fd < 0 || action->fd >= MAX_FD ||
+				(action->type == SPAWN_DO_DUP2 && (action->newfd < 0 || action->newfd >= MAX_FD)))
+				return -EBADF;
+		}
+	}
+
+	// like execve, a missing or broken program is reported to the caller instead of killing the child
+	struct vfs_file *file = open_exec(path);
+	int32_t ret = !file ? -ENOENT : elf_check(file);
+	if (ret < 0)
+	{
+		if (file)
+			fput(file);
+		return ret;
+	}
+
+	struct spawn_args *args = kcalloc(1, sizeof(struct spawn_args));
+	args->file = file;
+	args->argv = copy_strings(argv, &args->argc);
+	args->envp = copy_strings(envp, &args->envc);
+
+	if (file_actions)
+	{
+		args->nr_actions = file_actions->used;
+		memcpy(args->actions, file_actions->actions, args->nr_actions * sizeof(struct spawn_action));
+		for (int32_t i = 0; i < args->nr_actions; ++i)
+			if (args->actions[i].type == SPAWN_DO_OPEN)
+				args->actions[i].path = strdup(args->actions[i].path);
+	}
+
+	struct process *proc = create_process(current_process, path, current_process->pdir);
+	struct thread *th = __create_user_thread(proc, THREAD_READY, policy, priority, user_thread_spawn_entry, (uint32_t)args, 0);
+	queue_thread(th);
+
+	return proc->pid;
+}
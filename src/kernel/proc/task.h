@@ -3,8 +3,11 @@
 
 #include <include/ctype.h>
 #include <include/list.h>
+#include <include/sched.h>
+#include <include/spawn.h>
 #include <kernel/cpu/idt.h>
 #include <kernel/ipc/signal.h>
+#include <kernel/locking/rt_mutex.h>
 #include <kernel/locking/semaphore.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/elf.h>
@@ -32,6 +35,7 @@
 #define SIGNAL_CONTINUED 0x02
 #define SIGNAL_TERMINATED 0x04
 #define EXIT_TERMINATED 0x08
+#define EXIT_DEAD 0x10
 
 struct vfs_file;
 struct vfs_dentry;
@@ -50,13 +54,14 @@ enum thread_state
 enum thread_policy
 {
 	THREAD_KERNEL_POLICY,
+	THREAD_DEADLINE_POLICY,
 	THREAD_SYSTEM_POLICY,
 	THREAD_APP_POLICY,
 } thread_policy;
 
 struct files_struct
 {
-	struct semaphore lock;
+	struct rt_mutex lock;
 	struct vfs_file *fd[MAX_FD];
 };
 
@@ -83,6 +88,8 @@ struct vm_area_struct
 
 	struct list_head vm_sibling;
 	struct vfs_file *vm_file;
+	uint32_t vm_pgoff;	   // page index in vm_file where vm_start begins
+	uint32_t vm_file_end;  // private file mapping, bytes from here to vm_end are zero-filled
 };
 
 struct mm_struct
@@ -96,6 +103,57 @@ struct mm_struct
 	uint32_t start_brk, brk, end_brk, start_stack;
 };
 
+// NOTE: MQ 2020-10-16
+// constant bandwidth server: a deadline thread runs for at most dl_runtime in each dl_period,
+// earliest absolute deadline first, and is throttled until its next period when the budget is exhausted
+struct sched_dl_entity
+{
+	uint64_t dl_runtime;  // budget per period (ns)
+	uint64_t dl_deadline;  // relative deadline (ns)
+	uint64_t dl_period;
+	uint32_t dl_bw;	 // dl_runtime / dl_period in BW_UNIT
+
+	int64_t runtime;	// budget left in the current period
+	uint64_t deadline;	// absolute deadline (monotonic ns)
+	bool dl_throttled;
+	struct list_head throttled_sibling;
+
+	enum thread_policy normal_policy;  // class/priority to go back to with SCHED_NORMAL
+	int32_t normal_prio;
+};
+
+// wakeup-to-run latency: < 10us, < 100us, < 1ms, < 10ms, < 100ms, < 1s, >= 1s
+#define SCHED_LAT_BUCKETS 7
+
+// NOTE: MQ 2020-10-18
+// scheduler statistics, updated by update_thread/switch_thread and exposed via /dev/schedstat and getrusage
+struct sched_statistics
+{
+	uint64_t wait_start;  // monotonic nanosecond when the thread was queued as ready, 0 -> not waiting for cpu
+	bool wakeup;		  // it was woken up (not preempted) -> its wait is also counted as wakeup latency
+	uint64_t wait_sum;	  // total nanoseconds ready but not running
+	uint64_t wait_max;
+	uint32_t wait_count;
+	uint32_t nvcsw;		// switched out because it blocked or exited
+	uint32_t nivcsw;	// switched out while still runnable
+	uint32_t utime_ticks, stime_ticks;	// ticks which hit it in user/kernel mode, sum_exec_runtime is split by them
+	uint32_t lat_hist[SCHED_LAT_BUCKETS];
+};
+
+struct sched_cpu_stats
+{
+	uint64_t nr_switches;
+	uint64_t idle_time;	 // nanoseconds halted in schedule() because nothing was ready
+	uint32_t switch_rate;  // switches during the last full second
+};
+
+// cpu usage in nanoseconds, see getrusage
+struct task_rusage
+{
+	uint64_t utime, stime;
+	uint32_t nvcsw, nivcsw;
+};
+
 struct thread
 {
 	tid_t tid;
@@ -108,15 +166,29 @@ struct thread
 	uint32_t kernel_stack;
 	uint32_t user_stack;
 	struct interrupt_registers uregs;
+	void *fpu_state;  // fxsave area, allocated at the first fpu/sse instruction
 
 	sigset_t pending;
 	sigset_t blocked;
 	bool signaling;
 
 	uint32_t time_slice;
+	int32_t preempt_count;	// > 0 -> thread must not be switched out involuntarily
+	bool need_resched;		// set by tick/wake-up, consumed at irq return or preemption point
+	uint64_t exec_start;		// monotonic nanosecond when the thread is switched in
+	uint64_t sum_exec_runtime;	// total nanoseconds on cpu
+	struct sched_statistics stats;
 
 	struct plist_node sched_sibling;
+	struct sched_dl_entity dl;
 	struct timer_list sleep_timer;
+
+	// priority inheritance, see locking/rt_mutex.c
+	struct plist_head pi_waiters;			 // top waiter of each rt_mutex held by this thread
+	struct rt_mutex_waiter *pi_blocked_on;	 // rt_mutex this thread sleeps on
+	bool pi_boosted;
+	enum thread_policy normal_policy;  // class and priority before the boost
+	int32_t normal_prio;
 };
 
 struct process
@@ -137,10 +209,16 @@ struct process
 	struct tty_struct *tty;
 	struct sigaction sighand[NSIG];
 	int32_t exit_code;
+	struct task_rusage exit_usage;		// its thread's usage, saved when the thread is released
+	struct task_rusage children_usage;	// waited-for children and their descendants
 	int32_t caused_signal;
 	uint32_t flags;
 	struct wait_queue_head wait_chld;
 
+	// vfork child borrows parent's mm and page directory until it calls execve or exits
+	bool vfork_shared;
+	struct wait_queue_head vfork_done;
+
 	struct list_head sibling;
 	struct list_head children;
 };
@@ -160,24 +238,49 @@ struct thread *create_user_thread(struct process *parent, const char *path, enum
 struct process *create_kernel_process(const char *pname, void *func, int32_t priority);
 void process_load(const char *pname, const char *path, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *));
 struct process *process_fork(struct process *parent);
+struct process *process_vfork(struct process *parent);
+void vfork_wait_for_child(struct process *child);
+void vfork_release(struct process *proc);
+pid_t process_spawn(const char *path, const posix_spawn_file_actions_t *file_actions, char *const argv[], char *const envp[],
+					enum thread_policy policy, int priority);
 int32_t process_execve(const char *pathname, char *const argv[], char *const envp[]);
 void thread_sleep(uint32_t ms);
 struct process *find_process_by_pid(pid_t pid);
+void reparent_children(struct process *proc);
+void release_thread(struct thread *th);
+void release_process(struct process *proc);
+void process_rusage(struct process *proc, bool children, struct task_rusage *ru);
 
 // sched.c
+struct thread *pop_terminated_thread();
+void thread_rusage(struct thread *th, struct task_rusage *ru);
+void sched_get_cpu_stats(struct sched_cpu_stats *stats);
 void update_thread(struct thread *thread, uint8_t state);
 void queue_thread(struct thread *t);
+void sched_set_prio(struct thread *th, enum thread_policy policy, int32_t prio);
+int32_t sched_setattr(struct thread *th, struct sched_attr *attr);
+int32_t sched_getattr(struct thread *th, struct sched_attr *attr);
 void schedule();
 void sched_init();
 void lock_scheduler();
 void unlock_scheduler();
 int get_top_priority_from_list(enum thread_state state, enum thread_policy policy);
 void wake_up(struct wait_queue_head *hq);
+void wake_up_nr(struct wait_queue_head *hq, int nr);
+void wake_up_all(struct wait_queue_head *hq);
 int32_t thread_page_fault(struct interrupt_registers *regs);
 int32_t irq_schedule_handler(struct interrupt_registers *regs);
+int32_t irq_deadline_handler(struct interrupt_registers *regs);
+bool preemptible();
+void cond_resched();
+void preempt_schedule_irq();
 
 // exit.c
 int32_t do_wait(idtype_t idtype, id_t id, struct infop *infop, int options);
 void do_exit(int32_t code);
+void reaper_init();
+
+// schedstat.c
+void schedstat_init();
 
 #endif
@@ -32,16 +32,20 @@ struct infop
 };
 
 struct thread;
+struct wait_queue_entry;
 
-typedef void (*wait_queue_func)(struct thread *);
+typedef int (*wait_queue_func)(struct wait_queue_entry *);
 
 struct wait_queue_head
 {
 	struct list_head list;
 };
 
+#define WQ_FLAG_EXCLUSIVE 0x01
+
 struct wait_queue_entry
 {
+	uint32_t flags;
 	struct thread *thread;
 	wait_queue_func func;
 	struct list_head sibling;
@@ -50,12 +54,28 @@ struct wait_queue_entry
 extern volatile struct thread *current_thread;
 extern void schedule();
 
-#define DEFINE_WAIT(name)            \
-	struct wait_queue_entry name = { \
-		.thread = current_thread,    \
-		.func = poll_wakeup,         \
+int default_wake_function(struct wait_queue_entry *wait);
+int autoremove_wake_function(struct wait_queue_entry *wait);
+
+// NOTE: MQ 2020-10-15
+// wait entries live on the waiter's stack, they must be off the queue before the waiter returns
+#define DEFINE_WAIT_FUNC(name, function)           \
+	struct wait_queue_entry name = {               \
+		.flags = 0,                                \
+		.thread = (struct thread *)current_thread, \
+		.func = (function),                        \
+		.sibling = LIST_HEAD_INIT((name).sibling), \
 	}
 
+#define DEFINE_WAIT(name) DEFINE_WAIT_FUNC(name, default_wake_function)
+
+void add_wait_queue(struct wait_queue_head *wh, struct wait_queue_entry *wait);
+void add_wait_queue_exclusive(struct wait_queue_head *wh, struct wait_queue_entry *wait);
+void remove_wait_queue(struct wait_queue_head *wh, struct wait_queue_entry *wait);
+void prepare_to_wait(struct wait_queue_head *wh, struct wait_queue_entry *wait);
+void prepare_to_wait_exclusive(struct wait_queue_head *wh, struct wait_queue_entry *wait);
+void finish_wait(struct wait_queue_head *wh, struct wait_queue_entry *wait);
+
 // NOTE: MQ 2020-08-17 continue if receiving a signal
 #define wait_until(cond) ({                            \
 	for (; !(cond);)                                   \
@@ -84,11 +104,18 @@ extern void schedule();
 	}                                                      \
 })
 
-#define wait_event(wh, cond) ({                  \
-	DEFINE_WAIT(__wait);                         \
-	list_add_tail(&__wait.sibling, &(wh)->list); \
-	wait_until(cond);                            \
-	list_del(&__wait.sibling);                   \
+#define wait_event(wh, cond) ({     \
+	DEFINE_WAIT(__wait);            \
+	add_wait_queue(wh, &__wait);    \
+	wait_until(cond);               \
+	remove_wait_queue(wh, &__wait); \
+})
+
+// only one exclusive waiter is woken per wake_up, it is dequeued by the waker and requeued at the tail if it has to wait again
+#define wait_event_exclusive(wh, cond) ({                                  \
+	DEFINE_WAIT_FUNC(__wait, autoremove_wake_function);                    \
+	wait_until_with_prework(cond, prepare_to_wait_exclusive(wh, &__wait)); \
+	finish_wait(wh, &__wait);                                              \
 })
 
 #endif
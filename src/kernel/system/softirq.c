@@ -0,0 +1,87 @@
+#include "softirq.h"
+
+#include <include/bitops.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/utils/printf.h>
+
+#define MAX_SOFTIRQ_RESTART 10
+
+static softirq_action softirq_vec[NR_SOFTIRQS];
+static volatile unsigned long softirq_pending;
+static volatile bool softirq_running;
+static volatile uint32_t bh_disable_count;
+
+void open_softirq(uint32_t nr, softirq_action action)
+{
+	softirq_vec[nr] = action;
+}
+
+// safe to call from irq handlers, the action is run when the outermost irq returns
+void raise_softirq(uint32_t nr)
+{
+	set_bit(nr, &softirq_pending);
+}
+
+// running a softirq action or bottom halves are disabled, thread mustn't be preempted in both cases
+bool in_softirq()
+{
+	return softirq_running || bh_disable_count;
+}
+
+// NOTE: MQ 2020-10-12
+// state shared between threads and softirq actions (sockets, tcp timers) is protected by disabling bottom halves
+// -> interrupts stay enabled, pending softirqs are run when the outermost section ends
+void local_bh_disable()
+{
+	bh_disable_count++;
+	barrier();
+}
+
+void local_bh_enable()
+{
+	barrier();
+	if (--bh_disable_count)
+		return;
+
+	uint32_t flags = local_irq_save();
+	do_softirq();
+	local_irq_restore(flags);
+}
+
+// NOTE: MQ 2020-10-08
+// called at irq exit with interrupts disabled, actions run with interrupts enabled
+// nested irqs only raise bits, which are picked up by the restart loop below
+// if bits keep coming after MAX_SOFTIRQ_RESTART rounds, they wait for the next irq
+void do_softirq()
+{
+	if (softirq_running || bh_disable_count || !softirq_pending)
+		return;
+
+	softirq_running = true;
+	for (int restart = 0; softirq_pending && restart < MAX_SOFTIRQ_RESTART; ++restart)
+	{
+		unsigned long pending = softirq_pending;
+		softirq_pending = 0;
+
+		enable_interrupts();
+		for (uint32_t nr = 0; pending; ++nr, pending >>= 1)
+		{
+			if ((pending & 1) && softirq_vec[nr])
+				softirq_vec[nr]();
+		}
+		disable_interrupts();
+	}
+	softirq_running = false;
+}
+
+void softirq_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[softirq] - Initializing");
+
+	softirq_pending = 0;
+	softirq_running = false;
+	bh_disable_count = 0;
+
+	DEBUG &&debug_println(DEBUG_INFO, "[softirq] - Done");
+}
@@ -0,0 +1,25 @@
+#ifndef SYSTEM_SOFTIRQ_H
+#define SYSTEM_SOFTIRQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// NOTE: MQ 2020-10-08 lower index runs first
+enum
+{
+	TIMER_SOFTIRQ,
+	NET_RX_SOFTIRQ,
+	NR_SOFTIRQS,
+};
+
+typedef void (*softirq_action)();
+
+void open_softirq(uint32_t nr, softirq_action action);
+void raise_softirq(uint32_t nr);
+bool in_softirq();
+void local_bh_disable();
+void local_bh_enable();
+void do_softirq();
+void softirq_init();
+
+#endif
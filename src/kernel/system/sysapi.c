@@ -3,7 +3,9 @@
 #include <include/ctype.h>
 #include <include/errno.h>
 #include <include/fcntl.h>
+#include <include/resource.h>
 #include <kernel/cpu/hal.h>
+#include <kernel/cpu/sysenter.h>
 #include <kernel/devices/char/tty.h>
 #include <kernel/fs/pipefs/pipe.h>
 #include <kernel/fs/sockfs/sockfs.h>
@@ -30,6 +32,15 @@ pid_t sys_fork()
 	return child->pid;
 }
 
+static pid_t sys_vfork()
+{
+	struct process *child = process_vfork(current_process);
+	queue_thread(child->thread);
+	vfork_wait_for_child(child);
+
+	return child->pid;
+}
+
 static int32_t sys_waitid(idtype_t idtype, id_t id, struct infop *infop, int options)
 {
 	return do_wait(idtype, id, infop, options);
@@ -47,7 +58,7 @@ static int32_t sys_write(uint32_t fd, char *buf, size_t count)
 
 static int32_t sys_open(const char *path, int32_t flags, int32_t mode)
 {
-	return vfs_open(path, flags);
+	return vfs_open_mode(path, flags, mode);
 }
 
 static int32_t sys_fstat(int32_t fd, struct kstat *stat)
@@ -73,6 +84,11 @@ static int32_t sys_time(time_t *tloc)
 	return t;
 }
 
+static int32_t sys_clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+	return do_clock_gettime(clk_id, tp);
+}
+
 static int32_t sys_execve(const char *pathname, char *const argv[], char *const envp[])
 {
 	return process_execve(pathname, argv, envp);
@@ -89,6 +105,18 @@ static int32_t sys_pipe(int32_t *fd)
 	return do_pipe(fd);
 }
 
+// dynamic linker maps shared objects through it, segments come from page cache like the program's ones
+static int32_t sys_uselib(const char *library)
+{
+	struct vfs_file *file = open_exec(library);
+	if (!file)
+		return -ENOENT;
+
+	int32_t ret = elf_load_library(file);
+	fput(file);
+	return ret;
+}
+
 static int32_t sys_mmap(uint32_t addr, size_t length, uint32_t prot, uint32_t flags,
 						int32_t fd)
 {
@@ -192,10 +220,78 @@ static int32_t sys_kill(pid_t pid, int sig)
 	return do_kill(pid, sig);
 }
 
-static int32_t sys_posix_spawn(char *path)
+static struct thread *sched_find_thread(pid_t pid)
+{
+	if (!pid)
+		return current_thread;
+
+	struct process *proc = find_process_by_pid(pid);
+	return proc ? proc->thread : NULL;
+}
+
+// there are no users, a process may only change scheduling of itself and its children
+static bool sched_may_change(struct thread *th)
+{
+	struct process *proc = th->parent;
+	return proc == current_process || proc->parent == current_process;
+}
+
+static int32_t sys_sched_setattr(pid_t pid, struct sched_attr *attr, uint32_t flags)
+{
+	struct thread *th = sched_find_thread(pid);
+	if (!th)
+		return -ESRCH;
+	if (!attr || flags)
+		return -EINVAL;
+	if (!sched_may_change(th))
+		return -EPERM;
+
+	return sched_setattr(th, attr);
+}
+
+static int32_t sys_sched_getattr(pid_t pid, struct sched_attr *attr, uint32_t size, uint32_t flags)
+{
+	struct thread *th = sched_find_thread(pid);
+	if (!th)
+		return -ESRCH;
+	if (!attr || size < sizeof(struct sched_attr) || flags)
+		return -EINVAL;
+
+	return sched_getattr(th, attr);
+}
+
+static void ns_to_timeval(uint64_t ns, struct timeval *tv)
+{
+	tv->tv_sec = ns / NSEC_PER_SEC;
+	tv->tv_usec = ns % NSEC_PER_SEC / NSEC_PER_USEC;
+}
+
+static int32_t sys_getrusage(int who, struct rusage *usage)
+{
+	if (!usage || (who != RUSAGE_SELF && who != RUSAGE_CHILDREN))
+		return -EINVAL;
+
+	struct task_rusage ru;
+	process_rusage(current_process, who == RUSAGE_CHILDREN, &ru);
+
+	memset(usage, 0, sizeof(struct rusage));
+	ns_to_timeval(ru.utime, &usage->ru_utime);
+	ns_to_timeval(ru.stime, &usage->ru_stime);
+	usage->ru_nvcsw = ru.nvcsw;
+	usage->ru_nivcsw = ru.nivcsw;
+	return 0;
+}
+
+static int32_t sys_posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+							   char *const argv[], char *const envp[])
 {
 	int top = get_top_priority_from_list(THREAD_READY, THREAD_SYSTEM_POLICY);
-	process_load(path, path, THREAD_APP_POLICY, top - 1, NULL);
+	pid_t child = process_spawn(path, file_actions, argv, envp, THREAD_APP_POLICY, top - 1);
+	if (child < 0)
+		return child;
+
+	if (pid)
+		*pid = child;
 	return 0;
 }
 
@@ -321,6 +417,8 @@ static int32_t sys_debug_println(enum debug_level level, const char *out)
 #define __NR_getppid 64
 #define __NR_setsid 66
 #define __NR_sigaction 67
+#define __NR_getrusage 77
+#define __NR_uselib 86
 #define __NR_mmap 90
 #define __NR_munmap 91
 #define __NR_truncate 92
@@ -341,12 +439,16 @@ static int32_t sys_debug_println(enum debug_level level, const char *out)
 #define __NR_getsid 147
 #define __NR_nanosleep 162
 #define __NR_poll 168
+#define __NR_clock_gettime 265
 #define __NR_mq_open 277
 #define __NR_mq_close (__NR_mq_open + 1)
 #define __NR_mq_unlink (__NR_mq_open + 2)
 #define __NR_mq_send (__NR_mq_open + 3)
 #define __NR_mq_receive (__NR_mq_open + 4)
 #define __NR_waitid 284
+#define __NR_vfork 190
+#define __NR_sched_setattr 351
+#define __NR_sched_getattr 352
 #define __NR_sendto 369
 #define __NR_getptsname 370
 #define __NR_debug_printf 512
@@ -355,6 +457,7 @@ static int32_t sys_debug_println(enum debug_level level, const char *out)
 static void *syscalls[] = {
 	[__NR_exit] = sys_exit,
 	[__NR_fork] = sys_fork,
+	[__NR_vfork] = sys_vfork,
 	[__NR_read] = sys_read,
 	[__NR_write] = sys_write,
 	[__NR_open] = sys_open,
@@ -379,6 +482,8 @@ static void *syscalls[] = {
 	[__NR_sigprocmask] = sys_sigprocmask,
 	[__NR_pipe] = sys_pipe,
 	[__NR_posix_spawn] = sys_posix_spawn,
+	[__NR_getrusage] = sys_getrusage,
+	[__NR_uselib] = sys_uselib,
 	[__NR_mmap] = sys_mmap,
 	[__NR_truncate] = sys_truncate,
 	[__NR_ftruncate] = sys_ftruncate,
@@ -389,35 +494,61 @@ static void *syscalls[] = {
 	[__NR_recv] = sys_recv,
 	[__NR_nanosleep] = sys_nanosleep,
 	[__NR_poll] = sys_poll,
+	[__NR_clock_gettime] = sys_clock_gettime,
 	[__NR_mq_open] = sys_mq_open,
 	[__NR_mq_close] = sys_mq_close,
 	[__NR_mq_unlink] = sys_mq_unlink,
 	[__NR_mq_send] = sys_mq_send,
 	[__NR_mq_receive] = sys_mq_receive,
 	[__NR_waitid] = sys_waitid,
+	[__NR_sched_setattr] = sys_sched_setattr,
+	[__NR_sched_getattr] = sys_sched_getattr,
 	[__NR_getptsname] = sys_getptsname,
 	[__NR_debug_printf] = sys_debug_printf,
 	[__NR_debug_println] = sys_debug_println,
 };
 
-static int32_t syscall_dispatcher(struct interrupt_registers *regs)
+// NOTE: MQ 2020-10-08
+// only fork/vfork read user registers from `uregs` (to clone parent's context)
+// signal delivery snapshots the frame itself and execve builds a fresh one
+static bool syscall_needs_uregs(uint32_t idx)
 {
-	int idx = regs->eax;
+	return idx == __NR_fork || idx == __NR_vfork;
+}
 
-	uint32_t (*func)(unsigned int, ...) = syscalls[idx];
+static void syscall_dispatch(struct interrupt_registers *regs)
+{
+	uint32_t idx = regs->eax;
+
+	if (idx >= sizeof(syscalls) / sizeof(syscalls[0]) || !syscalls[idx])
+	{
+		regs->eax = -ENOSYS;
+		return;
+	}
 
-	if (!func)
-		return IRQ_HANDLER_STOP;
+	uint32_t (*func)(unsigned int, ...) = syscalls[idx];
 
-	memcpy(&current_thread->uregs, regs, sizeof(struct interrupt_registers));
+	if (syscall_needs_uregs(idx))
+		memcpy(&current_thread->uregs, regs, sizeof(struct interrupt_registers));
 
 	uint32_t ret = func(regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi);
 	regs->eax = ret;
+}
 
+static int32_t syscall_dispatcher(struct interrupt_registers *regs)
+{
+	syscall_dispatch(regs);
 	return IRQ_HANDLER_CONTINUE;
 }
 
+// sysenter entry (cpu/sysenter.asm) calls it directly, no interrupt handler list
+void syscall_fast_dispatcher(struct interrupt_registers *regs)
+{
+	syscall_dispatch(regs);
+}
+
 void syscall_init()
 {
 	register_interrupt_handler(DISPATCHER_ISR, syscall_dispatcher);
+	sysenter_init();
 }
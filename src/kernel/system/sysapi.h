@@ -7,6 +7,7 @@
 enum socket_type;
 
 void syscall_init();
+void syscall_fast_dispatcher(struct interrupt_registers *regs);
 pid_t sys_fork();
 int32_t sys_socket(int32_t family, enum socket_type type, int32_t protocal);
 int32_t sys_sbrk(intptr_t increment);
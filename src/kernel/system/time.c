@@ -1,15 +1,20 @@
 #include "time.h"
 
-#include <kernel/memory/vmm.h>
+#include <include/errno.h>
+#include <kernel/cpu/tsc.h>
+#include <stddef.h>
 
 extern volatile uint64_t jiffies;
 
 volatile uint64_t boot_seconds, current_seconds;
 struct time current_time;
+// realtime = monotonic + offset, offset is fixed when the boot time is read from rtc
+static volatile uint64_t realtime_offset_ns;
 
 void set_boot_seconds(uint64_t bs)
 {
 	boot_seconds = bs;
+	realtime_offset_ns = bs * NSEC_PER_SEC - ktime_get_ns();
 }
 
 void set_current_time(uint16_t year, uint8_t month, uint8_t day,
@@ -25,9 +30,8 @@ void set_current_time(uint16_t year, uint8_t month, uint8_t day,
 }
 
 // NOTE: MQ 2019-07-25 According to this paper http://howardhinnant.github.io/date_algorithms.html#civil_from_days
-static struct time *get_time_from_seconds(int32_t seconds)
+static void get_time_from_seconds(int32_t seconds, struct time *t)
 {
-	struct time *t = kcalloc(1, sizeof(struct time));
 	int32_t days = seconds / (24 * 3600);
 
 	days += 719468;
@@ -46,8 +50,6 @@ static struct time *get_time_from_seconds(int32_t seconds)
 	t->hour = (seconds % (24 * 3600)) / 3600;
 	t->minute = (seconds % (60 * 60)) / 60;
 	t->second = seconds % 60;
-
-	return t;
 }
 
 // NOTE: MQ 2019-07-25 According to this paper http://howardhinnant.github.io/date_algorithms.html#days_from_civil
@@ -77,12 +79,48 @@ uint32_t get_seconds(struct time *t)
 uint64_t get_milliseconds(struct time *t)
 {
 	if (t == NULL)
-		return boot_seconds * 1000 + jiffies;
+		return ktime_get_real_ns() / NSEC_PER_MSEC;
 	else
 		return get_seconds(t) * 1000 + jiffies % 1000;
 }
 
-struct time *get_time(int32_t seconds)
+void get_time(int32_t seconds, struct time *t)
+{
+	if (seconds == 0)
+		*t = current_time;
+	else
+		get_time_from_seconds(seconds, t);
+}
+
+// monotonic nanoseconds since boot, tsc based if it is calibrated otherwise pit resolution
+uint64_t ktime_get_ns()
+{
+	if (tsc_is_available())
+		return tsc_read_ns();
+	return jiffies * NSEC_PER_MSEC;
+}
+
+uint64_t ktime_get_real_ns()
 {
-	return seconds == 0 ? &current_time : get_time_from_seconds(seconds);
+	return ktime_get_ns() + realtime_offset_ns;
+}
+
+uint64_t ktime_get_real_offset_ns()
+{
+	return realtime_offset_ns;
+}
+
+int32_t do_clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+	uint64_t ns;
+	if (clk_id == CLOCK_REALTIME)
+		ns = ktime_get_real_ns();
+	else if (clk_id == CLOCK_MONOTONIC)
+		ns = ktime_get_ns();
+	else
+		return -EINVAL;
+
+	tp->tv_sec = ns / NSEC_PER_SEC;
+	tp->tv_nsec = ns % NSEC_PER_SEC;
+	return 0;
 }
@@ -1,8 +1,13 @@
 #ifndef SYSTEM_TIME_H
 #define SYSTEM_TIME_H
 
+#include <include/ctype.h>
 #include <stdint.h>
 
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+
 struct time
 {
 	uint8_t second;
@@ -18,6 +23,10 @@ void set_current_time(uint16_t year, uint8_t month, uint8_t day,
 					  uint8_t hour, uint8_t minute, uint8_t second);
 uint32_t get_seconds(struct time *);
 uint64_t get_milliseconds(struct time *t);
-struct time *get_time(int32_t seconds);
+void get_time(int32_t seconds, struct time *t);
+uint64_t ktime_get_ns();
+uint64_t ktime_get_real_ns();
+uint64_t ktime_get_real_offset_ns();
+int32_t do_clock_gettime(clockid_t clk_id, struct timespec *tp);
 
 #endif
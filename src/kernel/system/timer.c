@@ -1,9 +1,11 @@
 #include "timer.h"
 
 #include <kernel/cpu/idt.h>
+#include <kernel/system/softirq.h>
 #include <kernel/system/time.h>
 
 static struct list_head list_of_timer;
+static DEFINE_SPINLOCK(timer_lock);
 
 static void assert_timer_valid(struct timer_list *timer)
 {
@@ -16,7 +18,7 @@ bool is_actived_timer(struct timer_list *timer)
 	return timer->sibling.prev != LIST_POISON1 && timer->sibling.next != LIST_POISON2;
 }
 
-void add_timer(struct timer_list *timer)
+static void __add_timer(struct timer_list *timer)
 {
 	struct timer_list *iter, *node = NULL;
 	list_for_each_entry(iter, &list_of_timer, sibling)
@@ -30,31 +32,73 @@ void add_timer(struct timer_list *timer)
 	if (node)
 		list_add(&timer->sibling, &node->sibling);
 	else
-		list_add_tail(&timer->sibling, &list_of_timer);
+		list_add(&timer->sibling, &list_of_timer);
+}
+
+// NOTE: MQ 2020-10-08 timers are sorted by expires, the timer softirq only has to look at the head
+void add_timer(struct timer_list *timer)
+{
+	uint32_t flags = spin_lock_irqsave(&timer_lock);
+	__add_timer(timer);
+	spin_unlock_irqrestore(&timer_lock, flags);
 }
 
 void del_timer(struct timer_list *timer)
 {
+	uint32_t flags = spin_lock_irqsave(&timer_lock);
 	list_del(&timer->sibling);
+	spin_unlock_irqrestore(&timer_lock, flags);
 }
 
 void mod_timer(struct timer_list *timer, uint64_t expires)
 {
-	del_timer(timer);
+	uint32_t flags = spin_lock_irqsave(&timer_lock);
+	list_del(&timer->sibling);
 	timer->expires = expires;
-	add_timer(timer);
+	__add_timer(timer);
+	spin_unlock_irqrestore(&timer_lock, flags);
 }
 
-static int32_t timer_schedule_handler(struct interrupt_registers *regs)
+static struct timer_list *first_expired_timer(uint64_t cms)
+{
+	struct timer_list *timer = list_first_entry_or_null(&list_of_timer, struct timer_list, sibling);
+
+	if (timer)
+		assert_timer_valid(timer);
+	return timer && timer->expires <= cms ? timer : NULL;
+}
+
+// NOTE: MQ 2020-10-08
+// callbacks run in softirq with interrupts enabled, they are responsible for deleting or re-arming their timer
+// a callback which does neither is removed here, otherwise it would fire in a loop
+static void run_timers()
 {
-	struct timer_list *iter, *next;
 	uint64_t cms = get_milliseconds(NULL);
-	list_for_each_entry_safe(iter, next, &list_of_timer, sibling)
+
+	while (true)
 	{
-		assert_timer_valid(iter);
-		if (iter->expires <= cms)
-			iter->function(iter);
+		uint32_t flags = spin_lock_irqsave(&timer_lock);
+		struct timer_list *timer = first_expired_timer(cms);
+		spin_unlock_irqrestore(&timer_lock, flags);
+
+		if (!timer)
+			break;
+
+		timer->function(timer);
+
+		flags = spin_lock_irqsave(&timer_lock);
+		if (first_expired_timer(cms) == timer)
+			list_del(&timer->sibling);
+		spin_unlock_irqrestore(&timer_lock, flags);
 	}
+}
+
+static int32_t timer_schedule_handler(struct interrupt_registers *regs)
+{
+	spin_lock(&timer_lock);
+	if (first_expired_timer(get_milliseconds(NULL)))
+		raise_softirq(TIMER_SOFTIRQ);
+	spin_unlock(&timer_lock);
 
 	return IRQ_HANDLER_CONTINUE;
 }
@@ -62,5 +106,6 @@ static int32_t timer_schedule_handler(struct interrupt_registers *regs)
 void timer_init()
 {
 	INIT_LIST_HEAD(&list_of_timer);
+	open_softirq(TIMER_SOFTIRQ, run_timers);
 	register_interrupt_handler(IRQ8, timer_schedule_handler);
 }
@@ -12,8 +12,6 @@ struct timer_list
 	uint64_t expires;
 	void (*function)(struct timer_list *);
 	struct list_head sibling;
-	// TODO: MQ 2020-07-02 If there is the issue, which timer is deleted and iterated, considering using lock (better mutex)
-	spinlock_t lock;
 	uint32_t magic;
 };
 
@@ -21,7 +19,6 @@ struct timer_list
 	{                                          \
 		.function = (_function),               \
 		.expires = (_expires),                 \
-		.lock = 0,                             \
 		.magic = TIMER_MAGIC                   \
 	}
 
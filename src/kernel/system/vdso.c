@@ -0,0 +1,57 @@
+#include "vdso.h"
+
+#include <kernel/cpu/tsc.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/system/time.h>
+#include <kernel/utils/printf.h>
+
+extern volatile uint64_t jiffies;
+
+// NOTE: MQ 2020-10-05 vdso data takes the whole page, nothing else in kernel image is exposed to userspace
+static union
+{
+	struct vdso_data data;
+	uint8_t page[PMM_FRAME_SIZE];
+} vdso_page __attribute__((aligned(PMM_FRAME_SIZE)));
+
+static struct vdso_data *vdata = &vdso_page.data;
+
+void vdso_update()
+{
+	vdata->seq++;
+	barrier();
+
+	vdata->jiffies_ns = jiffies * NSEC_PER_MSEC;
+	vdata->realtime_offset_ns = ktime_get_real_offset_ns();
+
+	barrier();
+	vdata->seq++;
+}
+
+void vdso_map(struct pdirectory *dir)
+{
+	uint32_t paddr = (uint32_t)&vdso_page - KERNEL_HIGHER_HALF;
+
+	// page table is shared with user stack/mmap areas in the same 4MB -> it has to be writable, the page is not
+	vmm_create_page_table(dir, VDSO_DATA_ADDR, I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_USER);
+	vmm_map_address(dir, VDSO_DATA_ADDR, paddr, I86_PTE_PRESENT | I86_PTE_USER);
+}
+
+void vdso_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[vdso] - Initializing");
+
+	vdata->seq = 0;
+	if (tsc_is_available())
+	{
+		vdata->clock_mode = VDSO_CLOCK_TSC;
+		vdata->tsc_mult = tsc_get_mult();
+		vdata->tsc_shift = tsc_get_shift();
+		vdata->tsc_start = tsc_get_start();
+	}
+	else
+		vdata->clock_mode = VDSO_CLOCK_JIFFIES;
+	vdso_update();
+
+	DEBUG &&debug_println(DEBUG_INFO, "[vdso] - Done");
+}
@@ -0,0 +1,11 @@
+#ifndef SYSTEM_VDSO_H
+#define SYSTEM_VDSO_H
+
+#include <include/vdso.h>
+#include <kernel/memory/vmm.h>
+
+void vdso_init();
+void vdso_update();
+void vdso_map(struct pdirectory *dir);
+
+#endif
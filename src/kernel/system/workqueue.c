@@ -0,0 +1,69 @@
+#include "workqueue.h"
+
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/printf.h>
+
+static struct list_head work_list;
+static DEFINE_SPINLOCK(work_lock);
+static struct thread *worker_thread;
+
+// NOTE: MQ 2020-10-08
+// work runs in the kworker kernel thread -> it can sleep, allocate and take locks unlike softirq actions
+// a pending work is only queued once, re-queueing it before it runs is a no-op
+bool queue_work(struct work_struct *work)
+{
+	uint32_t flags = spin_lock_irqsave(&work_lock);
+
+	if (work->pending)
+	{
+		spin_unlock_irqrestore(&work_lock, flags);
+		return false;
+	}
+
+	work->pending = true;
+	list_add_tail(&work->sibling, &work_list);
+	if (worker_thread && worker_thread->state == THREAD_WAITING)
+		update_thread(worker_thread, THREAD_READY);
+
+	spin_unlock_irqrestore(&work_lock, flags);
+	return true;
+}
+
+static void worker_loop()
+{
+	// explain in kernel_init#unlock_scheduler
+	unlock_scheduler();
+
+	while (true)
+	{
+		uint32_t flags = spin_lock_irqsave(&work_lock);
+
+		if (list_empty(&work_list))
+		{
+			update_thread(worker_thread, THREAD_WAITING);
+			spin_unlock_irqrestore(&work_lock, flags);
+			schedule();
+			continue;
+		}
+
+		struct work_struct *work = list_first_entry(&work_list, struct work_struct, sibling);
+		list_del(&work->sibling);
+		work->pending = false;
+
+		spin_unlock_irqrestore(&work_lock, flags);
+
+		work->func(work);
+	}
+}
+
+void workqueue_init()
+{
+	DEBUG &&debug_println(DEBUG_INFO, "[workqueue] - Initializing");
+
+	INIT_LIST_HEAD(&work_list);
+	struct process *kworker = create_kernel_process("kworker", worker_loop, 0);
+	worker_thread = kworker->thread;
+
+	DEBUG &&debug_println(DEBUG_INFO, "[workqueue] - Done");
+}
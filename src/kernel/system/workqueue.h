@@ -0,0 +1,32 @@
+#ifndef SYSTEM_WORKQUEUE_H
+#define SYSTEM_WORKQUEUE_H
+
+#include <include/list.h>
+#include <stdbool.h>
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct
+{
+	work_func_t func;
+	struct list_head sibling;
+	bool pending;
+};
+
+#define WORK_INITIALIZER(_func) \
+	{                           \
+		.func = (_func),        \
+		.pending = false,       \
+	}
+
+#define INIT_WORK(_work, _func)   \
+	({                            \
+		(_work)->func = (_func);  \
+		(_work)->pending = false; \
+	})
+
+bool queue_work(struct work_struct *work);
+void workqueue_init();
+
+#endif
@@ -5,19 +5,27 @@
 
 #define SERIAL_PORT_A 0x3f8
 
-size_t vsprintf(char *buffer, const char *fmt, va_list args)
+// writes at most size - 1 characters plus the terminating null, returns how many are written (without the null)
+size_t vscnprintf(char *buffer, size_t size, const char *fmt, va_list args)
 {
-	if (!fmt)
+	if (!fmt || !size)
 		return 0;
 
-	char *buffer_iter = buffer;
+	size_t length = 0;
 	char *fmt_iter = fmt;
 	char number_buf[32] = {0};
+#define PUT_CHAR(ch)               \
+	do                             \
+	{                              \
+		if (length + 1 < size)     \
+			buffer[length++] = ch; \
+	} while (0)
+
 	for (; *fmt_iter; fmt_iter++)
 	{
 		if (*fmt_iter != '%')
 		{
-			*buffer_iter++ = *fmt_iter;
+			PUT_CHAR(*fmt_iter);
 			continue;
 		}
 
@@ -25,7 +33,7 @@ size_t vsprintf(char *buffer, const char *fmt, va_list args)
 		{
 		case 'c':
 		{
-			*buffer_iter++ = (char)va_arg(args, int);
+			PUT_CHAR((char)va_arg(args, int));
 			break;
 		}
 
@@ -34,7 +42,7 @@ size_t vsprintf(char *buffer, const char *fmt, va_list args)
 			char *s = (char *)va_arg(args, char *);
 
 			while (s && *s)
-				*buffer_iter++ = *s++;
+				PUT_CHAR(*s++);
 			break;
 		}
 
@@ -45,7 +53,7 @@ size_t vsprintf(char *buffer, const char *fmt, va_list args)
 			itoa_s(n, 10, number_buf);
 
 			for (char *c = number_buf; *c; c++)
-				*buffer_iter++ = *c;
+				PUT_CHAR(*c);
 			break;
 		}
 
@@ -55,7 +63,7 @@ size_t vsprintf(char *buffer, const char *fmt, va_list args)
 			itoa_s(n, 10, number_buf);
 
 			for (char *c = number_buf; *c; c++)
-				*buffer_iter++ = *c;
+				PUT_CHAR(*c);
 			break;
 		}
 
@@ -65,7 +73,7 @@ size_t vsprintf(char *buffer, const char *fmt, va_list args)
 			itoa_s(n, 10, number_buf);
 
 			for (char *c = number_buf; *c; c++)
-				*buffer_iter++ = *c;
+				PUT_CHAR(*c);
 			break;
 		}
 
@@ -76,17 +84,23 @@ size_t vsprintf(char *buffer, const char *fmt, va_list args)
 			itoa_s(n, 16, number_buf);
 
 			for (char *c = number_buf; *c; c++)
-				*buffer_iter++ = *c;
+				PUT_CHAR(*c);
 			break;
 		}
 		default:
-			*buffer_iter++ = *fmt_iter;
+			PUT_CHAR(*fmt_iter);
 			break;
 		}
 	}
+#undef PUT_CHAR
+
+	buffer[length] = '\0';
+	return length;
+}
 
-	*buffer_iter = '\0';
-	return buffer_iter - buffer;
+size_t vsprintf(char *buffer, const char *fmt, va_list args)
+{
+	return vscnprintf(buffer, SIZE_MAX, fmt, args);
 }
 
 size_t sprintf(char *buffer, const char *fmt, ...)
@@ -101,6 +115,18 @@ size_t sprintf(char *buffer, const char *fmt, ...)
 	return size;
 }
 
+size_t scnprintf(char *buffer, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	size_t length = vscnprintf(buffer, size, fmt, args);
+
+	va_end(args);
+
+	return length;
+}
+
 // LOG
 static char log_buffer[1024];
 static char *tag_opening[] = {
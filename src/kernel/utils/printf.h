@@ -16,6 +16,8 @@ enum debug_level
 
 size_t sprintf(char *buffer, const char *fmt, ...);
 size_t vsprintf(char *buffer, const char *fmt, va_list args);
+size_t scnprintf(char *buffer, size_t size, const char *fmt, ...);
+size_t vscnprintf(char *buffer, size_t size, const char *fmt, va_list args);
 int debug_printf(enum debug_level level, const char *fmt, ...);
 int debug_println(enum debug_level level, const char *fmt, ...);
 void debug_init();
@@ -0,0 +1,65 @@
+#ifndef LIBC_SPAWN_H
+#define LIBC_SPAWN_H
+
+#include <include/errno.h>
+#include <include/spawn.h>
+#include <libc/unistd.h>
+
+static inline int32_t posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions)
+{
+	file_actions->used = 0;
+	return 0;
+}
+
+static inline int32_t posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions)
+{
+	file_actions->used = 0;
+	return 0;
+}
+
+static inline struct spawn_action *posix_spawn_file_actions_next(posix_spawn_file_actions_t *file_actions)
+{
+	if (file_actions->used >= SPAWN_FILE_ACTIONS_MAX)
+		return NULL;
+	return &file_actions->actions[file_actions->used++];
+}
+
+static inline int32_t posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int32_t fd)
+{
+	struct spawn_action *action = posix_spawn_file_actions_next(file_actions);
+	if (!action)
+		return -ENOMEM;
+
+	action->type = SPAWN_DO_CLOSE;
+	action->fd = fd;
+	return 0;
+}
+
+static inline int32_t posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int32_t fd, int32_t newfd)
+{
+	struct spawn_action *action = posix_spawn_file_actions_next(file_actions);
+	if (!action)
+		return -ENOMEM;
+
+	action->type = SPAWN_DO_DUP2;
+	action->fd = fd;
+	action->newfd = newfd;
+	return 0;
+}
+
+static inline int32_t posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int32_t fd,
+													   const char *path, int32_t oflag, int32_t mode)
+{
+	struct spawn_action *action = posix_spawn_file_actions_next(file_actions);
+	if (!action)
+		return -ENOMEM;
+
+	action->type = SPAWN_DO_OPEN;
+	action->fd = fd;
+	action->path = path;
+	action->oflag = oflag;
+	action->mode = mode;
+	return 0;
+}
+
+#endif
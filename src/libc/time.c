@@ -0,0 +1,68 @@
+#include <include/vdso.h>
+#include <libc/unistd.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+static inline uint64_t rdtsc()
+{
+	uint64_t ret;
+	__asm__ __volatile__("rdtsc"
+						 : "=A"(ret));
+	return ret;
+}
+
+static uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+	uint32_t ah = a >> 32, al = a;
+	uint64_t ret = ((uint64_t)al * mul) >> shift;
+	if (ah)
+		ret += ((uint64_t)ah * mul) << (32 - shift);
+	return ret;
+}
+
+static uint64_t vdso_read_ns(clockid_t clk_id)
+{
+	const struct vdso_data *vd = (const struct vdso_data *)VDSO_DATA_ADDR;
+	uint32_t seq;
+	uint64_t ns;
+
+	do
+	{
+		while ((seq = vd->seq) & 1)
+			;
+		__asm__ __volatile__("" ::
+								 : "memory");
+
+		if (vd->clock_mode == VDSO_CLOCK_TSC)
+			ns = mul_u64_u32_shr(rdtsc() - vd->tsc_start, vd->tsc_mult, vd->tsc_shift);
+		else
+			ns = vd->jiffies_ns;
+
+		if (clk_id == CLOCK_REALTIME)
+			ns += vd->realtime_offset_ns;
+
+		__asm__ __volatile__("" ::
+								 : "memory");
+	} while (vd->seq != seq);
+
+	return ns;
+}
+
+int32_t clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+	if (clk_id != CLOCK_REALTIME && clk_id != CLOCK_MONOTONIC)
+		return syscall_clock_gettime(clk_id, tp);
+
+	uint64_t ns = vdso_read_ns(clk_id);
+	tp->tv_sec = ns / NSEC_PER_SEC;
+	tp->tv_nsec = ns % NSEC_PER_SEC;
+	return 0;
+}
+
+time_t time(time_t *tloc)
+{
+	time_t t = vdso_read_ns(CLOCK_REALTIME) / NSEC_PER_SEC;
+	if (tloc)
+		*tloc = t;
+	return t;
+}
@@ -3,6 +3,9 @@
 
 #include <include/ctype.h>
 #include <include/fcntl.h>
+#include <include/resource.h>
+#include <include/sched.h>
+#include <include/spawn.h>
 #include <libc/mqueue.h>
 #include <libc/signal.h>
 #include <libc/stdio.h>
@@ -33,6 +36,8 @@
 #define __NR_getppid 64
 #define __NR_setsid 66
 #define __NR_sigaction 67
+#define __NR_getrusage 77
+#define __NR_uselib 86
 #define __NR_mmap 90
 #define __NR_munmap 91
 #define __NR_truncate 92
@@ -53,12 +58,16 @@
 #define __NR_getsid 147
 #define __NR_nanosleep 162
 #define __NR_poll 168
+#define __NR_clock_gettime 265
 #define __NR_mq_open 277
 #define __NR_mq_close (__NR_mq_open + 1)
 #define __NR_mq_unlink (__NR_mq_open + 2)
 #define __NR_mq_send (__NR_mq_open + 3)
 #define __NR_mq_receive (__NR_mq_open + 4)
 #define __NR_waitid 284
+#define __NR_vfork 190
+#define __NR_sched_setattr 351
+#define __NR_sched_getattr 352
 #define __NR_sendto 369
 // TODO: MQ 2020-09-05 Use ioctl-FIODGNAME to get pts name
 #define __NR_getptsname 370
@@ -66,63 +75,86 @@
 #define __NR_debug_printf 512
 #define __NR_debug_println 513
 
-#define _syscall0(name)                           \
-	static inline int32_t syscall_##name()        \
-	{                                             \
-		int32_t ret;                              \
-		__asm__ __volatile__("int $0x7F"          \
-							 : "=a"(ret)          \
-							 : "0"(__NR_##name)); \
-		return ret;                               \
+// NOTE: MQ 2020-10-08
+// enter kernel via sysenter, kernel returns via sysexit with eip = edx, esp = ecx
+// -> push the return address and ebp, pass user stack in ebp, ecx/edx are clobbered
+// return address is computed from eip (call + offset), libc is position independent (libc.so)
+#define __SYSCALL_RETURN_ADDRESS \
+	"call 0f\n"                 \
+	"0:\n\t"                    \
+	"addl $1f-0b, (%%esp)\n\t"
+
+#define __SYSCALL_ENTRY        \
+	"push %%ebp\n\t"           \
+	__SYSCALL_RETURN_ADDRESS   \
+	"mov %%esp, %%ebp\n\t"     \
+	"sysenter\n"               \
+	"1:\n\t"                   \
+	"pop %%ebp\n\t"
+
+#define _syscall0(name)                                            \
+	static inline int32_t syscall_##name()                         \
+	{                                                              \
+		int32_t ret, __ecx, __edx;                                 \
+		__asm__ __volatile__(__SYSCALL_ENTRY                       \
+							 : "=a"(ret), "=c"(__ecx), "=d"(__edx) \
+							 : "0"(__NR_##name)                    \
+							 : "memory", "cc");                    \
+		return ret;                                                \
 	}
-#define _syscall1(name, type1)                               \
-	static inline int32_t syscall_##name(type1 arg1)         \
-	{                                                        \
-		int32_t ret;                                         \
-		__asm__ __volatile__("int $0x7F"                     \
-							 : "=a"(ret)                     \
-							 : "0"(__NR_##name), "b"(arg1)); \
-		return ret;                                          \
+#define _syscall1(name, type1)                                     \
+	static inline int32_t syscall_##name(type1 arg1)               \
+	{                                                              \
+		int32_t ret, __ecx, __edx;                                 \
+		__asm__ __volatile__(__SYSCALL_ENTRY                       \
+							 : "=a"(ret), "=c"(__ecx), "=d"(__edx) \
+							 : "0"(__NR_##name), "b"(arg1)         \
+							 : "memory", "cc");                    \
+		return ret;                                                \
 	}
 
-#define _syscall2(name, type1, type2)                                   \
-	static inline int32_t syscall_##name(type1 arg1, type2 arg2)        \
-	{                                                                   \
-		int32_t ret;                                                    \
-		__asm__ __volatile__("int $0x7F"                                \
-							 : "=a"(ret)                                \
-							 : "0"(__NR_##name), "b"(arg1), "c"(arg2)); \
-		return ret;                                                     \
+#define _syscall2(name, type1, type2)                                 \
+	static inline int32_t syscall_##name(type1 arg1, type2 arg2)      \
+	{                                                                 \
+		int32_t ret, __ecx, __edx;                                    \
+		__asm__ __volatile__(__SYSCALL_ENTRY                          \
+							 : "=a"(ret), "=c"(__ecx), "=d"(__edx)    \
+							 : "0"(__NR_##name), "b"(arg1), "1"(arg2) \
+							 : "memory", "cc");                       \
+		return ret;                                                   \
 	}
 
-#define _syscall3(name, type1, type2, type3)                                       \
-	static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3)       \
-	{                                                                              \
-		int32_t ret;                                                               \
-		__asm__ __volatile__("int $0x7F"                                           \
-							 : "=a"(ret)                                           \
-							 : "0"(__NR_##name), "b"(arg1), "c"(arg2), "d"(arg3)); \
-		return ret;                                                                \
+#define _syscall3(name, type1, type2, type3)                                     \
+	static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3)     \
+	{                                                                            \
+		int32_t ret, __ecx, __edx;                                               \
+		__asm__ __volatile__(__SYSCALL_ENTRY                                     \
+							 : "=a"(ret), "=c"(__ecx), "=d"(__edx)               \
+							 : "0"(__NR_##name), "b"(arg1), "1"(arg2), "2"(arg3) \
+							 : "memory", "cc");                                  \
+		return ret;                                                              \
 	}
 
-#define _syscall4(name, type1, type2, type3, type4)                                           \
-	static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4)      \
-	{                                                                                         \
-		int32_t ret;                                                                          \
-		__asm__ __volatile__("int $0x7F"                                                      \
-							 : "=a"(ret)                                                      \
-							 : "0"(__NR_##name), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4)); \
-		return ret;                                                                           \
+#define _syscall4(name, type1, type2, type3, type4)                                         \
+	static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4)    \
+	{                                                                                       \
+		int32_t ret, __ecx, __edx;                                                          \
+		__asm__ __volatile__(__SYSCALL_ENTRY                                                \
+							 : "=a"(ret), "=c"(__ecx), "=d"(__edx)                          \
+							 : "0"(__NR_##name), "b"(arg1), "1"(arg2), "2"(arg3), "S"(arg4) \
+							 : "memory", "cc");                                             \
+		return ret;                                                                         \
 	}
 
-#define _syscall5(name, type1, type2, type3, type4, type5)                                               \
-	static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4, type5 arg5)     \
-	{                                                                                                    \
-		int32_t ret;                                                                                     \
-		__asm__ __volatile__("int $0x7F"                                                                 \
-							 : "=a"(ret)                                                                 \
-							 : "0"(__NR_##name), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4), "D"(arg5)); \
-		return ret;                                                                                      \
+#define _syscall5(name, type1, type2, type3, type4, type5)                                             \
+	static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4, type5 arg5)   \
+	{                                                                                                  \
+		int32_t ret, __ecx, __edx;                                                                     \
+		__asm__ __volatile__(__SYSCALL_ENTRY                                                           \
+							 : "=a"(ret), "=c"(__ecx), "=d"(__edx)                                     \
+							 : "0"(__NR_##name), "b"(arg1), "1"(arg2), "2"(arg3), "S"(arg4), "D"(arg5) \
+							 : "memory", "cc");                                                        \
+		return ret;                                                                                    \
 	}
 
 struct pollfd;
@@ -181,11 +213,9 @@ static inline int32_t execve(const char *pathname, char *const argv[], char *con
 	return syscall_execve(pathname, argv, envp);
 }
 
+// NOTE: MQ 2020-10-05 time and clock_gettime are served from vdso page (libc/time.c) without trapping
 _syscall1(time, time_t *);
-static inline time_t time(time_t *tloc)
-{
-	return syscall_time(tloc);
-}
+_syscall2(clock_gettime, clockid_t, struct timespec *);
 
 _syscall2(dup2, int, int);
 static inline int32_t dup2(int oldfd, int newfd)
@@ -271,6 +301,19 @@ static inline int32_t munmap(void *addr, size_t length)
 	return syscall_munmap(addr, length);
 }
 
+// map a shared object (ld.so), returns its load address
+_syscall1(uselib, const char *);
+static inline int32_t uselib(const char *library)
+{
+	return syscall_uselib(library);
+}
+
+_syscall2(getrusage, int, struct rusage *);
+static inline int32_t getrusage(int who, struct rusage *usage)
+{
+	return syscall_getrusage(who, usage);
+}
+
 _syscall0(getpid);
 static inline int32_t getpid()
 {
@@ -342,10 +385,43 @@ static inline int32_t waitid(idtype_t idtype, id_t id, struct infop *infop, int
 	return syscall_waitid(idtype, id, infop, options);
 }
 
-_syscall1(posix_spawn, char *);
-static inline int32_t posix_spawn(char *path)
+_syscall3(sched_setattr, pid_t, struct sched_attr *, uint32_t);
+static inline int32_t sched_setattr(pid_t pid, struct sched_attr *attr, uint32_t flags)
+{
+	return syscall_sched_setattr(pid, attr, flags);
+}
+
+_syscall4(sched_getattr, pid_t, struct sched_attr *, uint32_t, uint32_t);
+static inline int32_t sched_getattr(pid_t pid, struct sched_attr *attr, uint32_t size, uint32_t flags)
+{
+	return syscall_sched_getattr(pid, attr, size, flags);
+}
+
+// NOTE: MQ 2020-10-17
+// vfork child runs on our stack until it calls execve/_exit and overwrites what is below its stack pointer
+// -> don't pop saved ebp from the stack when returning, keep it in esi (registers are restored by kernel)
+// -> always inlined, the child mustn't return from a function frame the parent still needs
+static inline __attribute__((always_inline)) int32_t vfork()
+{
+	int32_t ret, __ecx, __edx;
+	__asm__ __volatile__("mov %%ebp, %%esi\n\t"
+						 __SYSCALL_RETURN_ADDRESS
+						 "mov %%esp, %%ebp\n\t"
+						 "sysenter\n"
+						 "1:\n\t"
+						 "mov %%esi, %%ebp\n\t"
+						 : "=a"(ret), "=c"(__ecx), "=d"(__edx)
+						 : "0"(__NR_vfork)
+						 : "esi", "memory", "cc");
+	return ret;
+}
+
+_syscall5(posix_spawn, pid_t *, const char *, const posix_spawn_file_actions_t *, char *const *, char *const *);
+// spawn attributes are not supported, attrp is ignored
+static inline int32_t posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+								  const void *attrp, char *const argv[], char *const envp[])
 {
-	return syscall_posix_spawn(path);
+	return syscall_posix_spawn(pid, path, file_actions, argv, envp);
 }
 
 _syscall2(nanosleep, const struct timespec *, struct timespec *);
@@ -390,5 +466,7 @@ static inline int32_t sleep(uint32_t sec)
 }
 
 int32_t shm_open(const char *name, int32_t flags, int32_t mode);
+time_t time(time_t *tloc);
+int32_t clock_gettime(clockid_t clk_id, struct timespec *tp);
 
 #endif